@@ -8,7 +8,7 @@ RES_DIR=resource
 
 BUILD_DIR=build
 
-LIB=-lm -lGL -lGLU -lGLEW -lglfw -lpng
+LIB=-lm -lGL -lGLU -lGLEW -lglfw -lEGL -lpng -lpthread
 
 SRC=${wildcard src/*.cpp}
 
@@ -0,0 +1,34 @@
+// benchmark.hpp
+// frame time and scene pass counts of a headless run, written out as a json report
+
+#ifndef _BENCHMARK_HPP
+#define _BENCHMARK_HPP
+
+#include "common.hpp"
+#include "renderer.hpp"
+
+typedef struct Benchmark {
+	float* frame_ms;	// Cpu time of each frame, swap and gpu wait included
+	u32 frame_count;
+	u32 capacity;
+	u64 draws;	// Summed over the frames that had scene pass stats
+	u64 triangles_submitted;
+	u64 triangles_rasterized;
+	u64 fragments_shaded;
+	u32 max_draws;
+	u64 max_triangles;
+	u32 stats_count;
+	Render_stats render_totals;	// Summed over the frames that had been rendered
+	u32 render_count;
+} Benchmark;
+
+i32 benchmark_initialize(Benchmark* benchmark, u32 frames);
+
+void benchmark_add_frame(Benchmark* benchmark, float frame_ms, Scene_stats stats, Render_stats render_stats);
+
+// Writes to stdout when path is NULL
+i32 benchmark_write_report(Benchmark* benchmark, const char* path, const char* scene_path, i32 width, i32 height);
+
+void benchmark_destroy(Benchmark* benchmark);
+
+#endif
@@ -0,0 +1,68 @@
+// capture.hpp
+// frame readback through a ring of pixel buffers, the pngs are encoded on a worker thread so rendering never waits on either
+
+#ifndef _CAPTURE_HPP
+#define _CAPTURE_HPP
+
+#include <pthread.h>
+
+#include "common.hpp"
+
+#define CAPTURE_FRAMES 3	// Readbacks in flight, a frame is copied out once its fence has passed, usually two frames later
+#define MAX_CAPTURE_JOBS 8	// Frames copied out and waiting for the encoder
+#define CAPTURE_PATH_SIZE 512
+
+typedef struct Capture_job {
+	u8* pixels;	// Rgb, bottom up
+	i32 width;
+	i32 height;
+	u32 index;	// Written as <index>.png
+} Capture_job;
+
+typedef struct Capture_stats {
+	u32 requested;
+	u32 written;
+	u32 failed;
+	u32 readback_waits;	// Frames that found their pixel buffer still being read
+	u32 encoder_waits;	// Frames that found the encoder queue full
+	float wait_ms;
+} Capture_stats;
+
+typedef struct Frame_capture {
+	char directory[CAPTURE_PATH_SIZE];
+	u32 interval;	// Every interval-th frame is captured
+	u32 frame;
+	u32 next_index;
+
+	u32 pbos[CAPTURE_FRAMES];
+	u32 pbo_sizes[CAPTURE_FRAMES];
+	void* fences[CAPTURE_FRAMES];	// GLsync, set while the readback into that buffer is in flight
+	i32 widths[CAPTURE_FRAMES];
+	i32 heights[CAPTURE_FRAMES];
+	u32 indices[CAPTURE_FRAMES];
+	u32 slot;	// The next readback goes here
+
+	// Encoder, a single producer and consumer queue under the mutex
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t job_ready;
+	pthread_cond_t job_done;
+	Capture_job jobs[MAX_CAPTURE_JOBS];
+	u32 job_head;	// Next to encode
+	u32 job_tail;	// Next free
+	u8 quit;
+	u8 active;
+	Capture_stats stats;
+} Frame_capture;
+
+// Captures are written to directory as 0.png, 1.png, ... like the reference images
+i32 capture_initialize(Frame_capture* capture, const char* directory, u32 interval);
+
+// After the last pass of a frame and before the swap. Starts a readback of the backbuffer when the frame is due,
+// and hands finished readbacks to the encoder
+void capture_frame(Frame_capture* capture, i32 width, i32 height);
+
+// Waits for the readbacks in flight and for every png to be written
+void capture_destroy(Frame_capture* capture);
+
+#endif
@@ -118,4 +118,13 @@ i32 read_file(const char* path, Buffer* buffer);
 
 i32 read_and_null_terminate_file(const char* path, Buffer* buffer);
 
+// Nanoseconds on the monotonic clock, only the difference between two readings means anything
+u64 time_now_ns();
+
+// Milliseconds since a reading of time_now_ns
+float time_since_ms(u64 start);
+
+// Quoted, with quotes and backslashes escaped and control characters left out
+void write_json_string(FILE* fp, const char* text);
+
 #endif
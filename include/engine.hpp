@@ -9,8 +9,32 @@
 #include "matrix_math.hpp"
 #include "entity.hpp"
 #include "renderer.hpp"
+#include "benchmark.hpp"
+#include "frame_pacer.hpp"
 
 #define MAX_ENTITY 128
+#define DEFAULT_SCENE "01.scene"
+#define HEADLESS_TIME_STEP (1.0f / 60.0f)	// Headless runs step the animation by a fixed amount, so every run renders the same frames
+
+typedef struct Engine_options {
+	const char* scene_path;
+	u8 headless;	// Offscreen, no window and no input, a benchmark report is written on exit
+	u32 frames;	// Exit after this many frames, zero runs until closed
+	i32 width;
+	i32 height;
+	const char* report_path;	// Benchmark report, stdout when NULL
+	const char* gpu_csv_path;	// Gpu time of every pass per frame, not written when NULL
+	const char* trace_path;	// Chrome trace of the cpu scopes over the whole run, not recorded when NULL
+	float target_fps;	// Frame rate limit, zero runs unbounded
+	u8 vsync;
+	u8 low_latency;	// Sample input and move the camera right before the frame is culled and drawn, instead of after
+	const char* capture_path;	// Directory the captured frames are written to, nothing is captured when NULL
+	u32 capture_interval;	// Capture every n-th frame
+	u8 render_thread;	// Submit gl on a thread of its own, so the next frame is simulated while this one is drawn
+	u8 entity_costs;	// Measure the gpu cost of every entity's draws, printed on exit
+	const char* startup_report_path;	// Time and size of every load and upload before the first frame as json, nothing is traced when NULL
+	u8 sun_flares;	// Lens flares toward the first sun light, off unless asked for
+} Engine_options;
 
 typedef struct Engine {
 	u8 is_running;
@@ -26,12 +50,19 @@ typedef struct Engine {
     Scene scene;
 	u32 entity_count;
 	u32 target_entity_index;
+	u8 entity_visible[MAX_ENTITY];	// Result of the frustum culling pass of the current frame
+	u32 visible_count;	// Meshes that survived culling this frame
+	u32 culled_count;
+	u32 occluded_count;	// Inside the frustum but hidden behind occluders
+	Engine_options options;
+	Benchmark benchmark;
+	Frame_pacer pacer;
 } Engine;
 
 extern Engine engine;
 
 Entity* engine_push_empty_entity(Engine* engine);
 
-i32 engine_start();
+i32 engine_start(Engine_options* options);
 
 #endif
@@ -24,6 +24,15 @@ typedef struct Entity {
     // NOTE(linus): are the two fields above fine or do we want another solution (eg. per-property parenting or smthn)?
 
 	Material material;
+	u8 occluder;	// Rasterized into the occlusion buffer, hiding whatever is behind it
+	u8 batched;	// Never moves, drawn as a member of a static batch
+	u32 batch;
+	u32 batch_member;
+
+	// Refreshed by entity_update
+	mat4 transform;
+	Aabb world_bounds;
+	Bounding_sphere world_sphere;
 } Entity;
 
 typedef void (*Entity_update)(Entity* entity, struct Engine* engine);
@@ -43,8 +52,16 @@ Entity* entity_initialize(
 
 mat4 entity_get_transform(Entity* entity);
 
+// True when neither the entity nor anything it is attached to has an update function
+u8 entity_is_static(Entity* entity);
+
 void entity_update(Entity* entity, Engine* engine);
 
-void entity_render(Entity* entity, Scene* scene);
+// Stretches the world bounds down the entity's y axis by as much as ground.vert can lower it seen from the camera,
+// for entities drawn with GROUND_SHADER
+void entity_bend_bounds(Entity* entity, v3 camera_position, Aabb* bounds, Bounding_sphere* sphere);
+
+// Index is the entity's place in the engine, its gpu costs are reported under it
+void entity_render(Entity* entity, i32 index, Scene* scene);
 
 #endif
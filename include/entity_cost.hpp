@@ -0,0 +1,70 @@
+// entity_cost.hpp
+// gpu time and samples passed of every entity's draws, queried per draw and read back frames later
+
+#ifndef _ENTITY_COST_HPP
+#define _ENTITY_COST_HPP
+
+#include "common.hpp"
+
+#define ENTITY_COST_FRAMES 4	// Frames of queries in flight, a frame whose slot is still busy goes unmeasured
+#define MAX_COST_DRAWS 512	// Measured draws per frame, as many as a draw list holds
+#define MAX_COST_ENTITIES 128	// Entity indices draws are attributed to, as many as the engine has entities
+
+// What an entity cost on average over the frames it was drawn in
+typedef struct Entity_cost {
+	i32 entity;	// Index the draws were queued with
+	i32 mesh_id;
+	u32 triangles;
+	float gpu_us;
+	u32 pixels;	// Samples that passed the depth test
+	u32 frames;
+} Entity_cost;
+
+typedef struct Entity_cost_total {
+	i32 mesh_id;
+	u64 triangles;
+	u64 time_ns;
+	u64 samples;
+	u32 frames;
+	u32 last_frame;	// Frames the entity was drawn in more than once are counted once
+} Entity_cost_total;
+
+typedef struct Entity_cost_frame {
+	u32 queries[MAX_COST_DRAWS][2];	// Time elapsed and samples passed
+	i32 entities[MAX_COST_DRAWS];
+	i32 mesh_ids[MAX_COST_DRAWS];
+	u32 triangles[MAX_COST_DRAWS];
+	u32 draw_count;
+	u8 pending;
+	u32 frame;
+} Entity_cost_frame;
+
+typedef struct Entity_costs {
+	u8 enabled;	// Queries exist and draws are measured one by one
+	u8 active;	// Whether the current frame is being measured
+	Entity_cost_frame frames[ENTITY_COST_FRAMES];
+	u32 frame;
+	Entity_cost_total totals[MAX_COST_ENTITIES];
+	u32 measured;	// Frames collected since enabled
+	u32 dropped;
+} Entity_costs;
+
+// Enabling starts over from nothing, disabling keeps the totals so they can still be read
+void entity_costs_set_enabled(Entity_costs* costs, u8 enabled);
+
+// Collects the frames the gpu has finished, then starts measuring a new one
+void entity_costs_begin_frame(Entity_costs* costs);
+
+void entity_costs_end_frame(Entity_costs* costs);
+
+// Wraps a single draw, entity -1 is not attributed. Returns the draw to end, or -1 when not measuring
+i32 entity_costs_begin(Entity_costs* costs, i32 entity, i32 mesh_id, u32 triangles);
+
+void entity_costs_end(Entity_costs* costs, i32 draw);
+
+// Fills up to max_count entries ranked by gpu time, most expensive first. Returns how many were filled
+u32 entity_costs_get(Entity_costs* costs, Entity_cost* ranked, u32 max_count);
+
+void entity_costs_destroy(Entity_costs* costs);
+
+#endif
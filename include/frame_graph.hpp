@@ -0,0 +1,122 @@
+// frame_graph.hpp
+// declarative render passes, transient render targets are pooled and shared between passes that don't overlap
+
+#ifndef _FRAME_GRAPH_HPP
+#define _FRAME_GRAPH_HPP
+
+#include "common.hpp"
+#include "gpu_timer.hpp"
+
+#define MAX_GRAPH_PASSES 32
+#define MAX_GRAPH_RESOURCES 32
+#define MAX_GRAPH_PASS_READS 4
+#define MAX_GRAPH_TARGETS 32
+#define GRAPH_TARGET_KEEP_MS 1000.0f	// Pooled targets no frame has asked for in this long are released, so sizes the resolution scale returns to are kept
+
+typedef struct Graph_texture_desc {
+	i32 width;
+	i32 height;
+	u32 color_format;	// Sized internal format, e.g. GL_RGBA16
+	u32 depth_format;	// Zero for color only targets
+	u32 filter;
+} Graph_texture_desc;
+
+enum Graph_load {
+	GRAPH_LOAD_CLEAR = 0,
+	GRAPH_LOAD_DONT_CARE,	// The pass writes every pixel, so the old contents are neither cleared nor kept
+	GRAPH_LOAD_KEEP,	// The pass draws on top of what an earlier pass wrote
+};
+
+struct Frame_graph;
+
+typedef void (*Graph_execute)(struct Frame_graph* graph, i32 pass, void* data);
+
+// A render target as the passes see it, only valid for the frame it was declared in
+typedef struct Graph_resource {
+	const char* name;
+	Graph_texture_desc desc;
+	u8 imported;	// The default framebuffer, never pooled
+	i32 first_pass;
+	i32 last_pass;
+	i32 target;	// Pool target backing the resource, assigned when the graph is executed
+} Graph_resource;
+
+typedef struct Graph_pass {
+	const char* name;
+	Graph_execute execute;
+	void* data;
+	i32 reads[MAX_GRAPH_PASS_READS];
+	u32 read_count;
+	i32 write;
+	u8 color_load;	// Graph_load
+	u8 depth_load;
+} Graph_pass;
+
+// The framebuffer and textures behind one or more resources
+typedef struct Graph_target {
+	u32 fbo;
+	u32 color;
+	u32 depth;
+	Graph_texture_desc desc;
+	i32 busy_until;	// Last pass of the resource currently using the target
+	u32 last_frame;
+	u64 last_used;	// time_now_ns of the frame that last used it
+} Graph_target;
+
+typedef struct Graph_stats {
+	u32 pass_count;
+	u32 resource_count;	// Transient resources declared this frame
+	u32 target_count;	// Pool targets backing them
+	u64 resource_bytes;	// Memory the frame would need with one target per resource
+	u64 frame_bytes;	// Memory of the targets the frame actually used
+	u64 pool_bytes;	// Everything held by the pool, including targets kept around for other sizes
+	u32 clears;
+	u32 clears_skipped;
+	u32 invalidations;
+} Graph_stats;
+
+typedef struct Frame_graph {
+	Graph_pass passes[MAX_GRAPH_PASSES];
+	u32 pass_count;
+	Graph_resource resources[MAX_GRAPH_RESOURCES];
+	u32 resource_count;
+	Graph_target targets[MAX_GRAPH_TARGETS];
+	u32 target_count;
+	u32 frame;
+	u64 frame_time;	// time_now_ns when the frame was executed
+	u8 use_invalidate;	// Set when glInvalidateFramebuffer and glInvalidateTexImage are available
+	Graph_stats stats;
+	Gpu_timers* timers;	// Optional, every pass is timed under its name
+	u64 printed_frame_bytes;
+	u32 printed_target_count;
+} Frame_graph;
+
+void frame_graph_initialize(Frame_graph* graph);
+
+// Forgets the passes and resources of the previous frame, pooled targets are kept
+void frame_graph_begin(Frame_graph* graph);
+
+i32 frame_graph_import_backbuffer(Frame_graph* graph, const char* name, i32 width, i32 height);
+
+i32 frame_graph_create_texture(Frame_graph* graph, const char* name, Graph_texture_desc desc);
+
+// Passes run in the order they are added
+i32 frame_graph_add_pass(Frame_graph* graph, const char* name, Graph_execute execute, void* data);
+
+void frame_graph_read(Frame_graph* graph, i32 pass, i32 resource);
+
+void frame_graph_write(Frame_graph* graph, i32 pass, i32 resource, u8 color_load, u8 depth_load);
+
+// Assigns pool targets to the resources, then binds, clears and runs every pass
+void frame_graph_execute(Frame_graph* graph);
+
+// Color texture of a resource, only valid inside the execute callbacks
+u32 frame_graph_texture(Frame_graph* graph, i32 resource);
+
+Graph_stats frame_graph_get_stats(Frame_graph* graph);
+
+void frame_graph_print_stats(Frame_graph* graph);
+
+void frame_graph_destroy(Frame_graph* graph);
+
+#endif
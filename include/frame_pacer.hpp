@@ -0,0 +1,47 @@
+// frame_pacer.hpp
+// monotonic frame clock, an optional frame rate limiter and frame time statistics over a fixed interval
+
+#ifndef _FRAME_PACER_HPP
+#define _FRAME_PACER_HPP
+
+#include "common.hpp"
+
+#define PACER_SPIN_MS 1.5f	// The last stretch of a wait is spun out, sleeps overshoot by up to a scheduler tick
+#define PACER_STATS_INTERVAL_MS 500.0f	// How often the aggregated stats are handed out, e.g. for the window title
+
+typedef struct Frame_stats {
+	u32 frames;
+	float fps;
+	float average_ms;
+	float min_ms;
+	float max_ms;
+	float wait_ms;	// Average time per frame the limiter spent waiting
+} Frame_stats;
+
+typedef struct Frame_pacer {
+	float target_fps;	// Zero runs unbounded
+	u64 frame_start;	// Nanoseconds, CLOCK_MONOTONIC
+	u64 deadline;	// When the next frame may start
+	float delta_ms;	// Frame start to frame start, including the wait
+
+	// Running totals since the last stats were handed out
+	u64 interval_start;
+	u32 frames;
+	float total_ms;
+	float min_ms;
+	float max_ms;
+	float wait_ms;
+	Frame_stats stats;
+} Frame_pacer;
+
+void frame_pacer_initialize(Frame_pacer* pacer, float target_fps);
+
+void frame_pacer_set_target(Frame_pacer* pacer, float target_fps);
+
+// Waits for the target frame time when there is one, then starts the frame. Returns the seconds since the previous frame started
+float frame_pacer_begin_frame(Frame_pacer* pacer);
+
+// Returns 1 every PACER_STATS_INTERVAL_MS, with the stats of the frames since
+u8 frame_pacer_stats_due(Frame_pacer* pacer, Frame_stats* stats);
+
+#endif
@@ -0,0 +1,38 @@
+// frustum.hpp
+// view frustum extraction and culling of bounding volumes
+
+#ifndef _FRUSTUM_HPP
+#define _FRUSTUM_HPP
+
+#include "common.hpp"
+#include "mesh.hpp"
+#include "matrix_math.hpp"
+
+enum Frustum_plane {
+	FRUSTUM_LEFT = 0,
+	FRUSTUM_RIGHT,
+	FRUSTUM_BOTTOM,
+	FRUSTUM_TOP,
+	FRUSTUM_NEAR,
+	FRUSTUM_FAR,
+
+	MAX_FRUSTUM_PLANE,
+};
+
+// Planes are normalized and point inwards, a point p is inside when dot(plane.xyz, p) + plane.w >= 0
+typedef struct Frustum {
+	v4 planes[MAX_FRUSTUM_PLANE];
+} Frustum;
+
+// Extracts the world space frustum from projection * view
+Frustum frustum_from_matrix(mat4 m);
+
+Aabb aabb_transform(Aabb bounds, mat4 transform);
+
+Bounding_sphere bounding_sphere_transform(Bounding_sphere sphere, mat4 transform);
+
+// Tests four bounds at a time, visible[i] is set to 1 when both the box and the sphere intersect the frustum.
+// Returns the number of visible bounds
+u32 frustum_cull(Frustum* frustum, Aabb* bounds, Bounding_sphere* spheres, u32 count, u8* visible);
+
+#endif
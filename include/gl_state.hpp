@@ -0,0 +1,75 @@
+// gl_state.hpp
+// shadows opengl bindings and capabilities so redundant state changes are never issued
+
+#ifndef _GL_STATE_HPP
+#define _GL_STATE_HPP
+
+#include "common.hpp"
+
+#define MAX_TEXTURE_UNITS 16
+
+enum Gl_state_kind {
+	GL_STATE_PROGRAM = 0,
+	GL_STATE_VERTEX_ARRAY,
+	GL_STATE_FRAMEBUFFER,
+	GL_STATE_TEXTURE,
+	GL_STATE_BLEND,
+	GL_STATE_DEPTH,
+	GL_STATE_CULL,
+	GL_STATE_VIEWPORT,
+
+	MAX_GL_STATE,
+};
+
+typedef struct Gl_state_counters {
+	u32 issued[MAX_GL_STATE];
+	u32 skipped[MAX_GL_STATE];
+} Gl_state_counters;
+
+extern const char* gl_state_kind_names[];
+
+// Forgets everything that is shadowed, the next call of each kind always reaches opengl
+void gl_state_invalidate();
+
+void gl_state_use_program(u32 program);
+
+void gl_state_bind_vertex_array(u32 vao);
+
+void gl_state_bind_framebuffer(u32 fbo);
+
+u32 gl_state_bound_framebuffer();
+
+void gl_state_bind_texture(u32 unit, u32 target, u32 texture);
+
+// Call before deleting an object, opengl unbinds deleted names and may hand them out again
+void gl_state_forget_texture(u32 texture);
+
+void gl_state_forget_framebuffer(u32 fbo);
+
+void gl_state_forget_vertex_array(u32 vao);
+
+void gl_state_set_blend(u8 enabled);
+
+void gl_state_set_blend_func(u32 source, u32 destination);
+
+void gl_state_set_depth_test(u8 enabled);
+
+void gl_state_set_depth_func(u32 func);
+
+void gl_state_set_depth_write(u8 enabled);
+
+void gl_state_set_cull(u8 enabled);
+
+void gl_state_set_cull_face(u32 face);
+
+void gl_state_set_viewport(i32 x, i32 y, i32 width, i32 height);
+
+Gl_state_counters gl_state_get_counters();
+
+u32 gl_state_total_issued(Gl_state_counters* counters);
+
+u32 gl_state_total_skipped(Gl_state_counters* counters);
+
+void gl_state_reset_counters();
+
+#endif
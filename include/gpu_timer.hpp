@@ -0,0 +1,73 @@
+// gpu_timer.hpp
+// timestamp queries around render passes, read back frames later so the cpu never waits on the gpu
+
+#ifndef _GPU_TIMER_HPP
+#define _GPU_TIMER_HPP
+
+#include "common.hpp"
+
+#define GPU_TIMER_FRAMES 4	// Frames of queries in flight, a frame whose slot is still busy goes untimed
+#define MAX_GPU_SECTIONS 48	// Timed sections per frame
+#define MAX_GPU_TIMERS 32	// Distinct section names
+#define GPU_TIMER_HISTORY 64	// Frames the rolling average, min and max are taken over
+
+// Timings of every section with one name, sections sharing a name in a frame are summed
+typedef struct Gpu_timer_stats {
+	const char* name;
+	float last_ms;
+	float average_ms;
+	float min_ms;
+	float max_ms;
+	u32 samples;	// Frames in the window, up to GPU_TIMER_HISTORY
+} Gpu_timer_stats;
+
+typedef struct Gpu_timer {
+	const char* name;
+	float history[GPU_TIMER_HISTORY];
+	u32 count;
+	float frame_ms;	// Sum for the frame being collected
+	u8 seen;
+} Gpu_timer;
+
+typedef struct Gpu_timer_frame {
+	u32 queries[MAX_GPU_SECTIONS][2];	// Start and end timestamps
+	const char* names[MAX_GPU_SECTIONS];
+	u32 section_count;
+	u8 pending;
+	u32 frame;
+} Gpu_timer_frame;
+
+typedef struct Gpu_timers {
+	u8 supported;	// Timestamp queries are core in 3.3, but may be missing from older contexts
+	u8 active;	// Whether the current frame is being timed
+	Gpu_timer_frame frames[GPU_TIMER_FRAMES];
+	u32 frame;
+	Gpu_timer timers[MAX_GPU_TIMERS];
+	u32 timer_count;
+	u32 dropped;	// Frames skipped because every slot was still in flight
+	FILE* csv;	// Optional, one row per section and frame
+} Gpu_timers;
+
+void gpu_timers_initialize(Gpu_timers* timers);
+
+// Collects the frames the gpu has finished, then starts timing a new one
+void gpu_timers_begin_frame(Gpu_timers* timers);
+
+void gpu_timers_end_frame(Gpu_timers* timers);
+
+// Name must outlive the timers, it is compared by content. Returns the section to end, or -1 when not timing
+i32 gpu_timers_begin(Gpu_timers* timers, const char* name);
+
+void gpu_timers_end(Gpu_timers* timers, i32 section);
+
+// Fills up to max_count entries, returns how many there are
+u32 gpu_timers_get_stats(Gpu_timers* timers, Gpu_timer_stats* stats, u32 max_count);
+
+void gpu_timers_print_stats(Gpu_timers* timers);
+
+// Appends every collected frame to a csv file, NULL closes it
+i32 gpu_timers_set_csv(Gpu_timers* timers, const char* path);
+
+void gpu_timers_destroy(Gpu_timers* timers);
+
+#endif
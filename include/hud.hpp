@@ -0,0 +1,41 @@
+// hud.hpp
+// text overlay composed from a small built in bitmap font and drawn over the finished frame
+
+#ifndef _HUD_HPP
+#define _HUD_HPP
+
+#include "common.hpp"
+
+#define HUD_GLYPH_WIDTH 5
+#define HUD_GLYPH_HEIGHT 7
+#define HUD_CELL_WIDTH 6	// A column and two rows of spacing around every glyph
+#define HUD_CELL_HEIGHT 9
+#define HUD_FIRST_GLYPH ' '
+#define HUD_GLYPH_COUNT ('~' - ' ' + 1)
+#define HUD_COLUMNS 40
+#define HUD_ROWS 8
+#define HUD_WIDTH (HUD_COLUMNS * HUD_CELL_WIDTH + 2)	// Pixels of the text image, with a one pixel border
+#define HUD_HEIGHT (HUD_ROWS * HUD_CELL_HEIGHT + 2)
+#define HUD_SCALE 2	// Screen pixels per font pixel
+#define HUD_MARGIN 8
+#define HUD_REFRESH_FRAMES 10	// The text is recomposed and uploaded this often, readable instead of flickering
+
+typedef struct Hud {
+	u8 atlas[HUD_GLYPH_HEIGHT][HUD_GLYPH_COUNT * HUD_GLYPH_WIDTH];	// Coverage of every glyph side by side, top row first
+	u8 pixels[HUD_HEIGHT][HUD_WIDTH][4];	// Rgba, bottom row first like a texture upload
+	char text[HUD_ROWS * (HUD_COLUMNS + 1) + 1];
+	u32 texture;
+	u32 frame;
+} Hud;
+
+void hud_initialize(Hud* hud);
+
+// Lines are split on '\n', anything past HUD_COLUMNS or HUD_ROWS is cut off. Only uploads when the text changed
+void hud_set_text(Hud* hud, const char* text);
+
+// Counts frames, returns 1 when the text should be refreshed
+u8 hud_refresh_due(Hud* hud);
+
+void hud_destroy(Hud* hud);
+
+#endif
@@ -13,6 +13,9 @@ typedef struct Image {
 
 i32 load_image_from_file(const char* path, Image* image);
 
+// 8 bits per channel, gray, rgb or rgba by bytes per pixel. Bottom up rows are how opengl reads them back
+i32 write_image_to_file(const char* path, Image* image, u8 bottom_up);
+
 void unload_image(Image* image);
 
 #endif
@@ -0,0 +1,73 @@
+// light_cluster.hpp
+// clustered forward lighting, point lights are binned into a view space grid so each pixel only shades the lights near it
+
+#ifndef _LIGHT_CLUSTER_HPP
+#define _LIGHT_CLUSTER_HPP
+
+#include "common.hpp"
+#include "matrix_math.hpp"
+
+// The grid dimensions are repeated in textured_phong.frag and ground.frag
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+#define CLUSTER_COUNT (CLUSTER_X * CLUSTER_Y * CLUSTER_Z)
+#define CLUSTER_CLIP_NEAR 0.02f	// Near clipping plane, nothing closer is shaded
+#define CLUSTER_NEAR 1.0f	// Depth slices are exponential from here out, everything closer shares the first slice
+#define CLUSTER_FAR 2000.0f	// Far clipping plane
+
+#define MAX_POINT_LIGHTS 4096
+#define MAX_CLUSTER_INDICES (1 << 18)	// Light references over all clusters, any further ones are dropped
+#define CLUSTER_LIGHT_TEXELS 3	// RGBA32F texels per light in the light buffer
+#define LIGHT_CUTOFF (1.0f / 256.0f)	// Attenuation where a light's contribution is considered gone, which gives it a range
+
+typedef struct Point_light {
+    v3 position;
+    v3 color;
+    float ambient;
+    float falloff_linear;
+    float falloff_quadratic;
+} Point_light;
+
+typedef struct Cluster_stats {
+	u32 light_count;	// Lights in front of the camera with any range
+	u32 index_count;
+	u32 dropped;	// References that did not fit in MAX_CLUSTER_INDICES
+	u32 max_cluster_lights;
+	float build_ms;
+} Cluster_stats;
+
+typedef struct Light_clusters {
+	// Buffer textures the lit shaders fetch from
+	u32 light_buffer;
+	u32 light_texture;
+	u32 grid_buffer;	// Offset and count into the index list per cluster
+	u32 grid_texture;
+	u32 index_buffer;
+	u32 index_texture;
+
+	float lights[MAX_POINT_LIGHTS * CLUSTER_LIGHT_TEXELS * 4];	// View space position and range, color and ambient, falloff
+	u32 grid[CLUSTER_COUNT * 2];
+	u16 indices[MAX_CLUSTER_INDICES];
+	u16 cluster_bounds[MAX_POINT_LIGHTS][2];	// First and last depth slice of each light, from binning to the fill
+
+	Cluster_stats stats;
+	u32 printed_light_count;
+} Light_clusters;
+
+void light_clusters_initialize(Light_clusters* clusters);
+
+// Bins the lights for the given camera and uploads the result, count is clamped to MAX_POINT_LIGHTS
+void light_clusters_build(Light_clusters* clusters, Point_light* lights, i32 count, mat4 view, mat4 projection);
+
+// Binds the light, grid and index buffers to three texture units starting at first_unit
+void light_clusters_bind(Light_clusters* clusters, u32 first_unit);
+
+// Slice scale and bias, a depth d falls in slice log(d) * scale + bias
+v2 light_clusters_depth_params();
+
+float light_range(Point_light* light);
+
+void light_clusters_destroy(Light_clusters* clusters);
+
+#endif
@@ -123,6 +123,9 @@ inline v3 multiply_mat4_v3(mat4 m, v3 a, float* w);
 
 inline v3 multiply_mat4_v3(mat4 m, v3 a);
 
+// Position through an affine transform, the w row is ignored
+inline v3 transform_point(mat4 m, v3 p);
+
 inline v3 v3_from_v4(v4 a);
 
 inline v4 v4_from_v3(v3 a, float w);
@@ -267,6 +270,14 @@ inline v3 multiply_mat4_v3(mat4 m, v3 a) {
 	return result;
 }
 
+inline v3 transform_point(mat4 m, v3 p) {
+	return V3(
+		p.x * m.elements[0][0] + p.y * m.elements[1][0] + p.z * m.elements[2][0] + m.elements[3][0],
+		p.x * m.elements[0][1] + p.y * m.elements[1][1] + p.z * m.elements[2][1] + m.elements[3][1],
+		p.x * m.elements[0][2] + p.y * m.elements[1][2] + p.z * m.elements[2][2] + m.elements[3][2]
+	);
+}
+
 inline v4 multiply_mat4_v4(mat4 m, v4 a) {
 	v4 result;
 	float x = a.x, y = a.x, z = a.z, w = a.w;
@@ -5,6 +5,16 @@
 
 #include "common.hpp"
 
+typedef struct Aabb {
+	v3 min;
+	v3 max;
+} Aabb;
+
+typedef struct Bounding_sphere {
+	v3 center;
+	float radius;
+} Bounding_sphere;
+
 typedef struct Mesh {
 	v3* vertices;
 	u32 vertex_count;
@@ -29,10 +39,15 @@ typedef struct Mesh {
 
     v3* bitangents;
     u32 bitangent_count;
+
+	Aabb bounds;	// Object space bounds, computed by load_mesh
+	Bounding_sphere sphere;
 } Mesh;
 
 i32 mesh_sort_indices(Mesh* mesh);
 
+void mesh_compute_bounds(Mesh* mesh);
+
 i32 load_mesh(const char* path, Mesh* mesh, u8 sort_mesh);
 
 void unload_mesh(Mesh* mesh);
@@ -0,0 +1,123 @@
+// mesh_pool.hpp
+// sub-allocates static meshes out of shared vertex/index buffers
+
+#ifndef _MESH_POOL_HPP
+#define _MESH_POOL_HPP
+
+#include "common.hpp"
+#include "mesh.hpp"
+#include "matrix_math.hpp"
+#include "stream_buffer.hpp"
+
+// Vertex attribute locations shared by every program that draws from the pool
+enum Pool_attribute {
+	POOL_ATTRIB_POSITION = 0,
+	POOL_ATTRIB_UV,
+	POOL_ATTRIB_NORMAL,
+	POOL_ATTRIB_TANGENT,
+	POOL_ATTRIB_BITANGENT,
+	POOL_ATTRIB_MODEL,	// Per-instance, occupies four locations (one per column)
+	POOL_ATTRIB_NORMAL_MATRIX = POOL_ATTRIB_MODEL + 4,	// Per-instance, occupies three locations
+
+	MAX_POOL_ATTRIB = POOL_ATTRIB_NORMAL_MATRIX + 3,
+};
+
+typedef struct Pool_vertex {
+	v3 position;
+	v2 uv;
+	v3 normal;
+	v3 tangent;
+	v3 bitangent;
+} Pool_vertex;
+
+// Per-draw data, fetched through instanced attributes using the base instance of each draw
+typedef struct Pool_instance {
+	mat4 model;
+	v3 normal_matrix[3];	// Columns of the transposed inverse of the model matrix
+} Pool_instance;
+
+// Layout mandated by glMultiDrawElementsIndirect
+typedef struct Draw_elements_indirect_command {
+	u32 count;
+	u32 instance_count;
+	u32 first_index;
+	i32 base_vertex;
+	u32 base_instance;
+} Draw_elements_indirect_command;
+
+// Offset and count are in elements (vertices or indices), not bytes
+typedef struct Pool_range {
+	u32 offset;
+	u32 count;
+} Pool_range;
+
+#define MAX_FREE_RANGES 256
+
+typedef struct Range_allocator {
+	Pool_range free_ranges[MAX_FREE_RANGES];	// Sorted by offset, adjacent ranges are always merged
+	u32 free_range_count;
+	u32 capacity;
+	u32 used;
+} Range_allocator;
+
+typedef struct Mesh_pool {
+	u32 vao;
+	u32 vbo;
+	u32 ebo;
+	u32 position_vao;	// Positions and instance data only, for depth passes
+	u32 position_vbo;	// Copy of the vertex positions, tightly packed so depth passes fetch a fifth of the vertex data
+	Stream_buffer* stream;	// Instances and indirect commands are written here every frame
+	u32 first_instance;	// Of this frame's instances in the stream buffer, added to every base instance
+	u32 command_offset;	// Bytes, where this frame's indirect commands start in the stream buffer
+	Range_allocator vertices;
+	Range_allocator indices;
+	Draw_elements_indirect_command* commands;	// CPU copy of the last uploaded commands, used when multi draw is unavailable
+	u8 use_multi_draw;	// Set when glMultiDrawElementsIndirect (and base instance) is available
+} Mesh_pool;
+
+typedef struct Mesh_pool_stats {
+	u32 vertex_bytes_used;
+	u32 vertex_bytes_capacity;
+	u32 index_bytes_used;
+	u32 index_bytes_capacity;
+	float vertex_fragmentation;	// 0 when all free space is contiguous, towards 1 the more it is split up
+	float index_fragmentation;
+} Mesh_pool_stats;
+
+i32 range_allocator_initialize(Range_allocator* allocator, u32 capacity);
+
+i32 range_allocator_allocate(Range_allocator* allocator, u32 count, Pool_range* range);
+
+void range_allocator_free(Range_allocator* allocator, Pool_range range);
+
+void range_allocator_grow(Range_allocator* allocator, u32 new_capacity);
+
+float range_allocator_fragmentation(Range_allocator* allocator);
+
+// The instance attributes point into the stream buffer, which has to outlive the pool
+i32 mesh_pool_initialize(Mesh_pool* pool, u32 vertex_capacity, u32 index_capacity, Stream_buffer* stream);
+
+i32 mesh_pool_upload(Mesh_pool* pool, Mesh* mesh, Pool_range* vertices, Pool_range* indices);
+
+i32 mesh_pool_upload_vertices(Mesh_pool* pool, Pool_vertex* data, u32 vertex_count, u32* index_data, u32 index_count, Pool_range* vertices, Pool_range* indices);
+
+// Copies a mesh back out of the pool, indices come back relative to the mesh like they were uploaded
+void mesh_pool_read_vertices(Mesh_pool* pool, Pool_range vertices, Pool_range indices, Pool_vertex* vertex_data, u32* index_data);
+
+void mesh_pool_free(Mesh_pool* pool, Pool_range vertices, Pool_range indices);
+
+// Once per frame, between stream_buffer_begin_frame and stream_buffer_end_frame. Nothing is drawn when the stream region is full
+i32 mesh_pool_upload_draws(Mesh_pool* pool, Draw_elements_indirect_command* commands, Pool_instance* instances, u32 count);
+
+void mesh_pool_draw(Mesh_pool* pool, u32 first_command, u32 command_count);
+
+// Same as mesh_pool_draw, but only feeds positions from the position stream
+void mesh_pool_draw_positions(Mesh_pool* pool, u32 first_command, u32 command_count);
+
+Mesh_pool_stats mesh_pool_get_stats(Mesh_pool* pool);
+
+void mesh_pool_print_stats(Mesh_pool* pool);
+
+void mesh_pool_destroy(Mesh_pool* pool);
+
+#endif
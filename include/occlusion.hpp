@@ -0,0 +1,64 @@
+// occlusion.hpp
+// software occlusion culling, occluders are rasterized into a small depth buffer on the cpu
+
+#ifndef _OCCLUSION_HPP
+#define _OCCLUSION_HPP
+
+#include "common.hpp"
+#include "mesh.hpp"
+#include "matrix_math.hpp"
+
+#define OCCLUSION_WIDTH 256
+#define OCCLUSION_HEIGHT 128
+#define OCCLUSION_TILE_WIDTH 64	// Must be a multiple of four, the rasterizer works on four pixels at a time
+#define OCCLUSION_TILE_HEIGHT 32
+#define OCCLUSION_TILES_X (OCCLUSION_WIDTH / OCCLUSION_TILE_WIDTH)
+#define OCCLUSION_TILE_COUNT (OCCLUSION_TILES_X * (OCCLUSION_HEIGHT / OCCLUSION_TILE_HEIGHT))
+
+#define MAX_OCCLUSION_THREADS 8
+#define MAX_OCCLUDER_TRIANGLES 16384	// Screen space triangles per frame, the rest are dropped
+#define MAX_OCCLUDER_MESH_TRIANGLES 4096	// Occluder meshes are simplified to this many of their largest triangles
+#define MAX_OCCLUDER_VERTICES (MAX_OCCLUDER_MESH_TRIANGLES * 3)
+
+// Position only, simplified copy of a mesh used as occluder. Made of whole triangles of the mesh, so it never
+// covers anything the mesh does not
+typedef struct Occluder_mesh {
+	v3* vertices;
+	u32 vertex_count;
+	u32* indices;
+	u32 index_count;
+} Occluder_mesh;
+
+typedef struct Occlusion_stats {
+	u32 occluder_triangles;	// Rasterized this frame, after clipping
+	u32 dropped_triangles;	// Did not fit in MAX_OCCLUDER_TRIANGLES
+	u32 thread_count;
+	float rasterize_ms;
+} Occlusion_stats;
+
+// Starts the worker threads, zero picks one thread per core
+i32 occlusion_initialize(u32 thread_count);
+
+void occlusion_destroy();
+
+// Keeps a simplified copy of the mesh, so entities using it can be tagged as occluders
+i32 occlusion_add_mesh(i32 mesh_id, Mesh* mesh);
+
+void occlusion_begin(mat4 view, mat4 projection);
+
+// Bend lowers every vertex in object space by its squared view space distance in x and z times bend, the way
+// ground.vert does, zero leaves the mesh as it is
+void occlusion_add_occluder(i32 mesh_id, mat4 transform, float bend);
+
+// Clears and fills the depth buffer, tiles are spread over the worker threads
+void occlusion_rasterize();
+
+// Returns 0 only when the world space box is completely hidden behind the rasterized occluders
+u8 occlusion_test_aabb(Aabb bounds);
+
+// OCCLUSION_WIDTH * OCCLUSION_HEIGHT reciprocal view depths (1 / w), bottom row first. Zero where nothing was drawn
+const float* occlusion_get_depth_buffer();
+
+Occlusion_stats occlusion_get_stats();
+
+#endif
@@ -0,0 +1,78 @@
+// profiler.hpp
+// scoped cpu timing, every thread records into its own buffer and the whole run is written out as a chrome trace
+
+#ifndef _PROFILER_HPP
+#define _PROFILER_HPP
+
+#include "common.hpp"
+
+#ifndef NO_PROFILER
+	#define USE_PROFILER 1	// Build with -DNO_PROFILER to compile every scope out
+#endif
+
+#define MAX_PROFILER_THREADS 32
+#define PROFILER_THREAD_EVENTS (1 << 16)	// Per thread, later scopes are dropped once a buffer is full
+#define PROFILER_THREAD_NAME_SIZE 32
+
+typedef struct Profile_event {
+	const char* name;	// Must outlive the profiler, string literals or pass names
+	u64 start;	// Nanoseconds
+	u64 end;
+} Profile_event;
+
+typedef struct Profile_thread {
+	Profile_event* events;
+	u32 count;	// Only written by the owning thread, published with release stores
+	u32 dropped;
+	u32 id;
+	char name[PROFILER_THREAD_NAME_SIZE];
+} Profile_thread;
+
+#if USE_PROFILER
+
+// Scopes are only recorded between profiler_start and profiler_write_trace, otherwise they cost a clock read and a branch
+void profiler_start();
+
+u8 profiler_active();
+
+void profiler_record(const char* name, u64 start, u64 end);
+
+// Shows up as the thread name in the trace viewer
+void profiler_set_thread_name(const char* name);
+
+// Chrome trace event json, which chrome://tracing and ui.perfetto.dev both open. Stops recording
+i32 profiler_write_trace(const char* path);
+
+void profiler_destroy();
+
+struct Profile_scope {
+	const char* name;
+	u64 start;
+
+	Profile_scope(const char* scope_name) : name(scope_name), start(profiler_active() ? time_now_ns() : 0) {}
+	~Profile_scope() {
+		if (start) {
+			profiler_record(name, start, time_now_ns());
+		}
+	}
+};
+
+#define PROFILE_JOIN_(A, B) A##B
+#define PROFILE_JOIN(A, B) PROFILE_JOIN_(A, B)
+#define PROFILE_SCOPE(NAME) Profile_scope PROFILE_JOIN(profile_scope_, __LINE__)(NAME)
+#define PROFILE_FUNCTION() PROFILE_SCOPE(__func__)
+
+#else
+
+inline void profiler_start() {}
+inline u8 profiler_active() { return 0; }
+inline void profiler_set_thread_name(const char* name) {}
+inline i32 profiler_write_trace(const char* path) { return Error; }
+inline void profiler_destroy() {}
+
+#define PROFILE_SCOPE(NAME)
+#define PROFILE_FUNCTION()
+
+#endif
+
+#endif
@@ -0,0 +1,34 @@
+// render_stats.hpp
+// per-frame counters of what the renderer hands to opengl, bumped wherever draws are issued or data is uploaded
+
+#ifndef _RENDER_STATS_HPP
+#define _RENDER_STATS_HPP
+
+#include "common.hpp"
+#include "gl_state.hpp"
+
+typedef struct Render_stats {
+	u32 draw_calls;	// Api calls, a multi draw counts once
+	u64 triangles;	// Submitted, before any culling on the gpu
+	u32 program_switches;
+	u32 texture_binds;
+	u32 uniform_uploads;
+	u64 bytes_uploaded;	// Buffer and texture data written for the gpu, streamed draw data included
+} Render_stats;
+
+// Uploads a uniform and counts it: COUNTED_UNIFORM(glUniform1i, location, value)
+#define COUNTED_UNIFORM(Function, ...) (render_stats_count_uniform(), Function(__VA_ARGS__))
+
+// Like the gl state shadow, only to be called from the thread that owns the context
+void render_stats_count_draw(u64 triangles);
+
+void render_stats_count_uniform();
+
+void render_stats_count_upload(u64 bytes);
+
+void render_stats_reset();
+
+// Returns the counts since the previous call, program switches and texture binds come from the gl state counters
+Render_stats render_stats_end_frame(Gl_state_counters* state_counters);
+
+#endif
@@ -3,24 +3,30 @@
 #ifndef _RENDERER_HPP
 #define _RENDERER_HPP
 
+#include <pthread.h>
+
 #include "resource.hpp"
 #include "matrix_math.hpp"
+#include "mesh_pool.hpp"
+#include "frame_graph.hpp"
+#include "resolution.hpp"
+#include "shader_cache.hpp"
+#include "light_cluster.hpp"
+#include "static_batch.hpp"
+#include "gl_state.hpp"
+#include "capture.hpp"
+#include "render_stats.hpp"
+#include "hud.hpp"
+#include "entity_cost.hpp"
 
 typedef struct Model {
   u32 draw_count;
-  u32 vao;
-  u32 vbo;
-  u32 ebo;
+  Pool_range vertices;	// Sub-allocation in the shared mesh pool
+  Pool_range indices;
+  Aabb bounds;	// Object space, kept around for culling after the mesh itself is unloaded
+  Bounding_sphere sphere;
 } Model;
 
-typedef struct Fbo {
-	u32 texture;
-	u32 depth;
-	u32 fbo;
-	i32 width;
-	i32 height;
-} Fbo;
-
 typedef struct Texture {
 	u32 id = 0;
 	v2 offset = V2(0, 0);
@@ -41,6 +47,19 @@ typedef struct Value_map {
     u8 type;
 } Value_map;
 
+// Pipeline state of a material, set per material in the scene file
+enum Cull_mode {
+	CULL_BACK = 0,
+	CULL_FRONT,
+	CULL_NONE,	// For sprites and other single sided geometry seen from both sides
+};
+
+enum Blend_mode {
+	BLEND_NONE = 0,	// Opaque, drawn first
+	BLEND_ALPHA,	// Transparent, drawn after every opaque item and sorted back to front
+	BLEND_ADDITIVE,
+};
+
 typedef struct Material {
     Value_map ambient;
     Value_map diffuse; //TODO: rename color_map to diffuse_map and remove this field.
@@ -51,26 +70,64 @@ typedef struct Material {
     Texture texture1;
     float texture_mix;
     u32 shader_index; // NOTE: This is not the handle given by opengl, but rather the index as defined in resource.hpp
+    u32 variant; // One based slot in the renderer's shader variants, selected at scene load. Zero draws with the plain shader
+    u8 cull; // Cull_mode
+    u8 blend; // Blend_mode
+    u8 depth_write;
 } Material;
 
+// Material features a shader can be specialized for, each one a #define in the fragment shader
+enum Material_feature {
+	MATERIAL_AMBIENT_MAP = 1 << 0,
+	MATERIAL_DIFFUSE_MAP = 1 << 1,
+	MATERIAL_SPECULAR_MAP = 1 << 2,
+	MATERIAL_NORMAL_MAP = 1 << 3,
+	MATERIAL_TEXTURE_MIX = 1 << 4,
+
+	MAX_MATERIAL_FEATURE = 5,
+};
+
+#define MAX_SHADER_VARIANTS 64
+
+typedef struct Shader_variant {
+	u32 shader_index;
+	u32 features;	// Material_feature flags
+	u32 program;	// Zero until compiled, or if compiling failed
+} Shader_variant;
+
 extern mat4 projection;
 extern mat4 ortho_projection;
 extern mat4 view;
 extern mat4 model;
 
-enum Fbo_type {
-	FBO_STANDARD_FRAMEBUFFER = -1,
-	FBO_COLOR,
-	FBO_BRIGHTNESS_EXTRACT,
-	FBO_COMBINE,
-	FBO_V_BLUR,
-	FBO_H_BLUR,
+#define MAX_BLOOM_LEVELS 5	// Half resolution down to 1/32
+
+enum Bloom_quality {
+	BLOOM_QUALITY_LOW = 0,
+	BLOOM_QUALITY_MEDIUM,
+	BLOOM_QUALITY_HIGH,
 
-	MAX_FBO,
+	MAX_BLOOM_QUALITY,
+};
+
+typedef struct Bloom_preset {
+	const char* name;
+	u32 levels;	// Pyramid depth, at most MAX_BLOOM_LEVELS
+	u8 high_quality_downsample;	// 13 instead of 4 taps per downsampled pixel
+	float upsample_radius;
+} Bloom_preset;
+
+extern Bloom_preset bloom_presets[MAX_BLOOM_QUALITY];
+
+enum Fbo_blend {
+	FBO_BLEND_ALPHA = 0,
+	FBO_BLEND_NONE,
+	FBO_BLEND_ADDITIVE,
 };
 
 typedef struct Fbo_attributes {
 	u32 shader_id;
+	u8 blend;	// Fbo_blend
 	union {
 		struct {
 			u32 texture1;
@@ -83,80 +140,325 @@ typedef struct Fbo_attributes {
 			float factor;
 			u8 keep_color;
 		} extract;
+		struct {
+			u8 high_quality;
+		} downsample;
+		struct {
+			float radius;
+		} upsample;
 	};
 } Fbo_attributes;
 
+#define MAX_LIGHTS 64	// Sun lights, point lights go through the light clusters
+typedef struct Sun_light {
+    v3 angle;
+    v3 color;
+    float ambient;
+    float falloff_linear;
+    float falloff_quadratic;
+} Sun_light;
+
+typedef struct Scene {
+    Point_light* lights;
+    i32 num_lights;
+    Sun_light* sun_lights;
+    i32 num_sun_lights;
+} Scene;
+
+#define MAX_DRAW_ITEMS 512
+#define STREAM_REGION_SIZE (1 << 20)	// Bytes of per-frame data, instances and indirect commands of every draw take about 70 KiB
+
+// A mesh queued by render_mesh, drawn when the queue is submitted
+typedef struct Draw_item {
+	i32 mesh_id;	// -1 for static batches
+	mat4 transformation;
+	Material material;
+	struct Scene* scene;
+	Pool_range indices;	// The whole mesh, or the visible members of a static batch
+	i32 base_vertex;
+	Bounding_sphere sphere;	// Object space
+	i32 entity;	// Index of the entity that queued it, -1 for static batches
+} Draw_item;
+
+#define MAX_FLARES 6
+#define MAX_FLARE_TEXTURES 3
+#define FLARE_QUERY_FRAMES 3	// Occlusion queries in flight, a result is read once available and never waited on
+#define FLARE_PROBE_SIZE 16	// Pixels per side of the quad depth tested at the flare source
+
+// Lens flares queued by render_flares, drawn on top of the scene with one instanced draw
+typedef struct Flare_state {
+	u32 vao;
+	u32 instance_vbo;	// Position along the flare vector, size, opacity and texture slot per flare
+	u32 queries[FLARE_QUERY_FRAMES];
+	u8 query_pending[FLARE_QUERY_FRAMES];
+	u32 query_pixels[FLARE_QUERY_FRAMES];	// Probe area the query was issued with
+	u32 query_frame;
+	float visibility;	// From the latest query that has a result, kept while newer ones are still in flight
+	v3 source;
+	u8 queued;
+	struct {
+		i32 projection, view, source, scale, visibility, textures;
+	} flare_uniforms;	// Looked up once, after the shaders are linked
+	struct {
+		i32 projection, view, source, extent;
+	} probe_uniforms;
+} Flare_state;
+
+#define PREPASS_QUERY_FRAMES 3	// Fragment count queries in flight, read once available
+
+// Depth only pass over the opaque draws, so the shading pass only runs the fragment shader on visible pixels
+typedef struct Depth_prepass {
+	u8 enabled;
+	u32 queries[PREPASS_QUERY_FRAMES];	// Samples passed by the shading of the opaque draws
+	u8 query_pending[PREPASS_QUERY_FRAMES];
+	u8 query_prepass[PREPASS_QUERY_FRAMES];	// Whether the pre-pass ran in the frame the query was issued in
+	u32 query_pixels[PREPASS_QUERY_FRAMES];
+	u32 query_frame;
+	u64 fragments[2];	// Latest shaded fragment count without and with the pre-pass
+	u8 reported[2];
+} Depth_prepass;
+
+#define SCENE_QUERY_FRAMES 3
+#define SCENE_REPORT_FRAME 4	// The first frames are drawn before the camera settles, the stats printed come from this one
+
+// Work done by the scene pass in one frame
+typedef struct Scene_stats {
+	u32 draws;
+	u32 transparent_draws;
+	u64 triangles_submitted;
+	u64 triangles_rasterized;	// Primitives out of the clipping stage. Zero without pipeline statistics queries
+	u64 fragments_shaded;	// Fragment shader invocations. Zero without pipeline statistics queries
+	u32 pixels;	// Scene target size
+} Scene_stats;
+
+typedef struct Scene_statistics {
+	u8 supported;	// ARB_pipeline_statistics_query
+	u32 primitive_queries[SCENE_QUERY_FRAMES];
+	u32 fragment_queries[SCENE_QUERY_FRAMES];
+	u8 query_pending[SCENE_QUERY_FRAMES];
+	Scene_stats query_stats[SCENE_QUERY_FRAMES];	// Counted on the cpu while the frame was submitted
+	u32 query_frames[SCENE_QUERY_FRAMES];
+	u32 query_frame;
+	Scene_stats latest;
+	u8 reported;
+} Scene_statistics;
+
+// Switches the main thread flips, handed to the renderer with every frame
+typedef struct Render_settings {
+	u8 post_processing;
+	u8 bloom_quality;
+	u8 dynamic_resolution;
+	u8 depth_prepass;
+	u8 hud;
+	u8 entity_costs;
+} Render_settings;
+
+#define DRAW_LIST_COUNT 2	// One list being built while the other is rendered, a third would add a frame of latency
+
+// Everything one frame is rendered from. Filled by the main thread, then left alone until the renderer is done with it
+typedef struct Draw_list {
+	Draw_item items[MAX_DRAW_ITEMS];
+	u32 item_count;
+	mat4 view;
+	mat4 projection;
+	mat4 ortho_projection;
+	i32 width;
+	i32 height;
+	float delta_time;
+	i32 skybox_id;	// -1 when the frame has no skybox
+	float skybox_brightness;
+	u8 flares_queued;
+	v3 flare_source;
+	Point_light point_lights[MAX_POINT_LIGHTS];
+	i32 point_light_count;
+	Sun_light sun_lights[MAX_LIGHTS];
+	Scene scene;	// Points at the light copies, every item of the frame is drawn with it
+	Scene* scene_source;	// The scene the copies were taken from
+	Render_settings settings;
+	u8 print_gpu_timings;
+} Draw_list;
+
+// Results of rendered frames the main thread may read while the next one is being rendered
+typedef struct Render_published {
+	Scene_stats scene_stats;
+	float resolution_scale;
+	Gl_state_counters state_counters;	// Of the last frame
+	Render_stats render_stats;	// Of the last frame
+} Render_published;
+
+// Owns the gl context while running, and renders the draw lists the main thread submits in order
+typedef struct Render_thread {
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t list_ready;
+	pthread_cond_t list_done;
+	u32 submitted;	// Draw lists handed over, the next one is built in lists[submitted % DRAW_LIST_COUNT]
+	u32 completed;
+	u8 running;
+	u8 quit;
+	Render_published published;
+	Entity_cost entity_costs[MAX_COST_ENTITIES];	// Ranked, republished with every frame while entity costs are measured
+	u32 entity_cost_count;
+	u32 entity_cost_frames;
+} Render_thread;
+
 typedef struct Render_state {
 	u32 textures[MAX_TEXTURE];
 	u32 texture_count;
 
-	Fbo fbos[MAX_FBO];
-	u32 fbo_count;
+	Frame_graph graph;
+	Dynamic_resolution resolution;
 
 	u32 cube_maps[MAX_CUBE_MAP];
 	u32 cube_map_count;
 
 	Model models[MAX_MESH];
 	u32 model_count;
+
+	Stream_buffer stream;
+	Mesh_pool mesh_pool;
+
+	Draw_list lists[DRAW_LIST_COUNT];
+	Draw_list* building;	// Main thread, filled by render_mesh and the other queueing calls
+	Draw_list* frame;	// Being rendered
+	Render_settings settings;	// Latest from the main thread, copied into every draw list
+	u8 print_gpu_timings;
+	Render_thread thread;
+
+	i32 skybox_id;	// Of the frame being rendered, -1 when it has no skybox
+	float skybox_brightness;
+	Flare_state flares;
+	Depth_prepass prepass;
+	Scene_statistics statistics;
+	Light_clusters clusters;
+	Gpu_timers gpu_timers;
+	Frame_capture capture;
+	Hud hud;
+	Entity_costs entity_costs;
+	Static_batches static_batches;
+	Draw_item batch_items[MAX_STATIC_BATCHES];	// Material, scene and geometry of each batch, queued once per visible range
+	v2 cluster_tile_scale;	// Cluster tiles per pixel of the scene target
     
     u32 shaders[MAX_SHADER];
+	Shader_cache shader_cache;
+	Shader_variant variants[MAX_SHADER_VARIANTS];
+	u32 variant_count;
 
 	Resources resources;
 	i32 depth_func;
 	u8 use_post_processing;
+	u8 bloom_quality;
 	u8 initialized;
 } Render_state;
 
-#define MAX_LIGHTS 64
-typedef struct Point_light {
-    v3 position;
-    v3 color;
-    float ambient;
-    float falloff_linear;
-    float falloff_quadratic;
-} Point_light;
+i32 renderer_initialize();
 
-typedef struct Sun_light {
-    v3 angle;
-    v3 color;
-    float ambient;
-    float falloff_linear;
-    float falloff_quadratic;
-} Sun_light;
+void renderer_framebuffer_callback(i32 width, i32 height);
 
-typedef struct Scene {
-    Point_light* lights;
-    i32 num_lights;
-    Sun_light* sun_lights;
-    i32 num_sun_lights;
-} Scene;
+// Draws a full screen quad into the bound framebuffer
+void render_fullscreen_pass(u32 texture, Fbo_attributes attr);
 
-i32 renderer_initialize();
+void renderer_toggle_post_processing();
 
-void renderer_framebuffer_callback(i32 width, i32 height);
+void renderer_toggle_dynamic_resolution();
 
-void renderer_clear_fbo();
+void renderer_set_dynamic_resolution(u8 enabled);
 
-void renderer_bind_fbo(i32 fbo_id);
+void renderer_toggle_depth_prepass();
 
-void renderer_unbind_fbo();
+// Counters of the last frame drawn over its top left corner
+void renderer_toggle_hud();
 
-void render_fbo(i32 fbo_id, i32 target_fbo, Fbo_attributes attr);
+// Times every draw on its own and attributes it to the entity that queued it. Static batches are split up while measuring
+void renderer_toggle_entity_costs();
 
-void renderer_post_process();
+void renderer_set_entity_costs(u8 enabled);
 
-void renderer_toggle_post_processing();
+u8 renderer_entity_costs_enabled();
+
+// Costs of the entities drawn since measuring started, ranked by gpu time. Returns how many were filled
+u32 renderer_get_entity_costs(Entity_cost* costs, u32 max_count, u32* frames);
+
+// Fraction of the window resolution the scene is rendered at
+float renderer_get_resolution_scale();
+
+// Latest scene pass counts the gpu has finished, a few frames behind
+Scene_stats renderer_get_scene_stats();
 
-void renderer_clear_fbos();
+// State changes of the last rendered frame
+Gl_state_counters renderer_get_state_counters();
 
+// Draw calls, uploads and bindings of the last rendered frame
+Render_stats renderer_get_render_stats();
+
+Stream_stats renderer_get_stream_stats();
+
+// Rolling gpu times of every frame graph pass and the parts of the scene pass. Returns how many sections there are
+u32 renderer_get_gpu_timings(Gpu_timer_stats* stats, u32 max_count);
+
+void renderer_print_gpu_timings();
+
+// Appends the gpu time of every section to a csv file as frames come in, NULL stops
+i32 renderer_set_gpu_timer_csv(const char* path);
+
+void renderer_set_bloom_quality(u32 quality);
+
+void renderer_cycle_bloom_quality();
+
+void renderer_print_bloom_cost();
+
+// Queues the lens flares of a light at the given world position for this frame
 void render_flares(v3 flare_source);
 
-void render_flare(u32 texture_id, float flare_pos, float flare_size, float flare_opacity, v3 flare_source);
+u32 material_features(Material* material);
+
+// Points the material at the variant of its shader matching its features, compiled by renderer_compile_variants
+void renderer_select_variant(Material* material);
+
+// Compiles every selected variant that has no program yet, all submitted before any is waited on
+void renderer_compile_variants();
+
+i32 renderer_get_mesh_bounds(i32 mesh_id, Aabb* bounds, Bounding_sphere* sphere);
 
-void render_mesh(mat4 translation, i32 mesh_id, Material material, Scene* scene);
+// Entity is the index its costs are attributed to, -1 for none
+void render_mesh(mat4 translation, i32 mesh_id, Material material, Scene* scene, i32 entity);
+
+// Frees the static batches of the previous scene
+void renderer_clear_static_batches();
+
+// Places the mesh in the batch of its material, creating it when needed. Nothing is merged until the batches are built.
+// Ground shader meshes whose y axis the transform turns or scales are refused, they would bend the wrong way
+i32 renderer_add_static_mesh(mat4 transformation, i32 mesh_id, Material material, Scene* scene, u32* batch, u32* member);
+
+i32 renderer_build_static_batches();
+
+// Queues a member of a static batch, visible members of a batch are drawn together when the frame is rendered
+void render_static_mesh(u32 batch, u32 member);
 
 void render_skybox(u32 skybox_id, float brightness);
 
+// Copied into the draw list, up to MAX_POINT_LIGHTS
+void render_point_lights(Point_light* lights, i32 count);
+
+// Writes every interval-th frame to directory as a png, read back without stalling the frame.
+// Call before the render thread is started
+i32 renderer_start_capture(const char* directory, u32 interval);
+
+// Moves the gl context to a render thread, which renders the submitted draw lists from then on.
+// Everything else that touches gl (loading, static batches) has to wait until it is stopped again
+i32 renderer_start_thread();
+
+// Renders whatever was submitted, then hands the context back to the calling thread
+void renderer_stop_thread();
+
+// Picks the draw list the render_* calls of this frame fill. Waits while the render thread still reads it
+void renderer_begin_frame();
+
+// Finishes the draw list and renders it: the scene pass draws the queued meshes, skybox and flares, post processing follows,
+// then the buffers are swapped. With the render thread running this only hands the list over.
+// The frame time (in seconds) drives the dynamic resolution
+void renderer_render_frame(float delta_time);
+
 void renderer_destroy();
 
 #endif
@@ -0,0 +1,52 @@
+// resolution.hpp
+// dynamic resolution, scales the scene target to keep gpu frame times within a budget
+
+#ifndef _RESOLUTION_HPP
+#define _RESOLUTION_HPP
+
+#include "common.hpp"
+
+#define RESOLUTION_TARGET_MS 16.6f
+#define RESOLUTION_MIN_SCALE 0.5f
+#define RESOLUTION_MAX_SCALE 1.0f
+#define RESOLUTION_STEP 0.05f	// Scales are snapped to steps, so the target pool only ever sees a handful of sizes
+#define RESOLUTION_QUERY_FRAMES 4	// Timestamps are read this many frames late, so the cpu never waits on them
+#define RESOLUTION_HISTORY 8	// Frames averaged before the scale is changed
+#define RESOLUTION_COOLDOWN 15	// Frames to wait after a change before considering the next one
+
+typedef struct Dynamic_resolution {
+	u8 enabled;
+	u8 use_timer;	// Set when timestamp queries are available, otherwise only cpu frame times are used
+	float scale;
+	float target_ms;
+
+	u32 queries[RESOLUTION_QUERY_FRAMES][2];	// Start and end timestamps of a frame
+	float query_scale[RESOLUTION_QUERY_FRAMES];	// Results rendered at an older scale are thrown away
+	u8 query_pending[RESOLUTION_QUERY_FRAMES];
+	u32 frame;
+
+	float gpu_ms[RESOLUTION_HISTORY];
+	u32 gpu_count;
+	float cpu_ms[RESOLUTION_HISTORY];
+	u32 cpu_count;
+	u32 cooldown;
+
+	float gpu_average;
+	float cpu_average;
+} Dynamic_resolution;
+
+void resolution_initialize(Dynamic_resolution* resolution, float target_ms);
+
+// Brackets the gpu work of a frame with timestamp queries
+void resolution_begin_frame(Dynamic_resolution* resolution);
+
+void resolution_end_frame(Dynamic_resolution* resolution);
+
+// Collects finished queries and picks the scale for the next frame, cpu_ms is the full frame time seen by the engine
+void resolution_update(Dynamic_resolution* resolution, float cpu_ms);
+
+void resolution_set_enabled(Dynamic_resolution* resolution, u8 enabled);
+
+void resolution_destroy(Dynamic_resolution* resolution);
+
+#endif
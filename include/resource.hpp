@@ -16,9 +16,18 @@ enum Shader_id {
     FLARE_SHADER,
 	BRIGHTNESS_EXTRACT_SHADER,
     GROUND_SHADER,
+	BLOOM_DOWNSAMPLE_SHADER,
+	BLOOM_UPSAMPLE_SHADER,
+	FLARE_PROBE_SHADER,
+	DEPTH_SHADER,
+	GROUND_DEPTH_SHADER,
     MAX_SHADER
 };
 
+// ground.vert and ground_depth.vert lower every vertex by the square of its view space distance in x and z over this,
+// whatever the cpu does with those meshes has to bend them the same way
+#define GROUND_BEND_DISTANCE 800.0f
+
 enum Texture_id {
 	TEXTURE_MISSING = 0,
     TEXTURE_HOUSE,
@@ -5,6 +5,16 @@
 
 #include "engine.hpp"
 
+// Names the scene file gave an entity, NULL where it gave none
+typedef struct Entity_names {
+    const char* id;
+    const char* mesh;
+    const char* material;
+} Entity_names;
+
 u8 initialize_scene(Engine* engine, char* scene_path);
 
+// Valid until the next scene is loaded
+Entity_names scene_get_entity_names(Entity* entity);
+
 #endif
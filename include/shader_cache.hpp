@@ -0,0 +1,38 @@
+// shader_cache.hpp
+// keeps linked program binaries on disk, so later runs can skip compiling from source
+
+#ifndef _SHADER_CACHE_HPP
+#define _SHADER_CACHE_HPP
+
+#include "common.hpp"
+
+#define SHADER_CACHE_DIR "cache"
+#define SHADER_CACHE_MAGIC 0x48435353	// "SSCH"
+#define SHADER_CACHE_VERSION 1
+
+typedef struct Shader_cache {
+	u8 enabled;	// Set when program binaries can be retrieved and at least one binary format is supported
+	u64 driver_hash;	// Vendor, renderer and version strings, a driver update invalidates every entry
+	u32 hits;
+	u32 misses;
+	u32 rejected;	// Found on disk, but the driver refused the binary
+	u32 stored;
+} Shader_cache;
+
+void shader_cache_initialize(Shader_cache* cache);
+
+// FNV-1a, chained through the hash argument
+u64 shader_cache_hash(u64 hash, const char* text);
+
+// Key for a program built from the given sources by the current driver
+u64 shader_cache_key(Shader_cache* cache, const char* vert_source, const char* frag_source);
+
+// Returns a linked program, or zero when there is no usable binary for the key
+u32 shader_cache_load(Shader_cache* cache, const char* name, u64 key);
+
+// The program must have been linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set
+void shader_cache_store(Shader_cache* cache, const char* name, u64 key, u32 program);
+
+void shader_cache_print_stats(Shader_cache* cache);
+
+#endif
@@ -0,0 +1,44 @@
+// startup_trace.hpp
+// time and size of every asset load and upload before the first frame, reported as a table and a json file to diff between builds
+
+#ifndef _STARTUP_TRACE_HPP
+#define _STARTUP_TRACE_HPP
+
+#include "common.hpp"
+
+#define MAX_STARTUP_EVENTS 512
+#define STARTUP_ASSET_SIZE 128
+#define STARTUP_REPORT_ASSETS 15	// Most expensive assets listed in the table, the json has all of them
+
+typedef struct Startup_event {
+	const char* phase;	// String literal, events of one phase are summed in the report
+	char asset[STARTUP_ASSET_SIZE];	// Path or name, empty for a step that is not about one asset
+	u64 start;	// Nanoseconds since the trace started
+	u64 end;
+	u64 bytes;	// Read, decoded or uploaded, whatever the phase moves
+	i32 parent;	// Enclosing event, -1 at the top
+	u8 ended;
+} Startup_event;
+
+typedef struct Startup_trace {
+	Startup_event events[MAX_STARTUP_EVENTS];
+	u32 event_count;
+	i32 open;	// Innermost event not ended yet, -1 when there is none
+	u32 dropped;
+	u8 active;
+	u64 start;
+} Startup_trace;
+
+// Events are only recorded between startup_trace_start and startup_trace_report, and only from the main thread
+void startup_trace_start();
+
+// Asset may be NULL. Returns the event to end, or -1 when not tracing
+i32 startup_trace_begin(const char* phase, const char* asset);
+
+void startup_trace_end(i32 event, u64 bytes);
+
+// Prints the time spent in every phase and the most expensive assets, counting only the time not spent in nested events,
+// then writes every event to a json file. Stops tracing, later calls do nothing
+i32 startup_trace_report(const char* path);
+
+#endif
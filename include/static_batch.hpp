@@ -0,0 +1,58 @@
+// static_batch.hpp
+// merges meshes that never move into world space batches at scene load, drawn with one command per visible run
+
+#ifndef _STATIC_BATCH_HPP
+#define _STATIC_BATCH_HPP
+
+#include "common.hpp"
+#include "mesh.hpp"
+#include "mesh_pool.hpp"
+#include "matrix_math.hpp"
+
+#define MAX_STATIC_BATCHES 32
+#define MAX_BATCH_MEMBERS 256
+
+// One mesh placed in a batch, it keeps its own index range so it can still be culled on its own
+typedef struct Batch_member {
+	u32 batch;
+	mat4 transform;
+	Pool_range source_vertices;	// The mesh the member was made from
+	Pool_range source_indices;
+	Pool_range indices;	// In the pool, filled in by static_batches_build
+} Batch_member;
+
+typedef struct Static_batch {
+	Pool_range vertices;
+	Pool_range indices;
+	Bounding_sphere sphere;	// World space, around every member
+	u32 first_member;	// Into member_order
+	u32 member_count;
+} Static_batch;
+
+typedef struct Static_batches {
+	Static_batch batches[MAX_STATIC_BATCHES];
+	u32 batch_count;
+	Batch_member members[MAX_BATCH_MEMBERS];
+	u32 member_count;
+	u32 member_order[MAX_BATCH_MEMBERS];	// Members grouped by batch, in the order their indices are laid out
+	u8 visible[MAX_BATCH_MEMBERS];	// Set by static_batches_mark_visible, cleared when the ranges are collected
+	u8 built;
+} Static_batches;
+
+// Frees every batch, members added afterwards start new ones
+void static_batches_clear(Static_batches* batches, Mesh_pool* pool);
+
+i32 static_batches_create(Static_batches* batches, u32* batch);
+
+// Sphere is the object space bounding sphere of the mesh
+i32 static_batches_add(Static_batches* batches, u32 batch, Pool_range vertices, Pool_range indices, Bounding_sphere sphere, mat4 transform, u32* member);
+
+// Transforms every member into world space and uploads each batch as one mesh
+i32 static_batches_build(Static_batches* batches, Mesh_pool* pool);
+
+void static_batches_mark_visible(Static_batches* batches, u32 member);
+
+// Index ranges of the visible members of a batch, adjacent members merged into one range. Returns the range count
+u32 static_batches_visible_ranges(Static_batches* batches, u32 batch, Pool_range* ranges);
+
+#endif
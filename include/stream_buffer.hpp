@@ -0,0 +1,65 @@
+// stream_buffer.hpp
+// ring buffer for data written by the cpu every frame, mapped once and split into one region per frame in flight
+
+#ifndef _STREAM_BUFFER_HPP
+#define _STREAM_BUFFER_HPP
+
+#include "common.hpp"
+
+#define STREAM_FRAMES 3	// Regions, the cpu fills one while the gpu may still read the other two
+#define STREAM_FENCE_TIMEOUT_NS 1000000000ull	// Waits longer than this are reported and the region is reused anyway
+
+typedef struct Stream_allocation {
+	void* data;	// Write only, never read back from it
+	u32 buffer;
+	u32 offset;	// Bytes from the start of the buffer, for binding or attribute pointers
+	u32 size;
+} Stream_allocation;
+
+typedef struct Stream_stats {
+	u32 frames;
+	u32 fence_waits;	// Frames that found their region still in use by the gpu
+	float wait_ms;
+	float max_wait_ms;
+	u32 frame_bytes;	// Handed out in the current frame
+	u32 peak_bytes;
+	u32 overflows;	// Allocations that did not fit in the region
+} Stream_stats;
+
+typedef struct Stream_buffer {
+	u32 buffer;
+	u8* mapped;	// Persistent mapping, or a cpu copy that is uploaded on flush when buffer storage is unavailable
+	u8 persistent;
+	u32 region_size;
+	u32 region;	// Being written this frame
+	u32 head;	// Bytes used of the current region
+	u32 flushed;	// Bytes of the current region already uploaded, without a persistent mapping
+	i32 uniform_alignment;
+	void* fences[STREAM_FRAMES];	// GLsync, one per region
+	Stream_stats stats;
+} Stream_buffer;
+
+i32 stream_buffer_initialize(Stream_buffer* stream, u32 region_size);
+
+// Waits until the gpu is done with the region this frame writes to
+void stream_buffer_begin_frame(Stream_buffer* stream);
+
+// Offset is a multiple of alignment, which does not have to be a power of two
+i32 stream_buffer_allocate(Stream_buffer* stream, u32 size, u32 alignment, Stream_allocation* allocation);
+
+// Aligned for binding with glBindBufferRange(GL_UNIFORM_BUFFER, ...)
+i32 stream_buffer_allocate_uniform(Stream_buffer* stream, u32 size, Stream_allocation* allocation);
+
+// Makes what was written visible to draws issued after this. Nothing to do with a persistent coherent mapping
+void stream_buffer_flush(Stream_buffer* stream);
+
+// Fences the region after the last draw reading it
+void stream_buffer_end_frame(Stream_buffer* stream);
+
+Stream_stats stream_buffer_get_stats(Stream_buffer* stream);
+
+void stream_buffer_print_stats(Stream_buffer* stream);
+
+void stream_buffer_destroy(Stream_buffer* stream);
+
+#endif
@@ -23,6 +23,17 @@ typedef void (*framebuffer_change_cb)(i32 width, i32 height);
 
 i32 window_open(const char* title, i32 width, i32 height, u8 fullscreen, u8 vsync, framebuffer_change_cb framebuffer_cb);
 
+// Offscreen OpenGL context through EGL, for benchmarks on machines without a display. There is no input
+i32 window_open_headless(i32 width, i32 height, framebuffer_change_cb framebuffer_cb);
+
+// Binds the context to the calling thread, or releases it so another thread can take it
+void window_make_context_current(u8 current);
+
+// Whether the calling thread has the context, gl objects can only be released while it does
+u8 window_has_context();
+
+u8 window_is_headless();
+
 i32 window_width();
 
 i32 window_height();
@@ -31,6 +42,10 @@ void window_set_title(const char* title);
 
 i32 window_poll_events();
 
+// Takes in pending events so the cursor is current, but leaves the key and button edges to window_poll_events
+// so none are lost between the two. Returns -1 when the window is to be closed
+i32 window_poll_cursor();
+
 void window_clear_buffers(float r, float g, float b);
 
 void window_swap_buffers();
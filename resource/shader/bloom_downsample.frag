@@ -0,0 +1,42 @@
+// bloom_downsample.frag
+
+#version 330 core
+
+in vec2 texture_coord;
+
+layout (location = 0) out vec4 out_color;
+
+uniform sampler2D texture0;	// Level above, twice our resolution
+uniform bool high_quality;
+
+// Every fetch lands on the corner shared by four texels, so the bilinear filter averages all of them in one tap
+void main() {
+	vec2 texel = 1.0 / textureSize(texture0, 0);
+	vec4 color;
+	if (high_quality) {
+		// 13 taps covering 6x6 texels (Jimenez, Next Generation Post Processing in Call of Duty: Advanced Warfare)
+		vec4 a = texture(texture0, texture_coord + texel * vec2(-2, -2));
+		vec4 b = texture(texture0, texture_coord + texel * vec2( 0, -2));
+		vec4 c = texture(texture0, texture_coord + texel * vec2( 2, -2));
+		vec4 d = texture(texture0, texture_coord + texel * vec2(-2,  0));
+		vec4 e = texture(texture0, texture_coord);
+		vec4 f = texture(texture0, texture_coord + texel * vec2( 2,  0));
+		vec4 g = texture(texture0, texture_coord + texel * vec2(-2,  2));
+		vec4 h = texture(texture0, texture_coord + texel * vec2( 0,  2));
+		vec4 i = texture(texture0, texture_coord + texel * vec2( 2,  2));
+		vec4 j = texture(texture0, texture_coord + texel * vec2(-1, -1));
+		vec4 k = texture(texture0, texture_coord + texel * vec2( 1, -1));
+		vec4 l = texture(texture0, texture_coord + texel * vec2(-1,  1));
+		vec4 m = texture(texture0, texture_coord + texel * vec2( 1,  1));
+		color = e * 0.125 + (a + c + g + i) * 0.03125 + (b + d + f + h) * 0.0625 + (j + k + l + m) * 0.125;
+	}
+	else {
+		// 4 taps covering 4x4 texels
+		color = texture(texture0, texture_coord + texel * vec2(-1, -1));
+		color += texture(texture0, texture_coord + texel * vec2( 1, -1));
+		color += texture(texture0, texture_coord + texel * vec2(-1,  1));
+		color += texture(texture0, texture_coord + texel * vec2( 1,  1));
+		color *= 0.25;
+	}
+	out_color = color;
+}
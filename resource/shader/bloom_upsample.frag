@@ -0,0 +1,21 @@
+// bloom_upsample.frag
+
+#version 330 core
+
+in vec2 texture_coord;
+
+layout (location = 0) out vec4 out_color;
+
+uniform sampler2D texture0;	// Level below, half our resolution
+uniform float radius;	// In texels of texture0
+
+// 3x3 tent filter, the 1 2 1 weights per axis come from four bilinear fetches half a texel apart
+// instead of nine point samples. The result is added onto the level we render to
+void main() {
+	vec2 offset = (0.5 * radius) / textureSize(texture0, 0);
+	vec4 color = texture(texture0, texture_coord + vec2(-offset.x, -offset.y));
+	color += texture(texture0, texture_coord + vec2( offset.x, -offset.y));
+	color += texture(texture0, texture_coord + vec2(-offset.x,  offset.y));
+	color += texture(texture0, texture_coord + vec2( offset.x,  offset.y));
+	out_color = color * 0.25;
+}
@@ -14,22 +14,19 @@ uniform bool vertical;	// Dictates if we should blur vertically or horizontally
 // float weights[11] = float[] (1.000000, 0.882497, 0.606531, 0.324652, 0.135335, 0.043937, 0.011109, 0.002187, 0.000335, 0.000040, 0.000004);
 
 // 3.5 sigma
-float weights[11] = float[] (1.000000, 0.960005, 0.849366, 0.692569, 0.520450, 0.360448, 0.230066, 0.135335, 0.073370, 0.036658, 0.016880);
+// Adjacent taps of the 11 tap kernel are merged into one bilinear fetch placed between the two texels,
+// weighted so the hardware filter reproduces both of them: weight = w(a) + w(b), offset = (a w(a) + b w(b)) / weight
+float center_weight = 2.0;	// Was sampled in both directions
+float weights[5] = float[] (1.809371, 1.213019, 0.590514, 0.208705, 0.053538);
+float offsets[5] = float[] (1.469426, 3.429053, 5.389603, 7.351549, 9.315290);
 
 void main() {
-	vec4 color = vec4(0);
 	vec2 texel_size = 1.0 / textureSize(texture0, 0);
-	if (vertical) {
-		for (int i = 0; i < 11; i++) {
-			color += weights[i] * texture(texture0, texture_coord + vec2(0, texel_size.y * i));
-			color += weights[i] * texture(texture0, texture_coord - vec2(0, texel_size.y * i));
-		}
-	}
-	else {
-		for (int i = 0; i < 11; i++) {
-			color += weights[i] * texture(texture0, texture_coord + vec2(texel_size.x * i, 0));
-			color += weights[i] * texture(texture0, texture_coord - vec2(texel_size.x * i, 0));
-		}
+	vec2 direction = vertical ? vec2(0, texel_size.y) : vec2(texel_size.x, 0);
+	vec4 color = center_weight * texture(texture0, texture_coord);
+	for (int i = 0; i < 5; i++) {
+		color += weights[i] * texture(texture0, texture_coord + direction * offsets[i]);
+		color += weights[i] * texture(texture0, texture_coord - direction * offsets[i]);
 	}
 	out_color = color;
 }
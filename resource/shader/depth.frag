@@ -0,0 +1,10 @@
+// depth.frag
+
+#version 330 core
+
+layout (location = 0) out vec4 out_color;
+
+// Color writes are masked, only depth is written
+void main() {
+	out_color = vec4(0);
+}
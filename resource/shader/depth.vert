@@ -0,0 +1,16 @@
+// depth.vert
+
+#version 330 core
+in vec3 position;
+in mat4 model_matrix;	// Per draw, read from the mesh pool instance buffer
+
+uniform mat4 P;
+uniform mat4 V;
+
+// Written exactly like textured_phong.vert, the shading pass depth tests against this with GL_EQUAL
+invariant gl_Position;
+
+void main() {
+	mat4 VM = V * model_matrix;
+	gl_Position = P * VM * vec4(position, 1);
+}
@@ -2,12 +2,16 @@
 
 in vec2 texture_coord;
 in float flare_opacity;
+flat in int flare_texture;
 layout (location = 0) out vec4 out_color;
 
-uniform sampler2D flare_texture;
-uniform float flare_opacity_override;
+uniform sampler2D flare_textures[3];
 
 void main() {
-    out_color = texture(flare_texture, texture_coord);
-    out_color.a *= flare_opacity * flare_opacity_override;
+    // Every texture is sampled, indexing samplers with a varying is not allowed in 330 and would break the mip selection anyway
+    vec4 color0 = texture(flare_textures[0], texture_coord);
+    vec4 color1 = texture(flare_textures[1], texture_coord);
+    vec4 color2 = texture(flare_textures[2], texture_coord);
+    out_color = flare_texture == 0 ? color0 : (flare_texture == 1 ? color1 : color2);
+    out_color.a *= flare_opacity;
 }
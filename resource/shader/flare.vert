@@ -1,38 +1,32 @@
 #version 330 core
 
 in vec4 vertex;
+in vec4 flare_instance; // Position along the flare vector, size, opacity and texture slot of one flare
+
 out vec2 texture_coord;
 out float flare_opacity;
+flat out int flare_texture;
 
 uniform mat4 projection;
-uniform mat4 orthogonal;
 uniform mat4 view;
-uniform mat4 model;
-uniform mat4 reverse_model;
 
-uniform float flare_position; // How far along the flare vector should we be positioned?
-uniform float flare_size;
 uniform vec3 flare_source;
+uniform vec2 flare_scale; // Keeps the quads square whatever the aspect ratio
+uniform float flare_visibility; // Unoccluded part of the source, from an occlusion query a frame or two old
 
 void main() {
-    //vec3 flare_source = vec3(0,0,0);
-
 	texture_coord = vec2(vertex.z, 1 - vertex.w);
-    vec4 vertex_pos = orthogonal * model * vec4(vertex.xy, 0, 1);
+    flare_texture = int(flare_instance.w);
     vec4 flare_source_screenspace = projection * view * vec4(flare_source, 1);
 
     if (flare_source_screenspace.w > 0) {
         // To account for perspective:
-        float flare_source_x = flare_source_screenspace.x / flare_source_screenspace.w;
-        float flare_source_y = flare_source_screenspace.y / flare_source_screenspace.w;
-        vec2 flare_vector = vec2(flare_source_x, flare_source_y);
+        vec2 flare_vector = flare_source_screenspace.xy / flare_source_screenspace.w;
 
-        flare_opacity = 1 - ((length(flare_vector) * length(flare_vector)) / 0.9f);
+        flare_opacity = max(1 - dot(flare_vector, flare_vector) / 0.9f, 0) * flare_instance.z * flare_visibility;
 
-        gl_Position = vec4(
-            vertex_pos.xy * flare_size + flare_vector * flare_position,
-            0, 1
-        );
+        vec2 corner = (vertex.xy * 2 - 1) * flare_instance.y * flare_scale;
+        gl_Position = vec4(corner + flare_vector * flare_instance.x, 0, 1);
     } else {
         // Outside of screen. w <= 0 which means that it is not visible.
         gl_Position = vec4(2, 2, 0, 1);
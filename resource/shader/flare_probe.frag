@@ -0,0 +1,10 @@
+// flare_probe.frag
+
+#version 330 core
+
+layout (location = 0) out vec4 out_color;
+
+// Color writes are masked, only the samples passed count
+void main() {
+	out_color = vec4(1);
+}
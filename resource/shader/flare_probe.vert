@@ -0,0 +1,22 @@
+// flare_probe.vert
+
+#version 330 core
+
+in vec4 vertex;
+
+uniform mat4 projection;
+uniform mat4 view;
+
+uniform vec3 flare_source;
+uniform vec2 probe_extent; // Half size of the probe in normalized device coordinates
+
+// A small quad at the depth of the flare source, the samples passing the depth test tell how much of it is visible
+void main() {
+	vec4 source = projection * view * vec4(flare_source, 1);
+	if (source.w <= 0) {
+		gl_Position = vec4(2, 2, 0, 1);
+		return;
+	}
+	vec3 source_ndc = source.xyz / source.w;
+	gl_Position = vec4(source_ndc.xy + (vertex.xy * 2 - 1) * probe_extent, source_ndc.z, 1);
+}
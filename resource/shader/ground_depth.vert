@@ -0,0 +1,22 @@
+// ground_depth.vert
+
+#version 330 core
+in vec3 position;
+in mat4 model_matrix;	// Per draw, read from the mesh pool instance buffer
+
+uniform mat4 P;
+uniform mat4 V;
+
+// Bends the ground exactly like ground.vert, the shading pass depth tests against this with GL_EQUAL
+invariant gl_Position;
+
+void main() {
+	mat4 VM = V * model_matrix;
+
+	vec3 viewspace_position = (VM * vec4(position, 1)).xyz;
+    float dist_to_cam = length(viewspace_position.xz); // only count distance in x and z
+    vec3 new_world_pos = position;
+    new_world_pos.y -= (dist_to_cam * dist_to_cam) / 800;
+
+	gl_Position = P * VM * vec4(new_world_pos, 1);
+}
@@ -39,16 +39,53 @@ uniform float shininess;
 
 uniform mat4 V;
 
+#ifdef MATERIAL_VARIANT
+// Compiled for one set of material features, so unused fetches and branches are removed
+#ifdef AMBIENT_MAP
+#define AMBIENT_MAPPED true
+#else
+#define AMBIENT_MAPPED false
+#endif
+#ifdef DIFFUSE_MAP
+#define DIFFUSE_MAPPED true
+#else
+#define DIFFUSE_MAPPED false
+#endif
+#ifdef SPECULAR_MAP
+#define SPECULAR_MAPPED true
+#else
+#define SPECULAR_MAPPED false
+#endif
+#ifdef NORMAL_MAP
+#define NORMAL_MAPPED true
+#else
+#define NORMAL_MAPPED false
+#endif
+#ifdef TEXTURE_MIX
+#define TEXTURE_MIXED true
+#else
+#define TEXTURE_MIXED false
+#endif
+#else
+// Without a variant every feature is decided per pixel, a constant of -1 flags a mapped value
+#define AMBIENT_MAPPED (ambient_amp == -1)
+#define DIFFUSE_MAPPED (diffuse_amp == -1)
+#define SPECULAR_MAPPED (specular_amp == -1)
+#define NORMAL_MAPPED (normal_amp == -1)
+#define TEXTURE_MIXED (texture_mix != 0)
+#endif
+
+// Must match light_cluster.hpp
+#define CLUSTER_X 16
+#define CLUSTER_Y 9
+#define CLUSTER_Z 24
+uniform samplerBuffer cluster_lights; // Three texels per light: view space position and range, color and ambient, falloff
+uniform usamplerBuffer cluster_grid; // Offset and count into the index list per cluster
+uniform usamplerBuffer cluster_indices;
+uniform vec2 cluster_tile_scale; // Tiles per pixel
+uniform vec2 cluster_depth; // Slice scale and bias for log(depth)
+
 #define MAX_LIGHTS 64
-struct Point_light {
-    vec3 position; // position in view space
-    vec3 color;
-    float ambient;
-    float falloff_linear;
-    float falloff_quadratic;
-};
-uniform Point_light point_lights[MAX_LIGHTS];
-uniform int num_point_lights;
 
 struct Sun_light {
     vec3 angle; // UN-normalized direction vector, world space
@@ -61,44 +98,63 @@ uniform Sun_light sun_lights[MAX_LIGHTS];
 uniform int num_sun_lights;
 
 void main() {
-    vec3 obj_color = texture(color_map, texture_coord + color_map_offset).rgb + (texture_mix * texture(obj_texture1, texture_coord + offset1).rgb);
+    vec3 obj_color = texture(color_map, texture_coord + color_map_offset).rgb;
+    if (TEXTURE_MIXED) {
+        obj_color += texture_mix * texture(obj_texture1, texture_coord + offset1).rgb;
+    }
 
-    vec3 frag_ambient_amp = obj_color * ambient_amp;
-    if (ambient_amp == -1) {
+    vec3 frag_ambient_amp;
+    if (AMBIENT_MAPPED) {
         frag_ambient_amp = texture(ambient_map, texture_coord + ambient_map_offset).rgb;
+    } else {
+        frag_ambient_amp = obj_color * ambient_amp;
     }
 
-    vec3 frag_diffuse_amp = obj_color * diffuse_amp;
-    if (diffuse_amp == -1) {
+    vec3 frag_diffuse_amp;
+    if (DIFFUSE_MAPPED) {
         frag_diffuse_amp = texture(diffuse_map, texture_coord + diffuse_map_offset).rgb;
+    } else {
+        frag_diffuse_amp = obj_color * diffuse_amp;
     }
 
-    vec3 frag_specular_amp = obj_color * specular_amp;
-    if (specular_amp == -1) {
+    vec3 frag_specular_amp;
+    if (SPECULAR_MAPPED) {
         frag_specular_amp = texture(specular_map, texture_coord + specular_map_offset).rgb;
+    } else {
+        frag_specular_amp = obj_color * specular_amp;
     }
 
     vec3 interp_surface_normal = normalize(surface_normal);
-    if (normal_amp == -1) {
+    if (NORMAL_MAPPED) {
         interp_surface_normal = texture(normal_map, texture_coord + normal_map_offset).rgb * 2 - 1;
         interp_surface_normal = normalize(TBN * interp_surface_normal);
     }
 
     vec3 view_dir = normalize(-viewspace_position);
     vec3 out_rgb = vec3(0,0,0);
-    for (int i = 0; i < num_point_lights; i++) {
-        Point_light light = point_lights[i];
-        vec3 light_pos = (V * vec4(light.position, 1.0f)).xyz;
+    ivec3 cluster = ivec3(gl_FragCoord.xy * cluster_tile_scale, log(max(-viewspace_position.z, 1e-4)) * cluster_depth.x + cluster_depth.y);
+    cluster = clamp(cluster, ivec3(0), ivec3(CLUSTER_X - 1, CLUSTER_Y - 1, CLUSTER_Z - 1));
+    uvec2 cluster_range = texelFetch(cluster_grid, (cluster.z * CLUSTER_Y + cluster.y) * CLUSTER_X + cluster.x).xy;
+    for (uint i = 0u; i < cluster_range.y; i++) {
+        int light_index = int(texelFetch(cluster_indices, int(cluster_range.x + i)).r) * 3;
+        vec4 light_position = texelFetch(cluster_lights, light_index);
+        vec4 light_color = texelFetch(cluster_lights, light_index + 1);
+        vec4 light_falloff = texelFetch(cluster_lights, light_index + 2);
+        vec3 light_pos = light_position.xyz;
 
         float light_distance = length(light_pos - viewspace_position);
-        float falloff = 1.0f / (1 + light.falloff_linear * light_distance + light.falloff_quadratic * (light_distance * light_distance));
+        if (light_distance >= light_position.w) {
+            continue;
+        }
+        float falloff = 1.0f / (1 + light_falloff.x * light_distance + light_falloff.y * (light_distance * light_distance));
+        falloff = max(falloff - light_falloff.z, 0) / (1 - light_falloff.z); // Reaches zero at the range, so cluster edges don't show
 
         vec3 light_dir = normalize(light_pos - viewspace_position);
         vec3 reflection = normalize(reflect(-light_dir, interp_surface_normal));
 
         vec3 diffuse = max(dot(interp_surface_normal, light_dir), 0) * frag_diffuse_amp;
         vec3 specular = pow(max(dot(view_dir, reflection), 0), shininess) * frag_specular_amp;
-        out_rgb += vec3(light.color * falloff * (frag_ambient_amp * light.ambient + diffuse + specular));
+        out_rgb += vec3(light_color.rgb * falloff * (frag_ambient_amp * light_color.a + diffuse + specular));
     }
     for (int i = 0; i < num_sun_lights; i++) {
         Sun_light light = sun_lights[i];
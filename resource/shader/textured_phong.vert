@@ -6,17 +6,24 @@ in vec2 uv;
 in vec3 normal;
 in vec3 tangent;
 in vec3 bitangent;
+in mat4 model_matrix;	// Per draw, read from the mesh pool instance buffer
+in mat3 normal_matrix;
 
 out vec3 surface_normal;
 out vec2 texture_coord;
 out vec3 viewspace_position;
 out mat3 TBN;
 
-uniform mat4 VM;
-uniform mat4 PVM;
-uniform mat4 VM_normal;
+uniform mat4 P;
+uniform mat4 V;
+
+// The depth pre-pass computes the same position in its own program
+invariant gl_Position;
 
 void main() {
+	mat4 VM = V * model_matrix;
+	mat3 VM_normal = mat3(V) * normal_matrix;
+
 	texture_coord = vec2(uv.x, 1 - uv.y); // Flip Y so blender's UVs work
 	viewspace_position = (VM * vec4(position, 1)).xyz;
 
@@ -25,5 +32,5 @@ void main() {
     vec3 viewspace_bitangent = normalize(mat3(VM_normal) * bitangent);
     TBN = mat3(viewspace_tangent, viewspace_bitangent, surface_normal);
 
-	gl_Position = PVM * vec4(position, 1);
+	gl_Position = P * VM * vec4(position, 1);
 }
@@ -0,0 +1,119 @@
+// benchmark.cpp
+// frame time and scene pass counts of a headless run, written out as a json report
+
+#include <GL/glew.h>
+#include <algorithm>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "memory.hpp"
+#include "benchmark.hpp"
+
+static float percentile(float* sorted, u32 count, float p);
+
+// Nearest rank
+float percentile(float* sorted, u32 count, float p) {
+	if (count == 0) {
+		return 0;
+	}
+	u32 rank = (u32)ceilf(p / 100.0f * count);
+	return sorted[clamp(rank, 1u, count) - 1];
+}
+
+i32 benchmark_initialize(Benchmark* benchmark, u32 frames) {
+	*benchmark = (Benchmark) {};
+	benchmark->frame_ms = (float*)m_malloc(sizeof(float) * frames);
+	if (!benchmark->frame_ms) {
+		return Error;
+	}
+	benchmark->capacity = frames;
+	return NoError;
+}
+
+void benchmark_add_frame(Benchmark* benchmark, float frame_ms, Scene_stats stats, Render_stats render_stats) {
+	if (benchmark->frame_count < benchmark->capacity) {
+		benchmark->frame_ms[benchmark->frame_count++] = frame_ms;
+	}
+	// With the render thread the counts trail the frames by one, nothing has been rendered yet at first
+	if (render_stats.draw_calls > 0) {
+		Render_stats* totals = &benchmark->render_totals;
+		totals->draw_calls += render_stats.draw_calls;
+		totals->triangles += render_stats.triangles;
+		totals->program_switches += render_stats.program_switches;
+		totals->texture_binds += render_stats.texture_binds;
+		totals->uniform_uploads += render_stats.uniform_uploads;
+		totals->bytes_uploaded += render_stats.bytes_uploaded;
+		benchmark->render_count++;
+	}
+	// Stats trail the frames by the query latency, frames before the first result has come in have none
+	if (stats.draws == 0 && stats.triangles_submitted == 0) {
+		return;
+	}
+	benchmark->draws += stats.draws;
+	benchmark->triangles_submitted += stats.triangles_submitted;
+	benchmark->triangles_rasterized += stats.triangles_rasterized;
+	benchmark->fragments_shaded += stats.fragments_shaded;
+	benchmark->max_draws = std::max(benchmark->max_draws, stats.draws);
+	benchmark->max_triangles = std::max(benchmark->max_triangles, stats.triangles_submitted);
+	benchmark->stats_count++;
+}
+
+i32 benchmark_write_report(Benchmark* benchmark, const char* path, const char* scene_path, i32 width, i32 height) {
+	u32 count = benchmark->frame_count;
+	float* sorted = (float*)m_malloc(sizeof(float) * std::max(count, 1u));
+	if (!sorted) {
+		return Error;
+	}
+	memcpy(sorted, benchmark->frame_ms, sizeof(float) * count);
+	std::sort(sorted, sorted + count);
+	double total = 0;
+	for (u32 i = 0; i < count; ++i) {
+		total += sorted[i];
+	}
+	double stats_count = std::max(benchmark->stats_count, 1u);
+	double render_count = std::max(benchmark->render_count, 1u);
+	Render_stats* totals = &benchmark->render_totals;
+
+	FILE* fp = path ? fopen(path, "w") : stdout;
+	if (!fp) {
+		fprintf(stderr, "Failed to write benchmark report '%s'\n", path);
+		m_free(sorted, sizeof(float) * std::max(count, 1u));
+		return Error;
+	}
+	fprintf(fp, "{\n");
+	fprintf(fp, "\t\"scene\": ");
+	write_json_string(fp, scene_path);
+	fprintf(fp, ",\n\t\"renderer\": ");
+	write_json_string(fp, (const char*)glGetString(GL_RENDERER));
+	fprintf(fp, ",\n\t\"width\": %d,\n\t\"height\": %d,\n\t\"frames\": %u,\n", width, height, count);
+	fprintf(fp, "\t\"frame_ms\": {\"mean\": %.4f, \"min\": %.4f, \"p50\": %.4f, \"p90\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f},\n",
+		count ? total / count : 0.0, count ? sorted[0] : 0.0f,
+		percentile(sorted, count, 50), percentile(sorted, count, 90), percentile(sorted, count, 95), percentile(sorted, count, 99),
+		count ? sorted[count - 1] : 0.0f);
+	fprintf(fp, "\t\"draws\": {\"mean\": %.2f, \"max\": %u},\n", benchmark->draws / stats_count, benchmark->max_draws);
+	fprintf(fp, "\t\"triangles\": {\"mean\": %.1f, \"max\": %llu, \"rasterized_mean\": %.1f},\n",
+		benchmark->triangles_submitted / stats_count, (unsigned long long)benchmark->max_triangles, benchmark->triangles_rasterized / stats_count);
+	fprintf(fp, "\t\"fragments_shaded_mean\": %.1f,\n", benchmark->fragments_shaded / stats_count);
+	fprintf(fp, "\t\"render_stats_mean\": {\"draw_calls\": %.2f, \"triangles\": %.1f, \"program_switches\": %.2f, \"texture_binds\": %.2f, \"uniform_uploads\": %.2f, \"bytes_uploaded\": %.1f}\n",
+		totals->draw_calls / render_count, totals->triangles / render_count, totals->program_switches / render_count,
+		totals->texture_binds / render_count, totals->uniform_uploads / render_count, totals->bytes_uploaded / render_count);
+	fprintf(fp, "}\n");
+	if (path) {
+		fclose(fp);
+		fprintf(stdout, "Benchmark report written to '%s'\n", path);
+	}
+	m_free(sorted, sizeof(float) * std::max(count, 1u));
+	return NoError;
+}
+
+void benchmark_destroy(Benchmark* benchmark) {
+	if (benchmark->frame_ms) {
+		m_free(benchmark->frame_ms, sizeof(float) * benchmark->capacity);
+	}
+	*benchmark = (Benchmark) {};
+}
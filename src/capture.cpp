@@ -0,0 +1,219 @@
+// capture.cpp
+// frame readback through a ring of pixel buffers, the pngs are encoded on a worker thread so rendering never waits on either
+
+#include <GL/glew.h>
+#include <sys/stat.h>	// mkdir
+#include <errno.h>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "image.hpp"
+#include "gl_state.hpp"
+#include "profiler.hpp"
+#include "capture.hpp"
+
+#define CAPTURE_FENCE_TIMEOUT_NS 1000000000ull
+
+static void collect_readback(Frame_capture* capture, u32 slot, u8 wait);
+static void push_job(Frame_capture* capture, Capture_job job);
+static void* encoder_main(void* data);
+
+// Copies a finished readback out of its pixel buffer and queues it for encoding. Without wait, a readback still in flight is left alone
+void collect_readback(Frame_capture* capture, u32 slot, u8 wait) {
+	GLsync fence = (GLsync)capture->fences[slot];
+	if (!fence) {
+		return;
+	}
+	GLenum status = glClientWaitSync(fence, 0, 0);
+	if (status == GL_TIMEOUT_EXPIRED) {
+		if (!wait) {
+			return;
+		}
+		u64 start = time_now_ns();
+		status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, CAPTURE_FENCE_TIMEOUT_NS);
+		capture->stats.readback_waits++;
+		capture->stats.wait_ms += time_since_ms(start);
+	}
+	glDeleteSync(fence);
+	capture->fences[slot] = NULL;
+
+	i32 width = capture->widths[slot];
+	i32 height = capture->heights[slot];
+	u32 size = width * height * 3;
+	// Plain malloc, the encoder frees it and the m_malloc counters are not safe to update from another thread
+	u8* pixels = (u8*)malloc(size);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbos[slot]);
+	void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+	if (mapped && pixels) {
+		memcpy(pixels, mapped, size);
+	}
+	if (mapped) {
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (!mapped || !pixels || status == GL_WAIT_FAILED) {
+		free(pixels);
+		pthread_mutex_lock(&capture->mutex);
+		capture->stats.failed++;
+		pthread_mutex_unlock(&capture->mutex);
+		return;
+	}
+	push_job(capture, (Capture_job) {
+		.pixels = pixels,
+		.width = width,
+		.height = height,
+		.index = capture->indices[slot],
+	});
+}
+
+void push_job(Frame_capture* capture, Capture_job job) {
+	pthread_mutex_lock(&capture->mutex);
+	if (capture->job_tail - capture->job_head >= MAX_CAPTURE_JOBS) {
+		capture->stats.encoder_waits++;
+		u64 start = time_now_ns();
+		while (capture->job_tail - capture->job_head >= MAX_CAPTURE_JOBS) {
+			pthread_cond_wait(&capture->job_done, &capture->mutex);
+		}
+		capture->stats.wait_ms += time_since_ms(start);
+	}
+	capture->jobs[capture->job_tail % MAX_CAPTURE_JOBS] = job;
+	capture->job_tail++;
+	pthread_cond_signal(&capture->job_ready);
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+void* encoder_main(void* data) {
+	Frame_capture* capture = (Frame_capture*)data;
+	char path[CAPTURE_PATH_SIZE + 16];
+	profiler_set_thread_name("capture encoder");
+
+	pthread_mutex_lock(&capture->mutex);
+	for (;;) {
+		// Everything queued before quitting is still written
+		while (capture->job_head == capture->job_tail && !capture->quit) {
+			pthread_cond_wait(&capture->job_ready, &capture->mutex);
+		}
+		if (capture->job_head == capture->job_tail) {
+			break;
+		}
+		Capture_job job = capture->jobs[capture->job_head % MAX_CAPTURE_JOBS];
+		pthread_mutex_unlock(&capture->mutex);
+
+		snprintf(path, sizeof(path), "%s/%u.png", capture->directory, job.index);
+		Image image = {
+			.buffer = job.pixels,
+			.width = job.width,
+			.height = job.height,
+			.depth = 8,
+			.pitch = (u16)(job.width * 3),
+			.bytes_per_pixel = 3,
+		};
+		i32 result = write_image_to_file(path, &image, 1 /* bottom up */);
+		free(job.pixels);
+
+		pthread_mutex_lock(&capture->mutex);
+		capture->job_head++;
+		if (result == NoError) {
+			capture->stats.written++;
+		}
+		else {
+			capture->stats.failed++;
+		}
+		pthread_cond_broadcast(&capture->job_done);
+	}
+	pthread_mutex_unlock(&capture->mutex);
+	return NULL;
+}
+
+i32 capture_initialize(Frame_capture* capture, const char* directory, u32 interval) {
+	*capture = (Frame_capture) {};
+	if (mkdir(directory, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Failed to create capture directory '%s'\n", directory);
+		return Error;
+	}
+	snprintf(capture->directory, CAPTURE_PATH_SIZE, "%s", directory);
+	capture->interval = interval > 0 ? interval : 1;
+	glGenBuffers(CAPTURE_FRAMES, capture->pbos);
+
+	pthread_mutex_init(&capture->mutex, NULL);
+	pthread_cond_init(&capture->job_ready, NULL);
+	pthread_cond_init(&capture->job_done, NULL);
+	if (pthread_create(&capture->thread, NULL, encoder_main, capture) != 0) {
+		fprintf(stderr, "Failed to start the capture encoder\n");
+		pthread_cond_destroy(&capture->job_done);
+		pthread_cond_destroy(&capture->job_ready);
+		pthread_mutex_destroy(&capture->mutex);
+		glDeleteBuffers(CAPTURE_FRAMES, capture->pbos);
+		*capture = (Frame_capture) {};
+		return Error;
+	}
+	capture->active = 1;
+	fprintf(stdout, "Capturing every %u. frame to '%s'\n", capture->interval, capture->directory);
+	return NoError;
+}
+
+void capture_frame(Frame_capture* capture, i32 width, i32 height) {
+	if (!capture->active) {
+		return;
+	}
+	PROFILE_FUNCTION();
+	for (u32 i = 0; i < CAPTURE_FRAMES; ++i) {
+		collect_readback(capture, (capture->slot + i) % CAPTURE_FRAMES, 0);
+	}
+	if (capture->frame++ % capture->interval != 0 || width <= 0 || height <= 0) {
+		return;
+	}
+	u32 slot = capture->slot;
+	// Only waits when every buffer is still in flight, which takes more frames in flight than the driver usually allows
+	collect_readback(capture, slot, 1);
+
+	u32 size = width * height * 3;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capture->pbos[slot]);
+	if (capture->pbo_sizes[slot] < size) {
+		glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+		capture->pbo_sizes[slot] = size;
+	}
+	// Into the bound pixel buffer, so this only queues a copy instead of waiting for the frame to finish
+	gl_state_bind_framebuffer(0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, NULL);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	capture->fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	capture->widths[slot] = width;
+	capture->heights[slot] = height;
+	capture->indices[slot] = capture->next_index++;
+	capture->slot = (slot + 1) % CAPTURE_FRAMES;
+	capture->stats.requested++;
+}
+
+void capture_destroy(Frame_capture* capture) {
+	if (!capture->active) {
+		return;
+	}
+	// Oldest first, starting at the slot the next readback would have reused
+	for (u32 i = 0; i < CAPTURE_FRAMES; ++i) {
+		collect_readback(capture, (capture->slot + i) % CAPTURE_FRAMES, 1);
+	}
+	pthread_mutex_lock(&capture->mutex);
+	capture->quit = 1;
+	pthread_cond_signal(&capture->job_ready);
+	pthread_mutex_unlock(&capture->mutex);
+	pthread_join(capture->thread, NULL);
+
+	pthread_cond_destroy(&capture->job_done);
+	pthread_cond_destroy(&capture->job_ready);
+	pthread_mutex_destroy(&capture->mutex);
+	glDeleteBuffers(CAPTURE_FRAMES, capture->pbos);
+
+	Capture_stats* stats = &capture->stats;
+	fprintf(stdout, "Capture: %u frames written to '%s' of %u requested, %u failed, %u readback waits, %u encoder waits (%.2f ms)\n",
+		stats->written, capture->directory, stats->requested, stats->failed, stats->readback_waits, stats->encoder_waits, stats->wait_ms);
+	capture->active = 0;
+}
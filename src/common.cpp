@@ -1,5 +1,7 @@
 // common.cpp
 
+#include <time.h>	// clock_gettime
+
 #include "memory.hpp"
 #include "common.hpp"
 
@@ -57,3 +59,26 @@ i32 read_and_null_terminate_file(const char* path, Buffer* buffer) {
 	}
 	return result;
 }
+
+u64 time_now_ns() {
+	struct timespec now = {};
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (u64)now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+float time_since_ms(u64 start) {
+	return (time_now_ns() - start) / 1000000.0f;
+}
+
+void write_json_string(FILE* fp, const char* text) {
+	fputc('"', fp);
+	for (const char* c = text ? text : ""; *c; ++c) {
+		if (*c == '"' || *c == '\\') {
+			fputc('\\', fp);
+		}
+		if ((u8)*c >= 0x20) {
+			fputc(*c, fp);
+		}
+	}
+	fputc('"', fp);
+}
@@ -1,22 +1,31 @@
 // engine.cpp
 
-#include <sys/time.h>	// gettimeofday
-
 #include "window.hpp"
 #include "camera.hpp"
 #include "entity.hpp"
 #include "renderer.hpp"
+#include "gl_state.hpp"
+#include "render_stats.hpp"
+#include "frustum.hpp"
+#include "occlusion.hpp"
 #include "engine.hpp"
 #include "scene.hpp"
+#include "profiler.hpp"
+#include "startup_trace.hpp"
 
 #define MAX_DT 1.0f
-#define TITLE_SIZE 128
+#define TITLE_SIZE 256
+#define FLARE_SUN_DISTANCE 1000.0f	// Well inside the far plane, so the occlusion probe is not clipped
 
 Engine engine = {};
 u8 free_mouse = 0;
 
 static void engine_initialize(Engine* engine, u8 refresh_camera = 1);
 static i32 engine_run(Engine* engine);
+static void engine_cull_entities(Engine* engine);
+static void engine_batch_static_entities(Engine* engine);
+static void engine_update_camera(Engine* engine);
+static void engine_print_entity_costs(Engine* engine);
 
 void engine_initialize(Engine* engine, u8 refresh_camera) {
 	engine->is_running = 1;
@@ -32,22 +41,159 @@ void engine_initialize(Engine* engine, u8 refresh_camera) {
     if (refresh_camera) camera_initialize(V3(0, 0, -10));
 }
 
+// Fills entity_visible against the frustum the queued draws will be rendered with
+void engine_cull_entities(Engine* engine) {
+	Aabb bounds[MAX_ENTITY];
+	Bounding_sphere spheres[MAX_ENTITY];
+	u8 visible[MAX_ENTITY];
+	u32 indices[MAX_ENTITY];
+	u32 count = 0;
+
+	for (u32 entity_index = 0; entity_index < engine->entity_count; ++entity_index) {
+		Entity* entity = &engine->entities[entity_index];
+		engine->entity_visible[entity_index] = 1;	// Entities without a mesh are never culled
+		if (entity->mesh_id >= 0) {
+			bounds[count] = entity->world_bounds;
+			spheres[count] = entity->world_sphere;
+			if (entity->material.shader_index == GROUND_SHADER) {
+				entity_bend_bounds(entity, camera.pos, &bounds[count], &spheres[count]);
+			}
+			indices[count] = entity_index;
+			count++;
+		}
+	}
+
+	mat4 view_projection = multiply_mat4(projection, view);
+	Frustum frustum = frustum_from_matrix(view_projection);
+	engine->visible_count = frustum_cull(&frustum, bounds, spheres, count, visible);
+	engine->culled_count = count - engine->visible_count;
+
+	// Occluders in view are rasterized on the cpu, the remaining visible entities are tested against them
+	occlusion_begin(view, projection);
+	for (u32 i = 0; i < count; ++i) {
+		Entity* entity = &engine->entities[indices[i]];
+		if (visible[i] && entity->occluder) {
+			float bend = entity->material.shader_index == GROUND_SHADER ? 1.0f / GROUND_BEND_DISTANCE : 0.0f;
+			occlusion_add_occluder(entity->mesh_id, entity->transform, bend);
+		}
+	}
+	occlusion_rasterize();
+	engine->occluded_count = 0;
+	for (u32 i = 0; i < count; ++i) {
+		if (visible[i] && !engine->entities[indices[i]].occluder && !occlusion_test_aabb(bounds[i])) {
+			visible[i] = 0;
+			engine->occluded_count++;
+		}
+	}
+	engine->visible_count -= engine->occluded_count;
+
+	for (u32 i = 0; i < count; ++i) {
+		engine->entity_visible[indices[i]] = visible[i];
+	}
+}
+
+// Entities that never move are merged into world space batches, one per material. They are still culled one by one
+void engine_batch_static_entities(Engine* engine) {
+	renderer_clear_static_batches();
+	for (u32 entity_index = 0; entity_index < engine->entity_count; ++entity_index) {
+		Entity* entity = &engine->entities[entity_index];
+		entity->batched = 0;
+		if (entity->mesh_id < 0 || !entity_is_static(entity)) {
+			continue;
+		}
+		entity_update(entity, engine);
+		if (renderer_add_static_mesh(entity->transform, entity->mesh_id, entity->material, &engine->scene, &entity->batch, &entity->batch_member) == NoError) {
+			entity->batched = 1;
+		}
+	}
+	if (renderer_build_static_batches() != NoError) {
+		// Whatever did not make it into a batch is drawn on its own
+		for (u32 entity_index = 0; entity_index < engine->entity_count; ++entity_index) {
+			engine->entities[entity_index].batched = 0;
+		}
+		renderer_clear_static_batches();
+	}
+}
+
+void engine_update_camera(Engine* engine) {
+	PROFILE_FUNCTION();
+	if (engine->scroll_y != 0) {
+		camera.zoom_target -= 0.1f * engine->scroll_y;
+		camera.zoom_target = clamp(camera.zoom_target, 1.0f, 255.0f);
+	}
+
+	if (!free_mouse) {
+		window_get_cursor(&engine->mouse_x, &engine->mouse_y);
+		window_get_scroll(&engine->scroll_x, &engine->scroll_y);
+	}
+	camera_update(engine);
+}
+
+// Gpu time of the draws each entity queued, most expensive first. A few frames behind what is on screen
+void engine_print_entity_costs(Engine* engine) {
+	Entity_cost costs[MAX_COST_ENTITIES];
+	u32 frames = 0;
+	u32 count = renderer_get_entity_costs(costs, MAX_COST_ENTITIES, &frames);
+	fprintf(stdout, "Entity costs, average per frame drawn over %u frames (shading only, the depth pre-pass is not attributed):\n", frames);
+	fprintf(stdout, "  %-24s %-20s %-20s %9s %9s %9s %7s\n", "entity", "mesh", "material", "triangles", "gpu us", "pixels", "frames");
+	for (u32 i = 0; i < count; ++i) {
+		Entity_cost* cost = &costs[i];
+		char id[32];
+		Entity_names names = {};
+		if (cost->entity < (i32)engine->entity_count) {
+			names = scene_get_entity_names(&engine->entities[cost->entity]);
+		}
+		if (names.id) {
+			snprintf(id, sizeof(id), "%d %s", cost->entity, names.id);
+		}
+		else {
+			snprintf(id, sizeof(id), "%d", cost->entity);
+		}
+		fprintf(stdout, "  %-24s %-20s %-20s %9u %9.1f %9u %7u\n", id, names.mesh ? names.mesh : "-", names.material ? names.material : "-",
+			cost->triangles, cost->gpu_us, cost->pixels, cost->frames);
+	}
+}
+
 i32 engine_run(Engine* engine) {
-    if (!initialize_scene(engine, "01.scene")) {
+    if (!initialize_scene(engine, (char*)engine->options.scene_path)) {
         return Error;
     }
-
-	struct timeval now = {};
-	struct timeval prev = {};
+	i32 event = startup_trace_begin("static batches", NULL);
+	engine_batch_static_entities(engine);
+	startup_trace_end(event, 0);
+	// Only the first load is reported, the trace stops with it
+	if (engine->options.startup_report_path) {
+		startup_trace_report(engine->options.startup_report_path);
+	}
+	u32 frame_index = 0;
+	i32 status = NoError;
+	// What loading uploaded is not part of any frame
+	render_stats_reset();
+	// Started once the scene is loaded, loading needs the context on this thread
+	if (engine->options.render_thread) {
+		renderer_start_thread();
+	}
 
 	char title_string[TITLE_SIZE] = {0};
-	while (engine->is_running && window_poll_events() >= 0) {
-		prev = now;
-		gettimeofday(&now, NULL);
-		engine->delta_time = ((((now.tv_sec - prev.tv_sec) * 1000000.0f) + now.tv_usec) - (prev.tv_usec)) / 1000000.0f;
+	Frame_stats frame_stats = {};
+	Gl_state_counters state_counters = {};	// Of the previous frame
+	while (engine->is_running) {
+		PROFILE_SCOPE("frame");
+		// The limiter waits before input is polled, so what is sampled is as fresh as possible when the frame is drawn
+		engine->delta_time = frame_pacer_begin_frame(&engine->pacer);
+		{
+			PROFILE_SCOPE("poll events");
+			if (window_poll_events() < 0) {
+				break;
+			}
+		}
+		u64 frame_start = time_now_ns();
 		if (engine->delta_time >= MAX_DT) {
 			engine->delta_time = 0.1f;
 		}
+		if (engine->options.headless) {
+			engine->delta_time = HEADLESS_TIME_STEP;
+		}
 		if (engine->animation_playing) {
 			engine->total_time += engine->delta_time * engine->time_scale;
 		}
@@ -78,10 +224,12 @@ i32 engine_run(Engine* engine) {
 			fprintf(stdout, "Reset time scale: %g\n", engine->time_scale);
 		}
 		if (key_pressed[GLFW_KEY_R]) {
-            return 2;
+            status = 2;
+            break;
 		}
 		if (key_pressed[GLFW_KEY_F]) {
-            return 3;
+            status = 3;
+            break;
 		}
 		if (key_pressed[GLFW_KEY_M]) {
 			window_toggle_cursor_visibility();
@@ -90,41 +238,96 @@ i32 engine_run(Engine* engine) {
         if (key_pressed[GLFW_KEY_P]) {
 			renderer_toggle_post_processing();
         }
+		if (key_pressed[GLFW_KEY_B]) {
+			renderer_cycle_bloom_quality();
+		}
+		if (key_pressed[GLFW_KEY_O]) {
+			renderer_toggle_dynamic_resolution();
+		}
+		if (key_pressed[GLFW_KEY_Z]) {
+			renderer_toggle_depth_prepass();
+		}
+		if (key_pressed[GLFW_KEY_G]) {
+			renderer_print_gpu_timings();
+		}
+		if (key_pressed[GLFW_KEY_H]) {
+			renderer_toggle_hud();
+		}
 		if (key_pressed[GLFW_KEY_I]) {
 			camera.interactive_mode = !camera.interactive_mode;
 		}
+		if (key_pressed[GLFW_KEY_E]) {
+			// Pressed again, what was measured in between is printed
+			if (renderer_entity_costs_enabled()) {
+				engine_print_entity_costs(engine);
+			}
+			renderer_toggle_entity_costs();
+		}
 
-		renderer_bind_fbo(FBO_COLOR);
-
+		renderer_begin_frame();
 		render_skybox(CUBE_MAP_SPACE, 1.0f);
+		render_point_lights(engine->scene.lights, engine->scene.num_lights);
 
-		for (u32 entity_index = 0; entity_index < engine->entity_count; ++entity_index) {
-			Entity* entity = &engine->entities[entity_index];
-            if (entity->update != NULL)
-                entity->update(entity, engine);
-			entity_update(entity, engine);
-			entity_render(entity, &engine->scene);
+		{
+			PROFILE_SCOPE("update entities");
+			for (u32 entity_index = 0; entity_index < engine->entity_count; ++entity_index) {
+				Entity* entity = &engine->entities[entity_index];
+				if (entity->update != NULL)
+					entity->update(entity, engine);
+				entity_update(entity, engine);
+			}
 		}
+		if (engine->options.low_latency) {
+			// Polled again after the entity updates, and the camera is set up from it before culling rather than a frame late.
+			// Closing the window now still lets this frame finish
+			if (window_poll_cursor() < 0) {
+				engine->is_running = 0;
+			}
+			engine_update_camera(engine);
+		}
+		{
+			PROFILE_SCOPE("cull entities");
+			engine_cull_entities(engine);
+		}
+		{
+			PROFILE_SCOPE("queue entities");
+			for (u32 entity_index = 0; entity_index < engine->entity_count; ++entity_index) {
+				if (engine->entity_visible[entity_index]) {
+					entity_render(&engine->entities[entity_index], entity_index, &engine->scene);
+				}
+			}
+			if (engine->options.sun_flares && engine->scene.num_sun_lights > 0) {
+				// The sun sits far out along its light direction, the occlusion query decides whether the flares show
+				v3 sun_direction = normalize(engine->scene.sun_lights[0].angle);
+				render_flares(camera.pos - sun_direction * FLARE_SUN_DISTANCE);
+			}
+		}
+		renderer_render_frame(engine->delta_time);
 
-		if (engine->scroll_y != 0) {
-			camera.zoom_target -= 0.1f * engine->scroll_y;
-			camera.zoom_target = clamp(camera.zoom_target, 1.0f, 255.0f);
+		if (!engine->options.low_latency) {
+			engine_update_camera(engine);
 		}
 
-		if (!free_mouse) {
-			window_get_cursor(&engine->mouse_x, &engine->mouse_y);
-			window_get_scroll(&engine->scroll_x, &engine->scroll_y);
+		// Setting the title is a round trip to the window system, so it only happens a few times a second
+		if (frame_pacer_stats_due(&engine->pacer, &frame_stats)) {
+			snprintf(title_string, TITLE_SIZE, "Solar System | %.0f fps | %.2f ms (%.2f - %.2f) | %u gl state changes, %u skipped | %u visible, %u culled, %u occluded | %i%% resolution",
+				frame_stats.fps, frame_stats.average_ms, frame_stats.min_ms, frame_stats.max_ms, gl_state_total_issued(&state_counters), gl_state_total_skipped(&state_counters), engine->visible_count, engine->culled_count, engine->occluded_count, (i32)(renderer_get_resolution_scale() * 100.0f + 0.5f));
+			window_set_title(title_string);
 		}
-		camera_update(engine);
 
-		snprintf(title_string, TITLE_SIZE, "Solar System | %i fps | %g delta", (i32)(1.0f / engine->delta_time), engine->delta_time);
-		window_set_title(title_string);
+		state_counters = renderer_get_state_counters();
 
-		renderer_post_process();
-		window_swap_buffers();
-		renderer_clear_fbos();
+		if (engine->options.headless) {
+			float frame_ms = time_since_ms(frame_start);
+			benchmark_add_frame(&engine->benchmark, frame_ms, renderer_get_scene_stats(), renderer_get_render_stats());
+		}
+		frame_index++;
+		if (engine->options.frames > 0 && frame_index >= engine->options.frames) {
+			engine->is_running = 0;
+		}
 	}
-	return NoError;
+	renderer_stop_thread();
+	return status;
 }
 
 Entity* engine_push_empty_entity(Engine* engine) {
@@ -137,13 +340,44 @@ Entity* engine_push_empty_entity(Engine* engine) {
 	return NULL;
 }
 
-i32 engine_start() {
+i32 engine_start(Engine_options* options) {
 	i32 result = NoError;
 	engine_initialize(&engine);
+	engine.options = *options;
+	if (options->startup_report_path) {
+		startup_trace_start();
+	}
 
-	if ((result = window_open("Solar System", 800, 600, 0 /* fullscreen */, 0 /* vsync */, renderer_framebuffer_callback)) == NoError) {
+	i32 event = startup_trace_begin("window", NULL);
+	if (options->headless) {
+		result = window_open_headless(options->width, options->height, renderer_framebuffer_callback);
+	}
+	else {
+		result = window_open("Solar System", options->width, options->height, 0 /* fullscreen */, options->vsync, renderer_framebuffer_callback);
+	}
+	startup_trace_end(event, 0);
+	if (options->trace_path) {
+		profiler_set_thread_name("main");
+		profiler_start();
+	}
+	if (result == NoError) {
+        occlusion_initialize(0 /* one thread per core */);
         renderer_initialize();
         engine_initialize(&engine);
+        // Headless runs step time by a fixed amount and are never limited
+        frame_pacer_initialize(&engine.pacer, options->headless ? 0 : options->target_fps);
+        if (options->gpu_csv_path) {
+            renderer_set_gpu_timer_csv(options->gpu_csv_path);
+        }
+        if (options->capture_path) {
+            renderer_start_capture(options->capture_path, options->capture_interval);
+        }
+        renderer_set_entity_costs(options->entity_costs);
+        if (options->headless) {
+            // Fixed resolution, the numbers are only comparable when every frame renders the same pixels
+            renderer_set_dynamic_resolution(0);
+            benchmark_initialize(&engine.benchmark, options->frames);
+        }
         i32 status = engine_run(&engine);
         while (status == 2 || status == 3) {
             list_free(engine.scene.lights, engine.scene.num_lights);
@@ -153,9 +387,23 @@ i32 engine_start() {
         }
         list_free(engine.scene.lights, engine.scene.num_lights);
         list_free(engine.scene.sun_lights, engine.scene.num_sun_lights);
-		window_close();
+        if (options->headless) {
+            benchmark_write_report(&engine.benchmark, options->report_path, options->scene_path, options->width, options->height);
+            benchmark_destroy(&engine.benchmark);
+            renderer_print_gpu_timings();
+        }
+        if (renderer_entity_costs_enabled()) {
+            engine_print_entity_costs(&engine);
+        }
+        if (options->trace_path) {
+            profiler_write_trace(options->trace_path);
+        }
+		// Readbacks still in flight are collected and gl objects released while the context exists
 		renderer_destroy();
+		occlusion_destroy();
+		window_close();
 	}
+	profiler_destroy();
 	assert("memory leak" && (memory_total_allocated() == 0));
 	return result;
 }
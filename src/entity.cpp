@@ -5,6 +5,7 @@
 #include "camera.hpp"
 #include "entity.hpp"
 #include "matrix_math.hpp"
+#include "frustum.hpp"
 
 Entity* entity_initialize(
     Entity* entity,
@@ -57,11 +58,56 @@ mat4 entity_get_transform(Entity* entity) {
     return model;
 }
 
+u8 entity_is_static(Entity* entity) {
+	if (entity->update != NULL) {
+		return 0;
+	}
+	if (entity->parent && !entity_is_static(entity->parent)) {
+		return 0;
+	}
+	if (entity->following && !entity_is_static(entity->following)) {
+		return 0;
+	}
+	return 1;
+}
+
 void entity_update(Entity* entity, Engine* engine) {
+	entity->transform = entity_get_transform(entity);
+
+	Aabb bounds = {};
+	Bounding_sphere sphere = {};
+	if (entity->mesh_id >= 0 && renderer_get_mesh_bounds(entity->mesh_id, &bounds, &sphere) == NoError) {
+		entity->world_bounds = aabb_transform(bounds, entity->transform);
+		entity->world_sphere = bounding_sphere_transform(sphere, entity->transform);
+	}
 }
 
-void entity_render(Entity* entity, Scene* scene) {
-	if (entity->mesh_id >= 0) {
-		render_mesh(entity_get_transform(entity), entity->mesh_id, entity->material, scene);
+void entity_bend_bounds(Entity* entity, v3 camera_position, Aabb* bounds, Bounding_sphere* sphere) {
+	// A vertex is lowered by its squared view distance in x and z, which is never more than its distance to the camera
+	float farthest_square = 0;
+	for (u32 i = 0; i < 8; ++i) {
+		v3 corner = V3(
+			(i & 1) ? bounds->max.x : bounds->min.x,
+			(i & 2) ? bounds->max.y : bounds->min.y,
+			(i & 4) ? bounds->max.z : bounds->min.z
+		);
+		farthest_square = fmaxf(farthest_square, length_square_v3(corner - camera_position));
+	}
+	// In object space, so along the y axis as the transform rotated and scaled it
+	v3 up = V3(entity->transform.elements[1][0], entity->transform.elements[1][1], entity->transform.elements[1][2]);
+	v3 drop = up * (-farthest_square / GROUND_BEND_DISTANCE);
+	bounds->min = bounds->min + V3(fminf(drop.x, 0), fminf(drop.y, 0), fminf(drop.z, 0));
+	bounds->max = bounds->max + V3(fmaxf(drop.x, 0), fmaxf(drop.y, 0), fmaxf(drop.z, 0));
+	sphere->center = sphere->center + drop * 0.5f;
+	sphere->radius += length_v3(drop) * 0.5f;
+}
+
+void entity_render(Entity* entity, i32 index, Scene* scene) {
+	// Drawn on its own while entity costs are measured, a batch would be timed as a whole
+	if (entity->batched && !renderer_entity_costs_enabled()) {
+		render_static_mesh(entity->batch, entity->batch_member);
+	}
+	else if (entity->mesh_id >= 0) {
+		render_mesh(entity->transform, entity->mesh_id, entity->material, scene, index);
 	}
 }
@@ -0,0 +1,163 @@
+// entity_cost.cpp
+// gpu time and samples passed of every entity's draws, queried per draw and read back frames later
+
+#include <GL/glew.h>
+#include <algorithm>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "entity_cost.hpp"
+
+static u8 frame_available(Entity_cost_frame* frame);
+static void collect_frame(Entity_costs* costs, Entity_cost_frame* frame);
+static bool cost_greater(const Entity_cost& a, const Entity_cost& b);
+
+u8 frame_available(Entity_cost_frame* frame) {
+	for (u32 i = 0; i < frame->draw_count; ++i) {
+		for (u32 q = 0; q < 2; ++q) {
+			i32 available = 0;
+			glGetQueryObjectiv(frame->queries[i][q], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+void collect_frame(Entity_costs* costs, Entity_cost_frame* frame) {
+	for (u32 i = 0; i < frame->draw_count; ++i) {
+		GLuint64 time_ns = 0, samples = 0;
+		glGetQueryObjectui64v(frame->queries[i][0], GL_QUERY_RESULT, &time_ns);
+		glGetQueryObjectui64v(frame->queries[i][1], GL_QUERY_RESULT, &samples);
+		i32 entity = frame->entities[i];
+		if (entity < 0 || entity >= MAX_COST_ENTITIES) {
+			continue;
+		}
+		Entity_cost_total* total = &costs->totals[entity];
+		if (total->frames == 0 || total->last_frame != frame->frame) {
+			total->frames++;
+			total->last_frame = frame->frame;
+		}
+		total->mesh_id = frame->mesh_ids[i];
+		total->triangles += frame->triangles[i];
+		total->time_ns += time_ns;
+		total->samples += samples;
+	}
+	costs->measured++;
+	frame->pending = 0;
+}
+
+// Pixels break ties, timers without the resolution to tell cheap draws apart report them all as zero
+bool cost_greater(const Entity_cost& a, const Entity_cost& b) {
+	if (a.gpu_us != b.gpu_us) {
+		return a.gpu_us > b.gpu_us;
+	}
+	return a.pixels > b.pixels;
+}
+
+void entity_costs_set_enabled(Entity_costs* costs, u8 enabled) {
+	if (costs->enabled == enabled) {
+		return;
+	}
+	if (enabled) {
+		*costs = (Entity_costs) {};
+		for (u32 i = 0; i < ENTITY_COST_FRAMES; ++i) {
+			glGenQueries(MAX_COST_DRAWS * 2, &costs->frames[i].queries[0][0]);
+		}
+		costs->enabled = 1;
+		fprintf(stdout, "Entity costs: measuring every draw on its own\n");
+		return;
+	}
+	// Whatever is still in flight is given up, the queries go away with it
+	for (u32 i = 0; i < ENTITY_COST_FRAMES; ++i) {
+		glDeleteQueries(MAX_COST_DRAWS * 2, &costs->frames[i].queries[0][0]);
+		costs->frames[i].pending = 0;
+	}
+	costs->enabled = 0;
+	costs->active = 0;
+}
+
+void entity_costs_begin_frame(Entity_costs* costs) {
+	costs->active = 0;
+	if (!costs->enabled) {
+		return;
+	}
+	// Oldest first, an entity drawn in several of them is counted once per frame
+	for (u32 i = 1; i <= ENTITY_COST_FRAMES; ++i) {
+		Entity_cost_frame* frame = &costs->frames[(costs->frame + i) % ENTITY_COST_FRAMES];
+		if (frame->pending && frame_available(frame)) {
+			collect_frame(costs, frame);
+		}
+	}
+
+	Entity_cost_frame* frame = &costs->frames[costs->frame % ENTITY_COST_FRAMES];
+	if (frame->pending) {
+		costs->dropped++;
+		return;
+	}
+	frame->draw_count = 0;
+	frame->frame = costs->frame;
+	costs->active = 1;
+}
+
+void entity_costs_end_frame(Entity_costs* costs) {
+	if (costs->active) {
+		Entity_cost_frame* frame = &costs->frames[costs->frame % ENTITY_COST_FRAMES];
+		frame->pending = frame->draw_count > 0;
+	}
+	costs->active = 0;
+	costs->frame++;
+}
+
+i32 entity_costs_begin(Entity_costs* costs, i32 entity, i32 mesh_id, u32 triangles) {
+	Entity_cost_frame* frame = &costs->frames[costs->frame % ENTITY_COST_FRAMES];
+	if (!costs->active || frame->draw_count >= MAX_COST_DRAWS) {
+		return -1;
+	}
+	i32 draw = frame->draw_count++;
+	frame->entities[draw] = entity;
+	frame->mesh_ids[draw] = mesh_id;
+	frame->triangles[draw] = triangles;
+	// Different targets, both can be active at once. Nothing else may count samples while this is running
+	glBeginQuery(GL_TIME_ELAPSED, frame->queries[draw][0]);
+	glBeginQuery(GL_SAMPLES_PASSED, frame->queries[draw][1]);
+	return draw;
+}
+
+void entity_costs_end(Entity_costs* costs, i32 draw) {
+	if (draw < 0 || !costs->active) {
+		return;
+	}
+	glEndQuery(GL_SAMPLES_PASSED);
+	glEndQuery(GL_TIME_ELAPSED);
+}
+
+u32 entity_costs_get(Entity_costs* costs, Entity_cost* ranked, u32 max_count) {
+	u32 count = 0;
+	for (i32 i = 0; i < MAX_COST_ENTITIES && count < max_count; ++i) {
+		Entity_cost_total* total = &costs->totals[i];
+		if (total->frames == 0) {
+			continue;
+		}
+		ranked[count++] = (Entity_cost) {
+			.entity = i,
+			.mesh_id = total->mesh_id,
+			.triangles = (u32)(total->triangles / total->frames),
+			.gpu_us = total->time_ns / 1000.0f / total->frames,
+			.pixels = (u32)(total->samples / total->frames),
+			.frames = total->frames,
+		};
+	}
+	std::sort(ranked, ranked + count, cost_greater);
+	return count;
+}
+
+void entity_costs_destroy(Entity_costs* costs) {
+	entity_costs_set_enabled(costs, 0);
+}
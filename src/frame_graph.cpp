@@ -0,0 +1,442 @@
+// frame_graph.cpp
+// declarative render passes, transient render targets are pooled and shared between passes that don't overlap
+
+#include <GL/glew.h>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "frame_graph.hpp"
+#include "profiler.hpp"
+
+static u32 format_bytes(u32 format);
+static u64 desc_bytes(Graph_texture_desc* desc);
+static u8 desc_equal(Graph_texture_desc* a, Graph_texture_desc* b);
+static i32 target_create(Frame_graph* graph, Graph_texture_desc desc);
+static void target_destroy(Graph_target* target);
+static void release_unused_targets(Frame_graph* graph);
+static void assign_targets(Frame_graph* graph);
+static void resource_use(Frame_graph* graph, i32 pass, i32 resource);
+static void begin_pass(Frame_graph* graph, Graph_pass* pass);
+static void end_pass(Frame_graph* graph, i32 pass_index);
+
+u32 format_bytes(u32 format) {
+	switch (format) {
+		case 0:
+			return 0;
+		case GL_RGBA32F:
+			return 16;
+		case GL_RGBA16:
+		case GL_RGBA16F:
+			return 8;
+		case GL_RGB16F:
+			return 6;
+		default:	// RGBA8, R11F_G11F_B10F and the 24/32 bit depth formats
+			return 4;
+	}
+}
+
+u64 desc_bytes(Graph_texture_desc* desc) {
+	return (u64)desc->width * desc->height * (format_bytes(desc->color_format) + format_bytes(desc->depth_format));
+}
+
+u8 desc_equal(Graph_texture_desc* a, Graph_texture_desc* b) {
+	return a->width == b->width && a->height == b->height &&
+		a->color_format == b->color_format && a->depth_format == b->depth_format &&
+		a->filter == b->filter;
+}
+
+void frame_graph_initialize(Frame_graph* graph) {
+	*graph = (Frame_graph) {};
+	graph->use_invalidate = GLEW_VERSION_4_3 || GLEW_ARB_invalidate_subdata;
+	if (!graph->use_invalidate) {
+		fprintf(stdout, "Frame graph: attachment invalidation unavailable, dead targets are left to the driver\n");
+	}
+}
+
+void frame_graph_begin(Frame_graph* graph) {
+	graph->pass_count = 0;
+	graph->resource_count = 0;
+	graph->frame++;
+}
+
+i32 frame_graph_import_backbuffer(Frame_graph* graph, const char* name, i32 width, i32 height) {
+	i32 resource = frame_graph_create_texture(graph, name, (Graph_texture_desc) {
+		.width = width,
+		.height = height,
+	});
+	if (resource >= 0) {
+		graph->resources[resource].imported = 1;
+	}
+	return resource;
+}
+
+i32 frame_graph_create_texture(Frame_graph* graph, const char* name, Graph_texture_desc desc) {
+	if (graph->resource_count >= MAX_GRAPH_RESOURCES) {
+		fprintf(stderr, "Frame graph: too many resources (max: %d)\n", MAX_GRAPH_RESOURCES);
+		return -1;
+	}
+	desc.width = desc.width > 0 ? desc.width : 1;
+	desc.height = desc.height > 0 ? desc.height : 1;
+	i32 resource = graph->resource_count++;
+	graph->resources[resource] = (Graph_resource) {
+		.name = name,
+		.desc = desc,
+		.imported = 0,
+		.first_pass = -1,
+		.last_pass = -1,
+		.target = -1,
+	};
+	return resource;
+}
+
+i32 frame_graph_add_pass(Frame_graph* graph, const char* name, Graph_execute execute, void* data) {
+	if (graph->pass_count >= MAX_GRAPH_PASSES) {
+		fprintf(stderr, "Frame graph: too many passes (max: %d)\n", MAX_GRAPH_PASSES);
+		return -1;
+	}
+	i32 pass = graph->pass_count++;
+	graph->passes[pass] = (Graph_pass) {
+		.name = name,
+		.execute = execute,
+		.data = data,
+		.read_count = 0,
+		.write = -1,
+		.color_load = GRAPH_LOAD_CLEAR,
+		.depth_load = GRAPH_LOAD_CLEAR,
+	};
+	return pass;
+}
+
+// Stretches the lifetime of the resource to cover the pass
+void resource_use(Frame_graph* graph, i32 pass, i32 resource) {
+	Graph_resource* res = &graph->resources[resource];
+	if (res->first_pass < 0 || pass < res->first_pass) {
+		res->first_pass = pass;
+	}
+	if (pass > res->last_pass) {
+		res->last_pass = pass;
+	}
+}
+
+void frame_graph_read(Frame_graph* graph, i32 pass, i32 resource) {
+	if (pass < 0 || resource < 0) {
+		return;
+	}
+	Graph_pass* p = &graph->passes[pass];
+	if (p->read_count >= MAX_GRAPH_PASS_READS) {
+		fprintf(stderr, "Frame graph: pass %s reads too many resources (max: %d)\n", p->name, MAX_GRAPH_PASS_READS);
+		return;
+	}
+	p->reads[p->read_count++] = resource;
+	resource_use(graph, pass, resource);
+}
+
+void frame_graph_write(Frame_graph* graph, i32 pass, i32 resource, u8 color_load, u8 depth_load) {
+	if (pass < 0 || resource < 0) {
+		return;
+	}
+	Graph_pass* p = &graph->passes[pass];
+	p->write = resource;
+	p->color_load = color_load;
+	p->depth_load = depth_load;
+	resource_use(graph, pass, resource);
+}
+
+i32 target_create(Frame_graph* graph, Graph_texture_desc desc) {
+	i32 index = -1;
+	if (graph->target_count < MAX_GRAPH_TARGETS) {
+		index = graph->target_count++;
+	}
+	else {
+		// Full, the least recently used target the current frame hasn't claimed makes room
+		for (u32 i = 0; i < graph->target_count; ++i) {
+			Graph_target* candidate = &graph->targets[i];
+			if (candidate->last_frame != graph->frame && (index < 0 || candidate->last_frame < graph->targets[index].last_frame)) {
+				index = i;
+			}
+		}
+		if (index < 0) {
+			fprintf(stderr, "Frame graph: target pool full (max: %d)\n", MAX_GRAPH_TARGETS);
+			return -1;
+		}
+		target_destroy(&graph->targets[index]);
+	}
+	Graph_target* target = &graph->targets[index];
+	*target = (Graph_target) {
+		.desc = desc,
+		.busy_until = -1,
+	};
+
+	glGenFramebuffers(1, &target->fbo);
+	gl_state_bind_framebuffer(target->fbo);
+
+	glGenTextures(1, &target->color);
+	gl_state_bind_texture(0, GL_TEXTURE_2D, target->color);
+	glTexImage2D(GL_TEXTURE_2D, 0, desc.color_format, desc.width, desc.height, 0, GL_RGBA, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, desc.filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, desc.filter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, target->color, 0);
+
+	if (desc.depth_format) {
+		glGenTextures(1, &target->depth);
+		gl_state_bind_texture(0, GL_TEXTURE_2D, target->depth);
+		glTexImage2D(GL_TEXTURE_2D, 0, desc.depth_format, desc.width, desc.height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, target->depth, 0);
+	}
+
+	GLenum draw_buffers[] = {
+		GL_COLOR_ATTACHMENT0,
+	};
+	glDrawBuffers(1, draw_buffers);
+
+	GLenum err = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
+	if (err != GL_FRAMEBUFFER_COMPLETE) {
+		printf("FBO error: %i\n", err);
+	}
+	return index;
+}
+
+void target_destroy(Graph_target* target) {
+	// Names are recycled by opengl, so the shadowed bindings must not outlive them
+	gl_state_forget_texture(target->color);
+	gl_state_forget_framebuffer(target->fbo);
+	glDeleteTextures(1, &target->color);
+	if (target->depth) {
+		gl_state_forget_texture(target->depth);
+		glDeleteTextures(1, &target->depth);
+	}
+	glDeleteFramebuffers(1, &target->fbo);
+	*target = (Graph_target) {};
+}
+
+// Targets of an old window size, resolution scale or bloom quality linger for a while, then are dropped. The while is
+// measured in time so it is the same at any frame rate, but what the previous frame used stays however long that took
+void release_unused_targets(Frame_graph* graph) {
+	for (u32 i = 0; i < graph->target_count;) {
+		Graph_target* target = &graph->targets[i];
+		if (graph->frame - target->last_frame > 1 && (graph->frame_time - target->last_used) / 1000000.0f > GRAPH_TARGET_KEEP_MS) {
+			target_destroy(target);
+			graph->targets[i] = graph->targets[--graph->target_count];
+			continue;
+		}
+		++i;
+	}
+}
+
+// Walks the passes in order, a resource takes over any matching target whose previous user was last touched by an earlier pass
+void assign_targets(Frame_graph* graph) {
+	for (u32 i = 0; i < graph->target_count; ++i) {
+		graph->targets[i].busy_until = -1;
+	}
+
+	Graph_stats* stats = &graph->stats;
+	for (u32 pass = 0; pass < graph->pass_count; ++pass) {
+		for (u32 r = 0; r < graph->resource_count; ++r) {
+			Graph_resource* res = &graph->resources[r];
+			if (res->imported || res->first_pass != (i32)pass) {
+				continue;
+			}
+			i32 target = -1;
+			for (u32 t = 0; t < graph->target_count; ++t) {
+				Graph_target* candidate = &graph->targets[t];
+				if (candidate->busy_until < (i32)pass && desc_equal(&candidate->desc, &res->desc)) {
+					target = t;
+					break;
+				}
+			}
+			if (target < 0) {
+				target = target_create(graph, res->desc);
+				if (target < 0) {
+					continue;
+				}
+			}
+			Graph_target* t = &graph->targets[target];
+			if (t->last_frame != graph->frame) {
+				stats->target_count++;
+				stats->frame_bytes += desc_bytes(&t->desc);
+			}
+			t->busy_until = res->last_pass;
+			t->last_frame = graph->frame;
+			t->last_used = graph->frame_time;
+			res->target = target;
+			stats->resource_count++;
+			stats->resource_bytes += desc_bytes(&res->desc);
+		}
+	}
+}
+
+void begin_pass(Frame_graph* graph, Graph_pass* pass) {
+	Graph_stats* stats = &graph->stats;
+	Graph_resource* res = &graph->resources[pass->write];
+	u8 has_depth = 0;
+	GLenum color_attachment = GL_COLOR;
+	GLenum depth_attachment = GL_DEPTH;
+	if (res->imported) {
+		gl_state_bind_framebuffer(0);
+	}
+	else {
+		if (res->target < 0) {
+			return;
+		}
+		Graph_target* target = &graph->targets[res->target];
+		gl_state_bind_framebuffer(target->fbo);
+		has_depth = target->depth != 0;
+		color_attachment = GL_COLOR_ATTACHMENT0;
+		depth_attachment = GL_DEPTH_ATTACHMENT;
+	}
+	gl_state_set_viewport(0, 0, res->desc.width, res->desc.height);
+
+	GLbitfield clear = 0;
+	GLenum discard[2];
+	u32 discard_count = 0;
+	if (pass->color_load == GRAPH_LOAD_CLEAR) {
+		clear |= GL_COLOR_BUFFER_BIT;
+	}
+	else if (pass->color_load == GRAPH_LOAD_DONT_CARE) {
+		discard[discard_count++] = color_attachment;
+	}
+	if (has_depth) {
+		if (pass->depth_load == GRAPH_LOAD_CLEAR) {
+			clear |= GL_DEPTH_BUFFER_BIT;
+		}
+		else if (pass->depth_load == GRAPH_LOAD_DONT_CARE) {
+			discard[discard_count++] = depth_attachment;
+		}
+	}
+
+	// Telling the driver the contents are garbage is cheaper than clearing them, and is skipped altogether without support
+	stats->clears_skipped += discard_count;
+	if (discard_count > 0 && graph->use_invalidate) {
+		glInvalidateFramebuffer(GL_FRAMEBUFFER, discard_count, discard);
+		stats->invalidations += discard_count;
+	}
+	if (clear) {
+		if (clear & GL_DEPTH_BUFFER_BIT) {
+			gl_state_set_depth_write(1);	// Depth clears are masked like any other depth write
+		}
+		glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+		glClear(clear);
+		stats->clears += ((clear & GL_COLOR_BUFFER_BIT) != 0) + ((clear & GL_DEPTH_BUFFER_BIT) != 0);
+	}
+}
+
+// Drops whatever no later pass needs, while the written target is still bound
+void end_pass(Frame_graph* graph, i32 pass_index) {
+	if (!graph->use_invalidate) {
+		return;
+	}
+	Graph_stats* stats = &graph->stats;
+	Graph_pass* pass = &graph->passes[pass_index];
+	Graph_resource* written = &graph->resources[pass->write];
+
+	if (!written->imported && written->target >= 0) {
+		Graph_target* target = &graph->targets[written->target];
+		u8 depth_needed = 0;
+		for (u32 later = pass_index + 1; later < graph->pass_count; ++later) {
+			if (graph->passes[later].write == pass->write && graph->passes[later].depth_load == GRAPH_LOAD_KEEP) {
+				depth_needed = 1;
+			}
+		}
+		// Depth is never sampled by later passes, only drawn against
+		if (target->depth && !depth_needed) {
+			GLenum attachment = GL_DEPTH_ATTACHMENT;
+			glInvalidateFramebuffer(GL_FRAMEBUFFER, 1, &attachment);
+			stats->invalidations++;
+		}
+	}
+
+	for (u32 i = 0; i < pass->read_count; ++i) {
+		Graph_resource* res = &graph->resources[pass->reads[i]];
+		if (res->imported || res->target < 0 || res->last_pass != pass_index) {
+			continue;
+		}
+		glInvalidateTexImage(graph->targets[res->target].color, 0);
+		stats->invalidations++;
+	}
+}
+
+void frame_graph_execute(Frame_graph* graph) {
+	PROFILE_FUNCTION();
+	graph->stats = (Graph_stats) {
+		.pass_count = graph->pass_count,
+	};
+	graph->frame_time = time_now_ns();
+	release_unused_targets(graph);
+	assign_targets(graph);
+
+	for (u32 i = 0; i < graph->pass_count; ++i) {
+		Graph_pass* pass = &graph->passes[i];
+		if (pass->write < 0) {
+			continue;
+		}
+		PROFILE_SCOPE(pass->name);
+		i32 section = graph->timers ? gpu_timers_begin(graph->timers, pass->name) : -1;
+		begin_pass(graph, pass);
+		if (pass->execute) {
+			pass->execute(graph, i, pass->data);
+		}
+		end_pass(graph, i);
+		if (graph->timers) {
+			gpu_timers_end(graph->timers, section);
+		}
+	}
+
+	for (u32 i = 0; i < graph->target_count; ++i) {
+		graph->stats.pool_bytes += desc_bytes(&graph->targets[i].desc);
+	}
+
+	// Only printed when the layout changes, e.g. on resize or when the bloom quality is switched
+	if (graph->stats.frame_bytes != graph->printed_frame_bytes || graph->stats.target_count != graph->printed_target_count) {
+		frame_graph_print_stats(graph);
+		graph->printed_frame_bytes = graph->stats.frame_bytes;
+		graph->printed_target_count = graph->stats.target_count;
+	}
+}
+
+u32 frame_graph_texture(Frame_graph* graph, i32 resource) {
+	if (resource < 0 || (u32)resource >= graph->resource_count) {
+		return 0;
+	}
+	Graph_resource* res = &graph->resources[resource];
+	if (res->imported || res->target < 0) {
+		return 0;
+	}
+	return graph->targets[res->target].color;
+}
+
+Graph_stats frame_graph_get_stats(Frame_graph* graph) {
+	return graph->stats;
+}
+
+void frame_graph_print_stats(Frame_graph* graph) {
+	Graph_stats* stats = &graph->stats;
+	fprintf(stdout, "Render targets: %u passes, %u resources in %u targets, %.2f MiB per frame (%.2f MiB unaliased, %.2f MiB pooled), %u clears, %u skipped\n",
+		stats->pass_count,
+		stats->resource_count,
+		stats->target_count,
+		stats->frame_bytes / (1024.0 * 1024.0),
+		stats->resource_bytes / (1024.0 * 1024.0),
+		stats->pool_bytes / (1024.0 * 1024.0),
+		stats->clears,
+		stats->clears_skipped
+	);
+}
+
+void frame_graph_destroy(Frame_graph* graph) {
+	for (u32 i = 0; i < graph->target_count; ++i) {
+		target_destroy(&graph->targets[i]);
+	}
+	graph->target_count = 0;
+}
@@ -0,0 +1,89 @@
+// frame_pacer.cpp
+// monotonic frame clock, an optional frame rate limiter and frame time statistics over a fixed interval
+
+#include <time.h>	// nanosleep
+
+#include "common.hpp"
+#include "frame_pacer.hpp"
+
+static void wait_until(u64 deadline);
+
+// Hybrid wait, sleep through most of it and spin the rest, so the frame starts close to the deadline
+void wait_until(u64 deadline) {
+	u64 spin_ns = (u64)(PACER_SPIN_MS * 1000000.0f);
+	u64 now = time_now_ns();
+	if (deadline > now + spin_ns) {
+		u64 sleep_ns = deadline - now - spin_ns;
+		struct timespec duration = {
+			.tv_sec = (time_t)(sleep_ns / 1000000000ull),
+			.tv_nsec = (long)(sleep_ns % 1000000000ull),
+		};
+		nanosleep(&duration, NULL);
+	}
+	while (time_now_ns() < deadline);
+}
+
+void frame_pacer_initialize(Frame_pacer* pacer, float target_fps) {
+	*pacer = (Frame_pacer) {};
+	pacer->target_fps = target_fps > 0 ? target_fps : 0;
+	pacer->interval_start = time_now_ns();
+}
+
+void frame_pacer_set_target(Frame_pacer* pacer, float target_fps) {
+	pacer->target_fps = target_fps > 0 ? target_fps : 0;
+	pacer->deadline = 0;
+}
+
+float frame_pacer_begin_frame(Frame_pacer* pacer) {
+	float wait_ms = 0;
+	if (pacer->target_fps > 0 && pacer->deadline > 0) {
+		u64 wait_start = time_now_ns();
+		wait_until(pacer->deadline);
+		wait_ms = (time_now_ns() - wait_start) / 1000000.0f;
+	}
+	u64 now = time_now_ns();
+	pacer->delta_ms = pacer->frame_start ? (now - pacer->frame_start) / 1000000.0f : 0;
+
+	if (pacer->target_fps > 0) {
+		u64 period = (u64)(1000000000.0 / pacer->target_fps);
+		// Deadlines advance by whole periods, so the rate stays exact, unless a slow frame left them behind
+		pacer->deadline = pacer->deadline > 0 ? pacer->deadline + period : now + period;
+		if (pacer->deadline < now) {
+			pacer->deadline = now + period;
+		}
+	}
+
+	if (pacer->frame_start) {
+		if (pacer->frames == 0) {
+			pacer->min_ms = pacer->delta_ms;
+			pacer->max_ms = pacer->delta_ms;
+		}
+		pacer->frames++;
+		pacer->total_ms += pacer->delta_ms;
+		pacer->min_ms = fminf(pacer->min_ms, pacer->delta_ms);
+		pacer->max_ms = fmaxf(pacer->max_ms, pacer->delta_ms);
+		pacer->wait_ms += wait_ms;
+	}
+	pacer->frame_start = now;
+	return pacer->delta_ms / 1000.0f;
+}
+
+u8 frame_pacer_stats_due(Frame_pacer* pacer, Frame_stats* stats) {
+	if (pacer->frames == 0 || (pacer->frame_start - pacer->interval_start) / 1000000.0f < PACER_STATS_INTERVAL_MS) {
+		return 0;
+	}
+	pacer->stats = (Frame_stats) {
+		.frames = pacer->frames,
+		.fps = pacer->total_ms > 0 ? pacer->frames * 1000.0f / pacer->total_ms : 0,
+		.average_ms = pacer->total_ms / pacer->frames,
+		.min_ms = pacer->min_ms,
+		.max_ms = pacer->max_ms,
+		.wait_ms = pacer->wait_ms / pacer->frames,
+	};
+	*stats = pacer->stats;
+	pacer->interval_start = pacer->frame_start;
+	pacer->frames = 0;
+	pacer->total_ms = 0;
+	pacer->wait_ms = 0;
+	return 1;
+}
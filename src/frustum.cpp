@@ -0,0 +1,126 @@
+// frustum.cpp
+// view frustum extraction and culling of bounding volumes
+
+#include "common.hpp"
+#include "frustum.hpp"
+
+// Lanes per culling batch
+#define CULL_BATCH 4
+
+Frustum frustum_from_matrix(mat4 m) {
+	Frustum frustum = {};
+	// Rows of the (column major) matrix
+	v4 rows[4];
+	for (u32 i = 0; i < 4; ++i) {
+		rows[i] = V4(m.elements[0][i], m.elements[1][i], m.elements[2][i], m.elements[3][i]);
+	}
+	for (u32 i = 0; i < MAX_FRUSTUM_PLANE; ++i) {
+		v4 row = rows[i / 2];
+		float sign = (i % 2 == 0) ? 1.0f : -1.0f;	// Left, bottom and near add, the opposite planes subtract
+		v4 plane = V4(
+			rows[3].x + sign * row.x,
+			rows[3].y + sign * row.y,
+			rows[3].z + sign * row.z,
+			rows[3].w + sign * row.w
+		);
+		float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		if (length > 0) {
+			plane = V4(plane.x / length, plane.y / length, plane.z / length, plane.w / length);
+		}
+		frustum.planes[i] = plane;
+	}
+	return frustum;
+}
+
+Aabb aabb_transform(Aabb bounds, mat4 transform) {
+	v3 center = (bounds.min + bounds.max) * 0.5f;
+	v3 extent = (bounds.max - bounds.min) * 0.5f;
+	v3 world_center = transform_point(transform, center);
+	v3 world_extent = V3(
+		fabsf(transform.elements[0][0]) * extent.x + fabsf(transform.elements[1][0]) * extent.y + fabsf(transform.elements[2][0]) * extent.z,
+		fabsf(transform.elements[0][1]) * extent.x + fabsf(transform.elements[1][1]) * extent.y + fabsf(transform.elements[2][1]) * extent.z,
+		fabsf(transform.elements[0][2]) * extent.x + fabsf(transform.elements[1][2]) * extent.y + fabsf(transform.elements[2][2]) * extent.z
+	);
+	return (Aabb) {world_center - world_extent, world_center + world_extent};
+}
+
+Bounding_sphere bounding_sphere_transform(Bounding_sphere sphere, mat4 transform) {
+	float scale_square = 0;
+	for (u32 col = 0; col < 3; ++col) {
+		v3 axis = V3(transform.elements[col][0], transform.elements[col][1], transform.elements[col][2]);
+		float length_square = length_square_v3(axis);
+		if (length_square > scale_square) {
+			scale_square = length_square;
+		}
+	}
+	return (Bounding_sphere) {transform_point(transform, sphere.center), sphere.radius * sqrtf(scale_square)};
+}
+
+u32 frustum_cull(Frustum* frustum, Aabb* bounds, Bounding_sphere* spheres, u32 count, u8* visible) {
+	u32 visible_count = 0;
+
+	for (u32 first = 0; first < count; first += CULL_BATCH) {
+		u32 batch = count - first < CULL_BATCH ? count - first : CULL_BATCH;
+
+		// Gather the batch as a structure of arrays, unused lanes are zero and ignored
+		float box_center[3][CULL_BATCH] = {};
+		float box_extent[3][CULL_BATCH] = {};
+		float sphere_center[3][CULL_BATCH] = {};
+		float sphere_radius[CULL_BATCH] = {};
+		for (u32 i = 0; i < batch; ++i) {
+			Aabb box = bounds[first + i];
+			v3 center = (box.min + box.max) * 0.5f;
+			v3 extent = (box.max - box.min) * 0.5f;
+			Bounding_sphere sphere = spheres[first + i];
+			box_center[0][i] = center.x; box_center[1][i] = center.y; box_center[2][i] = center.z;
+			box_extent[0][i] = extent.x; box_extent[1][i] = extent.y; box_extent[2][i] = extent.z;
+			sphere_center[0][i] = sphere.center.x; sphere_center[1][i] = sphere.center.y; sphere_center[2][i] = sphere.center.z;
+			sphere_radius[i] = sphere.radius;
+		}
+
+#if USE_SSE
+		__m128 cx = _mm_loadu_ps(box_center[0]), cy = _mm_loadu_ps(box_center[1]), cz = _mm_loadu_ps(box_center[2]);
+		__m128 ex = _mm_loadu_ps(box_extent[0]), ey = _mm_loadu_ps(box_extent[1]), ez = _mm_loadu_ps(box_extent[2]);
+		__m128 sx = _mm_loadu_ps(sphere_center[0]), sy = _mm_loadu_ps(sphere_center[1]), sz = _mm_loadu_ps(sphere_center[2]);
+		__m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(sphere_radius));
+		__m128 outside = _mm_setzero_ps();
+
+		for (u32 p = 0; p < MAX_FRUSTUM_PLANE; ++p) {
+			v4 plane = frustum->planes[p];
+			__m128 nx = _mm_set1_ps(plane.x), ny = _mm_set1_ps(plane.y), nz = _mm_set1_ps(plane.z), d = _mm_set1_ps(plane.w);
+
+			__m128 sphere_distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, sx), _mm_mul_ps(ny, sy)), _mm_add_ps(_mm_mul_ps(nz, sz), d));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(sphere_distance, negative_radius));
+
+			// Furthest extent of the box along the plane normal
+			__m128 projected_extent = _mm_add_ps(_mm_add_ps(
+				_mm_mul_ps(_mm_set1_ps(fabsf(plane.x)), ex),
+				_mm_mul_ps(_mm_set1_ps(fabsf(plane.y)), ey)),
+				_mm_mul_ps(_mm_set1_ps(fabsf(plane.z)), ez)
+			);
+			__m128 box_distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, cx), _mm_mul_ps(ny, cy)), _mm_add_ps(_mm_mul_ps(nz, cz), d));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(box_distance, projected_extent), _mm_setzero_ps()));
+		}
+		i32 outside_mask = _mm_movemask_ps(outside);
+#else
+		i32 outside_mask = 0;
+		for (u32 i = 0; i < batch; ++i) {
+			for (u32 p = 0; p < MAX_FRUSTUM_PLANE; ++p) {
+				v4 plane = frustum->planes[p];
+				float sphere_distance = plane.x * sphere_center[0][i] + plane.y * sphere_center[1][i] + plane.z * sphere_center[2][i] + plane.w;
+				float box_distance = plane.x * box_center[0][i] + plane.y * box_center[1][i] + plane.z * box_center[2][i] + plane.w;
+				float projected_extent = fabsf(plane.x) * box_extent[0][i] + fabsf(plane.y) * box_extent[1][i] + fabsf(plane.z) * box_extent[2][i];
+				if (sphere_distance < -sphere_radius[i] || box_distance + projected_extent < 0) {
+					outside_mask |= 1 << i;
+					break;
+				}
+			}
+		}
+#endif
+		for (u32 i = 0; i < batch; ++i) {
+			visible[first + i] = !(outside_mask & (1 << i));
+			visible_count += visible[first + i];
+		}
+	}
+	return visible_count;
+}
@@ -0,0 +1,237 @@
+// gl_state.cpp
+// shadows opengl bindings and capabilities so redundant state changes are never issued
+
+#include <GL/glew.h>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "gl_state.hpp"
+
+#define STATE_UNKNOWN 0xffffffff
+
+// Texture targets we shadow per unit
+enum Texture_slot {
+	TEXTURE_SLOT_2D = 0,
+	TEXTURE_SLOT_CUBE_MAP,
+	TEXTURE_SLOT_BUFFER,
+
+	MAX_TEXTURE_SLOT,
+};
+
+typedef struct Gl_state {
+	u32 program;
+	u32 vertex_array;
+	u32 framebuffer;
+	u32 active_texture;
+	u32 textures[MAX_TEXTURE_UNITS][MAX_TEXTURE_SLOT];
+	u32 blend;
+	u32 blend_source;
+	u32 blend_destination;
+	u32 depth_test;
+	u32 depth_func;
+	u32 depth_write;
+	u32 cull;
+	u32 cull_face;
+	u32 viewport[4];
+	Gl_state_counters counters;
+} Gl_state;
+
+const char* gl_state_kind_names[MAX_GL_STATE] = {
+	"program",
+	"vertex array",
+	"framebuffer",
+	"texture",
+	"blend",
+	"depth",
+	"cull",
+	"viewport",
+};
+
+static Gl_state gl_state = {};
+static u8 gl_state_valid = 0;
+
+// Returns 1 if the call has to be issued, updating the shadow and counters either way
+static u8 gl_state_update(u32* shadow, u32 value, Gl_state_kind kind);
+static void gl_state_set_capability(u32* shadow, u32 capability, u8 enabled, Gl_state_kind kind);
+
+u8 gl_state_update(u32* shadow, u32 value, Gl_state_kind kind) {
+	if (!gl_state_valid) {
+		gl_state_invalidate();
+	}
+	if (*shadow == value) {
+		gl_state.counters.skipped[kind]++;
+		return 0;
+	}
+	*shadow = value;
+	gl_state.counters.issued[kind]++;
+	return 1;
+}
+
+void gl_state_set_capability(u32* shadow, u32 capability, u8 enabled, Gl_state_kind kind) {
+	if (gl_state_update(shadow, enabled != 0, kind)) {
+		if (enabled) {
+			glEnable(capability);
+		}
+		else {
+			glDisable(capability);
+		}
+	}
+}
+
+void gl_state_invalidate() {
+	Gl_state_counters counters = gl_state.counters;
+	memset(&gl_state, 0xff, sizeof(Gl_state));
+	gl_state.counters = counters;
+	gl_state_valid = 1;
+}
+
+void gl_state_use_program(u32 program) {
+	if (gl_state_update(&gl_state.program, program, GL_STATE_PROGRAM)) {
+		glUseProgram(program);
+	}
+}
+
+void gl_state_bind_vertex_array(u32 vao) {
+	if (gl_state_update(&gl_state.vertex_array, vao, GL_STATE_VERTEX_ARRAY)) {
+		glBindVertexArray(vao);
+	}
+}
+
+void gl_state_bind_framebuffer(u32 fbo) {
+	if (gl_state_update(&gl_state.framebuffer, fbo, GL_STATE_FRAMEBUFFER)) {
+		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	}
+}
+
+u32 gl_state_bound_framebuffer() {
+	return gl_state.framebuffer;
+}
+
+void gl_state_bind_texture(u32 unit, u32 target, u32 texture) {
+	assert(unit < MAX_TEXTURE_UNITS);
+	u32 slot = TEXTURE_SLOT_2D;
+	if (target == GL_TEXTURE_CUBE_MAP) {
+		slot = TEXTURE_SLOT_CUBE_MAP;
+	}
+	else if (target == GL_TEXTURE_BUFFER) {
+		slot = TEXTURE_SLOT_BUFFER;
+	}
+	if (!gl_state_update(&gl_state.textures[unit][slot], texture, GL_STATE_TEXTURE)) {
+		return;
+	}
+	// Only switch units when something actually has to be bound
+	if (gl_state.active_texture != unit) {
+		gl_state.active_texture = unit;
+		glActiveTexture(GL_TEXTURE0 + unit);
+	}
+	glBindTexture(target, texture);
+}
+
+void gl_state_forget_texture(u32 texture) {
+	for (u32 unit = 0; unit < MAX_TEXTURE_UNITS; ++unit) {
+		for (u32 slot = 0; slot < MAX_TEXTURE_SLOT; ++slot) {
+			if (gl_state.textures[unit][slot] == texture) {
+				gl_state.textures[unit][slot] = STATE_UNKNOWN;
+			}
+		}
+	}
+}
+
+void gl_state_forget_framebuffer(u32 fbo) {
+	if (gl_state.framebuffer == fbo) {
+		gl_state.framebuffer = STATE_UNKNOWN;
+	}
+}
+
+void gl_state_forget_vertex_array(u32 vao) {
+	if (gl_state.vertex_array == vao) {
+		gl_state.vertex_array = STATE_UNKNOWN;
+	}
+}
+
+void gl_state_set_blend(u8 enabled) {
+	gl_state_set_capability(&gl_state.blend, GL_BLEND, enabled, GL_STATE_BLEND);
+}
+
+void gl_state_set_blend_func(u32 source, u32 destination) {
+	if (!gl_state_valid) {
+		gl_state_invalidate();
+	}
+	if (gl_state.blend_source == source && gl_state.blend_destination == destination) {
+		gl_state.counters.skipped[GL_STATE_BLEND]++;
+		return;
+	}
+	gl_state.blend_source = source;
+	gl_state.blend_destination = destination;
+	gl_state.counters.issued[GL_STATE_BLEND]++;
+	glBlendFunc(source, destination);
+}
+
+void gl_state_set_depth_test(u8 enabled) {
+	gl_state_set_capability(&gl_state.depth_test, GL_DEPTH_TEST, enabled, GL_STATE_DEPTH);
+}
+
+void gl_state_set_depth_func(u32 func) {
+	if (gl_state_update(&gl_state.depth_func, func, GL_STATE_DEPTH)) {
+		glDepthFunc(func);
+	}
+}
+
+void gl_state_set_depth_write(u8 enabled) {
+	if (gl_state_update(&gl_state.depth_write, enabled != 0, GL_STATE_DEPTH)) {
+		glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+	}
+}
+
+void gl_state_set_cull(u8 enabled) {
+	gl_state_set_capability(&gl_state.cull, GL_CULL_FACE, enabled, GL_STATE_CULL);
+}
+
+void gl_state_set_cull_face(u32 face) {
+	if (gl_state_update(&gl_state.cull_face, face, GL_STATE_CULL)) {
+		glCullFace(face);
+	}
+}
+
+void gl_state_set_viewport(i32 x, i32 y, i32 width, i32 height) {
+	u32 viewport[4] = {(u32)x, (u32)y, (u32)width, (u32)height};
+	if (!gl_state_valid) {
+		gl_state_invalidate();
+	}
+	if (!memcmp(gl_state.viewport, viewport, sizeof(viewport))) {
+		gl_state.counters.skipped[GL_STATE_VIEWPORT]++;
+		return;
+	}
+	memcpy(gl_state.viewport, viewport, sizeof(viewport));
+	gl_state.counters.issued[GL_STATE_VIEWPORT]++;
+	glViewport(x, y, width, height);
+}
+
+Gl_state_counters gl_state_get_counters() {
+	return gl_state.counters;
+}
+
+u32 gl_state_total_issued(Gl_state_counters* counters) {
+	u32 total = 0;
+	for (u32 i = 0; i < MAX_GL_STATE; ++i) {
+		total += counters->issued[i];
+	}
+	return total;
+}
+
+u32 gl_state_total_skipped(Gl_state_counters* counters) {
+	u32 total = 0;
+	for (u32 i = 0; i < MAX_GL_STATE; ++i) {
+		total += counters->skipped[i];
+	}
+	return total;
+}
+
+void gl_state_reset_counters() {
+	memset(&gl_state.counters, 0, sizeof(Gl_state_counters));
+}
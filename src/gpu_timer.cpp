@@ -0,0 +1,204 @@
+// gpu_timer.cpp
+// timestamp queries around render passes, read back frames later so the cpu never waits on the gpu
+
+#include <GL/glew.h>
+#include <algorithm>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "gpu_timer.hpp"
+#include "window.hpp"
+
+static Gpu_timer* find_timer(Gpu_timers* timers, const char* name);
+static u8 frame_available(Gpu_timer_frame* frame);
+static void collect_frame(Gpu_timers* timers, Gpu_timer_frame* frame);
+
+Gpu_timer* find_timer(Gpu_timers* timers, const char* name) {
+	for (u32 i = 0; i < timers->timer_count; ++i) {
+		if (strcmp(timers->timers[i].name, name) == 0) {
+			return &timers->timers[i];
+		}
+	}
+	if (timers->timer_count >= MAX_GPU_TIMERS) {
+		return NULL;
+	}
+	Gpu_timer* timer = &timers->timers[timers->timer_count++];
+	*timer = (Gpu_timer) {
+		.name = name,
+	};
+	return timer;
+}
+
+// Results may come in out of order, so every query of the frame is checked
+u8 frame_available(Gpu_timer_frame* frame) {
+	for (u32 i = 0; i < frame->section_count; ++i) {
+		for (u32 q = 0; q < 2; ++q) {
+			i32 available = 0;
+			glGetQueryObjectiv(frame->queries[i][q], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) {
+				return 0;
+			}
+		}
+	}
+	return 1;
+}
+
+void collect_frame(Gpu_timers* timers, Gpu_timer_frame* frame) {
+	for (u32 i = 0; i < timers->timer_count; ++i) {
+		timers->timers[i].frame_ms = 0;
+		timers->timers[i].seen = 0;
+	}
+	for (u32 i = 0; i < frame->section_count; ++i) {
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(frame->queries[i][0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(frame->queries[i][1], GL_QUERY_RESULT, &end);
+		Gpu_timer* timer = find_timer(timers, frame->names[i]);
+		if (!timer) {
+			continue;
+		}
+		timer->frame_ms += end > start ? (end - start) / 1e6f : 0.0f;
+		timer->seen = 1;
+	}
+	for (u32 i = 0; i < timers->timer_count; ++i) {
+		Gpu_timer* timer = &timers->timers[i];
+		if (!timer->seen) {
+			continue;
+		}
+		timer->history[timer->count++ % GPU_TIMER_HISTORY] = timer->frame_ms;
+		if (timers->csv) {
+			fprintf(timers->csv, "%u,%s,%.4f\n", frame->frame, timer->name, timer->frame_ms);
+		}
+	}
+	frame->pending = 0;
+}
+
+void gpu_timers_initialize(Gpu_timers* timers) {
+	*timers = (Gpu_timers) {};
+	timers->supported = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (!timers->supported) {
+		fprintf(stdout, "Gpu timers: timestamp queries unavailable\n");
+		return;
+	}
+	for (u32 i = 0; i < GPU_TIMER_FRAMES; ++i) {
+		glGenQueries(MAX_GPU_SECTIONS * 2, &timers->frames[i].queries[0][0]);
+	}
+}
+
+void gpu_timers_begin_frame(Gpu_timers* timers) {
+	timers->active = 0;
+	if (!timers->supported) {
+		return;
+	}
+	// Oldest first, so the history stays in frame order
+	for (u32 i = 1; i <= GPU_TIMER_FRAMES; ++i) {
+		Gpu_timer_frame* frame = &timers->frames[(timers->frame + i) % GPU_TIMER_FRAMES];
+		if (frame->pending && frame_available(frame)) {
+			collect_frame(timers, frame);
+		}
+	}
+
+	Gpu_timer_frame* frame = &timers->frames[timers->frame % GPU_TIMER_FRAMES];
+	if (frame->pending) {
+		timers->dropped++;
+		return;
+	}
+	frame->section_count = 0;
+	frame->frame = timers->frame;
+	timers->active = 1;
+}
+
+void gpu_timers_end_frame(Gpu_timers* timers) {
+	if (timers->active) {
+		Gpu_timer_frame* frame = &timers->frames[timers->frame % GPU_TIMER_FRAMES];
+		frame->pending = frame->section_count > 0;
+	}
+	timers->active = 0;
+	timers->frame++;
+}
+
+i32 gpu_timers_begin(Gpu_timers* timers, const char* name) {
+	Gpu_timer_frame* frame = &timers->frames[timers->frame % GPU_TIMER_FRAMES];
+	if (!timers->active || frame->section_count >= MAX_GPU_SECTIONS) {
+		return -1;
+	}
+	i32 section = frame->section_count++;
+	frame->names[section] = name;
+	glQueryCounter(frame->queries[section][0], GL_TIMESTAMP);
+	return section;
+}
+
+void gpu_timers_end(Gpu_timers* timers, i32 section) {
+	if (section < 0 || !timers->active) {
+		return;
+	}
+	Gpu_timer_frame* frame = &timers->frames[timers->frame % GPU_TIMER_FRAMES];
+	glQueryCounter(frame->queries[section][1], GL_TIMESTAMP);
+}
+
+u32 gpu_timers_get_stats(Gpu_timers* timers, Gpu_timer_stats* stats, u32 max_count) {
+	for (u32 i = 0; i < timers->timer_count && i < max_count; ++i) {
+		Gpu_timer* timer = &timers->timers[i];
+		u32 samples = timer->count < GPU_TIMER_HISTORY ? timer->count : GPU_TIMER_HISTORY;
+		Gpu_timer_stats* entry = &stats[i];
+		*entry = (Gpu_timer_stats) {
+			.name = timer->name,
+			.last_ms = samples > 0 ? timer->history[(timer->count - 1) % GPU_TIMER_HISTORY] : 0.0f,
+			.samples = samples,
+		};
+		float sum = 0;
+		for (u32 s = 0; s < samples; ++s) {
+			float ms = timer->history[s];
+			sum += ms;
+			entry->min_ms = s == 0 ? ms : std::min(entry->min_ms, ms);
+			entry->max_ms = std::max(entry->max_ms, ms);
+		}
+		entry->average_ms = samples > 0 ? sum / samples : 0.0f;
+	}
+	return timers->timer_count;
+}
+
+void gpu_timers_print_stats(Gpu_timers* timers) {
+	if (!timers->supported) {
+		return;
+	}
+	Gpu_timer_stats stats[MAX_GPU_TIMERS];
+	u32 count = gpu_timers_get_stats(timers, stats, MAX_GPU_TIMERS);
+	fprintf(stdout, "Gpu time over the last %u frames (%u frames dropped):\n", GPU_TIMER_HISTORY, timers->dropped);
+	fprintf(stdout, "  %-28s %9s %9s %9s %9s\n", "section", "last ms", "avg ms", "min ms", "max ms");
+	for (u32 i = 0; i < count; ++i) {
+		fprintf(stdout, "  %-28s %9.3f %9.3f %9.3f %9.3f\n", stats[i].name, stats[i].last_ms, stats[i].average_ms, stats[i].min_ms, stats[i].max_ms);
+	}
+}
+
+i32 gpu_timers_set_csv(Gpu_timers* timers, const char* path) {
+	if (timers->csv) {
+		fclose(timers->csv);
+		timers->csv = NULL;
+	}
+	if (!path) {
+		return NoError;
+	}
+	timers->csv = fopen(path, "w");
+	if (!timers->csv) {
+		fprintf(stderr, "Failed to open gpu timer csv '%s'\n", path);
+		return Error;
+	}
+	fprintf(timers->csv, "frame,section,ms\n");
+	return NoError;
+}
+
+void gpu_timers_destroy(Gpu_timers* timers) {
+	// Queries belong to the context, deleting them after it is gone leaks them in the driver
+	assert("gpu timers destroyed without a context" && window_has_context());
+	gpu_timers_set_csv(timers, NULL);
+	if (timers->supported) {
+		for (u32 i = 0; i < GPU_TIMER_FRAMES; ++i) {
+			glDeleteQueries(MAX_GPU_SECTIONS * 2, &timers->frames[i].queries[0][0]);
+		}
+	}
+}
@@ -0,0 +1,161 @@
+// hud.cpp
+// text overlay composed from a small built in bitmap font and drawn over the finished frame
+
+#include <GL/glew.h>
+#include <ctype.h>
+#include <algorithm>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "render_stats.hpp"
+#include "hud.hpp"
+
+typedef struct Glyph {
+	char c;
+	u8 rows[HUD_GLYPH_HEIGHT];	// Top row first, bit 4 is the leftmost pixel
+} Glyph;
+
+// Upper case only, lower case letters are drawn with these
+static const Glyph glyphs[] = {
+	{'0', {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}},
+	{'1', {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}},
+	{'2', {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}},
+	{'3', {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}},
+	{'4', {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}},
+	{'5', {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}},
+	{'6', {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}},
+	{'7', {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}},
+	{'8', {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}},
+	{'9', {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}},
+	{'A', {0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}},
+	{'B', {0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e}},
+	{'C', {0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e}},
+	{'D', {0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c}},
+	{'E', {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f}},
+	{'F', {0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10}},
+	{'G', {0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f}},
+	{'H', {0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11}},
+	{'I', {0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e}},
+	{'J', {0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c}},
+	{'K', {0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11}},
+	{'L', {0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f}},
+	{'M', {0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11}},
+	{'N', {0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11}},
+	{'O', {0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}},
+	{'P', {0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10}},
+	{'Q', {0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d}},
+	{'R', {0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11}},
+	{'S', {0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e}},
+	{'T', {0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}},
+	{'U', {0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e}},
+	{'V', {0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04}},
+	{'W', {0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a}},
+	{'X', {0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11}},
+	{'Y', {0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04}},
+	{'Z', {0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f}},
+	{':', {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}},
+	{'.', {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}},
+	{',', {0x00, 0x00, 0x00, 0x00, 0x0c, 0x04, 0x08}},
+	{'%', {0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03}},
+	{'/', {0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00}},
+	{'-', {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}},
+	{'+', {0x00, 0x04, 0x04, 0x1f, 0x04, 0x04, 0x00}},
+	{'(', {0x02, 0x04, 0x08, 0x08, 0x08, 0x04, 0x02}},
+	{')', {0x08, 0x04, 0x02, 0x02, 0x02, 0x04, 0x08}},
+	{'|', {0x04, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04}},
+};
+
+static void compose(Hud* hud);
+
+// Text over a translucent backdrop, the backdrop only covers the lines in use
+void compose(Hud* hud) {
+	memset(hud->pixels, 0, sizeof(hud->pixels));
+	i32 row = 0;
+	i32 column = 0;
+	i32 widest = 0;
+	for (const char* c = hud->text; *c && row < HUD_ROWS; ++c) {
+		if (*c == '\n') {
+			row++;
+			column = 0;
+			continue;
+		}
+		if (column >= HUD_COLUMNS) {
+			continue;
+		}
+		i32 glyph = toupper((u8)*c) - HUD_FIRST_GLYPH;
+		if (glyph > 0 && glyph < HUD_GLYPH_COUNT) {
+			i32 x0 = 1 + column * HUD_CELL_WIDTH;
+			i32 y0 = 1 + row * HUD_CELL_HEIGHT + 1;
+			for (i32 y = 0; y < HUD_GLYPH_HEIGHT; ++y) {
+				u8* coverage = &hud->atlas[y][glyph * HUD_GLYPH_WIDTH];
+				u8 (*line)[4] = hud->pixels[HUD_HEIGHT - 1 - (y0 + y)];
+				for (i32 x = 0; x < HUD_GLYPH_WIDTH; ++x) {
+					if (coverage[x]) {
+						line[x0 + x][0] = line[x0 + x][1] = line[x0 + x][2] = line[x0 + x][3] = 255;
+					}
+				}
+			}
+		}
+		column++;
+		widest = std::max(widest, column);
+	}
+	i32 lines = std::min(row + 1, HUD_ROWS);
+	i32 backdrop_width = widest * HUD_CELL_WIDTH + 2;
+	for (i32 y = 0; y < lines * HUD_CELL_HEIGHT + 2; ++y) {
+		u8 (*line)[4] = hud->pixels[HUD_HEIGHT - 1 - y];
+		for (i32 x = 0; x < backdrop_width; ++x) {
+			if (!line[x][3]) {
+				line[x][3] = 160;
+			}
+		}
+	}
+}
+
+void hud_initialize(Hud* hud) {
+	memset(hud, 0, sizeof(Hud));
+	for (u32 i = 0; i < ARR_SIZE(glyphs); ++i) {
+		i32 glyph = glyphs[i].c - HUD_FIRST_GLYPH;
+		for (i32 y = 0; y < HUD_GLYPH_HEIGHT; ++y) {
+			for (i32 x = 0; x < HUD_GLYPH_WIDTH; ++x) {
+				hud->atlas[y][glyph * HUD_GLYPH_WIDTH + x] = (glyphs[i].rows[y] >> (HUD_GLYPH_WIDTH - 1 - x)) & 1;
+			}
+		}
+	}
+	glGenTextures(1, &hud->texture);
+	gl_state_bind_texture(0, GL_TEXTURE_2D, hud->texture);
+	// Nearest, the font is scaled up by whole pixels and should stay crisp
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, HUD_WIDTH, HUD_HEIGHT, 0, GL_RGBA, GL_UNSIGNED_BYTE, hud->pixels);
+}
+
+void hud_set_text(Hud* hud, const char* text) {
+	if (!strncmp(hud->text, text, sizeof(hud->text) - 1)) {
+		return;
+	}
+	snprintf(hud->text, sizeof(hud->text), "%s", text);
+	compose(hud);
+	gl_state_bind_texture(0, GL_TEXTURE_2D, hud->texture);
+	glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, HUD_WIDTH, HUD_HEIGHT, GL_RGBA, GL_UNSIGNED_BYTE, hud->pixels);
+	render_stats_count_upload(sizeof(hud->pixels));
+}
+
+u8 hud_refresh_due(Hud* hud) {
+	return hud->frame++ % HUD_REFRESH_FRAMES == 0;
+}
+
+void hud_destroy(Hud* hud) {
+	if (hud->texture) {
+		gl_state_forget_texture(hud->texture);
+		glDeleteTextures(1, &hud->texture);
+	}
+	hud->texture = 0;
+}
@@ -5,15 +5,20 @@
 #include "common.hpp"
 #include "memory.hpp"
 #include "image.hpp"
+#include "profiler.hpp"
+#include "startup_trace.hpp"
 
 i32 load_image_from_file(const char* path, Image* image) {
+	PROFILE_FUNCTION();
 	i32 result = NoError;
 	i32 row_size = 0;
 	u8* pixels = NULL;
 	png_bytep* rows = NULL;
+	i32 event = startup_trace_begin("png decode", path);
 	FILE* fp = fopen(path, "r");
 	if (!fp) {
 		fprintf(stderr, "No such image file '%s'\n", path);
+		startup_trace_end(event, 0);
 		return Error;
 	}
 	png_structp png;
@@ -97,6 +102,7 @@ i32 load_image_from_file(const char* path, Image* image) {
 	png_destroy_read_struct(&png, &info, NULL);
 	m_free(rows, row_size);
 done:
+	startup_trace_end(event, result == NoError ? (u64)image->width * image->height * image->bytes_per_pixel : 0);	// Decoded size
 	return result;
 }
 
@@ -106,3 +112,49 @@ void unload_image(Image* image) {
 		memset(image, 0, sizeof(Image));
 	}
 }
+
+// Written a row at a time, nothing is allocated here so it is safe to call from any thread
+i32 write_image_to_file(const char* path, Image* image, u8 bottom_up) {
+	PROFILE_FUNCTION();
+	i32 color_type = PNG_COLOR_TYPE_RGB;
+	switch (image->bytes_per_pixel) {
+		case 1: color_type = PNG_COLOR_TYPE_GRAY; break;
+		case 3: color_type = PNG_COLOR_TYPE_RGB; break;
+		case 4: color_type = PNG_COLOR_TYPE_RGBA; break;
+		default: {
+			fprintf(stderr, "Can not write %u bytes per pixel to '%s'\n", image->bytes_per_pixel, path);
+			return Error;
+		}
+	}
+	FILE* fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "Failed to open image file '%s' for writing\n", path);
+		return Error;
+	}
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = png ? png_create_info_struct(png) : NULL;
+	if (!info) {
+		png_destroy_write_struct(&png, NULL);
+		fclose(fp);
+		return Error;
+	}
+	if (setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(fp);
+		return Error;
+	}
+	png_init_io(png, fp);
+	// Captures are written once and compared, speed matters more than size
+	png_set_compression_level(png, 1);
+	png_set_IHDR(png, info, image->width, image->height, 8, color_type, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	u32 pitch = image->pitch ? image->pitch : image->width * image->bytes_per_pixel;
+	for (i32 row = 0; row < image->height; ++row) {
+		i32 source = bottom_up ? image->height - 1 - row : row;
+		png_write_row(png, image->buffer + (u64)source * pitch);
+	}
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	fclose(fp);
+	return NoError;
+}
@@ -0,0 +1,241 @@
+// light_cluster.cpp
+// clustered forward lighting, point lights are binned into a view space grid so each pixel only shades the lights near it
+
+#include <GL/glew.h>
+#include <algorithm>
+#include <math.h>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "render_stats.hpp"
+#include "light_cluster.hpp"
+
+static i32 depth_slice(float depth, v2 params);
+static i32 screen_tile(float ndc, i32 tiles);
+static u8 sphere_tiles(v3 center, float radius, float depth_min, float depth_max, v2 projection_scale, i32* tiles);
+static void create_buffer_texture(u32* buffer, u32* texture, u32 size, u32 format);
+
+i32 depth_slice(float depth, v2 params) {
+	if (depth <= CLUSTER_NEAR) {
+		return 0;
+	}
+	i32 slice = (i32)(logf(depth) * params.x + params.y);
+	return clamp(slice, 0, CLUSTER_Z - 1);
+}
+
+i32 screen_tile(float ndc, i32 tiles) {
+	i32 tile = (i32)floorf((ndc * 0.5f + 0.5f) * tiles);
+	return clamp(tile, 0, tiles - 1);
+}
+
+// Tiles covered by the part of a view space sphere between two depths, zero when that part is off screen or empty.
+// The part fits in a cylinder as wide as its widest cross section, and x / depth is monotonic,
+// so the extremes of the screen rectangle lie at the nearest or farthest depth
+u8 sphere_tiles(v3 center, float radius, float depth_min, float depth_max, v2 projection_scale, i32* tiles) {
+	float center_depth = -center.z;
+	float offset = 0;
+	if (center_depth < depth_min) {
+		offset = depth_min - center_depth;
+	}
+	else if (center_depth > depth_max) {
+		offset = center_depth - depth_max;
+	}
+	if (offset >= radius) {
+		return 0;
+	}
+	float section = sqrtf(radius * radius - offset * offset);
+	depth_min = std::max(std::max(depth_min, center_depth - radius), CLUSTER_CLIP_NEAR);
+	depth_max = std::min(depth_max, center_depth + radius);
+	if (depth_max <= depth_min) {
+		return 0;
+	}
+
+	float x_min = projection_scale.x * std::min((center.x - section) / depth_min, (center.x - section) / depth_max);
+	float x_max = projection_scale.x * std::max((center.x + section) / depth_min, (center.x + section) / depth_max);
+	float y_min = projection_scale.y * std::min((center.y - section) / depth_min, (center.y - section) / depth_max);
+	float y_max = projection_scale.y * std::max((center.y + section) / depth_min, (center.y + section) / depth_max);
+	if (x_min > 1 || x_max < -1 || y_min > 1 || y_max < -1) {
+		return 0;
+	}
+	tiles[0] = screen_tile(x_min, CLUSTER_X);
+	tiles[1] = screen_tile(x_max, CLUSTER_X);
+	tiles[2] = screen_tile(y_min, CLUSTER_Y);
+	tiles[3] = screen_tile(y_max, CLUSTER_Y);
+	return 1;
+}
+
+void create_buffer_texture(u32* buffer, u32* texture, u32 size, u32 format) {
+	glGenBuffers(1, buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, *buffer);
+	glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW);
+	glGenTextures(1, texture);
+	gl_state_bind_texture(0, GL_TEXTURE_BUFFER, *texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, format, *buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+}
+
+void light_clusters_initialize(Light_clusters* clusters) {
+	*clusters = (Light_clusters) {};
+	create_buffer_texture(&clusters->light_buffer, &clusters->light_texture, sizeof(clusters->lights), GL_RGBA32F);
+	create_buffer_texture(&clusters->grid_buffer, &clusters->grid_texture, sizeof(clusters->grid), GL_RG32UI);
+	create_buffer_texture(&clusters->index_buffer, &clusters->index_texture, sizeof(clusters->indices), GL_R16UI);
+}
+
+v2 light_clusters_depth_params() {
+	float scale = CLUSTER_Z / logf(CLUSTER_FAR / CLUSTER_NEAR);
+	return V2(scale, -logf(CLUSTER_NEAR) * scale);
+}
+
+// Distance where the attenuation of the brightest channel drops below LIGHT_CUTOFF
+float light_range(Point_light* light) {
+	float intensity = std::max(light->color.x, std::max(light->color.y, light->color.z));
+	float k = intensity / LIGHT_CUTOFF;
+	if (k <= 1.0f) {
+		return 0;
+	}
+	float l = light->falloff_linear;
+	float q = light->falloff_quadratic;
+	if (q > 0) {
+		return (-l + sqrtf(l * l + 4.0f * q * (k - 1.0f))) / (2.0f * q);
+	}
+	if (l > 0) {
+		return (k - 1.0f) / l;
+	}
+	return CLUSTER_FAR;	// Never fades, so it reaches every cluster
+}
+
+// Two passes over the lights: count the references per cluster, then fill the index list at the prefix summed offsets.
+// Every depth slice gets its own screen rectangle, as wide as the light's sphere is within that slice
+void light_clusters_build(Light_clusters* clusters, Point_light* lights, i32 count, mat4 view, mat4 projection) {
+	static u32 cursors[CLUSTER_COUNT];
+	static float slice_depths[CLUSTER_Z + 1];
+	u64 start = time_now_ns();
+
+	Cluster_stats* stats = &clusters->stats;
+	*stats = (Cluster_stats) {};
+	v2 depth_params = light_clusters_depth_params();
+	v2 projection_scale = V2(projection.elements[0][0], projection.elements[1][1]);
+	count = std::min(count, MAX_POINT_LIGHTS);
+	memset(clusters->grid, 0, sizeof(clusters->grid));
+	slice_depths[0] = CLUSTER_CLIP_NEAR;
+	for (u32 z = 1; z <= CLUSTER_Z; ++z) {
+		slice_depths[z] = expf((z - depth_params.y) / depth_params.x);
+	}
+
+	u32 binned = 0;
+	for (i32 i = 0; i < count; ++i) {
+		Point_light* light = &lights[i];
+		float range = light_range(light);
+		v3 p = transform_point(view, light->position);
+		i32 tiles[4];
+		if (range <= 0 || !sphere_tiles(p, range, CLUSTER_CLIP_NEAR, CLUSTER_FAR, projection_scale, tiles)) {
+			continue;
+		}
+
+		u16* bounds = clusters->cluster_bounds[binned];
+		bounds[0] = depth_slice(-p.z - range, depth_params);
+		bounds[1] = depth_slice(-p.z + range, depth_params);
+		for (i32 z = bounds[0]; z <= bounds[1]; ++z) {
+			if (!sphere_tiles(p, range, slice_depths[z], slice_depths[z + 1], projection_scale, tiles)) {
+				continue;
+			}
+			for (i32 y = tiles[2]; y <= tiles[3]; ++y) {
+				for (i32 x = tiles[0]; x <= tiles[1]; ++x) {
+					clusters->grid[((z * CLUSTER_Y + y) * CLUSTER_X + x) * 2 + 1]++;
+				}
+			}
+		}
+
+		// The shader indexes lights in binning order, so lights culled above take no space
+		float intensity = std::max(light->color.x, std::max(light->color.y, light->color.z));
+		u8 fades = light->falloff_linear > 0 || light->falloff_quadratic > 0;
+		float* data = &clusters->lights[binned * CLUSTER_LIGHT_TEXELS * 4];
+		data[0] = p.x; data[1] = p.y; data[2] = p.z; data[3] = range;
+		data[4] = light->color.x; data[5] = light->color.y; data[6] = light->color.z; data[7] = light->ambient;
+		data[8] = light->falloff_linear; data[9] = light->falloff_quadratic;
+		data[10] = fades ? LIGHT_CUTOFF / intensity : 0;	// Subtracted in the shader, so the light reaches zero right at its range
+		data[11] = 0;
+		binned++;
+	}
+
+	u32 offset = 0;
+	for (u32 i = 0; i < CLUSTER_COUNT; ++i) {
+		u32 lights_in_cluster = clusters->grid[i * 2 + 1];
+		stats->max_cluster_lights = std::max(stats->max_cluster_lights, lights_in_cluster);
+		if (offset + lights_in_cluster > MAX_CLUSTER_INDICES) {
+			u32 kept = MAX_CLUSTER_INDICES - offset;
+			stats->dropped += lights_in_cluster - kept;
+			lights_in_cluster = kept;
+			clusters->grid[i * 2 + 1] = kept;
+		}
+		clusters->grid[i * 2] = offset;
+		cursors[i] = offset;
+		offset += lights_in_cluster;
+	}
+
+	for (u32 i = 0; i < binned; ++i) {
+		u16* bounds = clusters->cluster_bounds[i];
+		float* data = &clusters->lights[i * CLUSTER_LIGHT_TEXELS * 4];
+		v3 p = V3(data[0], data[1], data[2]);
+		i32 tiles[4];
+		for (i32 z = bounds[0]; z <= bounds[1]; ++z) {
+			if (!sphere_tiles(p, data[3], slice_depths[z], slice_depths[z + 1], projection_scale, tiles)) {
+				continue;
+			}
+			for (i32 y = tiles[2]; y <= tiles[3]; ++y) {
+				for (i32 x = tiles[0]; x <= tiles[1]; ++x) {
+					u32 cluster = (z * CLUSTER_Y + y) * CLUSTER_X + x;
+					if (cursors[cluster] < clusters->grid[cluster * 2] + clusters->grid[cluster * 2 + 1]) {
+						clusters->indices[cursors[cluster]++] = i;
+					}
+				}
+			}
+		}
+	}
+	stats->light_count = binned;
+	stats->index_count = offset;
+
+	// Orphaned before every upload, so the driver never has to wait for the previous frame to finish reading
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters->light_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(clusters->lights), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, binned * CLUSTER_LIGHT_TEXELS * 4 * sizeof(float), clusters->lights);
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters->grid_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(clusters->grid), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, sizeof(clusters->grid), clusters->grid);
+	glBindBuffer(GL_TEXTURE_BUFFER, clusters->index_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, sizeof(clusters->indices), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_TEXTURE_BUFFER, 0, offset * sizeof(u16), clusters->indices);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	render_stats_count_upload(binned * CLUSTER_LIGHT_TEXELS * 4 * sizeof(float) + sizeof(clusters->grid) + offset * sizeof(u16));
+
+	stats->build_ms = time_since_ms(start);
+	if (count != (i32)clusters->printed_light_count) {
+		clusters->printed_light_count = count;
+		fprintf(stdout, "Light clusters: %i point lights, %u binned, %u references (at most %u per cluster), %u dropped, %.2f ms\n",
+			count, stats->light_count, stats->index_count, stats->max_cluster_lights, stats->dropped, stats->build_ms);
+	}
+}
+
+void light_clusters_bind(Light_clusters* clusters, u32 first_unit) {
+	gl_state_bind_texture(first_unit, GL_TEXTURE_BUFFER, clusters->light_texture);
+	gl_state_bind_texture(first_unit + 1, GL_TEXTURE_BUFFER, clusters->grid_texture);
+	gl_state_bind_texture(first_unit + 2, GL_TEXTURE_BUFFER, clusters->index_texture);
+}
+
+void light_clusters_destroy(Light_clusters* clusters) {
+	gl_state_forget_texture(clusters->light_texture);
+	gl_state_forget_texture(clusters->grid_texture);
+	gl_state_forget_texture(clusters->index_texture);
+	glDeleteTextures(1, &clusters->light_texture);
+	glDeleteTextures(1, &clusters->grid_texture);
+	glDeleteTextures(1, &clusters->index_texture);
+	glDeleteBuffers(1, &clusters->light_buffer);
+	glDeleteBuffers(1, &clusters->grid_buffer);
+	glDeleteBuffers(1, &clusters->index_buffer);
+}
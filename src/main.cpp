@@ -4,6 +4,126 @@
 
 #include "engine.hpp"
 
+#define DEFAULT_WIDTH 800
+#define DEFAULT_HEIGHT 600
+#define DEFAULT_HEADLESS_FRAMES 300
+
+static void print_usage(const char* program);
+
+void print_usage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  --scene PATH          scene file to load (default: %s)\n"
+		"  --size WIDTHxHEIGHT   window or offscreen resolution (default: %dx%d)\n"
+		"  --frames N            exit after N frames\n"
+		"  --headless            render offscreen without a window or input, then write a benchmark report (default: %d frames)\n"
+		"  --report PATH         where the headless report goes (default: stdout)\n"
+		"  --gpu-csv PATH        write the gpu time of every render pass per frame as csv\n"
+		"  --trace PATH          record cpu scopes and write them as a chrome trace on exit\n"
+		"  --capture DIR         write frames to DIR as 0.png, 1.png, ... for comparing against reference images\n"
+		"  --capture-every N     capture every Nth frame (default: 1)\n"
+		"  --fps N               limit the frame rate to N frames per second\n"
+		"  --vsync               wait for the vertical blank when swapping buffers\n"
+		"  --low-latency         sample input right before the frame is drawn instead of after\n"
+		"  --no-render-thread    submit gl from the main thread, one frame after the other\n"
+		"  --entity-costs        time every entity's draws on the gpu and print them ranked on exit\n"
+		"  --startup-report PATH trace every asset load and upload until the first frame, print a summary and write it as json\n"
+		"  --flares              draw lens flares toward the sun\n",
+		program, DEFAULT_SCENE, DEFAULT_WIDTH, DEFAULT_HEIGHT, DEFAULT_HEADLESS_FRAMES);
+}
+
 int main(int argc, char** argv) {
-	return engine_start();
+	Engine_options options = {
+		.scene_path = DEFAULT_SCENE,
+		.headless = 0,
+		.frames = 0,
+		.width = DEFAULT_WIDTH,
+		.height = DEFAULT_HEIGHT,
+		.report_path = NULL,
+		.gpu_csv_path = NULL,
+		.trace_path = NULL,
+		.target_fps = 0,
+		.vsync = 0,
+		.low_latency = 0,
+		.capture_path = NULL,
+		.capture_interval = 1,
+		.render_thread = 1,
+		.entity_costs = 0,
+		.startup_report_path = NULL,
+		.sun_flares = 0,
+	};
+	for (i32 i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (strcmp(arg, "--headless") == 0) {
+			options.headless = 1;
+			continue;
+		}
+		if (strcmp(arg, "--vsync") == 0) {
+			options.vsync = 1;
+			continue;
+		}
+		if (strcmp(arg, "--low-latency") == 0) {
+			options.low_latency = 1;
+			continue;
+		}
+		if (strcmp(arg, "--no-render-thread") == 0) {
+			options.render_thread = 0;
+			continue;
+		}
+		if (strcmp(arg, "--entity-costs") == 0) {
+			options.entity_costs = 1;
+			continue;
+		}
+		if (strcmp(arg, "--flares") == 0) {
+			options.sun_flares = 1;
+			continue;
+		}
+		if (!value) {
+			print_usage(argv[0]);
+			return Error;
+		}
+		if (strcmp(arg, "--scene") == 0) {
+			options.scene_path = value;
+		}
+		else if (strcmp(arg, "--report") == 0) {
+			options.report_path = value;
+		}
+		else if (strcmp(arg, "--gpu-csv") == 0) {
+			options.gpu_csv_path = value;
+		}
+		else if (strcmp(arg, "--trace") == 0) {
+			options.trace_path = value;
+		}
+		else if (strcmp(arg, "--capture") == 0) {
+			options.capture_path = value;
+		}
+		else if (strcmp(arg, "--startup-report") == 0) {
+			options.startup_report_path = value;
+		}
+		else if (strcmp(arg, "--capture-every") == 0) {
+			options.capture_interval = (u32)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--fps") == 0) {
+			options.target_fps = strtof(value, NULL);
+		}
+		else if (strcmp(arg, "--frames") == 0) {
+			options.frames = (u32)strtoul(value, NULL, 10);
+		}
+		else if (strcmp(arg, "--size") == 0) {
+			if (sscanf(value, "%dx%d", &options.width, &options.height) != 2 || options.width <= 0 || options.height <= 0) {
+				print_usage(argv[0]);
+				return Error;
+			}
+		}
+		else {
+			print_usage(argv[0]);
+			return Error;
+		}
+		i++;
+	}
+	if (options.headless && options.frames == 0) {
+		options.frames = DEFAULT_HEADLESS_FRAMES;
+	}
+	return engine_start(&options);
 }
@@ -7,6 +7,8 @@
 #include "memory.hpp"
 #include "mesh.hpp"
 #include "matrix_math.hpp"
+#include "profiler.hpp"
+#include "startup_trace.hpp"
 
 #define MAX_LINE_SIZE 256
 
@@ -38,6 +40,8 @@ void mesh_initialize(Mesh* mesh) {
 	mesh->tangent_count = 0;
 	mesh->bitangents = NULL;
 	mesh->bitangent_count = 0;
+	mesh->bounds = (Aabb) {};
+	mesh->sphere = (Bounding_sphere) {};
 #endif
 }
 
@@ -99,10 +103,13 @@ i32 mesh_sort_indices(Mesh* mesh) {
 }
 
 i32 load_mesh(const char* path, Mesh* mesh, u8 sort_mesh) {
+	PROFILE_FUNCTION();
 	i32 result = NoError;
+	i32 event = startup_trace_begin("obj parse", path);
 	mesh_initialize(mesh);
 	Buffer buffer = Buffer();	// Buffer to store the wavefront object contents in
 	if (read_file(path, &buffer) != NoError) {
+		startup_trace_end(event, 0);
 		return Error;
 	}
 	char line[MAX_LINE_SIZE] = {};	// Current line we are reading
@@ -198,13 +205,42 @@ i32 load_mesh(const char* path, Mesh* mesh, u8 sort_mesh) {
 		}
 	}
 	if (sort_mesh) {
+		i32 sort_event = startup_trace_begin("mesh sort indices", path);
 		mesh_sort_indices(mesh);
+		startup_trace_end(sort_event, (u64)mesh->vertex_index_count * (sizeof(v2) + sizeof(v3)));	// The uv and normal arrays rebuilt per index
 	}
+	mesh_compute_bounds(mesh);
 done:
+	startup_trace_end(event, buffer.size);	// File size
 	buffer_free(&buffer);	// The buffer data is parsed and loaded into the mesh data structure, therefore it is not needed anymore
 	return result;
 }
 
+void mesh_compute_bounds(Mesh* mesh) {
+	if (mesh->vertex_count == 0) {
+		mesh->bounds = (Aabb) {};
+		mesh->sphere = (Bounding_sphere) {};
+		return;
+	}
+	Aabb bounds = {mesh->vertices[0], mesh->vertices[0]};
+	for (u32 i = 1; i < mesh->vertex_count; ++i) {
+		v3 vertex = mesh->vertices[i];
+		bounds.min = V3(fminf(bounds.min.x, vertex.x), fminf(bounds.min.y, vertex.y), fminf(bounds.min.z, vertex.z));
+		bounds.max = V3(fmaxf(bounds.max.x, vertex.x), fmaxf(bounds.max.y, vertex.y), fmaxf(bounds.max.z, vertex.z));
+	}
+	// Centered on the box, but sized by the vertices since the box corners are usually further out
+	v3 center = (bounds.min + bounds.max) * 0.5f;
+	float radius_square = 0;
+	for (u32 i = 0; i < mesh->vertex_count; ++i) {
+		float distance_square = length_square_v3(mesh->vertices[i] - center);
+		if (distance_square > radius_square) {
+			radius_square = distance_square;
+		}
+	}
+	mesh->bounds = bounds;
+	mesh->sphere = (Bounding_sphere) {center, sqrtf(radius_square)};
+}
+
 void unload_mesh(Mesh* mesh) {
 	list_free(mesh->vertices, mesh->vertex_count);
 	list_free(mesh->vertex_indices, mesh->vertex_index_count);
@@ -0,0 +1,442 @@
+// mesh_pool.cpp
+// sub-allocates static meshes out of shared vertex/index buffers
+
+#include <GL/glew.h>
+#include <stddef.h>	// offsetof
+#include <algorithm>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "memory.hpp"
+#include "gl_state.hpp"
+#include "render_stats.hpp"
+#include "mesh_pool.hpp"
+
+#define POOL_GROWTH_FACTOR 2
+
+static void range_allocator_insert(Range_allocator* allocator, Pool_range range);
+static void mesh_pool_bind_vertex_attributes(Mesh_pool* pool);
+static void mesh_pool_bind_position_attributes(Mesh_pool* pool);
+static void mesh_pool_bind_instance_attributes(Mesh_pool* pool, u32 first_instance);
+static void mesh_pool_resize_buffer(u32* buffer, u32 old_size, u32 new_size);
+static void mesh_pool_draw_commands(Mesh_pool* pool, u32 vao, u32 first_command, u32 command_count);
+static i32 mesh_pool_reserve(Mesh_pool* pool, u32 vertex_count, u32 index_count);
+
+i32 range_allocator_initialize(Range_allocator* allocator, u32 capacity) {
+	allocator->free_range_count = 0;
+	allocator->capacity = capacity;
+	allocator->used = 0;
+	if (capacity > 0) {
+		allocator->free_ranges[0] = (Pool_range) { .offset = 0, .count = capacity };
+		allocator->free_range_count = 1;
+	}
+	return NoError;
+}
+
+// First fit, the pool only ever sees a handful of allocations at scene load
+i32 range_allocator_allocate(Range_allocator* allocator, u32 count, Pool_range* range) {
+	for (u32 i = 0; i < allocator->free_range_count; ++i) {
+		Pool_range* free_range = &allocator->free_ranges[i];
+		if (free_range->count < count) {
+			continue;
+		}
+		range->offset = free_range->offset;
+		range->count = count;
+		free_range->offset += count;
+		free_range->count -= count;
+		if (free_range->count == 0) {
+			memmove(&allocator->free_ranges[i], &allocator->free_ranges[i + 1], (allocator->free_range_count - i - 1) * sizeof(Pool_range));
+			allocator->free_range_count--;
+		}
+		allocator->used += count;
+		return NoError;
+	}
+	return Error;
+}
+
+void range_allocator_insert(Range_allocator* allocator, Pool_range range) {
+	u32 index = 0;
+	while (index < allocator->free_range_count && allocator->free_ranges[index].offset < range.offset) {
+		index++;
+	}
+
+	// Merge with the neighbouring ranges if they touch
+	Pool_range* prev = index > 0 ? &allocator->free_ranges[index - 1] : NULL;
+	Pool_range* next = index < allocator->free_range_count ? &allocator->free_ranges[index] : NULL;
+	u8 merge_prev = prev && prev->offset + prev->count == range.offset;
+	u8 merge_next = next && range.offset + range.count == next->offset;
+
+	if (merge_prev && merge_next) {
+		prev->count += range.count + next->count;
+		memmove(next, next + 1, (allocator->free_range_count - index - 1) * sizeof(Pool_range));
+		allocator->free_range_count--;
+	}
+	else if (merge_prev) {
+		prev->count += range.count;
+	}
+	else if (merge_next) {
+		next->offset = range.offset;
+		next->count += range.count;
+	}
+	else {
+		if (allocator->free_range_count == MAX_FREE_RANGES) {
+			fprintf(stderr, "Warning: range allocator out of free ranges, losing %u elements\n", range.count);
+			return;
+		}
+		memmove(&allocator->free_ranges[index + 1], &allocator->free_ranges[index], (allocator->free_range_count - index) * sizeof(Pool_range));
+		allocator->free_ranges[index] = range;
+		allocator->free_range_count++;
+	}
+}
+
+void range_allocator_free(Range_allocator* allocator, Pool_range range) {
+	if (range.count == 0) {
+		return;
+	}
+	range_allocator_insert(allocator, range);
+	allocator->used -= range.count;
+}
+
+void range_allocator_grow(Range_allocator* allocator, u32 new_capacity) {
+	if (new_capacity <= allocator->capacity) {
+		return;
+	}
+	range_allocator_insert(allocator, (Pool_range) { .offset = allocator->capacity, .count = new_capacity - allocator->capacity });
+	allocator->capacity = new_capacity;
+}
+
+float range_allocator_fragmentation(Range_allocator* allocator) {
+	u32 total_free = allocator->capacity - allocator->used;
+	u32 largest_free = 0;
+	for (u32 i = 0; i < allocator->free_range_count; ++i) {
+		largest_free = std::max(largest_free, allocator->free_ranges[i].count);
+	}
+	if (total_free == 0) {
+		return 0;
+	}
+	return 1.0f - (float)largest_free / total_free;
+}
+
+void mesh_pool_bind_vertex_attributes(Mesh_pool* pool) {
+	glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+	glEnableVertexAttribArray(POOL_ATTRIB_POSITION);
+	glVertexAttribPointer(POOL_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(Pool_vertex), (void*)offsetof(Pool_vertex, position));
+	glEnableVertexAttribArray(POOL_ATTRIB_UV);
+	glVertexAttribPointer(POOL_ATTRIB_UV, 2, GL_FLOAT, GL_FALSE, sizeof(Pool_vertex), (void*)offsetof(Pool_vertex, uv));
+	glEnableVertexAttribArray(POOL_ATTRIB_NORMAL);
+	glVertexAttribPointer(POOL_ATTRIB_NORMAL, 3, GL_FLOAT, GL_FALSE, sizeof(Pool_vertex), (void*)offsetof(Pool_vertex, normal));
+	glEnableVertexAttribArray(POOL_ATTRIB_TANGENT);
+	glVertexAttribPointer(POOL_ATTRIB_TANGENT, 3, GL_FLOAT, GL_FALSE, sizeof(Pool_vertex), (void*)offsetof(Pool_vertex, tangent));
+	glEnableVertexAttribArray(POOL_ATTRIB_BITANGENT);
+	glVertexAttribPointer(POOL_ATTRIB_BITANGENT, 3, GL_FLOAT, GL_FALSE, sizeof(Pool_vertex), (void*)offsetof(Pool_vertex, bitangent));
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void mesh_pool_bind_position_attributes(Mesh_pool* pool) {
+	glBindBuffer(GL_ARRAY_BUFFER, pool->position_vbo);
+	glEnableVertexAttribArray(POOL_ATTRIB_POSITION);
+	glVertexAttribPointer(POOL_ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(v3), NULL);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Without base instance support the per-draw data is reached by moving the attribute pointers instead
+void mesh_pool_bind_instance_attributes(Mesh_pool* pool, u32 first_instance) {
+	u8* base = (u8*)((size_t)first_instance * sizeof(Pool_instance));
+	glBindBuffer(GL_ARRAY_BUFFER, pool->stream->buffer);
+	for (u32 i = 0; i < 4; ++i) {
+		u32 attribute = POOL_ATTRIB_MODEL + i;
+		glEnableVertexAttribArray(attribute);
+		glVertexAttribPointer(attribute, 4, GL_FLOAT, GL_FALSE, sizeof(Pool_instance), base + offsetof(Pool_instance, model) + i * sizeof(v4));
+		glVertexAttribDivisor(attribute, 1);
+	}
+	for (u32 i = 0; i < 3; ++i) {
+		u32 attribute = POOL_ATTRIB_NORMAL_MATRIX + i;
+		glEnableVertexAttribArray(attribute);
+		glVertexAttribPointer(attribute, 3, GL_FLOAT, GL_FALSE, sizeof(Pool_instance), base + offsetof(Pool_instance, normal_matrix) + i * sizeof(v3));
+		glVertexAttribDivisor(attribute, 1);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void mesh_pool_resize_buffer(u32* buffer, u32 old_size, u32 new_size) {
+	u32 new_buffer = 0;
+	glGenBuffers(1, &new_buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, new_buffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, new_size, NULL, GL_STATIC_DRAW);
+	if (*buffer && old_size > 0) {
+		glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (*buffer) {
+		glDeleteBuffers(1, buffer);
+	}
+	*buffer = new_buffer;
+}
+
+// Grows the shared buffers (keeping their contents) until the requested counts fit in a single free range
+i32 mesh_pool_reserve(Mesh_pool* pool, u32 vertex_count, u32 index_count) {
+	Range_allocator* allocators[2] = { &pool->vertices, &pool->indices };
+	u32 counts[2] = { vertex_count, index_count };
+	u32* buffers[2] = { &pool->vbo, &pool->ebo };
+	u32 element_sizes[2] = { sizeof(Pool_vertex), sizeof(u32) };
+	u8 grew = 0;
+
+	for (u32 i = 0; i < 2; ++i) {
+		Range_allocator* allocator = allocators[i];
+		u32 largest_free = 0;
+		for (u32 r = 0; r < allocator->free_range_count; ++r) {
+			largest_free = std::max(largest_free, allocator->free_ranges[r].count);
+		}
+		if (largest_free >= counts[i]) {
+			continue;
+		}
+		u32 new_capacity = std::max(allocator->capacity * POOL_GROWTH_FACTOR, allocator->capacity + counts[i]);
+		mesh_pool_resize_buffer(buffers[i], allocator->capacity * element_sizes[i], new_capacity * element_sizes[i]);
+		if (allocator == &pool->vertices) {
+			mesh_pool_resize_buffer(&pool->position_vbo, allocator->capacity * sizeof(v3), new_capacity * sizeof(v3));
+		}
+		range_allocator_grow(allocator, new_capacity);
+		grew = 1;
+	}
+	if (!grew) {
+		return NoError;
+	}
+
+	// The vaos still point at the old buffers
+	gl_state_bind_vertex_array(pool->vao);
+	mesh_pool_bind_vertex_attributes(pool);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->ebo);
+	gl_state_bind_vertex_array(pool->position_vao);
+	mesh_pool_bind_position_attributes(pool);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->ebo);
+	gl_state_bind_vertex_array(0);
+	return NoError;
+}
+
+i32 mesh_pool_initialize(Mesh_pool* pool, u32 vertex_capacity, u32 index_capacity, Stream_buffer* stream) {
+	pool->vao = pool->vbo = pool->ebo = 0;
+	pool->position_vao = pool->position_vbo = 0;
+	pool->stream = stream;
+	pool->first_instance = 0;
+	pool->command_offset = 0;
+	pool->commands = NULL;
+	pool->use_multi_draw = (GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect) && (GLEW_VERSION_4_2 || GLEW_ARB_base_instance);
+
+	range_allocator_initialize(&pool->vertices, vertex_capacity);
+	range_allocator_initialize(&pool->indices, index_capacity);
+
+	glGenVertexArrays(1, &pool->vao);
+	glGenVertexArrays(1, &pool->position_vao);
+	mesh_pool_resize_buffer(&pool->vbo, 0, vertex_capacity * sizeof(Pool_vertex));
+	mesh_pool_resize_buffer(&pool->position_vbo, 0, vertex_capacity * sizeof(v3));
+	mesh_pool_resize_buffer(&pool->ebo, 0, index_capacity * sizeof(u32));
+
+	gl_state_bind_vertex_array(pool->vao);
+	mesh_pool_bind_vertex_attributes(pool);
+	mesh_pool_bind_instance_attributes(pool, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->ebo);
+	gl_state_bind_vertex_array(pool->position_vao);
+	mesh_pool_bind_position_attributes(pool);
+	mesh_pool_bind_instance_attributes(pool, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool->ebo);
+	gl_state_bind_vertex_array(0);
+	return NoError;
+}
+
+i32 mesh_pool_upload_vertices(Mesh_pool* pool, Pool_vertex* data, u32 vertex_count, u32* index_data, u32 index_count, Pool_range* vertices, Pool_range* indices) {
+	*vertices = (Pool_range) {};
+	*indices = (Pool_range) {};
+	if (vertex_count == 0 || index_count == 0) {
+		return Error;
+	}
+
+	mesh_pool_reserve(pool, vertex_count, index_count);
+	if (range_allocator_allocate(&pool->vertices, vertex_count, vertices) != NoError) {
+		fprintf(stderr, "Mesh pool failed to allocate %u vertices\n", vertex_count);
+		return Error;
+	}
+	if (range_allocator_allocate(&pool->indices, index_count, indices) != NoError) {
+		fprintf(stderr, "Mesh pool failed to allocate %u indices\n", index_count);
+		range_allocator_free(&pool->vertices, *vertices);
+		*vertices = (Pool_range) {};
+		return Error;
+	}
+	// Without its positions the mesh would be missing from the depth pre-pass, and the GL_EQUAL scene pass would drop it
+	v3* positions = (v3*)m_malloc(sizeof(v3) * vertex_count);
+	if (!positions) {
+		fprintf(stderr, "Mesh pool failed to allocate %u positions\n", vertex_count);
+		mesh_pool_free(pool, *vertices, *indices);
+		*vertices = (Pool_range) {};
+		*indices = (Pool_range) {};
+		return Error;
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, pool->vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, vertices->offset * sizeof(Pool_vertex), vertex_count * sizeof(Pool_vertex), data);
+	render_stats_count_upload(vertex_count * sizeof(Pool_vertex));
+
+	for (u32 i = 0; i < vertex_count; ++i) {
+		positions[i] = data[i].position;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, pool->position_vbo);
+	glBufferSubData(GL_ARRAY_BUFFER, vertices->offset * sizeof(v3), vertex_count * sizeof(v3), positions);
+	render_stats_count_upload(vertex_count * sizeof(v3));
+	m_free(positions, sizeof(v3) * vertex_count);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	// Indices stay relative to the mesh, the base vertex of each draw takes care of the offset
+	glBindBuffer(GL_COPY_WRITE_BUFFER, pool->ebo);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, indices->offset * sizeof(u32), index_count * sizeof(u32), index_data);
+	render_stats_count_upload(index_count * sizeof(u32));
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	return NoError;
+}
+
+i32 mesh_pool_upload(Mesh_pool* pool, Mesh* mesh, Pool_range* vertices, Pool_range* indices) {
+	i32 result = NoError;
+	u32 vertex_count = mesh->vertex_count;
+	Pool_vertex* data = (Pool_vertex*)m_malloc(sizeof(Pool_vertex) * vertex_count);
+	if (!data && vertex_count > 0) {
+		return Error;
+	}
+
+	// Interleave the separate attribute streams, attributes missing for a vertex are zeroed
+	for (u32 i = 0; i < vertex_count; ++i) {
+		Pool_vertex* vertex = &data[i];
+		memset(vertex, 0, sizeof(Pool_vertex));
+		vertex->position = mesh->vertices[i];
+		if (i < mesh->uv_count)        vertex->uv = mesh->uv[i];
+		if (i < mesh->normal_count)    vertex->normal = mesh->normals[i];
+		if (i < mesh->tangent_count)   vertex->tangent = mesh->tangents[i];
+		if (i < mesh->bitangent_count) vertex->bitangent = mesh->bitangents[i];
+	}
+
+	result = mesh_pool_upload_vertices(pool, data, vertex_count, mesh->vertex_indices, mesh->vertex_index_count, vertices, indices);
+	if (data) {
+		m_free(data, sizeof(Pool_vertex) * vertex_count);
+	}
+	return result;
+}
+
+// Goes through the copy read target, binding the element array buffer would change whichever vao is bound
+void mesh_pool_read_vertices(Mesh_pool* pool, Pool_range vertices, Pool_range indices, Pool_vertex* vertex_data, u32* index_data) {
+	glBindBuffer(GL_COPY_READ_BUFFER, pool->vbo);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, vertices.offset * sizeof(Pool_vertex), vertices.count * sizeof(Pool_vertex), vertex_data);
+	glBindBuffer(GL_COPY_READ_BUFFER, pool->ebo);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, indices.offset * sizeof(u32), indices.count * sizeof(u32), index_data);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+void mesh_pool_free(Mesh_pool* pool, Pool_range vertices, Pool_range indices) {
+	range_allocator_free(&pool->vertices, vertices);
+	range_allocator_free(&pool->indices, indices);
+}
+
+// Instances are aligned to their own size, so the instance attributes keep pointing at the start of the stream buffer
+// and this frame's instances are reached by offsetting the base instance of each draw
+i32 mesh_pool_upload_draws(Mesh_pool* pool, Draw_elements_indirect_command* commands, Pool_instance* instances, u32 count) {
+	pool->commands = commands;
+	if (count == 0) {
+		return NoError;
+	}
+
+	Stream_allocation instance_data = {};
+	Stream_allocation command_data = {};
+	if (stream_buffer_allocate(pool->stream, count * sizeof(Pool_instance), sizeof(Pool_instance), &instance_data) != NoError ||
+		(pool->use_multi_draw && stream_buffer_allocate(pool->stream, count * sizeof(Draw_elements_indirect_command), sizeof(u32), &command_data) != NoError)) {
+		pool->commands = NULL;
+		return Error;
+	}
+	memcpy(instance_data.data, instances, count * sizeof(Pool_instance));
+	pool->first_instance = instance_data.offset / sizeof(Pool_instance);
+
+	if (pool->use_multi_draw) {
+		Draw_elements_indirect_command* mapped = (Draw_elements_indirect_command*)command_data.data;
+		for (u32 i = 0; i < count; ++i) {
+			Draw_elements_indirect_command command = commands[i];
+			command.base_instance += pool->first_instance;
+			mapped[i] = command;
+		}
+		pool->command_offset = command_data.offset;
+	}
+	stream_buffer_flush(pool->stream);
+	return NoError;
+}
+
+void mesh_pool_draw_commands(Mesh_pool* pool, u32 vao, u32 first_command, u32 command_count) {
+	if (!pool->commands) {
+		return;
+	}
+	gl_state_bind_vertex_array(vao);
+	if (pool->use_multi_draw) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, pool->stream->buffer);
+		glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(size_t)(pool->command_offset + first_command * sizeof(Draw_elements_indirect_command)), command_count, 0);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+		u64 triangles = 0;
+		for (u32 i = first_command; i < first_command + command_count; ++i) {
+			triangles += (u64)pool->commands[i].count / 3 * pool->commands[i].instance_count;
+		}
+		render_stats_count_draw(triangles);
+		return;
+	}
+
+	for (u32 i = first_command; i < first_command + command_count; ++i) {
+		Draw_elements_indirect_command* command = &pool->commands[i];
+		mesh_pool_bind_instance_attributes(pool, pool->first_instance + command->base_instance);
+		glDrawElementsBaseVertex(GL_TRIANGLES, command->count, GL_UNSIGNED_INT, (void*)(command->first_index * sizeof(u32)), command->base_vertex);
+		render_stats_count_draw(command->count / 3);
+	}
+	mesh_pool_bind_instance_attributes(pool, 0);
+}
+
+// Draws a range of the commands handed to mesh_pool_upload_draws, leaving the pool vao bound
+void mesh_pool_draw(Mesh_pool* pool, u32 first_command, u32 command_count) {
+	mesh_pool_draw_commands(pool, pool->vao, first_command, command_count);
+}
+
+void mesh_pool_draw_positions(Mesh_pool* pool, u32 first_command, u32 command_count) {
+	mesh_pool_draw_commands(pool, pool->position_vao, first_command, command_count);
+}
+
+Mesh_pool_stats mesh_pool_get_stats(Mesh_pool* pool) {
+	return (Mesh_pool_stats) {
+		.vertex_bytes_used = (u32)(pool->vertices.used * sizeof(Pool_vertex)),
+		.vertex_bytes_capacity = (u32)(pool->vertices.capacity * sizeof(Pool_vertex)),
+		.index_bytes_used = (u32)(pool->indices.used * sizeof(u32)),
+		.index_bytes_capacity = (u32)(pool->indices.capacity * sizeof(u32)),
+		.vertex_fragmentation = range_allocator_fragmentation(&pool->vertices),
+		.index_fragmentation = range_allocator_fragmentation(&pool->indices),
+	};
+}
+
+void mesh_pool_print_stats(Mesh_pool* pool) {
+	Mesh_pool_stats stats = mesh_pool_get_stats(pool);
+	printf("Mesh pool: vertices %u/%u bytes (%.1f%% fragmented), indices %u/%u bytes (%.1f%% fragmented), %s\n",
+		stats.vertex_bytes_used, stats.vertex_bytes_capacity, stats.vertex_fragmentation * 100.0f,
+		stats.index_bytes_used, stats.index_bytes_capacity, stats.index_fragmentation * 100.0f,
+		pool->use_multi_draw ? "multi draw indirect" : "base vertex fallback"
+	);
+}
+
+void mesh_pool_destroy(Mesh_pool* pool) {
+	gl_state_forget_vertex_array(pool->vao);
+	gl_state_forget_vertex_array(pool->position_vao);
+	glDeleteVertexArrays(1, &pool->vao);
+	glDeleteVertexArrays(1, &pool->position_vao);
+	glDeleteBuffers(1, &pool->vbo);
+	glDeleteBuffers(1, &pool->position_vbo);
+	glDeleteBuffers(1, &pool->ebo);
+	pool->vao = pool->vbo = pool->ebo = 0;
+	pool->position_vao = pool->position_vbo = 0;
+	pool->stream = NULL;
+	pool->commands = NULL;
+	range_allocator_initialize(&pool->vertices, 0);
+	range_allocator_initialize(&pool->indices, 0);
+}
@@ -0,0 +1,517 @@
+// occlusion.cpp
+// software occlusion culling, occluders are rasterized into a small depth buffer on the cpu
+
+#include <pthread.h>
+#include <unistd.h>	// sysconf
+#include <algorithm>
+
+#include "common.hpp"
+#include "memory.hpp"
+#include "resource.hpp"
+#include "occlusion.hpp"
+#include "profiler.hpp"
+
+#define NEAR_EPSILON 0.00001f
+
+typedef struct Occluder_triangle {
+	float x[3];	// Screen space, in pixels
+	float y[3];
+	float z[3];	// Reciprocal of the view depth (1 / w), which is linear in screen space
+	i32 min_x, min_y, max_x, max_y;	// Covered pixels, clamped to the buffer
+} Occluder_triangle;
+
+typedef struct Occluder_candidate {
+	u32 first_index;	// Of the triangle in the mesh's index list
+	float area;	// Squared, only compared
+} Occluder_candidate;
+
+typedef struct Occlusion_state {
+	float depth[OCCLUSION_WIDTH * OCCLUSION_HEIGHT] __attribute__((aligned(16)));
+	Occluder_mesh meshes[MAX_MESH];
+	Occluder_triangle triangles[MAX_OCCLUDER_TRIANGLES];
+	u32 triangle_count;
+	v4 clip_vertices[MAX_OCCLUDER_VERTICES];	// Scratch space for the occluder being set up
+	mat4 view;
+	mat4 view_projection;
+	Occlusion_stats stats;
+
+	pthread_t threads[MAX_OCCLUSION_THREADS];
+	u32 worker_count;	// The calling thread rasterizes as well, so this is one less than the thread count
+	pthread_mutex_t mutex;
+	pthread_cond_t work_ready;
+	pthread_cond_t work_done;
+	u32 generation;	// Bumped for every rasterization, workers wait for it to change
+	u32 finished_workers;
+	u32 next_tile;	// Handed out atomically
+	u8 quit;
+	u8 initialized;
+} Occlusion_state;
+
+static Occlusion_state occlusion = {};
+
+static v4 transform_v4(mat4 m, v4 v);
+static bool candidate_larger(const Occluder_candidate& a, const Occluder_candidate& b);
+static void occlusion_emit_triangle(v4 a, v4 b, v4 c);
+static void occlusion_clip_triangle(v4 a, v4 b, v4 c);
+static void occlusion_rasterize_tile(u32 tile);
+static void occlusion_rasterize_tiles();
+static void* occlusion_worker(void* data);
+
+v4 transform_v4(mat4 m, v4 v) {
+	return V4(
+		v.x * m.elements[0][0] + v.y * m.elements[1][0] + v.z * m.elements[2][0] + v.w * m.elements[3][0],
+		v.x * m.elements[0][1] + v.y * m.elements[1][1] + v.z * m.elements[2][1] + v.w * m.elements[3][1],
+		v.x * m.elements[0][2] + v.y * m.elements[1][2] + v.z * m.elements[2][2] + v.w * m.elements[3][2],
+		v.x * m.elements[0][3] + v.y * m.elements[1][3] + v.z * m.elements[2][3] + v.w * m.elements[3][3]
+	);
+}
+
+bool candidate_larger(const Occluder_candidate& a, const Occluder_candidate& b) {
+	return a.area > b.area;
+}
+
+i32 occlusion_initialize(u32 thread_count) {
+	if (thread_count == 0) {
+		thread_count = (u32)sysconf(_SC_NPROCESSORS_ONLN);
+	}
+	if (thread_count < 1) thread_count = 1;
+	if (thread_count > MAX_OCCLUSION_THREADS) thread_count = MAX_OCCLUSION_THREADS;
+	if (thread_count > OCCLUSION_TILE_COUNT) thread_count = OCCLUSION_TILE_COUNT;
+
+	pthread_mutex_init(&occlusion.mutex, NULL);
+	pthread_cond_init(&occlusion.work_ready, NULL);
+	pthread_cond_init(&occlusion.work_done, NULL);
+	occlusion.generation = 0;
+	occlusion.quit = 0;
+	occlusion.worker_count = 0;
+	for (u32 i = 0; i < thread_count - 1; ++i) {
+		if (pthread_create(&occlusion.threads[i], NULL, occlusion_worker, NULL) != 0) {
+			fprintf(stderr, "Failed to start occlusion worker thread, continuing with %u\n", occlusion.worker_count);
+			break;
+		}
+		occlusion.worker_count++;
+	}
+	occlusion.stats = (Occlusion_stats) {};
+	occlusion.stats.thread_count = occlusion.worker_count + 1;
+	occlusion.triangle_count = 0;
+	memset(occlusion.depth, 0, sizeof(occlusion.depth));
+	occlusion.initialized = 1;
+	return NoError;
+}
+
+void occlusion_destroy() {
+	if (!occlusion.initialized) {
+		return;
+	}
+	pthread_mutex_lock(&occlusion.mutex);
+	occlusion.quit = 1;
+	pthread_cond_broadcast(&occlusion.work_ready);
+	pthread_mutex_unlock(&occlusion.mutex);
+	for (u32 i = 0; i < occlusion.worker_count; ++i) {
+		pthread_join(occlusion.threads[i], NULL);
+	}
+	pthread_cond_destroy(&occlusion.work_ready);
+	pthread_cond_destroy(&occlusion.work_done);
+	pthread_mutex_destroy(&occlusion.mutex);
+
+	for (u32 i = 0; i < MAX_MESH; ++i) {
+		Occluder_mesh* mesh = &occlusion.meshes[i];
+		list_free(mesh->vertices, mesh->vertex_count);
+		list_free(mesh->indices, mesh->index_count);
+	}
+	occlusion.initialized = 0;
+}
+
+// Keeps the largest triangles as they are. Moving vertices, as merging them would, can make the occluder cover
+// pixels the mesh does not and hide what is actually in view, while leaving triangles out only makes it occlude less
+i32 occlusion_add_mesh(i32 mesh_id, Mesh* mesh) {
+	if (mesh_id < 0 || mesh_id >= MAX_MESH || mesh->vertex_count == 0 || mesh->vertex_index_count < 3) {
+		return Error;
+	}
+	Occluder_mesh* occluder = &occlusion.meshes[mesh_id];
+	list_free(occluder->vertices, occluder->vertex_count);
+	list_free(occluder->indices, occluder->index_count);
+
+	u32 triangle_count = mesh->vertex_index_count / 3;
+	Occluder_candidate* candidates = (Occluder_candidate*)m_malloc(sizeof(Occluder_candidate) * triangle_count);
+	u32 candidate_count = 0;
+	for (u32 i = 0; i + 2 < mesh->vertex_index_count; i += 3) {
+		v3 a = mesh->vertices[mesh->vertex_indices[i]];
+		v3 b = mesh->vertices[mesh->vertex_indices[i + 1]];
+		v3 c = mesh->vertices[mesh->vertex_indices[i + 2]];
+		float area = length_square_v3(cross_product(b - a, c - a));
+		if (area > 0) {
+			candidates[candidate_count++] = (Occluder_candidate) {
+				.first_index = i,
+				.area = area,
+			};
+		}
+	}
+	if (candidate_count > MAX_OCCLUDER_MESH_TRIANGLES) {
+		std::stable_sort(candidates, candidates + candidate_count, candidate_larger);
+		candidate_count = MAX_OCCLUDER_MESH_TRIANGLES;
+	}
+
+	i32* remap = (i32*)m_malloc(sizeof(i32) * mesh->vertex_count);
+	memset(remap, 0xff, sizeof(i32) * mesh->vertex_count);
+	v3* vertices = (v3*)m_malloc(sizeof(v3) * candidate_count * 3);
+	u32* indices = (u32*)m_malloc(sizeof(u32) * candidate_count * 3);
+	u32 vertex_count = 0;
+	for (u32 i = 0; i < candidate_count; ++i) {
+		for (u32 corner = 0; corner < 3; ++corner) {
+			u32 vertex = mesh->vertex_indices[candidates[i].first_index + corner];
+			if (remap[vertex] < 0) {
+				remap[vertex] = vertex_count;
+				vertices[vertex_count++] = mesh->vertices[vertex];
+			}
+			indices[i * 3 + corner] = remap[vertex];
+		}
+	}
+
+	occluder->vertices = NULL;
+	occluder->vertex_count = 0;
+	occluder->indices = NULL;
+	occluder->index_count = 0;
+	if (candidate_count > 0) {
+		occluder->vertices = (v3*)m_realloc(vertices, sizeof(v3) * candidate_count * 3, sizeof(v3) * vertex_count);
+		occluder->vertex_count = vertex_count;
+		occluder->indices = indices;
+		occluder->index_count = candidate_count * 3;
+	}
+	else {
+		m_free(vertices, 0);
+		m_free(indices, 0);
+	}
+
+	m_free(candidates, sizeof(Occluder_candidate) * triangle_count);
+	m_free(remap, sizeof(i32) * mesh->vertex_count);
+	return NoError;
+}
+
+void occlusion_begin(mat4 view, mat4 projection) {
+	occlusion.view = view;
+	occlusion.view_projection = multiply_mat4(projection, view);
+	occlusion.triangle_count = 0;
+	occlusion.stats.occluder_triangles = 0;
+	occlusion.stats.dropped_triangles = 0;
+}
+
+void occlusion_emit_triangle(v4 a, v4 b, v4 c) {
+	if (occlusion.triangle_count >= MAX_OCCLUDER_TRIANGLES) {
+		occlusion.stats.dropped_triangles++;
+		return;
+	}
+	Occluder_triangle triangle = {};
+	v4 vertices[3] = {a, b, c};
+	float min_x = 1e30f, min_y = 1e30f, max_x = -1e30f, max_y = -1e30f;
+	for (u32 i = 0; i < 3; ++i) {
+		float inverse_w = 1.0f / vertices[i].w;
+		triangle.x[i] = (vertices[i].x * inverse_w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		triangle.y[i] = (vertices[i].y * inverse_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		triangle.z[i] = inverse_w;
+		min_x = fminf(min_x, triangle.x[i]);
+		min_y = fminf(min_y, triangle.y[i]);
+		max_x = fmaxf(max_x, triangle.x[i]);
+		max_y = fmaxf(max_y, triangle.y[i]);
+	}
+	// Pixel centers covered by the bounding box
+	triangle.min_x = (i32)clamp(ceilf(min_x - 0.5f), 0.0f, (float)OCCLUSION_WIDTH);
+	triangle.min_y = (i32)clamp(ceilf(min_y - 0.5f), 0.0f, (float)OCCLUSION_HEIGHT);
+	triangle.max_x = (i32)clamp(floorf(max_x - 0.5f), -1.0f, (float)(OCCLUSION_WIDTH - 1));
+	triangle.max_y = (i32)clamp(floorf(max_y - 0.5f), -1.0f, (float)(OCCLUSION_HEIGHT - 1));
+	if (triangle.min_x > triangle.max_x || triangle.min_y > triangle.max_y) {
+		return;
+	}
+	// Wind counter clockwise so the inside of every edge is positive, occluders are two sided
+	float area = (triangle.x[1] - triangle.x[0]) * (triangle.y[2] - triangle.y[0]) - (triangle.x[2] - triangle.x[0]) * (triangle.y[1] - triangle.y[0]);
+	if (fabsf(area) < 0.0001f) {
+		return;
+	}
+	if (area < 0) {
+		float x = triangle.x[1], y = triangle.y[1], z = triangle.z[1];
+		triangle.x[1] = triangle.x[2]; triangle.y[1] = triangle.y[2]; triangle.z[1] = triangle.z[2];
+		triangle.x[2] = x; triangle.y[2] = y; triangle.z[2] = z;
+	}
+	occlusion.triangles[occlusion.triangle_count++] = triangle;
+}
+
+// Clips against the near plane (z >= -w), which can turn the triangle into a quad
+void occlusion_clip_triangle(v4 a, v4 b, v4 c) {
+	v4 input[3] = {a, b, c};
+	v4 output[4];
+	u32 output_count = 0;
+	for (u32 i = 0; i < 3; ++i) {
+		v4 current = input[i];
+		v4 next = input[(i + 1) % 3];
+		float current_distance = current.z + current.w;
+		float next_distance = next.z + next.w;
+		if (current_distance >= 0) {
+			output[output_count++] = current;
+		}
+		if ((current_distance >= 0) != (next_distance >= 0)) {
+			float t = current_distance / (current_distance - next_distance);
+			output[output_count++] = V4(
+				current.x + (next.x - current.x) * t,
+				current.y + (next.y - current.y) * t,
+				current.z + (next.z - current.z) * t,
+				current.w + (next.w - current.w) * t
+			);
+		}
+	}
+	for (u32 i = 2; i < output_count; ++i) {
+		if (output[0].w > NEAR_EPSILON && output[i - 1].w > NEAR_EPSILON && output[i].w > NEAR_EPSILON) {
+			occlusion_emit_triangle(output[0], output[i - 1], output[i]);
+		}
+	}
+}
+
+void occlusion_add_occluder(i32 mesh_id, mat4 transform, float bend) {
+	if (mesh_id < 0 || mesh_id >= MAX_MESH) {
+		return;
+	}
+	Occluder_mesh* mesh = &occlusion.meshes[mesh_id];
+	mat4 model_view = multiply_mat4(occlusion.view, transform);
+	mat4 model_view_projection = multiply_mat4(occlusion.view_projection, transform);
+	for (u32 i = 0; i < mesh->vertex_count; ++i) {
+		v3 vertex = mesh->vertices[i];
+		if (bend != 0) {
+			// Vertices are bent where the gpu bends them, the triangles in between follow the same way
+			v4 view_position = transform_v4(model_view, V4(vertex.x, vertex.y, vertex.z, 1.0f));
+			vertex.y -= (view_position.x * view_position.x + view_position.z * view_position.z) * bend;
+		}
+		occlusion.clip_vertices[i] = transform_v4(model_view_projection, V4(vertex.x, vertex.y, vertex.z, 1.0f));
+	}
+	u32 previous_count = occlusion.triangle_count;
+	for (u32 i = 0; i + 2 < mesh->index_count; i += 3) {
+		v4 a = occlusion.clip_vertices[mesh->indices[i]];
+		v4 b = occlusion.clip_vertices[mesh->indices[i + 1]];
+		v4 c = occlusion.clip_vertices[mesh->indices[i + 2]];
+		// Trivially reject triangles entirely outside one of the side or far planes
+		if ((a.x > a.w && b.x > b.w && c.x > c.w) || (a.x < -a.w && b.x < -b.w && c.x < -c.w) ||
+			(a.y > a.w && b.y > b.w && c.y > c.w) || (a.y < -a.w && b.y < -b.w && c.y < -c.w) ||
+			(a.z > a.w && b.z > b.w && c.z > c.w)) {
+			continue;
+		}
+		if (a.z >= -a.w && b.z >= -b.w && c.z >= -c.w && a.w > NEAR_EPSILON && b.w > NEAR_EPSILON && c.w > NEAR_EPSILON) {
+			occlusion_emit_triangle(a, b, c);
+		}
+		else {
+			occlusion_clip_triangle(a, b, c);
+		}
+	}
+	occlusion.stats.occluder_triangles += occlusion.triangle_count - previous_count;
+}
+
+void occlusion_rasterize_tile(u32 tile) {
+	i32 tile_x = (tile % OCCLUSION_TILES_X) * OCCLUSION_TILE_WIDTH;
+	i32 tile_y = (tile / OCCLUSION_TILES_X) * OCCLUSION_TILE_HEIGHT;
+	i32 tile_max_x = tile_x + OCCLUSION_TILE_WIDTH - 1;
+	i32 tile_max_y = tile_y + OCCLUSION_TILE_HEIGHT - 1;
+
+	for (i32 y = tile_y; y <= tile_max_y; ++y) {
+		memset(&occlusion.depth[y * OCCLUSION_WIDTH + tile_x], 0, sizeof(float) * OCCLUSION_TILE_WIDTH);
+	}
+
+	for (u32 t = 0; t < occlusion.triangle_count; ++t) {
+		Occluder_triangle* triangle = &occlusion.triangles[t];
+		i32 min_x = triangle->min_x > tile_x ? triangle->min_x : tile_x;
+		i32 min_y = triangle->min_y > tile_y ? triangle->min_y : tile_y;
+		i32 max_x = triangle->max_x < tile_max_x ? triangle->max_x : tile_max_x;
+		i32 max_y = triangle->max_y < tile_max_y ? triangle->max_y : tile_max_y;
+		if (min_x > max_x || min_y > max_y) {
+			continue;
+		}
+
+		// Edge functions e = a * x + b * y + c, positive on the inside
+		float edge_a[3], edge_b[3], edge_c[3];
+		for (u32 i = 0; i < 3; ++i) {
+			u32 j = (i + 1) % 3;
+			edge_a[i] = triangle->y[i] - triangle->y[j];
+			edge_b[i] = triangle->x[j] - triangle->x[i];
+			edge_c[i] = -(edge_a[i] * triangle->x[i] + edge_b[i] * triangle->y[i]);
+		}
+		// Plane equation of the depth
+		float x10 = triangle->x[1] - triangle->x[0], y10 = triangle->y[1] - triangle->y[0], z10 = triangle->z[1] - triangle->z[0];
+		float x20 = triangle->x[2] - triangle->x[0], y20 = triangle->y[2] - triangle->y[0], z20 = triangle->z[2] - triangle->z[0];
+		float inverse_area = 1.0f / (x10 * y20 - x20 * y10);
+		float depth_dx = (z10 * y20 - z20 * y10) * inverse_area;
+		float depth_dy = (z20 * x10 - z10 * x20) * inverse_area;
+		float depth_c = triangle->z[0] - depth_dx * triangle->x[0] - depth_dy * triangle->y[0];
+
+		min_x &= ~3;	// Tiles start on a multiple of four, so this never leaves the tile
+#if USE_SSE
+		__m128 lane_offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+		__m128 zero = _mm_setzero_ps();
+		for (i32 y = min_y; y <= max_y; ++y) {
+			float* row = &occlusion.depth[y * OCCLUSION_WIDTH];
+			float center_y = y + 0.5f;
+			__m128 row_e0 = _mm_set1_ps(edge_b[0] * center_y + edge_c[0]);
+			__m128 row_e1 = _mm_set1_ps(edge_b[1] * center_y + edge_c[1]);
+			__m128 row_e2 = _mm_set1_ps(edge_b[2] * center_y + edge_c[2]);
+			__m128 row_depth = _mm_set1_ps(depth_dy * center_y + depth_c);
+			for (i32 x = min_x; x <= max_x; x += 4) {
+				__m128 center_x = _mm_add_ps(_mm_set1_ps((float)x), lane_offsets);
+				__m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a[0]), center_x), row_e0);
+				__m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a[1]), center_x), row_e1);
+				__m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(edge_a[2]), center_x), row_e2);
+				__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+				if (_mm_movemask_ps(inside) == 0) {
+					continue;
+				}
+				__m128 depth = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(depth_dx), center_x), row_depth);
+				__m128 current = _mm_load_ps(&row[x]);
+				__m128 nearest = _mm_max_ps(current, depth);
+				_mm_store_ps(&row[x], _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+			}
+		}
+#else
+		for (i32 y = min_y; y <= max_y; ++y) {
+			float* row = &occlusion.depth[y * OCCLUSION_WIDTH];
+			float center_y = y + 0.5f;
+			for (i32 x = min_x; x <= max_x; ++x) {
+				float center_x = x + 0.5f;
+				if (edge_a[0] * center_x + edge_b[0] * center_y + edge_c[0] < 0 ||
+					edge_a[1] * center_x + edge_b[1] * center_y + edge_c[1] < 0 ||
+					edge_a[2] * center_x + edge_b[2] * center_y + edge_c[2] < 0) {
+					continue;
+				}
+				float depth = depth_dx * center_x + depth_dy * center_y + depth_c;
+				if (depth > row[x]) {
+					row[x] = depth;
+				}
+			}
+		}
+#endif
+	}
+}
+
+void occlusion_rasterize_tiles() {
+	PROFILE_SCOPE("rasterize occluders");
+	while (1) {
+		u32 tile = __atomic_fetch_add(&occlusion.next_tile, 1, __ATOMIC_RELAXED);
+		if (tile >= OCCLUSION_TILE_COUNT) {
+			break;
+		}
+		occlusion_rasterize_tile(tile);
+	}
+}
+
+void* occlusion_worker(void* data) {
+	u32 seen_generation = 0;
+	profiler_set_thread_name("occlusion worker");
+	while (1) {
+		pthread_mutex_lock(&occlusion.mutex);
+		while (occlusion.generation == seen_generation && !occlusion.quit) {
+			pthread_cond_wait(&occlusion.work_ready, &occlusion.mutex);
+		}
+		if (occlusion.quit) {
+			pthread_mutex_unlock(&occlusion.mutex);
+			break;
+		}
+		seen_generation = occlusion.generation;
+		pthread_mutex_unlock(&occlusion.mutex);
+
+		occlusion_rasterize_tiles();
+
+		pthread_mutex_lock(&occlusion.mutex);
+		occlusion.finished_workers++;
+		if (occlusion.finished_workers == occlusion.worker_count) {
+			pthread_cond_signal(&occlusion.work_done);
+		}
+		pthread_mutex_unlock(&occlusion.mutex);
+	}
+	return NULL;
+}
+
+void occlusion_rasterize() {
+	u64 start = time_now_ns();
+
+	pthread_mutex_lock(&occlusion.mutex);
+	occlusion.next_tile = 0;
+	occlusion.finished_workers = 0;
+	occlusion.generation++;
+	pthread_cond_broadcast(&occlusion.work_ready);
+	pthread_mutex_unlock(&occlusion.mutex);
+
+	occlusion_rasterize_tiles();
+
+	pthread_mutex_lock(&occlusion.mutex);
+	while (occlusion.finished_workers < occlusion.worker_count) {
+		pthread_cond_wait(&occlusion.work_done, &occlusion.mutex);
+	}
+	pthread_mutex_unlock(&occlusion.mutex);
+
+	occlusion.stats.rasterize_ms = time_since_ms(start);
+}
+
+u8 occlusion_test_aabb(Aabb bounds) {
+	if (occlusion.triangle_count == 0) {
+		return 1;
+	}
+	float min_x = 1e30f, min_y = 1e30f, max_x = -1e30f, max_y = -1e30f;
+	float max_depth = 0;	// Of the nearest corner, as 1 / w
+	for (u32 i = 0; i < 8; ++i) {
+		v4 corner = V4(
+			(i & 1) ? bounds.max.x : bounds.min.x,
+			(i & 2) ? bounds.max.y : bounds.min.y,
+			(i & 4) ? bounds.max.z : bounds.min.z,
+			1.0f
+		);
+		v4 clip = transform_v4(occlusion.view_projection, corner);
+		if (clip.w <= NEAR_EPSILON || clip.z < -clip.w) {
+			return 1;	// Crosses the near plane, the camera is (almost) inside it
+		}
+		float inverse_w = 1.0f / clip.w;
+		float x = (clip.x * inverse_w * 0.5f + 0.5f) * OCCLUSION_WIDTH;
+		float y = (clip.y * inverse_w * 0.5f + 0.5f) * OCCLUSION_HEIGHT;
+		min_x = fminf(min_x, x);
+		min_y = fminf(min_y, y);
+		max_x = fmaxf(max_x, x);
+		max_y = fmaxf(max_y, y);
+		max_depth = fmaxf(max_depth, inverse_w);
+	}
+	// Every pixel the box touches, not just the covered centers
+	i32 first_x = (i32)clamp(floorf(min_x), 0.0f, (float)OCCLUSION_WIDTH);
+	i32 first_y = (i32)clamp(floorf(min_y), 0.0f, (float)OCCLUSION_HEIGHT);
+	i32 last_x = (i32)clamp(floorf(max_x), -1.0f, (float)(OCCLUSION_WIDTH - 1));
+	i32 last_y = (i32)clamp(floorf(max_y), -1.0f, (float)(OCCLUSION_HEIGHT - 1));
+	if (first_x > last_x || first_y > last_y) {
+		return 1;
+	}
+
+#if USE_SSE
+	__m128 box_depth = _mm_set1_ps(max_depth);
+	__m128 lanes = _mm_setr_ps(0, 1, 2, 3);
+	__m128 first = _mm_set1_ps((float)first_x);
+	__m128 last = _mm_set1_ps((float)last_x);
+	for (i32 y = first_y; y <= last_y; ++y) {
+		const float* row = &occlusion.depth[y * OCCLUSION_WIDTH];
+		for (i32 x = first_x & ~3; x <= last_x; x += 4) {
+			__m128 column = _mm_add_ps(_mm_set1_ps((float)x), lanes);
+			__m128 in_box = _mm_and_ps(_mm_cmpge_ps(column, first), _mm_cmple_ps(column, last));
+			__m128 not_hidden = _mm_cmple_ps(_mm_load_ps(&row[x]), box_depth);
+			if (_mm_movemask_ps(_mm_and_ps(in_box, not_hidden))) {
+				return 1;
+			}
+		}
+	}
+#else
+	for (i32 y = first_y; y <= last_y; ++y) {
+		const float* row = &occlusion.depth[y * OCCLUSION_WIDTH];
+		for (i32 x = first_x; x <= last_x; ++x) {
+			if (row[x] <= max_depth) {
+				return 1;
+			}
+		}
+	}
+#endif
+	return 0;
+}
+
+const float* occlusion_get_depth_buffer() {
+	return occlusion.depth;
+}
+
+Occlusion_stats occlusion_get_stats() {
+	return occlusion.stats;
+}
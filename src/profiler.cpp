@@ -0,0 +1,132 @@
+// profiler.cpp
+// scoped cpu timing, every thread records into its own buffer and the whole run is written out as a chrome trace
+
+#include <algorithm>
+
+#include "common.hpp"
+#include "profiler.hpp"
+
+#if USE_PROFILER
+
+typedef struct Profiler {
+	Profile_thread threads[MAX_PROFILER_THREADS];
+	u32 thread_count;	// Claimed atomically, a thread takes a slot the first time it records or is named
+	u8 active;
+	u64 start;
+} Profiler;
+
+static Profiler profiler = {};
+static __thread Profile_thread* local_thread = NULL;
+
+static Profile_thread* profiler_thread();
+
+Profile_thread* profiler_thread() {
+	if (local_thread) {
+		return local_thread;
+	}
+	u32 id = __atomic_fetch_add(&profiler.thread_count, 1, __ATOMIC_RELAXED);
+	if (id >= MAX_PROFILER_THREADS) {
+		return NULL;
+	}
+	local_thread = &profiler.threads[id];
+	local_thread->id = id;
+	if (!local_thread->name[0]) {
+		snprintf(local_thread->name, PROFILER_THREAD_NAME_SIZE, "thread %u", id);
+	}
+	return local_thread;
+}
+
+void profiler_start() {
+	profiler.start = time_now_ns();
+	__atomic_store_n(&profiler.active, 1, __ATOMIC_RELEASE);
+}
+
+u8 profiler_active() {
+	return __atomic_load_n(&profiler.active, __ATOMIC_RELAXED);
+}
+
+void profiler_record(const char* name, u64 start, u64 end) {
+	Profile_thread* thread = profiler_thread();
+	if (!thread) {
+		return;
+	}
+	if (!thread->events) {
+		// Plain malloc, the m_malloc counters are not safe to update from worker threads
+		thread->events = (Profile_event*)malloc(sizeof(Profile_event) * PROFILER_THREAD_EVENTS);
+		if (!thread->events) {
+			return;
+		}
+	}
+	u32 count = thread->count;
+	if (count >= PROFILER_THREAD_EVENTS) {
+		thread->dropped++;
+		return;
+	}
+	thread->events[count] = (Profile_event) {
+		.name = name,
+		.start = start,
+		.end = end,
+	};
+	// The writer only reads events below the published count
+	__atomic_store_n(&thread->count, count + 1, __ATOMIC_RELEASE);
+}
+
+void profiler_set_thread_name(const char* name) {
+	Profile_thread* thread = profiler_thread();
+	if (thread) {
+		snprintf(thread->name, PROFILER_THREAD_NAME_SIZE, "%s", name);
+	}
+}
+
+// Complete ("X") events, nested scopes on one thread stack up by their times alone
+i32 profiler_write_trace(const char* path) {
+	__atomic_store_n(&profiler.active, 0, __ATOMIC_RELEASE);
+	FILE* fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to write trace '%s'\n", path);
+		return Error;
+	}
+	u32 thread_count = std::min(__atomic_load_n(&profiler.thread_count, __ATOMIC_ACQUIRE), (u32)MAX_PROFILER_THREADS);
+	u32 event_count = 0;
+	u32 dropped = 0;
+	u8 first = 1;
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	for (u32 i = 0; i < thread_count; ++i) {
+		Profile_thread* thread = &profiler.threads[i];
+		fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": ", first ? "" : ",\n", i);
+		write_json_string(fp, thread->name);
+		fprintf(fp, "}}");
+		first = 0;
+
+		u32 count = __atomic_load_n(&thread->count, __ATOMIC_ACQUIRE);
+		for (u32 e = 0; e < count; ++e) {
+			Profile_event* event = &thread->events[e];
+			if (event->start < profiler.start) {
+				continue;
+			}
+			fprintf(fp, ",\n{\"name\": ");
+			write_json_string(fp, event->name);
+			fprintf(fp, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+				i, (event->start - profiler.start) / 1000.0, (event->end - event->start) / 1000.0);
+		}
+		event_count += count;
+		dropped += thread->dropped;
+	}
+	fprintf(fp, "\n]}\n");
+	fclose(fp);
+	fprintf(stdout, "Trace written to '%s': %u scopes on %u threads, %u dropped\n", path, event_count, thread_count, dropped);
+	return NoError;
+}
+
+// Only once every recording thread has stopped, their buffers go away
+void profiler_destroy() {
+	u32 thread_count = std::min(profiler.thread_count, (u32)MAX_PROFILER_THREADS);
+	for (u32 i = 0; i < thread_count; ++i) {
+		free(profiler.threads[i].events);
+		profiler.threads[i].events = NULL;
+		profiler.threads[i].count = 0;
+	}
+	profiler.active = 0;
+}
+
+#endif
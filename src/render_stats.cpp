@@ -0,0 +1,33 @@
+// render_stats.cpp
+// per-frame counters of what the renderer hands to opengl, bumped wherever draws are issued or data is uploaded
+
+#include "common.hpp"
+#include "gl_state.hpp"
+#include "render_stats.hpp"
+
+static Render_stats render_stats = {};
+
+void render_stats_count_draw(u64 triangles) {
+	render_stats.draw_calls++;
+	render_stats.triangles += triangles;
+}
+
+void render_stats_count_uniform() {
+	render_stats.uniform_uploads++;
+}
+
+void render_stats_count_upload(u64 bytes) {
+	render_stats.bytes_uploaded += bytes;
+}
+
+void render_stats_reset() {
+	render_stats = (Render_stats) {};
+}
+
+Render_stats render_stats_end_frame(Gl_state_counters* state_counters) {
+	Render_stats stats = render_stats;
+	stats.program_switches = state_counters->issued[GL_STATE_PROGRAM];
+	stats.texture_binds = state_counters->issued[GL_STATE_TEXTURE];
+	render_stats = (Render_stats) {};
+	return stats;
+}
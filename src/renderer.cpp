@@ -2,6 +2,7 @@
 
 #include <GL/glew.h>
 #include <string>
+#include <algorithm>
 
 #if defined(__APPLE__)
 	#include <OpenGL/gl.h>
@@ -15,8 +16,21 @@
 #include "image.hpp"
 #include "window.hpp"
 #include "camera.hpp"
+#include "gl_state.hpp"
+#include "render_stats.hpp"
+#include "occlusion.hpp"
+#include "frustum.hpp"
+#include "shader_cache.hpp"
+#include "profiler.hpp"
+#include "startup_trace.hpp"
 #include "renderer.hpp"
 
+Bloom_preset bloom_presets[MAX_BLOOM_QUALITY] = {
+	{"low", 4, 0, 1.0f},
+	{"medium", MAX_BLOOM_LEVELS, 0, 1.0f},
+	{"high", MAX_BLOOM_LEVELS, 1, 1.0f},
+};
+
 mat4 projection;
 mat4 ortho_projection;
 mat4 view;
@@ -32,14 +46,88 @@ Render_state render_state = {};
     flare_shader = 0,
 	brightness_extract_shader = 0;*/
 
-Model cube_model;
-Fbo* current_fbo = NULL;
-
 #define SHADER_ERROR_BUFFER_SIZE 512
+#define SHADER_DEFINES_SIZE 256
+
+#define BLOOM_EXTRACT_FACTOR 0.2f
+#define BLOOM_INTENSITY 0.5f
+
+#define CLUSTER_TEXTURE_UNIT 6	// Light, grid and index buffers follow the six material textures
+
+#define BATCH_UP_EPSILON 0.000001f	// Squared, how far a batched ground mesh's y axis may be from the world's
+#define FLARE_ATTRIB_INSTANCE 1	// Per flare attribute, the flare vao has no uv to share the location with
+
+// Inputs of a full screen pass, resolved to textures once the frame graph has assigned targets
+typedef struct Fullscreen_pass {
+	i32 source;
+	i32 source1;	// Bound as texture1 for the combine shader, -1 when unused
+	Fbo_attributes attributes;
+} Fullscreen_pass;
+
+// A program on its way through the compiler. Every program is submitted before the first status query,
+// so drivers with parallel compilation can work on all of them at once
+typedef struct Shader_build {
+	const char* path;
+	char name[MAX_PATH_SIZE];	// Path plus the variant, used for the cache and error messages
+	char defines[SHADER_DEFINES_SIZE];	// Inserted right after the #version line of both stages
+	Buffer vert_source;
+	Buffer frag_source;
+	u64 key;
+	u32 vert_shader;
+	u32 frag_shader;
+	u32 program;
+	u8 from_cache;
+} Shader_build;
+
+static const char* bloom_level_names[MAX_BLOOM_LEVELS] = {
+	"bloom 1/2",
+	"bloom 1/4",
+	"bloom 1/8",
+	"bloom 1/16",
+	"bloom 1/32",
+};
 
 u32 quad_vbo = 0;
 u32 quad_vao = 0;
 
+u32 cube_vbo = 0;
+u32 cube_vao = 0;
+#define cube_vertex_count (ARR_SIZE(cube_vertices) / 3)
+
+// Attribute names bound to fixed locations before linking, so every program agrees with the mesh pool vao
+static const struct {
+	const char* name;
+	u32 location;
+} attribute_locations[] = {
+	{"vertex",			0},	// Screen quad, shares location 0 with position
+	{"position",		POOL_ATTRIB_POSITION},
+	{"uv",				POOL_ATTRIB_UV},
+	{"normal",			POOL_ATTRIB_NORMAL},
+	{"tangent",			POOL_ATTRIB_TANGENT},
+	{"bitangent",		POOL_ATTRIB_BITANGENT},
+	{"model_matrix",	POOL_ATTRIB_MODEL},
+	{"normal_matrix",	POOL_ATTRIB_NORMAL_MATRIX},
+	{"flare_instance",	FLARE_ATTRIB_INSTANCE},
+};
+
+// Six flares, three from the center to the screen towards the light
+// and three towards the opposite edge of the screen
+static const float flare_instances[MAX_FLARES][4] = {
+	// position,	size,	opacity,	texture slot
+	{ 0.95f,		0.75f,	0.75f,		0},
+	{ 0.60f,		0.30f,	0.80f,		2},
+	{ 0.33f,		0.12f,	1.00f,		1},
+	{ 0.25f,		0.25f,	0.85f,		1},
+	{-0.25f,		0.12f,	0.60f,		1},
+	{-0.60f,		0.15f,	0.40f,		1},
+};
+
+static const u32 flare_textures[MAX_FLARE_TEXTURES] = {
+	TEXTURE_LENSFLARE_1,
+	TEXTURE_LENSFLARE_2,
+	TEXTURE_LENSFLARE_3,
+};
+
 static float quad_vertices[] = {
 	// vertex,	uv
 	0.0f, 1.0f, 0.0f, 1.0f,
@@ -101,99 +189,158 @@ float cube_vertices[] = {
 
 static void opengl_initialize(Render_state* renderer);
 static i32 render_state_initialize(Render_state* renderer);
-static i32 shader_compile_from_source(const char* vert_source, const char* frag_source, u32* program_out);
-static i32 shader_compile_from_file(const char* path, u32* program_out);
+static void shader_source(u32 shader, const char* source, const char* defines);
+static i32 shader_submit(Shader_build* build);
+static i32 shader_finish(Shader_build* build, u32* program_out);
 static void upload_quad_data();
+static void upload_cube_data();
 static i32 upload_texture(Render_state* renderer, Image* image, u32* texture_id);
 static i32 upload_skybox_texture(Render_state* renderer, u32 skybox_id, u32* texture_id);
-static i32 upload_model(Model* model, float* vertices, u32 vertex_count);
-static i32 upload_model(Model* model, Mesh* mesh);
-static void unload_model(Model* model);
+static i32 upload_model(Render_state* renderer, Model* model, Mesh* mesh);
+static void unload_model(Render_state* renderer, Model* model);
 static void unload_texture(u32* texture_id);
-static void store_attribute(Model* model, i32 attribute_index, u32 count, u32 size, void* data);
-static void fbos_initialize(Render_state* renderer, i32 width, i32 height);
-static void fbos_unload(Render_state* renderer);
-static void fbo_initialize(Fbo* fbo, i32 width, i32 height, i32 filter_method);
-static void fbo_unload(Fbo* fbo);
+static u32 depth_program(Render_state* renderer, Material* material);
+static void set_cull_mode(u8 cull);
+static void set_material_state(Material* material, u8 depth_write);
+static void depth_prepass_draw(Render_state* renderer, Draw_item** items, u32* programs, u32 opaque_count);
+static void depth_prepass_read_queries(Depth_prepass* prepass);
+static void scene_statistics_read_queries(Scene_statistics* statistics);
+static void shade_draws(Render_state* renderer, Draw_item** items, u32 first, u32 end, u8 depth_write);
+static void queue_static_batches(Render_state* renderer, Draw_list* list);
+static void submit_draws(Render_state* renderer, i32 width, i32 height);
+static void draw_skybox(Render_state* renderer);
+static void flares_initialize(Render_state* renderer);
+static void flares_probe(Render_state* renderer, i32 width, i32 height);
+static void flares_draw(Render_state* renderer, i32 width, i32 height);
+static void flares_destroy(Render_state* renderer);
+static void scene_pass(Frame_graph* graph, i32 pass, void* data);
+static void fullscreen_pass(Frame_graph* graph, i32 pass, void* data);
+static i32 add_fullscreen_pass(Frame_graph* graph, Fullscreen_pass* data, const char* name, i32 source, i32 source1, i32 target, u8 load, Fbo_attributes attr);
+static void bloom_cost(Bloom_preset* preset, i32 width, i32 height, double* pixels, double* fetches);
+static void execute_frame_graph(Render_state* renderer);
+static Draw_list* draw_list(Render_state* renderer);
+static void capture_scene(Draw_list* list, Scene* scene);
+static void apply_settings(Render_state* renderer, Render_settings* settings);
+static void build_frame_graph(Render_state* renderer, i32 width, i32 height);
+static void render_draw_list(Render_state* renderer, Draw_list* list);
+static void publish_frame(Render_state* renderer);
+static void draw_hud(Render_state* renderer);
+static void* render_thread_main(void* data);
+
+// #version has to stay the first statement, so the defines go in between it and the rest of the source
+void shader_source(u32 shader, const char* source, const char* defines) {
+	const char* body = source;
+	const char* version = strstr(source, "#version");
+	if (version) {
+		const char* line_end = strchr(version, '\n');
+		body = line_end ? line_end + 1 : version + strlen(version);
+	}
+	const char* sources[] = {source, defines, body};
+	i32 lengths[] = {(i32)(body - source), (i32)strlen(defines), -1};
+	glShaderSource(shader, 3, sources, lengths);
+}
 
-i32 shader_compile_from_source(const char* vert_source, const char* frag_source, u32* program_out) {
+i32 shader_submit(Shader_build* build) {
 	i32 result = NoError;
-	i32 compile_report = 0;
-	u32 program = 0;
-	char err_log[SHADER_ERROR_BUFFER_SIZE] = {};
-	u32 vert_shader = 0, frag_shader = 0;
-
-	// Create and compile vertex shader
-	vert_shader = glCreateShader(GL_VERTEX_SHADER);
-	glShaderSource(vert_shader, 1, &vert_source, NULL);
-	glCompileShader(vert_shader);
-
-	// Fetch compilation status of vertex shader
-	glGetShaderiv(vert_shader, GL_COMPILE_STATUS, &compile_report);
-	if (!compile_report) {
-		glGetShaderInfoLog(vert_shader, SHADER_ERROR_BUFFER_SIZE, NULL, err_log);
-		fprintf(stderr, "error in vertex shader: %s\n", err_log);
-		result = Error;
-		goto done;
+	Shader_cache* cache = &render_state.shader_cache;
+	if (build->name[0] == '\0') {
+		snprintf(build->name, MAX_PATH_SIZE, "%s", build->path);
 	}
-
-	// Create and compile fragment shader
-	frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	glShaderSource(frag_shader, 1, &frag_source, NULL);
-	glCompileShader(frag_shader);
-
-	// Fetch compilation status of fragment shader
-	glGetShaderiv(frag_shader, GL_COMPILE_STATUS, &compile_report);
-	if (!compile_report) {
-		glGetShaderInfoLog(frag_shader, SHADER_ERROR_BUFFER_SIZE, NULL, err_log);
-		fprintf(stderr, "error in fragment shader: %s\n", err_log);
-		result = Error;
-		goto done;
+	char vert_path[MAX_PATH_SIZE] = {0};
+	char frag_path[MAX_PATH_SIZE] = {0};
+	snprintf(vert_path, MAX_PATH_SIZE, "%s.vert", build->path);
+	snprintf(frag_path, MAX_PATH_SIZE, "%s.frag", build->path);
+	// Reading, hashing and handing the sources to the driver. Compiling may happen here or only once the status is asked for
+	i32 event = startup_trace_begin("shader submit", build->name);
+	if ((result = read_and_null_terminate_file(vert_path, &build->vert_source)) != NoError) {
+		startup_trace_end(event, 0);
+		return result;
 	}
-
-	program = glCreateProgram();
-	glAttachShader(program, vert_shader);
-	glAttachShader(program, frag_shader);
-	glLinkProgram(program);
-
-	glGetProgramiv(program, GL_VALIDATE_STATUS, &compile_report);
-#if 0
-	if (!compile_report) {
-		glGetProgramInfoLog(program, SHADER_ERROR_BUFFER_SIZE, NULL, err_log);
-		fprintf(stderr, "shader compile error: %s\n", err_log);
-		goto done;
+	if ((result = read_and_null_terminate_file(frag_path, &build->frag_source)) != NoError) {
+		startup_trace_end(event, 0);
+		return result;
+	}
+	u64 source_bytes = build->vert_source.size + build->frag_source.size;
+
+	// Attribute locations are bound before linking, so they are as much part of the program as the sources
+	build->key = shader_cache_key(cache, build->vert_source.data, build->frag_source.data);
+	for (u32 i = 0; i < ARR_SIZE(attribute_locations); ++i) {
+		char binding[64] = {0};
+		snprintf(binding, sizeof(binding), "%s=%u", attribute_locations[i].name, attribute_locations[i].location);
+		build->key = shader_cache_hash(build->key, binding);
+	}
+	build->key = shader_cache_hash(build->key, build->defines);
+	if ((build->program = shader_cache_load(cache, build->name, build->key)) != 0) {
+		build->from_cache = 1;
+		startup_trace_end(event, source_bytes);
+		return NoError;
 	}
-#endif
-
-	*program_out = program;
 
-done:
-	if (vert_shader > 0)
-		glDeleteShader(vert_shader);
-	if (frag_shader > 0)
-		glDeleteShader(frag_shader);
-	return result;
+	printf("Compiling shader %s...\n", build->name);
+	build->vert_shader = glCreateShader(GL_VERTEX_SHADER);
+	shader_source(build->vert_shader, build->vert_source.data, build->defines);
+	glCompileShader(build->vert_shader);
+	build->frag_shader = glCreateShader(GL_FRAGMENT_SHADER);
+	shader_source(build->frag_shader, build->frag_source.data, build->defines);
+	glCompileShader(build->frag_shader);
+
+	// Linking right away is fine, a failed compile just makes the link fail too
+	build->program = glCreateProgram();
+	glAttachShader(build->program, build->vert_shader);
+	glAttachShader(build->program, build->frag_shader);
+	for (u32 i = 0; i < ARR_SIZE(attribute_locations); ++i) {
+		glBindAttribLocation(build->program, attribute_locations[i].location, attribute_locations[i].name);
+	}
+	if (cache->enabled) {
+		glProgramParameteri(build->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+	glLinkProgram(build->program);
+	startup_trace_end(event, source_bytes);
+	return NoError;
 }
 
-i32 shader_compile_from_file(const char* path, u32* program_out) {
+i32 shader_finish(Shader_build* build, u32* program_out) {
 	i32 result = NoError;
-
-	Buffer vert_source = {};
-	Buffer frag_source = {};
-	char vert_path[MAX_PATH_SIZE] = {0};
-	char frag_path[MAX_PATH_SIZE] = {0};
-	snprintf(vert_path, MAX_PATH_SIZE, "%s.vert", path);
-	snprintf(frag_path, MAX_PATH_SIZE, "%s.frag", path);
-	if ((result = read_and_null_terminate_file(vert_path, &vert_source)) != NoError) {
-		goto done;
-	}
-	if ((result = read_and_null_terminate_file(frag_path, &frag_source)) != NoError) {
-		goto done;
-	}
-	result = shader_compile_from_source(vert_source.data, frag_source.data, program_out);
-done:
-	buffer_free(&vert_source);
-	buffer_free(&frag_source);
+	i32 status = 0;
+	char err_log[SHADER_ERROR_BUFFER_SIZE] = {};
+	i32 event = startup_trace_begin("shader finish", build->name);
+
+	if (build->program && !build->from_cache) {
+		// First status query, this is where we wait if the compiler is still busy with the program
+		glGetProgramiv(build->program, GL_LINK_STATUS, &status);
+		if (!status) {
+			glGetShaderiv(build->vert_shader, GL_COMPILE_STATUS, &status);
+			if (!status) {
+				glGetShaderInfoLog(build->vert_shader, SHADER_ERROR_BUFFER_SIZE, NULL, err_log);
+				fprintf(stderr, "error in vertex shader %s: %s\n", build->name, err_log);
+			}
+			glGetShaderiv(build->frag_shader, GL_COMPILE_STATUS, &status);
+			if (!status) {
+				glGetShaderInfoLog(build->frag_shader, SHADER_ERROR_BUFFER_SIZE, NULL, err_log);
+				fprintf(stderr, "error in fragment shader %s: %s\n", build->name, err_log);
+			}
+			glGetProgramInfoLog(build->program, SHADER_ERROR_BUFFER_SIZE, NULL, err_log);
+			fprintf(stderr, "shader link error %s: %s\n", build->name, err_log);
+			glDeleteProgram(build->program);
+			build->program = 0;
+			result = Error;
+		}
+		else {
+			shader_cache_store(&render_state.shader_cache, build->name, build->key, build->program);
+		}
+	}
+	if (build->vert_shader > 0)
+		glDeleteShader(build->vert_shader);
+	if (build->frag_shader > 0)
+		glDeleteShader(build->frag_shader);
+	buffer_free(&build->vert_source);
+	buffer_free(&build->frag_source);
+
+	if (build->program == 0) {
+		result = Error;
+	}
+	*program_out = build->program;
+	startup_trace_end(event, 0);
 	return result;
 }
 
@@ -203,11 +350,24 @@ void upload_quad_data() {
 	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), quad_vertices, GL_STATIC_DRAW);
 
-	glBindVertexArray(quad_vao);
+	gl_state_bind_vertex_array(quad_vao);
 	glEnableVertexAttribArray(0);
 	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), NULL);
 	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindVertexArray(0);
+	gl_state_bind_vertex_array(0);
+}
+
+void upload_cube_data() {
+	glGenVertexArrays(1, &cube_vao);
+	glGenBuffers(1, &cube_vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, cube_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices, GL_STATIC_DRAW);
+
+	gl_state_bind_vertex_array(cube_vao);
+	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), NULL);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	gl_state_bind_vertex_array(0);
 }
 
 i32 upload_texture(Render_state* renderer, Image* image, u32* texture_id) {
@@ -215,7 +375,7 @@ i32 upload_texture(Render_state* renderer, Image* image, u32* texture_id) {
 	i32 texture_format = image->bytes_per_pixel == 4 ? GL_RGBA : GL_RGB;
 
 	glGenTextures(1, texture_id);
-	glBindTexture(GL_TEXTURE_2D, *texture_id);
+	gl_state_bind_texture(0, GL_TEXTURE_2D, *texture_id);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -223,7 +383,7 @@ i32 upload_texture(Render_state* renderer, Image* image, u32* texture_id) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
 	glTexImage2D(GL_TEXTURE_2D, 0, texture_format, image->width, image->height, 0, texture_format, GL_UNSIGNED_BYTE, image->buffer);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	render_stats_count_upload((u64)image->width * image->height * image->bytes_per_pixel);
 	return result;
 }
 
@@ -232,7 +392,7 @@ i32 upload_mipmap_texture(Render_state* renderer, Image* image, u32* texture_id)
 	i32 texture_format = image->bytes_per_pixel == 4 ? GL_RGBA : GL_RGB;
 
 	glGenTextures(1, texture_id);
-	glBindTexture(GL_TEXTURE_2D, *texture_id);
+	gl_state_bind_texture(0, GL_TEXTURE_2D, *texture_id);
 
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -240,17 +400,18 @@ i32 upload_mipmap_texture(Render_state* renderer, Image* image, u32* texture_id)
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 
 	gluBuild2DMipmaps(GL_TEXTURE_2D, texture_format, image->width, image->height, texture_format, GL_UNSIGNED_BYTE, image->buffer);
-	glBindTexture(GL_TEXTURE_2D, 0);
+	render_stats_count_upload((u64)image->width * image->height * image->bytes_per_pixel);
 	return result;
 }
 
 i32 upload_skybox_texture(Render_state* renderer, u32 skybox_id, u32* texture_id) {
 	glGenTextures(1, texture_id);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, *texture_id);
+	gl_state_bind_texture(0, GL_TEXTURE_CUBE_MAP, *texture_id);
 
 	for (i32 i = 0; i < 6; i++) {
 		Image* image = &renderer->resources.skybox_images[i + skybox_id];
 		glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGBA, image->width, image->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image->buffer);
+		render_stats_count_upload((u64)image->width * image->height * 4);
 	}
 
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -258,150 +419,38 @@ i32 upload_skybox_texture(Render_state* renderer, u32 skybox_id, u32* texture_id
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-
-	glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
-	return NoError;
-}
-
-i32 upload_model(Model* model, float* vertices, u32 vertex_count) {
-	model->draw_count = vertex_count / 3;
-
-	glGenVertexArrays(1, &model->vao);
-	glBindVertexArray(model->vao);
-
-	glGenBuffers(1, &model->vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, model->vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertex_count * sizeof(float), vertices, GL_STATIC_DRAW);
-
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, 3 * sizeof(float), GL_FALSE, NULL);
-	glBindVertexArray(0);
 	return NoError;
 }
 
-i32 upload_model(Model* model, Mesh* mesh) {
-	model->draw_count = mesh->vertex_index_count;	// We are using indexed rendering, which means that the draw count is equal to the amount of indices on the mesh
-
-	glGenVertexArrays(1, &model->vao);
-	glBindVertexArray(model->vao);
-
-	glGenBuffers(1, &model->ebo);
-
-	store_attribute(model, 0, 3, mesh->vertex_count * sizeof(v3), &mesh->vertices[0]);
-	store_attribute(model, 1, 2, mesh->uv_count * sizeof(v2), &mesh->uv[0]);
-	store_attribute(model, 2, 3, mesh->normal_count * sizeof(v3), &mesh->normals[0]);
-	store_attribute(model, 3, 3, mesh->tangent_count * sizeof(v3), &mesh->tangents[0]);
-	store_attribute(model, 4, 3, mesh->bitangent_count * sizeof(v3), &mesh->bitangents[0]);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, model->ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh->vertex_index_count * sizeof(u32), &mesh->vertex_indices[0], GL_STATIC_DRAW);
-
-	glBindVertexArray(0);
-	return NoError;
+i32 upload_model(Render_state* renderer, Model* model, Mesh* mesh) {
+	i32 result = mesh_pool_upload(&renderer->mesh_pool, mesh, &model->vertices, &model->indices);
+	model->draw_count = model->indices.count;	// We are using indexed rendering, which means that the draw count is equal to the amount of indices on the mesh
+	model->bounds = mesh->bounds;
+	model->sphere = mesh->sphere;
+	return result;
 }
 
-void unload_model(Model* model) {
-	glDeleteVertexArrays(1, &model->vao);
-	glDeleteVertexArrays(1, &model->vbo);
-	glDeleteBuffers(1, &model->ebo);
+void unload_model(Render_state* renderer, Model* model) {
+	mesh_pool_free(&renderer->mesh_pool, model->vertices, model->indices);
+	model->vertices = model->indices = (Pool_range) {};
+	model->draw_count = 0;
 }
 
 void unload_texture(u32* texture_id) {
+	gl_state_forget_texture(*texture_id);
 	glDeleteTextures(1, texture_id);
 }
 
-void store_attribute(Model* model, i32 attribute_index, u32 count, u32 size, void* data) {
-	glEnableVertexAttribArray(attribute_index);
-	glGenBuffers(1, &model->vbo);
-	glBindBuffer(GL_ARRAY_BUFFER, model->vbo);
-	glBufferData(GL_ARRAY_BUFFER, size, data, GL_STATIC_DRAW);
-	glVertexAttribPointer(attribute_index, count, GL_FLOAT, GL_FALSE, 0, NULL);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-}
-
-void fbos_initialize(Render_state* renderer, i32 width, i32 height) {
-	for (i32 i = 0; i < MAX_FBO; ++i) {
-		Fbo* fbo = &renderer->fbos[i];
-#if 1
-		if (i == FBO_H_BLUR || i == FBO_V_BLUR || i == FBO_BRIGHTNESS_EXTRACT) {
-			fbo_initialize(fbo, width, height, GL_LINEAR);
-		}
-		else {
-			fbo_initialize(fbo, width, height, GL_NEAREST);
-		}
-#else
-		fbo_initialize(fbo, width, height, GL_NEAREST);
-#endif
-		renderer->fbo_count++;
-	}
-}
-
-void fbos_unload(Render_state* renderer) {
-	for (i32 i = 0; i < MAX_FBO; ++i) {
-		Fbo* fbo = &renderer->fbos[i];
-		fbo_unload(fbo);
-	}
-	renderer->fbo_count = 0;
-}
-
-void fbo_initialize(Fbo* fbo, i32 width, i32 height, i32 filter_method) {
-	fbo->width = width;
-	fbo->height = height;
-
-	glGenFramebuffers(1, &fbo->fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo->fbo);
-
-	glGenTextures(1, &fbo->texture);
-	glBindTexture(GL_TEXTURE_2D, fbo->texture);
-
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, width, height, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter_method);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter_method);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);	// TODO: Other wrapping
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	glGenTextures(1, &fbo->depth);
-	glBindTexture(GL_TEXTURE_2D, fbo->depth);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_BYTE, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	// NOTE(lucas): Was GL_CLAMP_TO_EDGE
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, fbo->texture, 0);
-	glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, fbo->depth, 0);
-
-	GLenum draw_buffers[] = {
-		GL_COLOR_ATTACHMENT0,
-		GL_DEPTH_ATTACHMENT,
-	};
-	glDrawBuffers(2, draw_buffers);
-
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, fbo->fbo);
-	GLenum err = glCheckFramebufferStatus(GL_DRAW_FRAMEBUFFER);
-	if (err != GL_FRAMEBUFFER_COMPLETE) {
-		printf("FBO error: %i\n", err);
-	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-void fbo_unload(Fbo* fbo) {
-	glDeleteTextures(1, &fbo->texture);
-	glDeleteTextures(1, &fbo->depth);
-	glDeleteFramebuffers(1, &fbo->fbo);
-	fbo->width = 0;
-	fbo->height = 0;
-}
-
 void opengl_initialize(Render_state* renderer) {
-	glEnable(GL_BLEND);
+	gl_state_invalidate();
 	glEnable(GL_TEXTURE_2D);
-    // Disabled, we want our sprites to work!
-	//glEnable(GL_CULL_FACE);
-	//glCullFace(GL_BACK); 
-	glEnable(GL_DEPTH_TEST);
+	// Blending and culling are per material in the scene pass, and set by every other pass that draws
+	gl_state_set_blend(0);
+	gl_state_set_cull(0);
+	gl_state_set_cull_face(GL_BACK);
+	gl_state_set_depth_test(1);
 	glAlphaFunc(GL_GREATER, 1);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state_set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 	glEnable(GL_TEXTURE_GEN_S);
 	glEnable(GL_TEXTURE_GEN_R);
 	glEnable(GL_TEXTURE_GEN_T);
@@ -409,53 +458,126 @@ void opengl_initialize(Render_state* renderer) {
 	glEnable(GL_FRAMEBUFFER_SRGB);
 
 	renderer->depth_func = GL_LESS;
-	glDepthFunc(renderer->depth_func);
+	gl_state_set_depth_func(renderer->depth_func);
 }
 
 i32 render_state_initialize(Render_state* renderer) {
 	opengl_initialize(renderer);
 	upload_quad_data();
+	upload_cube_data();
 	Resources* res = &renderer->resources;
 	renderer->texture_count = 0;
 	renderer->model_count = 0;
 	renderer->cube_map_count = 0;
 
+	// Shaders go first, so the driver can compile them while resources are loaded and uploaded
+	static Shader_build builds[MAX_SHADER];
+	u8 parallel = 0;
+	u64 shader_start = time_now_ns();
+	shader_cache_initialize(&renderer->shader_cache);
+	if (GLEW_KHR_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsKHR(0xffffffff);	// Let the driver pick the thread count
+		parallel = 1;
+	}
+	else if (GLEW_ARB_parallel_shader_compile) {
+		glMaxShaderCompilerThreadsARB(0xffffffff);
+		parallel = 1;
+	}
+	for (u32 i = 0; i < MAX_SHADER; i++) {
+		builds[i] = (Shader_build) {
+			.path = shader_path[i],
+		};
+		shader_submit(&builds[i]);
+	}
+	float submit_ms = time_since_ms(shader_start);
+
 	resources_initialize(res);
 	resources_load(res);
 
 	for (u32 i = 0; i < res->image_count; i++) {
 		Image* image = &res->images[i];
 		u32* texture_id = &renderer->textures[i];
+		i32 event = startup_trace_begin("texture upload", texture_path[i]);
 		upload_mipmap_texture(renderer, image, texture_id);
+		startup_trace_end(event, (u64)image->width * image->height * image->bytes_per_pixel);
 		renderer->texture_count++;
 	}
 
 	for (u32 i = 0; i < res->skybox_count / 6; i++) {
 		u32* cube_map_id = &renderer->cube_maps[i];
+		i32 event = startup_trace_begin("cube map upload", skybox_path[i * 6]);
 		upload_skybox_texture(renderer, i * 6, cube_map_id);
+		u64 bytes = 0;
+		for (u32 face = 0; face < 6; face++) {
+			bytes += (u64)res->skybox_images[i * 6 + face].width * res->skybox_images[i * 6 + face].height * 4;
+		}
+		startup_trace_end(event, bytes);
 		renderer->cube_map_count++;
 	}
 
+	// Size the shared buffers to fit every mesh up front, so loading never has to grow them
+	u32 total_vertices = 0;
+	u32 total_indices = 0;
+	for (u32 i = 0; i < res->mesh_count; i++) {
+		total_vertices += res->meshes[i].vertex_count;
+		total_indices += res->meshes[i].vertex_index_count;
+	}
+	stream_buffer_initialize(&renderer->stream, STREAM_REGION_SIZE);
+	mesh_pool_initialize(&renderer->mesh_pool, total_vertices, total_indices, &renderer->stream);
+	renderer->building = NULL;
+	renderer->frame = NULL;
+
 	for (u32 i = 0; i < res->mesh_count; i++) {
 		Mesh* mesh = &res->meshes[i];
 		Model* model = &renderer->models[i];
-		upload_model(model, mesh);
+		i32 event = startup_trace_begin("mesh upload", mesh_path[i]);
+		upload_model(renderer, model, mesh);
+		occlusion_add_mesh(i, mesh);
+		startup_trace_end(event, (u64)model->vertices.count * sizeof(Pool_vertex) + (u64)model->indices.count * sizeof(u32));
 		renderer->model_count++;
 	}
+	mesh_pool_print_stats(&renderer->mesh_pool);
 
-    for (int i = 0; i < MAX_SHADER; i++) {
-        printf("Compiling shader %s...\n", shader_path[i]);
-        shader_compile_from_file(shader_path[i], &renderer->shaders[i]);
-    }
-
-	renderer->fbo_count = 0;
-	upload_model(&cube_model, cube_vertices, ARR_SIZE(cube_vertices));
-	fbos_initialize(renderer, window_width(), window_height());
+	u64 shader_wait = time_now_ns();
+	for (u32 i = 0; i < MAX_SHADER; i++) {
+		shader_finish(&builds[i], &renderer->shaders[i]);
+	}
+	float wait_ms = time_since_ms(shader_wait);
+	shader_cache_print_stats(&renderer->shader_cache);
+	// Submitting plus waiting is the time shaders cost on the startup path, the compile itself overlaps resource loading
+	fprintf(stdout, "Shader setup took %.2f ms (%.2f ms submitting, %.2f ms waiting on the compiler, parallel compile %s)\n",
+		submit_ms + wait_ms,
+		submit_ms,
+		wait_ms,
+		parallel ? "on" : "off"
+	);
+
+	renderer->skybox_id = -1;
+	flares_initialize(renderer);
+	renderer->prepass = (Depth_prepass) {
+		.enabled = 1,
+	};
+	glGenQueries(PREPASS_QUERY_FRAMES, renderer->prepass.queries);
+	renderer->statistics = (Scene_statistics) {
+		.supported = GLEW_ARB_pipeline_statistics_query,
+	};
+	glGenQueries(SCENE_QUERY_FRAMES, renderer->statistics.primitive_queries);
+	glGenQueries(SCENE_QUERY_FRAMES, renderer->statistics.fragment_queries);
+	light_clusters_initialize(&renderer->clusters);
+	frame_graph_initialize(&renderer->graph);
 	return NoError;
 }
 
 i32 renderer_initialize() {
+	i32 event = startup_trace_begin("glew init", NULL);
 	i32 glew_error = glewInit();
+	startup_trace_end(event, 0);
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+	// A GLEW built for GLX reports this on a headless EGL context, after the OpenGL entry points are already loaded
+	if (glew_error == GLEW_ERROR_NO_GLX_DISPLAY && window_is_headless()) {
+		glew_error = GLEW_OK;
+	}
+#endif
 	if (glew_error != GLEW_OK) {
 		fprintf(stderr, "Failed to initialize GLEW: %s\n", glewGetErrorString(glew_error));
 		return Error;
@@ -463,7 +585,9 @@ i32 renderer_initialize() {
 	view = mat4d(1.0f);
 	model = mat4d(1.0f);
 
+	event = startup_trace_begin("render state", NULL);
 	render_state_initialize(&render_state);
+	startup_trace_end(event, 0);
 
 	/*shader_compile_from_file("resource/shader/textured_phong", &diffuse_shader);
 	shader_compile_from_file("resource/shader/skybox", &skybox_shader);
@@ -474,410 +598,1483 @@ i32 renderer_initialize() {
 	shader_compile_from_file("resource/shader/brightness_extract", &brightness_extract_shader);*/
 
 	render_state.use_post_processing = 1;
+	render_state.bloom_quality = BLOOM_QUALITY_MEDIUM;
+	resolution_initialize(&render_state.resolution, RESOLUTION_TARGET_MS);
+	render_state.settings = (Render_settings) {
+		.post_processing = render_state.use_post_processing,
+		.bloom_quality = render_state.bloom_quality,
+		.dynamic_resolution = render_state.resolution.enabled,
+		.depth_prepass = render_state.prepass.enabled,
+		.hud = 0,
+	};
+	hud_initialize(&render_state.hud);
+	render_state.thread = (Render_thread) {};
+	gpu_timers_initialize(&render_state.gpu_timers);
+	render_state.graph.timers = &render_state.gpu_timers;
+	renderer_print_bloom_cost();
 	render_state.initialized = 1;
 	return 0;
 }
 
+// Render targets are sized from the window whenever the frame graph is built, old sizes fall out of the pool by themselves
 void renderer_framebuffer_callback(i32 width, i32 height) {
+}
+
+void render_fullscreen_pass(u32 texture, Fbo_attributes attr) {
 	Render_state* renderer = &render_state;
-	if (!renderer->initialized) {
-		return;
+
+	u32 handle = attr.shader_id;
+
+	gl_state_use_program(handle);
+	u32 texture0 = texture;
+
+	float width = renderer->frame->width;
+	float height = renderer->frame->height;
+
+	mat4 model_matrix = translate(V3(0, 0, 0));
+	model_matrix = multiply_mat4(model_matrix, scale_mat4(V3(width, height, 1)));
+
+	COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "projection"), 1, GL_FALSE, (float*)&renderer->frame->ortho_projection);
+	COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "model"), 1, GL_FALSE, (float*)&model_matrix);
+
+	COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "texture0"), 0);
+	gl_state_bind_texture(0, GL_TEXTURE_2D, texture0);
+
+	// Do bindings depending on which shader the pass uses
+	if (handle == renderer->shaders[COMBINE_SHADER]) {
+		COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "texture1"), 1);
+		gl_state_bind_texture(1, GL_TEXTURE_2D, attr.combine.texture1);
+		COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, "mix"), attr.combine.mix);
+	}
+	else if (handle == renderer->shaders[BLUR_SHADER]) {
+		COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "vertical"), attr.blur.vertical);
+	}
+	else if (handle == renderer->shaders[BRIGHTNESS_EXTRACT_SHADER]) {
+		COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, "factor"), attr.extract.factor);
+		COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "keep_color"), attr.extract.keep_color);
+	}
+	else if (handle == renderer->shaders[BLOOM_DOWNSAMPLE_SHADER]) {
+		COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "high_quality"), attr.downsample.high_quality);
 	}
-	fbos_unload(renderer);
-	fbos_initialize(renderer, width, height);
+	else if (handle == renderer->shaders[BLOOM_UPSAMPLE_SHADER]) {
+		COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, "radius"), attr.upsample.radius);
+	}
+
+	switch (attr.blend) {
+		case FBO_BLEND_NONE:
+			gl_state_set_blend(0);
+			break;
+		case FBO_BLEND_ADDITIVE:
+			gl_state_set_blend(1);
+			gl_state_set_blend_func(GL_ONE, GL_ONE);
+			break;
+		default:
+			gl_state_set_blend(1);
+			gl_state_set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			break;
+	}
+
+	// Full screen passes never depth test, the scene passes enable it again themselves
+	gl_state_set_depth_test(0);
+	gl_state_set_cull(0);
+	gl_state_bind_vertex_array(quad_vao);
+
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	render_stats_count_draw(2);
+}
+
+// The settings only take effect once the renderer gets to a draw list they were copied into
+void renderer_toggle_post_processing() {
+	render_state.settings.post_processing = !render_state.settings.post_processing;
+}
+
+void renderer_toggle_dynamic_resolution() {
+	render_state.settings.dynamic_resolution = !render_state.settings.dynamic_resolution;
+}
+
+void renderer_set_dynamic_resolution(u8 enabled) {
+	render_state.settings.dynamic_resolution = enabled;
+}
+
+void renderer_toggle_depth_prepass() {
+	Render_settings* settings = &render_state.settings;
+	settings->depth_prepass = !settings->depth_prepass;
+	fprintf(stdout, "Depth pre-pass: %s\n", settings->depth_prepass ? "on" : "off");
 }
 
-// Clears the currently bound fbo
-void renderer_clear_fbo() {
-	Fbo* fbo = current_fbo;
-	if (fbo) {
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo->fbo);
+void renderer_toggle_hud() {
+	render_state.settings.hud = !render_state.settings.hud;
+}
+
+void renderer_toggle_entity_costs() {
+	renderer_set_entity_costs(!render_state.settings.entity_costs);
+}
+
+void renderer_set_entity_costs(u8 enabled) {
+	render_state.settings.entity_costs = enabled;
+}
+
+u8 renderer_entity_costs_enabled() {
+	return render_state.settings.entity_costs;
+}
+
+void apply_settings(Render_state* renderer, Render_settings* settings) {
+	renderer->use_post_processing = settings->post_processing;
+	renderer->bloom_quality = settings->bloom_quality;
+	if (renderer->resolution.enabled != settings->dynamic_resolution) {
+		resolution_set_enabled(&renderer->resolution, settings->dynamic_resolution);
 	}
-	else {
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	Depth_prepass* prepass = &renderer->prepass;
+	if (prepass->enabled != settings->depth_prepass) {
+		prepass->enabled = settings->depth_prepass;
+		prepass->reported[prepass->enabled] = 0;	// Report the count for the new mode once it comes in
 	}
-	glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	entity_costs_set_enabled(&renderer->entity_costs, settings->entity_costs);
 }
 
-void renderer_bind_fbo(i32 fbo_id) {
-	Render_state* renderer = &render_state;
-	if (fbo_id >= 0) {
-		Fbo* fbo = &renderer->fbos[fbo_id];
-		current_fbo = fbo;
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo->fbo);
+Scene_stats renderer_get_scene_stats() {
+	Render_thread* thread = &render_state.thread;
+	if (!thread->running) {
+		return thread->published.scene_stats;
 	}
-	else {
-		current_fbo = NULL;
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	pthread_mutex_lock(&thread->mutex);
+	Scene_stats stats = thread->published.scene_stats;
+	pthread_mutex_unlock(&thread->mutex);
+	return stats;
+}
+
+Render_stats renderer_get_render_stats() {
+	Render_thread* thread = &render_state.thread;
+	if (!thread->running) {
+		return thread->published.render_stats;
 	}
+	pthread_mutex_lock(&thread->mutex);
+	Render_stats stats = thread->published.render_stats;
+	pthread_mutex_unlock(&thread->mutex);
+	return stats;
 }
 
-void renderer_unbind_fbo() {
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	current_fbo = NULL;
+Gl_state_counters renderer_get_state_counters() {
+	Render_thread* thread = &render_state.thread;
+	if (!thread->running) {
+		return thread->published.state_counters;
+	}
+	pthread_mutex_lock(&thread->mutex);
+	Gl_state_counters counters = thread->published.state_counters;
+	pthread_mutex_unlock(&thread->mutex);
+	return counters;
 }
 
-void render_fbo(i32 fbo_id, i32 target_fbo, Fbo_attributes attr) {
-	renderer_bind_fbo(target_fbo);
+u32 renderer_get_entity_costs(Entity_cost* costs, u32 max_count, u32* frames) {
+	Render_thread* thread = &render_state.thread;
+	if (thread->running) {
+		pthread_mutex_lock(&thread->mutex);
+	}
+	u32 count = std::min(thread->entity_cost_count, max_count);
+	memcpy(costs, thread->entity_costs, sizeof(Entity_cost) * count);
+	*frames = thread->entity_cost_frames;
+	if (thread->running) {
+		pthread_mutex_unlock(&thread->mutex);
+	}
+	return count;
+}
 
-	Render_state* renderer = &render_state;
-	Fbo* fbo = &renderer->fbos[fbo_id];
+Stream_stats renderer_get_stream_stats() {
+	return stream_buffer_get_stats(&render_state.stream);
+}
 
-	u32 handle = attr.shader_id;
+u32 renderer_get_gpu_timings(Gpu_timer_stats* stats, u32 max_count) {
+	return gpu_timers_get_stats(&render_state.gpu_timers, stats, max_count);
+}
 
-	glUseProgram(handle);
-	u32 texture0 = fbo->texture;
+// The timers belong to the thread rendering, which prints them after its next frame
+void renderer_print_gpu_timings() {
+	if (render_state.thread.running) {
+		render_state.print_gpu_timings = 1;
+		return;
+	}
+	gpu_timers_print_stats(&render_state.gpu_timers);
+}
 
-	float width = window_width();
-	float height = window_height();
+i32 renderer_set_gpu_timer_csv(const char* path) {
+	return gpu_timers_set_csv(&render_state.gpu_timers, path);
+}
 
-	model = translate(V3(0, 0, 0));
-	model = multiply_mat4(model, scale_mat4(V3(width, height, 1)));
+float renderer_get_resolution_scale() {
+	Render_thread* thread = &render_state.thread;
+	if (!thread->running) {
+		return thread->published.resolution_scale;
+	}
+	pthread_mutex_lock(&thread->mutex);
+	float scale = thread->published.resolution_scale;
+	pthread_mutex_unlock(&thread->mutex);
+	return scale;
+}
 
-	glUniformMatrix4fv(glGetUniformLocation(handle, "projection"), 1, GL_FALSE, (float*)&ortho_projection);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "model"), 1, GL_FALSE, (float*)&model);
+void renderer_set_bloom_quality(u32 quality) {
+	if (quality >= MAX_BLOOM_QUALITY) {
+		return;
+	}
+	render_state.settings.bloom_quality = quality;
+	fprintf(stdout, "Bloom quality: %s\n", bloom_presets[quality].name);
+}
 
-	glUniform1i(glGetUniformLocation(handle, "texture0"), 0);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture0);
+void renderer_cycle_bloom_quality() {
+	renderer_set_bloom_quality((render_state.settings.bloom_quality + 1) % MAX_BLOOM_QUALITY);
+}
 
-	// Do bindings depending on which fbo we are handling
-	switch (fbo_id) {
-		case FBO_COMBINE: {
-			glUniform1i(glGetUniformLocation(handle, "texture1"), 1);
-			glActiveTexture(GL_TEXTURE1);
-			glBindTexture(GL_TEXTURE_2D, attr.combine.texture1);
-			glUniform1f(glGetUniformLocation(handle, "mix"), attr.combine.mix);
-			break;
+// Pixels written and texels fetched by the post processing of one frame
+void bloom_cost(Bloom_preset* preset, i32 width, i32 height, double* pixels, double* fetches) {
+	double full = (double)width * height;
+	*pixels = full;	// Combine
+	*fetches = full * 2;
+	for (u32 level = 0; level < preset->levels; ++level) {
+		double area = (double)(width >> (level + 1)) * (height >> (level + 1));
+		if (level == 0) {
+			*pixels += area;	// Extract
+			*fetches += area;
 		}
-		case FBO_V_BLUR:
-		case FBO_H_BLUR: {
-			glUniform1i(glGetUniformLocation(handle, "vertical"), attr.blur.vertical);
-			break;
+		else {
+			*pixels += area;	// Downsample into this level
+			*fetches += area * (preset->high_quality_downsample ? 13 : 4);
 		}
-		case FBO_BRIGHTNESS_EXTRACT: {
-			glUniform1f(glGetUniformLocation(handle, "factor"), attr.extract.factor);
-			break;
+		if (level + 1 < preset->levels) {
+			*pixels += area;	// Upsample from the level below
+			*fetches += area * 4;
 		}
-		default:
-			break;
 	}
+}
 
+void renderer_print_bloom_cost() {
+	struct {
+		const char* name;
+		i32 width;
+		i32 height;
+	} resolutions[] = {
+		{"1080p", 1920, 1080},
+		{"4K", 3840, 2160},
+	};
+	for (u32 i = 0; i < ARR_SIZE(resolutions); ++i) {
+		double full = (double)resolutions[i].width * resolutions[i].height;
+		// The previous chain: copy, extract, vertical and horizontal 22 tap blur and combine, all at full resolution
+		double old_pixels = full * 5;
+		double old_fetches = full * (1 + 1 + 22 + 22 + 2);
+		for (u32 quality = 0; quality < MAX_BLOOM_QUALITY; ++quality) {
+			double pixels = 0, fetches = 0;
+			bloom_cost(&bloom_presets[quality], resolutions[i].width, resolutions[i].height, &pixels, &fetches);
+			fprintf(stdout, "Bloom %-6s %5s: %6.2f Mpx written (%.0f%% less), %6.2f M texel fetches (%.0f%% less) than the full resolution blur\n",
+				bloom_presets[quality].name, resolutions[i].name,
+				pixels / 1e6, 100.0 * (1.0 - pixels / old_pixels),
+				fetches / 1e6, 100.0 * (1.0 - fetches / old_fetches)
+			);
+		}
+	}
+}
+
+void render_flares(v3 flare_source) {
+	Draw_list* list = draw_list(&render_state);
+	list->flare_source = flare_source;
+	list->flares_queued = 1;
+}
+
+void flares_initialize(Render_state* renderer) {
+	Flare_state* flares = &renderer->flares;
+	*flares = (Flare_state) {};
+
+	// Shares the quad corners, the flares only add one attribute per instance
+	glGenVertexArrays(1, &flares->vao);
+	glGenBuffers(1, &flares->instance_vbo);
+	gl_state_bind_vertex_array(flares->vao);
+	glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
 	glEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), NULL);
+	glBindBuffer(GL_ARRAY_BUFFER, flares->instance_vbo);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(flare_instances), flare_instances, GL_STATIC_DRAW);
+	glEnableVertexAttribArray(FLARE_ATTRIB_INSTANCE);
+	glVertexAttribPointer(FLARE_ATTRIB_INSTANCE, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), NULL);
+	glVertexAttribDivisor(FLARE_ATTRIB_INSTANCE, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	gl_state_bind_vertex_array(0);
+
+	glGenQueries(FLARE_QUERY_FRAMES, flares->queries);
+
+	u32 handle = renderer->shaders[FLARE_SHADER];
+	flares->flare_uniforms.projection = glGetUniformLocation(handle, "projection");
+	flares->flare_uniforms.view = glGetUniformLocation(handle, "view");
+	flares->flare_uniforms.source = glGetUniformLocation(handle, "flare_source");
+	flares->flare_uniforms.scale = glGetUniformLocation(handle, "flare_scale");
+	flares->flare_uniforms.visibility = glGetUniformLocation(handle, "flare_visibility");
+	flares->flare_uniforms.textures = glGetUniformLocation(handle, "flare_textures");
+	if (handle) {
+		// Sampler units never change, so they are set once here
+		i32 units[MAX_FLARE_TEXTURES] = {0, 1, 2};
+		gl_state_use_program(handle);
+		COUNTED_UNIFORM(glUniform1iv, flares->flare_uniforms.textures, MAX_FLARE_TEXTURES, units);
+	}
+
+	handle = renderer->shaders[FLARE_PROBE_SHADER];
+	flares->probe_uniforms.projection = glGetUniformLocation(handle, "projection");
+	flares->probe_uniforms.view = glGetUniformLocation(handle, "view");
+	flares->probe_uniforms.source = glGetUniformLocation(handle, "flare_source");
+	flares->probe_uniforms.extent = glGetUniformLocation(handle, "probe_extent");
+}
+
+// Counts the samples of a small quad at the source passing the depth test against the finished scene.
+// Results are picked up frames later, whenever the gpu has them, so the cpu never waits on a query
+void flares_probe(Render_state* renderer, i32 width, i32 height) {
+	Flare_state* flares = &renderer->flares;
+	u32 handle = renderer->shaders[FLARE_PROBE_SHADER];
+	if (!handle) {
+		flares->visibility = 1.0f;
+		return;
+	}
+
+	// Oldest first, so the newest available result is the one kept
+	for (u32 i = 0; i < FLARE_QUERY_FRAMES; ++i) {
+		u32 slot = (flares->query_frame + i) % FLARE_QUERY_FRAMES;
+		if (!flares->query_pending[slot]) {
+			continue;
+		}
+		u32 available = 0;
+		glGetQueryObjectuiv(flares->queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			continue;
+		}
+		u32 samples = 0;
+		glGetQueryObjectuiv(flares->queries[slot], GL_QUERY_RESULT, &samples);
+		flares->visibility = clamp((float)samples / flares->query_pixels[slot], 0.0f, 1.0f);
+		flares->query_pending[slot] = 0;
+	}
 
-	glBindVertexArray(quad_vao);
+	// Every query still in flight, the gpu is that far behind and this frame goes without a probe
+	u32 slot = flares->query_frame % FLARE_QUERY_FRAMES;
+	flares->query_frame++;
+	if (flares->query_pending[slot]) {
+		return;
+	}
 
-	glDisable(GL_DEPTH_TEST);
+	v2 extent = V2((float)FLARE_PROBE_SIZE / width, (float)FLARE_PROBE_SIZE / height);
+	gl_state_use_program(handle);
+	COUNTED_UNIFORM(glUniformMatrix4fv, flares->probe_uniforms.projection, 1, GL_FALSE, (float*)&renderer->frame->projection);
+	COUNTED_UNIFORM(glUniformMatrix4fv, flares->probe_uniforms.view, 1, GL_FALSE, (float*)&renderer->frame->view);
+	COUNTED_UNIFORM(glUniform3fv, flares->probe_uniforms.source, 1, (float*)&flares->source);
+	COUNTED_UNIFORM(glUniform2fv, flares->probe_uniforms.extent, 1, (float*)&extent);
 
+	gl_state_set_depth_test(1);
+	gl_state_set_depth_func(renderer->depth_func);
+	gl_state_set_depth_write(0);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	gl_state_bind_vertex_array(quad_vao);
+
+	glBeginQuery(GL_SAMPLES_PASSED, flares->queries[slot]);
 	glDrawArrays(GL_TRIANGLES, 0, 6);
+	glEndQuery(GL_SAMPLES_PASSED);
+	render_stats_count_draw(2);
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	gl_state_set_depth_write(1);
+	flares->query_pending[slot] = 1;
+	flares->query_pixels[slot] = FLARE_PROBE_SIZE * FLARE_PROBE_SIZE;
+}
 
-	glEnable(GL_DEPTH_TEST);
+// All flares in one instanced draw, faded by the visibility of the source
+void flares_draw(Render_state* renderer, i32 width, i32 height) {
+	Flare_state* flares = &renderer->flares;
+	u32 handle = renderer->shaders[FLARE_SHADER];
+	if (!handle || flares->visibility <= 0.0f) {
+		return;
+	}
 
-	glBindVertexArray(0);
+	float size = std::min(width, height);
+	v2 scale = V2(size / width, size / height);
+	gl_state_use_program(handle);
+	COUNTED_UNIFORM(glUniformMatrix4fv, flares->flare_uniforms.projection, 1, GL_FALSE, (float*)&renderer->frame->projection);
+	COUNTED_UNIFORM(glUniformMatrix4fv, flares->flare_uniforms.view, 1, GL_FALSE, (float*)&renderer->frame->view);
+	COUNTED_UNIFORM(glUniform3fv, flares->flare_uniforms.source, 1, (float*)&flares->source);
+	COUNTED_UNIFORM(glUniform2fv, flares->flare_uniforms.scale, 1, (float*)&scale);
+	COUNTED_UNIFORM(glUniform1f, flares->flare_uniforms.visibility, flares->visibility);
+	for (u32 i = 0; i < MAX_FLARE_TEXTURES; ++i) {
+		gl_state_bind_texture(i, GL_TEXTURE_2D, renderer->textures[flare_textures[i]]);
+	}
 
-	glDisableVertexAttribArray(0);
+	gl_state_set_depth_test(0);
+	gl_state_set_blend(1);
+	gl_state_set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state_bind_vertex_array(flares->vao);
+
+	glDrawArraysInstanced(GL_TRIANGLES, 0, 6, MAX_FLARES);
+	render_stats_count_draw(2 * MAX_FLARES);
+}
+
+void flares_destroy(Render_state* renderer) {
+	Flare_state* flares = &renderer->flares;
+	gl_state_forget_vertex_array(flares->vao);
+	glDeleteVertexArrays(1, &flares->vao);
+	glDeleteBuffers(1, &flares->instance_vbo);
+	glDeleteQueries(FLARE_QUERY_FRAMES, flares->queries);
+}
+
+static u8 value_map_equal(Value_map* a, Value_map* b) {
+	if (a->type != b->type) {
+		return 0;
+	}
+	if (a->type == VALUE_MAP_CONST) {
+		return a->value.constant == b->value.constant;
+	}
+	return a->value.map.id == b->value.map.id && a->value.map.offset == b->value.map.offset;
+}
 
-	glUseProgram(0);
+// Draws can only share a multi draw call if nothing they set through uniforms differs
+static u8 material_equal(Material* a, Material* b) {
+	return a->shader_index == b->shader_index &&
+		a->variant == b->variant &&
+		value_map_equal(&a->ambient, &b->ambient) &&
+		value_map_equal(&a->diffuse, &b->diffuse) &&
+		value_map_equal(&a->specular, &b->specular) &&
+		value_map_equal(&a->normal, &b->normal) &&
+		a->shininess == b->shininess &&
+		a->color_map.id == b->color_map.id && a->color_map.offset == b->color_map.offset &&
+		a->texture1.id == b->texture1.id && a->texture1.offset == b->texture1.offset &&
+		a->texture_mix == b->texture_mix &&
+		a->cull == b->cull && a->blend == b->blend && a->depth_write == b->depth_write;
 }
 
-void renderer_post_process() {
+// The plain shader samples or reads the constant per pixel and gets both, with a constant of -1 flagging the map.
+// A variant is compiled for one of the two, so the texture and uniforms of the other are left alone
+static void set_value_map_uniforms(u32 handle, Value_map value, const char* name, u32 unit, u8 variant, u8 constant_used) {
 	Render_state* renderer = &render_state;
+	char uniform[64] = {0};
+	u8 mapped = value.type == VALUE_MAP_MAP;
+	if (mapped || !variant) {
+		v2 offset = mapped ? value.value.map.offset : V2(0.0f, 0.0f);
+		snprintf(uniform, sizeof(uniform), "%s_map_offset", name);
+		COUNTED_UNIFORM(glUniform2fv, glGetUniformLocation(handle, uniform), 1, (float*)&offset);
+		snprintf(uniform, sizeof(uniform), "%s_map", name);
+		COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, uniform), unit);
+		gl_state_bind_texture(unit, GL_TEXTURE_2D, renderer->textures[mapped ? value.value.map.id : 0]);
+	}
+	if (!variant || (!mapped && constant_used)) {
+		snprintf(uniform, sizeof(uniform), "%s_amp", name);
+		COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, uniform), mapped ? -1.0f : value.value.constant);
+	}
+}
 
-	if (!renderer->use_post_processing) {
-		render_fbo(FBO_COLOR, FBO_STANDARD_FRAMEBUFFER, (Fbo_attributes) {
-			.shader_id = renderer->shaders[TEXTURE_SHADER], //texture_shader,
-			{},
-		});
-		return;
+static void set_material_uniforms(u32 handle, Material material, Scene* scene) {
+	Render_state* renderer = &render_state;
+	u8 variant = material.variant > 0 && handle == renderer->variants[material.variant - 1].program;
+
+	COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "P"), 1, GL_FALSE, (float*)&renderer->frame->projection);
+	COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "V"), 1, GL_FALSE, (float*)&renderer->frame->view);
+
+	COUNTED_UNIFORM(glUniform2fv, glGetUniformLocation(handle, "color_map_offset"), 1, (float*)&material.color_map.offset);
+	COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "color_map"), 0);
+	gl_state_bind_texture(0, GL_TEXTURE_2D, renderer->textures[material.color_map.id]);
+
+	set_value_map_uniforms(handle, material.ambient, "ambient", 1, variant, 1);
+	set_value_map_uniforms(handle, material.diffuse, "diffuse", 2, variant, 1);
+	set_value_map_uniforms(handle, material.specular, "specular", 3, variant, 1);
+	// TODO: normal_amp is kinda strange and only acts like a flag. normals will never be scaled. better solution?
+	set_value_map_uniforms(handle, material.normal, "normal", 4, variant, 0);
+
+	if (!variant || material.texture_mix != 0) {
+		COUNTED_UNIFORM(glUniform2fv, glGetUniformLocation(handle, "offset1"), 1, (float*)&material.texture1.offset);
+		COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, "texture_mix"), material.texture_mix);
+		COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "obj_texture1"), 5);
+		gl_state_bind_texture(5, GL_TEXTURE_2D, renderer->textures[material.texture1.id]);
 	}
+	COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, "shininess"), material.shininess);
 
-	render_fbo(FBO_COLOR, FBO_BRIGHTNESS_EXTRACT, (Fbo_attributes) {
-		.shader_id = renderer->shaders[TEXTURE_SHADER], //texture_shader,
-	});
+    // Point lights are fetched from the clusters of each pixel
+	v2 depth_params = light_clusters_depth_params();
+	COUNTED_UNIFORM(glUniform2fv, glGetUniformLocation(handle, "cluster_tile_scale"), 1, (float*)&renderer->cluster_tile_scale);
+	COUNTED_UNIFORM(glUniform2fv, glGetUniformLocation(handle, "cluster_depth"), 1, (float*)&depth_params);
+	COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "cluster_lights"), CLUSTER_TEXTURE_UNIT);
+	COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "cluster_grid"), CLUSTER_TEXTURE_UNIT + 1);
+	COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "cluster_indices"), CLUSTER_TEXTURE_UNIT + 2);
+	light_clusters_bind(&renderer->clusters, CLUSTER_TEXTURE_UNIT);
 
-	render_fbo(FBO_BRIGHTNESS_EXTRACT, FBO_V_BLUR, (Fbo_attributes) {
-		.shader_id = renderer->shaders[BRIGHTNESS_EXTRACT_SHADER], //brightness_extract_shader,
-		{
-			.extract = {
-				.factor = 0.2f,
-				.keep_color = 1,
-			},
-		}
-	});
+    for (i32 i = 0; i < scene->num_sun_lights; i++) {
+        if (i == MAX_LIGHTS) {
+            printf("Warning: too many light sources (max: %d).", MAX_LIGHTS);
+            break;
+        }
+        Sun_light light = scene->sun_lights[i];
+        std::string uniform_name = "sun_lights[" + std::to_string(i) + "]";
 
-	render_fbo(FBO_V_BLUR, FBO_H_BLUR, (Fbo_attributes) {
-		.shader_id = renderer->shaders[BLUR_SHADER], //blur_shader,
-		{
-			.blur = {
-				.vertical = 1,
-			}
+        COUNTED_UNIFORM(glUniform3fv, glGetUniformLocation(handle, (uniform_name + ".angle").c_str()), 1, (float*)&light.angle);
+        COUNTED_UNIFORM(glUniform3fv, glGetUniformLocation(handle, (uniform_name + ".color").c_str()), 1, (float*)&light.color);
+        COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, (uniform_name + ".falloff_linear").c_str()), light.falloff_linear);
+        COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, (uniform_name + ".falloff_quadratic").c_str()), light.falloff_quadratic);
+        COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, (uniform_name + ".ambient").c_str()), light.ambient);
+    }
+    COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "num_sun_lights"), std::min(scene->num_sun_lights, MAX_LIGHTS));
+}
+
+u32 material_features(Material* material) {
+	u32 features = 0;
+	if (material->ambient.type == VALUE_MAP_MAP) {
+		features |= MATERIAL_AMBIENT_MAP;
+	}
+	if (material->diffuse.type == VALUE_MAP_MAP) {
+		features |= MATERIAL_DIFFUSE_MAP;
+	}
+	if (material->specular.type == VALUE_MAP_MAP) {
+		features |= MATERIAL_SPECULAR_MAP;
+	}
+	if (material->normal.type == VALUE_MAP_MAP) {
+		features |= MATERIAL_NORMAL_MAP;
+	}
+	if (material->texture_mix != 0) {
+		features |= MATERIAL_TEXTURE_MIX;
+	}
+	return features;
+}
+
+void renderer_select_variant(Material* material) {
+	Render_state* renderer = &render_state;
+	material->variant = 0;
+	// Only the lit material shaders are written with feature defines
+	if (material->shader_index != DIFFUSE_SHADER && material->shader_index != GROUND_SHADER) {
+		return;
+	}
+	u32 features = material_features(material);
+	for (u32 i = 0; i < renderer->variant_count; ++i) {
+		Shader_variant* variant = &renderer->variants[i];
+		if (variant->shader_index == material->shader_index && variant->features == features) {
+			material->variant = i + 1;
+			return;
 		}
-	});
+	}
+	if (renderer->variant_count >= MAX_SHADER_VARIANTS) {
+		fprintf(stderr, "Warning: too many shader variants (max: %d), using the plain shader\n", MAX_SHADER_VARIANTS);
+		return;
+	}
+	renderer->variants[renderer->variant_count++] = (Shader_variant) {
+		.shader_index = material->shader_index,
+		.features = features,
+		.program = 0,
+	};
+	material->variant = renderer->variant_count;
+}
 
-	render_fbo(FBO_H_BLUR, FBO_COMBINE, (Fbo_attributes) {
-		.shader_id = renderer->shaders[BLUR_SHADER], //blur_shader,
-		{
-			.blur = {
-				.vertical = 0,
+void renderer_compile_variants() {
+	Render_state* renderer = &render_state;
+	static Shader_build builds[MAX_SHADER_VARIANTS];
+	static const char* feature_defines[MAX_MATERIAL_FEATURE] = {
+		"#define AMBIENT_MAP\n",
+		"#define DIFFUSE_MAP\n",
+		"#define SPECULAR_MAP\n",
+		"#define NORMAL_MAP\n",
+		"#define TEXTURE_MIX\n",
+	};
+
+	u32 submitted = 0;
+	for (u32 i = 0; i < renderer->variant_count; ++i) {
+		Shader_variant* variant = &renderer->variants[i];
+		Shader_build* build = &builds[i];
+		*build = (Shader_build) {
+			.path = shader_path[variant->shader_index],
+		};
+		if (variant->program) {
+			continue;
+		}
+		snprintf(build->name, MAX_PATH_SIZE, "%s#%02x", build->path, variant->features);
+		u32 length = snprintf(build->defines, SHADER_DEFINES_SIZE, "#define MATERIAL_VARIANT\n");
+		for (u32 feature = 0; feature < MAX_MATERIAL_FEATURE; ++feature) {
+			if (variant->features & (1 << feature)) {
+				length += snprintf(build->defines + length, SHADER_DEFINES_SIZE - length, "%s", feature_defines[feature]);
 			}
 		}
-	});
-
-	render_fbo(FBO_COMBINE, FBO_STANDARD_FRAMEBUFFER, (Fbo_attributes) {
-		.shader_id = renderer->shaders[COMBINE_SHADER], //combine_shader,
-		{
-			.combine = {
-				.texture1 = renderer->fbos[FBO_COLOR].texture,
-				.mix = 0.05f,
-			},
+		shader_submit(build);
+		submitted++;
+	}
+	for (u32 i = 0; i < renderer->variant_count; ++i) {
+		Shader_variant* variant = &renderer->variants[i];
+		if (variant->program) {
+			continue;
 		}
-	});
+		shader_finish(&builds[i], &variant->program);
+	}
+	fprintf(stdout, "Shader variants: %u in use, %u built\n", renderer->variant_count, submitted);
 }
 
-void renderer_toggle_post_processing() {
-	render_state.use_post_processing = !render_state.use_post_processing;
+i32 renderer_get_mesh_bounds(i32 mesh_id, Aabb* bounds, Bounding_sphere* sphere) {
+	Render_state* renderer = &render_state;
+	if (mesh_id < 0 || (u32)mesh_id >= renderer->model_count) {
+		return Error;
+	}
+	*bounds = renderer->models[mesh_id].bounds;
+	*sphere = renderer->models[mesh_id].sphere;
+	return NoError;
 }
 
-void renderer_clear_fbos() {
+// Queues the mesh, nothing is drawn until the scene pass of the frame graph runs
+void render_mesh(mat4 transformation, i32 mesh_id, Material material, Scene* scene, i32 entity) {
+	PROFILE_FUNCTION();
+	if (mesh_id < 0 || mesh_id >= MAX_MESH) {
+		return;
+	}
 	Render_state* renderer = &render_state;
-	for (u32 i = 0; i < renderer->fbo_count; i++) {
-		renderer_bind_fbo(i);
-		renderer_clear_fbo();	// Clear the bound framebuffer object
+	Draw_list* list = draw_list(renderer);
+	if (list->item_count >= MAX_DRAW_ITEMS) {
+		fprintf(stderr, "Warning: draw queue full (max: %d)\n", MAX_DRAW_ITEMS);
+		return;
 	}
-	renderer_unbind_fbo();
-	renderer_clear_fbo();	// Clear the normal framebuffer
+	capture_scene(list, scene);
+	Model* model = &renderer->models[mesh_id];
+	list->items[list->item_count++] = (Draw_item) {
+		.mesh_id = mesh_id,
+		.transformation = transformation,
+		.material = material,
+		.scene = &list->scene,
+		.indices = { .offset = model->indices.offset, .count = model->draw_count },
+		.base_vertex = (i32)model->vertices.offset,
+		.sphere = model->sphere,
+		.entity = entity,
+	};
 }
 
-void render_flares(v3 flare_source) {
-    // Six flares, three from the center to the screen towards the light (0,1,2)
-    // and three towards the opposite edge of the screen (-3, -2, -1)
-    float flare_sizes[6]     = {0.75, 0.3, 0.12, 0.25,  0.12,  0.15};
-    float flare_positions[6] = {0.95, 0.6, 0.33, 0.25, -0.25, -0.60};
-    float flare_opacities[6] = {0.75, 0.8, 1.00, 0.85,  0.60,  0.40};
-    i32 flare_textures[6] = {
-        TEXTURE_LENSFLARE_1,
-        TEXTURE_LENSFLARE_3,
-        TEXTURE_LENSFLARE_2,
-        TEXTURE_LENSFLARE_2,
-        TEXTURE_LENSFLARE_2,
-        TEXTURE_LENSFLARE_2,
-    };
-    for (i32 i = 0; i < 6; i++) {
-        render_flare(flare_textures[i], flare_positions[i], flare_sizes[i], flare_opacities[i], flare_source);
-    }
+void renderer_clear_static_batches() {
+	Render_state* renderer = &render_state;
+	static_batches_clear(&renderer->static_batches, &renderer->mesh_pool);
 }
 
-void render_flare(u32 texture_id, float flare_pos, float flare_size, float flare_opacity, v3 flare_source) {
+i32 renderer_add_static_mesh(mat4 transformation, i32 mesh_id, Material material, Scene* scene, u32* batch, u32* member) {
 	Render_state* renderer = &render_state;
+	Static_batches* batches = &renderer->static_batches;
+	if (mesh_id < 0 || (u32)mesh_id >= renderer->model_count || renderer->models[mesh_id].draw_count == 0) {
+		return Error;
+	}
+	// ground.vert bends along the y axis of the vertices it is given, which in a batch is the world's. Only where the
+	// transform keeps that axis as it is does the mesh come out the same
+	if (material.shader_index == GROUND_SHADER) {
+		v3 up = V3(transformation.elements[1][0], transformation.elements[1][1], transformation.elements[1][2]);
+		if (length_square_v3(up - V3(0, 1, 0)) > BATCH_UP_EPSILON) {
+			return Error;
+		}
+	}
 
-	u32 handle = renderer->shaders[FLARE_SHADER]; //flare_shader;
+	u32 index = 0;
+	while (index < batches->batch_count &&
+		!(renderer->batch_items[index].scene == scene && material_equal(&renderer->batch_items[index].material, &material))) {
+		index++;
+	}
+	if (index == batches->batch_count) {
+		if (static_batches_create(batches, &index) != NoError) {
+			return Error;
+		}
+		renderer->batch_items[index] = (Draw_item) {
+			.mesh_id = -1,
+			.transformation = mat4d(1.0f),
+			.material = material,
+			.scene = scene,
+			.entity = -1,
+		};
+	}
 
-	glUseProgram(handle);
-	u32 texture0 = renderer->textures[texture_id];
+	Model* model = &renderer->models[mesh_id];
+	if (static_batches_add(batches, index, model->vertices, model->indices, model->sphere, transformation, member) != NoError) {
+		return Error;
+	}
+	*batch = index;
+	return NoError;
+}
 
-	float width = std::min(window_width(), window_height());
+i32 renderer_build_static_batches() {
+	Render_state* renderer = &render_state;
+	Static_batches* batches = &renderer->static_batches;
+	i32 result = static_batches_build(batches, &renderer->mesh_pool);
+
+	u32 vertex_count = 0;
+	for (u32 i = 0; i < batches->batch_count; ++i) {
+		Static_batch* batch = &batches->batches[i];
+		Draw_item* item = &renderer->batch_items[i];
+		item->base_vertex = (i32)batch->vertices.offset;
+		item->sphere = batch->sphere;	// Already in world space, the transformation is the identity
+		vertex_count += batch->vertices.count;
+	}
+	if (batches->member_count > 0) {
+		fprintf(stdout, "Static batches: %u meshes merged into %u batches, %u vertices\n", batches->member_count, batches->batch_count, vertex_count);
+	}
+	return result;
+}
 
-    model = scale_mat4(V3(width, width, 1)); // Make square
-	model = multiply_mat4(model, translate(V3(0.5f, 0, 0))); // Center
+void render_static_mesh(u32 batch, u32 member) {
+	Render_state* renderer = &render_state;
+	if (batch < renderer->static_batches.batch_count) {
+		static_batches_mark_visible(&renderer->static_batches, member);
+	}
+}
 
-	glUniformMatrix4fv(glGetUniformLocation(handle, "projection"), 1, GL_FALSE, (float*)&projection);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "orthogonal"), 1, GL_FALSE, (float*)&ortho_projection);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "view"), 1, GL_FALSE, (float*)&view);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "model"), 1, GL_FALSE, (float*)&model);
-	glUniform1f(glGetUniformLocation(handle, "flare_position"), flare_pos);
-	glUniform1f(glGetUniformLocation(handle, "flare_size"), flare_size);
-	glUniform1f(glGetUniformLocation(handle, "flare_opacity_override"), flare_opacity);
-    glUniform3fv(glGetUniformLocation(handle, "flare_source"), 1, (float*)&flare_source);
+// Queues one draw per run of adjacent visible members, a fully visible batch is a single draw
+void queue_static_batches(Render_state* renderer, Draw_list* list) {
+	Static_batches* batches = &renderer->static_batches;
+	static Pool_range ranges[MAX_BATCH_MEMBERS];
+	for (u32 i = 0; i < batches->batch_count; ++i) {
+		u32 range_count = static_batches_visible_ranges(batches, i, ranges);
+		for (u32 r = 0; r < range_count; ++r) {
+			if (list->item_count >= MAX_DRAW_ITEMS) {
+				fprintf(stderr, "Warning: draw queue full (max: %d)\n", MAX_DRAW_ITEMS);
+				return;
+			}
+			capture_scene(list, renderer->batch_items[i].scene);
+			Draw_item* item = &list->items[list->item_count++];
+			*item = renderer->batch_items[i];
+			item->indices = ranges[r];
+			item->scene = &list->scene;
+		}
+	}
+}
 
-	glUniform1i(glGetUniformLocation(handle, "flare_texture"), 0);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture0);
+// Depth only program for a material, zero when the material is not drawn in the depth pre-pass
+u32 depth_program(Render_state* renderer, Material* material) {
+	if (material->blend != BLEND_NONE || !material->depth_write) {
+		return 0;
+	}
+	switch (material->shader_index) {
+		case DIFFUSE_SHADER:
+			return renderer->shaders[DEPTH_SHADER];
+		case GROUND_SHADER:
+			return renderer->shaders[GROUND_DEPTH_SHADER];
+		default:
+			return 0;
+	}
+}
 
-	glEnableVertexAttribArray(0);
-	glBindVertexArray(quad_vao);
+void set_cull_mode(u8 cull) {
+	gl_state_set_cull(cull != CULL_NONE);
+	if (cull != CULL_NONE) {
+		gl_state_set_cull_face(cull == CULL_FRONT ? GL_FRONT : GL_BACK);
+	}
+}
 
-	glDisable(GL_DEPTH_TEST);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+// Blending, culling and depth writes of the material. depth_write is cleared while depth is already final
+void set_material_state(Material* material, u8 depth_write) {
+	set_cull_mode(material->cull);
+	switch (material->blend) {
+		case BLEND_NONE:
+			gl_state_set_blend(0);
+			break;
+		case BLEND_ALPHA:
+			gl_state_set_blend(1);
+			gl_state_set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+			break;
+		case BLEND_ADDITIVE:
+			gl_state_set_blend(1);
+			gl_state_set_blend_func(GL_SRC_ALPHA, GL_ONE);
+			break;
+	}
+	gl_state_set_depth_write(depth_write && material->depth_write);
+}
 
-	glDrawArrays(GL_TRIANGLES, 0, 6);
+// Fills depth for the opaque draws from the position only stream, with color writes off.
+// Culling matches the shading pass, otherwise a culled face could hide the one that is shaded
+void depth_prepass_draw(Render_state* renderer, Draw_item** items, u32* programs, u32 opaque_count) {
+	gl_state_set_depth_test(1);
+	gl_state_set_depth_func(renderer->depth_func);
+	gl_state_set_depth_write(1);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+	u32 first = 0;
+	while (first < opaque_count) {
+		u32 last = first + 1;
+		while (last < opaque_count && programs[last] == programs[first] && items[last]->material.cull == items[first]->material.cull) {
+			last++;
+		}
+		u32 handle = programs[first];
+		gl_state_use_program(handle);
+		COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "P"), 1, GL_FALSE, (float*)&renderer->frame->projection);
+		COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "V"), 1, GL_FALSE, (float*)&renderer->frame->view);
+		set_cull_mode(items[first]->material.cull);
+		mesh_pool_draw_positions(&renderer->mesh_pool, first, last - first);
+		first = last;
+	}
 
-	glEnable(GL_DEPTH_TEST);
-    glDisable(GL_BLEND);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
 
-	glBindVertexArray(0);
-	glDisableVertexAttribArray(0);
-	glUseProgram(0);
+// Picks up finished fragment counts without waiting, and prints the first one of each mode
+void depth_prepass_read_queries(Depth_prepass* prepass) {
+	for (u32 i = 0; i < PREPASS_QUERY_FRAMES; ++i) {
+		u32 slot = (prepass->query_frame + i) % PREPASS_QUERY_FRAMES;
+		if (!prepass->query_pending[slot]) {
+			continue;
+		}
+		u32 available = 0;
+		glGetQueryObjectuiv(prepass->queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			continue;
+		}
+		u32 samples = 0;
+		glGetQueryObjectuiv(prepass->queries[slot], GL_QUERY_RESULT, &samples);
+		prepass->query_pending[slot] = 0;
+
+		u8 mode = prepass->query_prepass[slot];
+		prepass->fragments[mode] = samples;
+		if (!prepass->reported[mode]) {
+			prepass->reported[mode] = 1;
+			fprintf(stdout, "Shaded fragments %s depth pre-pass: %u (%.2f per scene pixel)\n",
+				mode ? "with" : "without", samples, (float)samples / std::max(prepass->query_pixels[slot], 1u));
+		}
+	}
 }
 
-void render_mesh(mat4 transformation, i32 mesh_id, Material material, Scene* scene) {
-	if (mesh_id < 0 || mesh_id >= MAX_MESH) {
-		return;
+// Picks up finished pipeline statistics without waiting, one frame is printed once the camera has settled
+void scene_statistics_read_queries(Scene_statistics* statistics) {
+	for (u32 i = 0; i < SCENE_QUERY_FRAMES; ++i) {
+		u32 slot = (statistics->query_frame + i) % SCENE_QUERY_FRAMES;
+		if (!statistics->query_pending[slot]) {
+			continue;
+		}
+		u32 available = 1;
+		if (statistics->supported) {
+			glGetQueryObjectuiv(statistics->fragment_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+		}
+		if (!available) {
+			continue;
+		}
+		Scene_stats stats = statistics->query_stats[slot];
+		if (statistics->supported) {
+			GLuint64 primitives = 0;
+			GLuint64 fragments = 0;
+			glGetQueryObjectui64v(statistics->primitive_queries[slot], GL_QUERY_RESULT, &primitives);
+			glGetQueryObjectui64v(statistics->fragment_queries[slot], GL_QUERY_RESULT, &fragments);
+			stats.triangles_rasterized = primitives;
+			stats.fragments_shaded = fragments;
+		}
+		statistics->query_pending[slot] = 0;
+		statistics->latest = stats;
+
+		if (!statistics->reported && statistics->query_frames[slot] >= SCENE_REPORT_FRAME) {
+			statistics->reported = 1;
+			fprintf(stdout, "Scene pass: %u draws (%u transparent), %llu triangles submitted", stats.draws, stats.transparent_draws, (unsigned long long)stats.triangles_submitted);
+			if (statistics->supported) {
+				fprintf(stdout, ", %llu rasterized, %llu fragments shaded (%.2f per scene pixel)", (unsigned long long)stats.triangles_rasterized,
+					(unsigned long long)stats.fragments_shaded, (double)stats.fragments_shaded / std::max(stats.pixels, 1u));
+			}
+			fprintf(stdout, "\n");
+		}
 	}
-	Render_state* renderer = &render_state;
-	u32 texture1 = renderer->textures[material.texture1.id];
-
-    u32 color_map = renderer->textures[material.color_map.id];
-    u32 ambient_map = renderer->textures[material.ambient.type == VALUE_MAP_MAP ? material.ambient.value.map.id : 0];
-    u32 diffuse_map = renderer->textures[material.diffuse.type == VALUE_MAP_MAP ? material.diffuse.value.map.id : 0];
-    u32 specular_map = renderer->textures[material.specular.type == VALUE_MAP_MAP ? material.specular.value.map.id : 0];
-    u32 normal_map = renderer->textures[material.normal.type == VALUE_MAP_MAP ? material.normal.value.map.id : 0];
-	Model* mesh = &renderer->models[mesh_id];
-
-	//u32 handle = renderer->shaders[DIFFUSE_SHADER];
-	u32 handle = renderer->shaders[material.shader_index];
-	glUseProgram(handle);
-
-	/*model = translate(position);
-	model = multiply_mat4(model, rotate(rotation.y, V3(0.0f, 1.0f, 0.0f)));
-	model = multiply_mat4(model, rotate(rotation.z, V3(0.0f, 0.0f, 1.0f)));
-	model = multiply_mat4(model, rotate(rotation.x, V3(1.0f, 0.0f, 0.0f)));
-	model = multiply_mat4(model, scale_mat4(size));*/
-    model = transformation;
-
-    mat4 VM = multiply_mat4(view, model);
-    mat4 PVM = multiply_mat4(projection, VM);
-    mat4 VM_normal = transpose(inverse(VM));
-
-	glUniformMatrix4fv(glGetUniformLocation(handle, "P"), 1, GL_FALSE, (float*)&projection);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "V"), 1, GL_FALSE, (float*)&view);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "VM"), 1, GL_FALSE, (float*)&VM);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "PVM"), 1, GL_FALSE, (float*)&PVM);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "VM_normal"), 1, GL_FALSE, (float*)&VM_normal);
-
-    v2 default_offset = V2(0.0f, 0.0f);
-	glUniform2fv(glGetUniformLocation(handle, "color_map_offset"), 1, (float*)&material.color_map.offset);
-	glUniform2fv(
-        glGetUniformLocation(handle, "ambient_map_offset"), 1,
-        material.ambient.type == VALUE_MAP_MAP ? (float*)&material.ambient.value.map.offset : (float*)&default_offset
-    );
-	glUniform2fv(
-        glGetUniformLocation(handle, "diffuse_map_offset"), 1,
-        material.diffuse.type == VALUE_MAP_MAP ? (float*)&material.diffuse.value.map.offset : (float*)&default_offset
-    );
-	glUniform2fv(
-        glGetUniformLocation(handle, "specular_map_offset"), 1,
-        material.specular.type == VALUE_MAP_MAP ? (float*)&material.specular.value.map.offset : (float*)&default_offset
-    );
-	glUniform2fv(
-        glGetUniformLocation(handle, "normal_map_offset"), 1,
-        material.normal.type == VALUE_MAP_MAP ? (float*)&material.normal.value.map.offset : (float*)&default_offset
-    );
-
-	glUniform2fv(glGetUniformLocation(handle, "offset1"), 1, (float*)&material.texture1.offset);
-	glUniform1f(glGetUniformLocation(handle, "texture_mix"), material.texture_mix);
-
-    // Mappable values
-    // If type is not VALUE_MAP_CONST, set their value to -1 (which isn't valid to the shader normally, so should be fine as a flag)
-	glUniform1f(glGetUniformLocation(handle, "ambient_amp"), material.ambient.type == VALUE_MAP_CONST ? material.ambient.value.constant : -1.0f);
-	glUniform1f(glGetUniformLocation(handle, "diffuse_amp"), material.diffuse.type == VALUE_MAP_CONST ? material.diffuse.value.constant : -1.0f);
-	glUniform1f(glGetUniformLocation(handle, "specular_amp"), material.specular.type == VALUE_MAP_CONST ? material.specular.value.constant : -1.0f);
-	glUniform1f(glGetUniformLocation(handle, "normal_amp"), material.normal.type == VALUE_MAP_CONST ? material.normal.value.constant : -1.0f);
-    // TODO: this -^ is kinda strange and acts like a flag. normals will never be scaled. better solution?
-	glUniform1f(glGetUniformLocation(handle, "shininess"), material.shininess);
-
-    for (i32 i = 0; i < scene->num_lights; i++) {
-        if (i == MAX_LIGHTS) {
-            printf("Warning: too many light sources (max: %d).", MAX_LIGHTS);
-            break;
-        }
-        Point_light light = scene->lights[i];
-        std::string uniform_name = "point_lights[" + std::to_string(i) + "]";
-        glUniform3fv(glGetUniformLocation(handle, (uniform_name + ".position").c_str()), 1, (float*)&light.position);
-        glUniform3fv(glGetUniformLocation(handle, (uniform_name + ".color").c_str()), 1, (float*)&light.color);
-        glUniform1f(glGetUniformLocation(handle, (uniform_name + ".falloff_linear").c_str()), light.falloff_linear);
-        glUniform1f(glGetUniformLocation(handle, (uniform_name + ".falloff_quadratic").c_str()), light.falloff_quadratic);
-        glUniform1f(glGetUniformLocation(handle, (uniform_name + ".ambient").c_str()), light.ambient);
-    }
-    glUniform1i(glGetUniformLocation(handle, "num_point_lights"), std::min(scene->num_lights, MAX_LIGHTS));
+}
 
-    for (i32 i = 0; i < scene->num_sun_lights; i++) {
-        if (i == MAX_LIGHTS) {
-            printf("Warning: too many light sources (max: %d).", MAX_LIGHTS);
-            break;
-        }
-        Sun_light light = scene->sun_lights[i];
-        std::string uniform_name = "sun_lights[" + std::to_string(i) + "]";
+// Draws the runs in [first, end) with their material shaders, one multi draw per run of identical materials.
+// While entity costs are measured every item is a run of its own, so its queries cover nothing else
+void shade_draws(Render_state* renderer, Draw_item** items, u32 first, u32 end, u8 depth_write) {
+	Entity_costs* costs = &renderer->entity_costs;
+	while (first < end) {
+		u32 last = first + 1;
+		while (!costs->enabled && last < end && material_equal(&items[first]->material, &items[last]->material)) {
+			last++;
+		}
 
-        glUniform3fv(glGetUniformLocation(handle, (uniform_name + ".angle").c_str()), 1, (float*)&light.angle);
-        glUniform3fv(glGetUniformLocation(handle, (uniform_name + ".color").c_str()), 1, (float*)&light.color);
-        glUniform1f(glGetUniformLocation(handle, (uniform_name + ".falloff_linear").c_str()), light.falloff_linear);
-        glUniform1f(glGetUniformLocation(handle, (uniform_name + ".falloff_quadratic").c_str()), light.falloff_quadratic);
-        glUniform1f(glGetUniformLocation(handle, (uniform_name + ".ambient").c_str()), light.ambient);
-    }
-    glUniform1i(glGetUniformLocation(handle, "num_sun_lights"), std::min(scene->num_sun_lights, MAX_LIGHTS));
+		Material* material = &items[first]->material;
+		u32 handle = renderer->shaders[material->shader_index];
+		if (material->variant > 0 && renderer->variants[material->variant - 1].program) {
+			handle = renderer->variants[material->variant - 1].program;
+		}
+		gl_state_use_program(handle);
+		set_material_state(material, depth_write);
+		set_material_uniforms(handle, *material, items[first]->scene);
+		i32 draw = entity_costs_begin(costs, items[first]->entity, items[first]->mesh_id, items[first]->indices.count / 3);
+		mesh_pool_draw(&renderer->mesh_pool, first, last - first);
+		entity_costs_end(costs, draw);
+		first = last;
+	}
+}
 
-	glBindVertexArray(mesh->vao);
+typedef struct Sorted_item {
+	float depth;	// View space z, more negative is further away
+	Draw_item* item;
+} Sorted_item;
 
-	glEnableVertexAttribArray(0);	// vertices
-	glEnableVertexAttribArray(1);	// uv coordinates
-	glEnableVertexAttribArray(2);	// normals
+static bool sorted_item_further(const Sorted_item& a, const Sorted_item& b) {
+	return a.depth < b.depth;
+}
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, color_map);
+// Writes every queued mesh into the indirect command buffer and shades them in three groups:
+// opaque draws the depth pre-pass covers, the remaining opaque draws, then transparent draws back to front.
+// With the pre-pass enabled the first group lays down depth first and only its visible fragments are shaded,
+// the skybox follows the opaque groups at far depth so it only fills what geometry left uncovered
+void submit_draws(Render_state* renderer, i32 width, i32 height) {
+	Mesh_pool* pool = &renderer->mesh_pool;
+	Depth_prepass* prepass = &renderer->prepass;
+	Scene_statistics* statistics = &renderer->statistics;
+
+	static Draw_elements_indirect_command commands[MAX_DRAW_ITEMS];
+	static Pool_instance instances[MAX_DRAW_ITEMS];
+	static Draw_item* items[MAX_DRAW_ITEMS];
+	static u32 programs[MAX_DRAW_ITEMS];
+	static Draw_item* opaque[MAX_DRAW_ITEMS];
+	static Sorted_item transparent[MAX_DRAW_ITEMS];
+	u32 prepass_count = 0;
+	u32 opaque_count = 0;
+	u32 transparent_count = 0;
+	Scene_stats stats = {
+		.pixels = (u32)(width * height),
+	};
 
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, ambient_map);
+	// Stable partition, so runs of identical materials stay together within the opaque groups
+	Draw_list* list = renderer->frame;
+	for (u32 i = 0; i < list->item_count; ++i) {
+		Draw_item* item = &list->items[i];
+		if (item->indices.count == 0) {
+			continue;
+		}
+		stats.triangles_submitted += item->indices.count / 3;
+		if (item->material.blend != BLEND_NONE) {
+			v3 center = bounding_sphere_transform(item->sphere, item->transformation).center;
+			transparent[transparent_count++] = (Sorted_item) {
+				.depth = list->view.elements[0][2] * center.x + list->view.elements[1][2] * center.y + list->view.elements[2][2] * center.z + list->view.elements[3][2],
+				.item = item,
+			};
+			continue;
+		}
+		u32 program = depth_program(renderer, &item->material);
+		if (program) {
+			programs[prepass_count] = program;
+			items[prepass_count++] = item;
+		}
+		else {
+			opaque[opaque_count++] = item;
+		}
+	}
+	std::stable_sort(transparent, transparent + transparent_count, sorted_item_further);
+	for (u32 i = 0; i < opaque_count; ++i) {
+		items[prepass_count + i] = opaque[i];
+	}
+	opaque_count += prepass_count;
+	for (u32 i = 0; i < transparent_count; ++i) {
+		items[opaque_count + i] = transparent[i].item;
+	}
+	u32 command_count = opaque_count + transparent_count;
+	stats.draws = command_count;
+	stats.transparent_draws = transparent_count;
+
+	for (u32 i = 0; i < command_count; ++i) {
+		Draw_item* item = items[i];
+		mat4 normal_matrix = transpose(inverse(item->transformation));
+
+		Pool_instance* instance = &instances[i];
+		instance->model = item->transformation;
+		for (u32 col = 0; col < 3; ++col) {
+			instance->normal_matrix[col] = V3(normal_matrix.elements[col][0], normal_matrix.elements[col][1], normal_matrix.elements[col][2]);
+		}
 
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, diffuse_map);
+		commands[i] = (Draw_elements_indirect_command) {
+			.count = item->indices.count,
+			.instance_count = 1,
+			.first_index = item->indices.offset,
+			.base_vertex = item->base_vertex,
+			.base_instance = i,
+		};
+	}
+	if (command_count > 0) {
+		if (mesh_pool_upload_draws(pool, commands, instances, command_count) != NoError) {
+			fprintf(stderr, "Stream buffer full, %u draws skipped\n", command_count);
+		}
+	}
 
-	glActiveTexture(GL_TEXTURE3);
-	glBindTexture(GL_TEXTURE_2D, specular_map);
+	entity_costs_begin_frame(&renderer->entity_costs);
+	depth_prepass_read_queries(prepass);
+	u8 use_prepass = prepass->enabled && prepass_count > 0;
+	for (u32 i = 0; use_prepass && i < prepass_count; ++i) {
+		if (!programs[i]) {
+			use_prepass = 0;	// Depth shader failed to build, shade the usual way
+		}
+	}
+	if (use_prepass) {
+		i32 section = gpu_timers_begin(&renderer->gpu_timers, "scene: depth pre-pass");
+		depth_prepass_draw(renderer, items, programs, prepass_count);
+		gpu_timers_end(&renderer->gpu_timers, section);
+	}
 
-	glActiveTexture(GL_TEXTURE4);
-	glBindTexture(GL_TEXTURE_2D, normal_map);
+	// Shading only, the pre-pass is not counted. Every query still in flight means this frame goes uncounted
+	scene_statistics_read_queries(statistics);
+	u32 statistics_slot = statistics->query_frame % SCENE_QUERY_FRAMES;
+	statistics->query_frame++;
+	u8 gathering = !statistics->query_pending[statistics_slot];
+	if (gathering && statistics->supported) {
+		glBeginQuery(GL_CLIPPING_OUTPUT_PRIMITIVES_ARB, statistics->primitive_queries[statistics_slot]);
+		glBeginQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB, statistics->fragment_queries[statistics_slot]);
+	}
 
-	glActiveTexture(GL_TEXTURE5);
-	glBindTexture(GL_TEXTURE_2D, texture1);
+	gl_state_set_depth_test(1);
+	if (use_prepass) {
+		// Depth is final already, only the front most fragment of each pixel passes
+		gl_state_set_depth_func(GL_EQUAL);
+	}
+	else {
+		gl_state_set_depth_func(renderer->depth_func);
+	}
 
-	glUniform1i(glGetUniformLocation(handle, "color_map"), 0);
-	glUniform1i(glGetUniformLocation(handle, "ambient_map"), 1);
-	glUniform1i(glGetUniformLocation(handle, "diffuse_map"), 2);
-	glUniform1i(glGetUniformLocation(handle, "specular_map"), 3);
-	glUniform1i(glGetUniformLocation(handle, "normal_map"), 4);
-	glUniform1i(glGetUniformLocation(handle, "obj_texture1"), 5);
+	i32 section = gpu_timers_begin(&renderer->gpu_timers, "scene: opaque");
+	u32 slot = prepass->query_frame % PREPASS_QUERY_FRAMES;
+	prepass->query_frame++;
+	// Samples are counted per draw while entity costs are measured, and only one such query can run at a time
+	u8 counting = prepass_count > 0 && !prepass->query_pending[slot] && !renderer->entity_costs.enabled;
+	if (counting) {
+		glBeginQuery(GL_SAMPLES_PASSED, prepass->queries[slot]);
+	}
+	shade_draws(renderer, items, 0, prepass_count, !use_prepass);
+	if (counting) {
+		glEndQuery(GL_SAMPLES_PASSED);
+		prepass->query_pending[slot] = 1;
+		prepass->query_prepass[slot] = use_prepass;
+		prepass->query_pixels[slot] = width * height;
+	}
 
-	glDrawElements(GL_TRIANGLES, mesh->draw_count, GL_UNSIGNED_INT, 0);
+	gl_state_set_depth_func(renderer->depth_func);
+	shade_draws(renderer, items, prepass_count, opaque_count, 1);
+	gpu_timers_end(&renderer->gpu_timers, section);
+	if (renderer->skybox_id >= 0) {
+		section = gpu_timers_begin(&renderer->gpu_timers, "scene: skybox");
+		draw_skybox(renderer);
+		gpu_timers_end(&renderer->gpu_timers, section);
+	}
+	if (transparent_count > 0) {
+		section = gpu_timers_begin(&renderer->gpu_timers, "scene: transparent");
+		shade_draws(renderer, items, opaque_count, command_count, 1);
+		gpu_timers_end(&renderer->gpu_timers, section);
+	}
 
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
-	glDisableVertexAttribArray(2);
+	gl_state_set_cull(0);
+	gl_state_set_depth_write(1);
+	if (gathering) {
+		if (statistics->supported) {
+			glEndQuery(GL_CLIPPING_OUTPUT_PRIMITIVES_ARB);
+			glEndQuery(GL_FRAGMENT_SHADER_INVOCATIONS_ARB);
+		}
+		statistics->query_pending[statistics_slot] = 1;
+		statistics->query_stats[statistics_slot] = stats;
+		statistics->query_frames[statistics_slot] = statistics->query_frame - 1;
+	}
+	entity_costs_end_frame(&renderer->entity_costs);
+}
 
-	glBindVertexArray(0);
+void render_skybox(u32 skybox_id, float brightness) {
+	Draw_list* list = draw_list(&render_state);
+	list->skybox_id = skybox_id;
+	list->skybox_brightness = brightness;
+}
 
-	glUseProgram(0);
+void render_point_lights(Point_light* lights, i32 count) {
+	Draw_list* list = draw_list(&render_state);
+	count = clamp(count, 0, MAX_POINT_LIGHTS);
+	memcpy(list->point_lights, lights, sizeof(Point_light) * count);
+	list->point_light_count = count;
 }
 
-void render_skybox(u32 skybox_id, float brightness) {
-	Render_state* renderer = &render_state;
-	u32 texture = renderer->cube_maps[skybox_id];
+void draw_skybox(Render_state* renderer) {
+	u32 texture = renderer->cube_maps[renderer->skybox_id];
 
 	u32 handle = renderer->shaders[SKYBOX_SHADER];//skybox_shader;
-	glUseProgram(handle);
+	gl_state_use_program(handle);
 
-	mat4 view_matrix = view;
+	mat4 view_matrix = renderer->frame->view;
 	view_matrix.elements[3][0] = 0;
 	view_matrix.elements[3][1] = 0;
 	view_matrix.elements[3][2] = 0;
 
-	glDepthFunc(GL_LEQUAL);
+	gl_state_set_depth_test(1);
+	gl_state_set_depth_func(GL_LEQUAL);
+	gl_state_set_depth_write(1);
+	gl_state_set_blend(0);
+	gl_state_set_cull(0);	// Seen from the inside
 
-	glUniformMatrix4fv(glGetUniformLocation(handle, "projection"), 1, GL_FALSE, (float*)&projection);
-	glUniformMatrix4fv(glGetUniformLocation(handle, "view"), 1, GL_FALSE, (float*)&view_matrix);
-	glUniform1f(glGetUniformLocation(handle, "brightness"), brightness);
+	COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "projection"), 1, GL_FALSE, (float*)&renderer->frame->projection);
+	COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "view"), 1, GL_FALSE, (float*)&view_matrix);
+	COUNTED_UNIFORM(glUniform1f, glGetUniformLocation(handle, "brightness"), renderer->skybox_brightness);
 
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+	gl_state_bind_texture(0, GL_TEXTURE_CUBE_MAP, texture);
 
-	glBindVertexArray(cube_model.vao);
-	glDrawArrays(GL_TRIANGLES, 0, cube_model.draw_count);
-	glBindVertexArray(0);
+	gl_state_bind_vertex_array(cube_vao);
+	glDrawArrays(GL_TRIANGLES, 0, cube_vertex_count);
+	render_stats_count_draw(cube_vertex_count / 3);
+}
 
-	glDepthFunc(renderer->depth_func);
+void scene_pass(Frame_graph* graph, i32 pass, void* data) {
+	Render_state* renderer = (Render_state*)data;
+	Graph_texture_desc* desc = &graph->resources[graph->passes[pass].write].desc;
+	renderer->cluster_tile_scale = V2((float)CLUSTER_X / desc->width, (float)CLUSTER_Y / desc->height);
+	submit_draws(renderer, desc->width, desc->height);
+	if (renderer->flares.queued) {
+		i32 section = gpu_timers_begin(&renderer->gpu_timers, "scene: flares");
+		flares_probe(renderer, desc->width, desc->height);
+		flares_draw(renderer, desc->width, desc->height);
+		gpu_timers_end(&renderer->gpu_timers, section);
+	}
+}
 
-	glUseProgram(0);
+void fullscreen_pass(Frame_graph* graph, i32 pass, void* data) {
+	Fullscreen_pass* fullscreen = (Fullscreen_pass*)data;
+	Fbo_attributes attr = fullscreen->attributes;
+	if (fullscreen->source1 >= 0) {
+		attr.combine.texture1 = frame_graph_texture(graph, fullscreen->source1);
+	}
+	render_fullscreen_pass(frame_graph_texture(graph, fullscreen->source), attr);
+}
+
+i32 add_fullscreen_pass(Frame_graph* graph, Fullscreen_pass* data, const char* name, i32 source, i32 source1, i32 target, u8 load, Fbo_attributes attr) {
+	*data = (Fullscreen_pass) {
+		.source = source,
+		.source1 = source1,
+		.attributes = attr,
+	};
+	i32 pass = frame_graph_add_pass(graph, name, fullscreen_pass, data);
+	frame_graph_read(graph, pass, source);
+	frame_graph_read(graph, pass, source1);
+	frame_graph_write(graph, pass, target, load, GRAPH_LOAD_DONT_CARE);
+	return pass;
+}
+
+// Everything the gpu is handed for a frame happens in here, so timers and fences bracket all of it
+void execute_frame_graph(Render_state* renderer) {
+	stream_buffer_begin_frame(&renderer->stream);
+	gpu_timers_begin_frame(&renderer->gpu_timers);
+	resolution_begin_frame(&renderer->resolution);
+	frame_graph_execute(&renderer->graph);
+	resolution_end_frame(&renderer->resolution);
+	gpu_timers_end_frame(&renderer->gpu_timers);
+	stream_buffer_end_frame(&renderer->stream);
+}
+
+void build_frame_graph(Render_state* renderer, i32 width, i32 height) {
+	Frame_graph* graph = &renderer->graph;
+	static Fullscreen_pass fullscreen[MAX_GRAPH_PASSES];
+	u32 fullscreen_count = 0;
+	float scale = renderer->resolution.scale;
+	i32 scene_width = (i32)(width * scale + 0.5f);
+	i32 scene_height = (i32)(height * scale + 0.5f);
+
+	frame_graph_begin(graph);
+	i32 backbuffer = frame_graph_import_backbuffer(graph, "backbuffer", width, height);
+	// Linear, the bloom extract reads it at half resolution and the final pass stretches it over the window
+	i32 color = frame_graph_create_texture(graph, "scene", (Graph_texture_desc) {
+		.width = scene_width,
+		.height = scene_height,
+		.color_format = GL_RGBA16,
+		.depth_format = GL_DEPTH_COMPONENT32,
+		.filter = GL_LINEAR,
+	});
+
+	// The skybox covers every pixel, so only depth has to be cleared when there is one
+	i32 scene = frame_graph_add_pass(graph, "scene", scene_pass, renderer);
+	frame_graph_write(graph, scene, color, renderer->skybox_id >= 0 ? GRAPH_LOAD_DONT_CARE : GRAPH_LOAD_CLEAR, GRAPH_LOAD_CLEAR);
+
+	if (!renderer->use_post_processing) {
+		// Blended, the scene alpha is not always one, so the backbuffer still has to be cleared
+		add_fullscreen_pass(graph, &fullscreen[fullscreen_count++], "copy", color, -1, backbuffer, GRAPH_LOAD_CLEAR, (Fbo_attributes) {
+			.shader_id = renderer->shaders[TEXTURE_SHADER], //texture_shader,
+		});
+		return;
+	}
+
+	Bloom_preset* preset = &bloom_presets[renderer->bloom_quality];
+	i32 bloom[MAX_BLOOM_LEVELS];
+	for (u32 level = 0; level < preset->levels; ++level) {
+		// Only color is needed for the bloom levels
+		bloom[level] = frame_graph_create_texture(graph, bloom_level_names[level], (Graph_texture_desc) {
+			.width = scene_width >> (level + 1),
+			.height = scene_height >> (level + 1),
+			.color_format = GL_RGBA16,
+			.depth_format = 0,
+			.filter = GL_LINEAR,
+		});
+	}
+
+	// Bright parts are extracted straight into the half resolution level, the bilinear fetch averages 2x2 scene pixels
+	add_fullscreen_pass(graph, &fullscreen[fullscreen_count++], "bloom extract", color, -1, bloom[0], GRAPH_LOAD_DONT_CARE, (Fbo_attributes) {
+		.shader_id = renderer->shaders[BRIGHTNESS_EXTRACT_SHADER], //brightness_extract_shader,
+		.blend = FBO_BLEND_NONE,
+		{
+			.extract = {
+				.factor = BLOOM_EXTRACT_FACTOR,
+				.keep_color = 0,
+			},
+		}
+	});
+
+	for (u32 level = 1; level < preset->levels; ++level) {
+		add_fullscreen_pass(graph, &fullscreen[fullscreen_count++], "bloom downsample", bloom[level - 1], -1, bloom[level], GRAPH_LOAD_DONT_CARE, (Fbo_attributes) {
+			.shader_id = renderer->shaders[BLOOM_DOWNSAMPLE_SHADER],
+			.blend = FBO_BLEND_NONE,
+			{
+				.downsample = {
+					.high_quality = preset->high_quality_downsample,
+				},
+			}
+		});
+	}
+
+	// Each level is blurred on its way up and accumulated onto the next larger one
+	for (u32 level = preset->levels - 1; level > 0; --level) {
+		add_fullscreen_pass(graph, &fullscreen[fullscreen_count++], "bloom upsample", bloom[level], -1, bloom[level - 1], GRAPH_LOAD_KEEP, (Fbo_attributes) {
+			.shader_id = renderer->shaders[BLOOM_UPSAMPLE_SHADER],
+			.blend = FBO_BLEND_ADDITIVE,
+			{
+				.upsample = {
+					.radius = preset->upsample_radius,
+				},
+			}
+		});
+	}
+
+	// Samples both inputs bilinearly, which is also what upscales a reduced resolution scene to the window
+	add_fullscreen_pass(graph, &fullscreen[fullscreen_count++], "combine", bloom[0], color, backbuffer, GRAPH_LOAD_DONT_CARE, (Fbo_attributes) {
+		.shader_id = renderer->shaders[COMBINE_SHADER], //combine_shader,
+		.blend = FBO_BLEND_NONE,
+		{
+			.combine = {
+				.texture1 = 0,	// Scene color, filled in when the pass runs
+				.mix = BLOOM_INTENSITY / preset->levels,	// Every level adds its own copy of the bright parts
+			},
+		}
+	});
+}
+
+// Render side of a frame, on whichever thread owns the context
+void render_draw_list(Render_state* renderer, Draw_list* list) {
+	PROFILE_FUNCTION();
+	renderer->frame = list;
+	apply_settings(renderer, &list->settings);
+	renderer->skybox_id = list->skybox_id;
+	renderer->skybox_brightness = list->skybox_brightness;
+	renderer->flares.queued = list->flares_queued;
+	renderer->flares.source = list->flare_source;
+
+	resolution_update(&renderer->resolution, list->delta_time * 1000.0f);
+	{
+		PROFILE_SCOPE("build light clusters");
+		light_clusters_build(&renderer->clusters, list->point_lights, list->point_light_count, list->view, list->projection);
+	}
+	build_frame_graph(renderer, list->width, list->height);
+	execute_frame_graph(renderer);
+	// Drawn after the capture, the captured frames are compared against references without it
+	capture_frame(&renderer->capture, list->width, list->height);
+	if (list->settings.hud) {
+		draw_hud(renderer);
+	}
+	if (list->print_gpu_timings) {
+		gpu_timers_print_stats(&renderer->gpu_timers);
+	}
+	{
+		PROFILE_SCOPE("swap buffers");
+		window_swap_buffers();
+	}
+	renderer->frame = NULL;
+}
+
+// Only what the main thread reads back, the counters start over for the next frame
+void publish_frame(Render_state* renderer) {
+	Gl_state_counters state_counters = gl_state_get_counters();
+	renderer->thread.published = (Render_published) {
+		.scene_stats = renderer->statistics.latest,
+		.resolution_scale = renderer->resolution.scale,
+		.state_counters = state_counters,
+		.render_stats = render_stats_end_frame(&state_counters),
+	};
+	gl_state_reset_counters();
+	Entity_costs* costs = &renderer->entity_costs;
+	if (costs->enabled) {
+		renderer->thread.entity_cost_count = entity_costs_get(costs, renderer->thread.entity_costs, MAX_COST_ENTITIES);
+		renderer->thread.entity_cost_frames = costs->measured;
+	}
+}
+
+// Straight onto the backbuffer with the texture shader, the text only changes every HUD_REFRESH_FRAMES
+void draw_hud(Render_state* renderer) {
+	Hud* hud = &renderer->hud;
+	if (hud_refresh_due(hud)) {
+		Render_stats* stats = &renderer->thread.published.render_stats;
+		char text[sizeof(hud->text)];
+		snprintf(text, sizeof(text),
+			"draw calls  %u\n"
+			"triangles   %llu\n"
+			"programs    %u\n"
+			"textures    %u\n"
+			"uniforms    %u\n"
+			"uploaded    %.1f kib\n"
+			"resolution  %d%%",
+			stats->draw_calls, (unsigned long long)stats->triangles, stats->program_switches, stats->texture_binds,
+			stats->uniform_uploads, stats->bytes_uploaded / 1024.0f, (i32)(renderer->resolution.scale * 100.0f + 0.5f));
+		hud_set_text(hud, text);
+	}
+	u32 handle = renderer->shaders[TEXTURE_SHADER];
+	gl_state_bind_framebuffer(0);
+	gl_state_set_viewport(0, 0, renderer->frame->width, renderer->frame->height);
+	gl_state_use_program(handle);
+
+	mat4 model_matrix = translate(V3(HUD_MARGIN, HUD_MARGIN, 0));
+	model_matrix = multiply_mat4(model_matrix, scale_mat4(V3(HUD_WIDTH * HUD_SCALE, HUD_HEIGHT * HUD_SCALE, 1)));
+	COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "projection"), 1, GL_FALSE, (float*)&renderer->frame->ortho_projection);
+	COUNTED_UNIFORM(glUniformMatrix4fv, glGetUniformLocation(handle, "model"), 1, GL_FALSE, (float*)&model_matrix);
+	COUNTED_UNIFORM(glUniform1i, glGetUniformLocation(handle, "texture0"), 0);
+	gl_state_bind_texture(0, GL_TEXTURE_2D, hud->texture);
+
+	gl_state_set_blend(1);
+	gl_state_set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	gl_state_set_depth_test(0);
+	gl_state_set_cull(0);
+	gl_state_bind_vertex_array(quad_vao);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	render_stats_count_draw(2);
+}
+
+void* render_thread_main(void* data) {
+	Render_state* renderer = (Render_state*)data;
+	Render_thread* thread = &renderer->thread;
+	profiler_set_thread_name("render");
+	window_make_context_current(1);
+
+	pthread_mutex_lock(&thread->mutex);
+	for (;;) {
+		// Lists submitted before quitting are still rendered, in order
+		while (thread->completed == thread->submitted && !thread->quit) {
+			pthread_cond_wait(&thread->list_ready, &thread->mutex);
+		}
+		if (thread->completed == thread->submitted) {
+			break;
+		}
+		Draw_list* list = &renderer->lists[thread->completed % DRAW_LIST_COUNT];
+		pthread_mutex_unlock(&thread->mutex);
+
+		render_draw_list(renderer, list);
+
+		pthread_mutex_lock(&thread->mutex);
+		publish_frame(renderer);
+		thread->completed++;
+		pthread_cond_broadcast(&thread->list_done);
+	}
+	pthread_mutex_unlock(&thread->mutex);
+
+	window_make_context_current(0);
+	return NULL;
+}
+
+i32 renderer_start_capture(const char* directory, u32 interval) {
+	return capture_initialize(&render_state.capture, directory, interval);
+}
+
+i32 renderer_start_thread() {
+	Render_state* renderer = &render_state;
+	Render_thread* thread = &renderer->thread;
+	if (thread->running) {
+		return NoError;
+	}
+	// A list begun before this would be counted in the wrong slot
+	renderer->building = NULL;
+	thread->quit = 0;
+	pthread_mutex_init(&thread->mutex, NULL);
+	pthread_cond_init(&thread->list_ready, NULL);
+	pthread_cond_init(&thread->list_done, NULL);
+
+	// Released here first, a context is current on one thread at a time
+	window_make_context_current(0);
+	if (pthread_create(&thread->thread, NULL, render_thread_main, renderer) != 0) {
+		fprintf(stderr, "Failed to start the render thread, rendering on the main thread\n");
+		window_make_context_current(1);
+		pthread_cond_destroy(&thread->list_done);
+		pthread_cond_destroy(&thread->list_ready);
+		pthread_mutex_destroy(&thread->mutex);
+		return Error;
+	}
+	thread->running = 1;
+	return NoError;
+}
+
+void renderer_stop_thread() {
+	Render_state* renderer = &render_state;
+	Render_thread* thread = &renderer->thread;
+	if (!thread->running) {
+		return;
+	}
+	pthread_mutex_lock(&thread->mutex);
+	thread->quit = 1;
+	pthread_cond_signal(&thread->list_ready);
+	pthread_mutex_unlock(&thread->mutex);
+	pthread_join(thread->thread, NULL);
+
+	pthread_cond_destroy(&thread->list_done);
+	pthread_cond_destroy(&thread->list_ready);
+	pthread_mutex_destroy(&thread->mutex);
+	thread->running = 0;
+	window_make_context_current(1);
+	renderer->building = NULL;
+}
+
+void renderer_begin_frame() {
+	Render_state* renderer = &render_state;
+	Render_thread* thread = &renderer->thread;
+	if (thread->running) {
+		// Both lists are still waiting to be rendered, the main thread is a whole frame ahead
+		pthread_mutex_lock(&thread->mutex);
+		while (thread->submitted - thread->completed >= DRAW_LIST_COUNT) {
+			pthread_cond_wait(&thread->list_done, &thread->mutex);
+		}
+		pthread_mutex_unlock(&thread->mutex);
+	}
+	Draw_list* list = &renderer->lists[thread->submitted % DRAW_LIST_COUNT];
+	list->item_count = 0;
+	list->point_light_count = 0;
+	list->skybox_id = -1;
+	list->flares_queued = 0;
+	list->scene_source = NULL;
+	list->scene = (Scene) {};
+	list->print_gpu_timings = 0;
+	renderer->building = list;
+}
+
+Draw_list* draw_list(Render_state* renderer) {
+	if (!renderer->building) {
+		renderer_begin_frame();
+	}
+	return renderer->building;
+}
+
+// Sun lights are copied once per frame, the items of a frame share the copy of the last scene they were queued with
+void capture_scene(Draw_list* list, Scene* scene) {
+	if (scene == list->scene_source) {
+		return;
+	}
+	i32 count = clamp(scene->num_sun_lights, 0, MAX_LIGHTS);
+	memcpy(list->sun_lights, scene->sun_lights, sizeof(Sun_light) * count);
+	list->scene = (Scene) {
+		.lights = scene->lights,
+		.num_lights = scene->num_lights,
+		.sun_lights = list->sun_lights,
+		.num_sun_lights = count,
+	};
+	list->scene_source = scene;
+}
+
+void renderer_render_frame(float delta_time) {
+	PROFILE_FUNCTION();
+	Render_state* renderer = &render_state;
+	Render_thread* thread = &renderer->thread;
+	Draw_list* list = draw_list(renderer);
+	queue_static_batches(renderer, list);
+	list->view = view;
+	list->projection = projection;
+	list->ortho_projection = ortho_projection;
+	list->width = window_width();
+	list->height = window_height();
+	list->delta_time = delta_time;
+	list->settings = renderer->settings;
+	list->print_gpu_timings = renderer->print_gpu_timings;
+	renderer->print_gpu_timings = 0;
+	renderer->building = NULL;
+
+	if (!thread->running) {
+		render_draw_list(renderer, list);
+		publish_frame(renderer);
+		thread->submitted++;
+		thread->completed++;
+		return;
+	}
+	pthread_mutex_lock(&thread->mutex);
+	thread->submitted++;
+	pthread_cond_signal(&thread->list_ready);
+	pthread_mutex_unlock(&thread->mutex);
 }
 
 void renderer_destroy() {
@@ -886,14 +2083,28 @@ void renderer_destroy() {
     for (u32 i = 0; i < MAX_SHADER; i++) {
         glDeleteShader(renderer->shaders[i]);
     }
+	for (u32 i = 0; i < renderer->variant_count; i++) {
+		glDeleteProgram(renderer->variants[i].program);
+	}
+	renderer->variant_count = 0;
 	/*glDeleteShader(diffuse_shader);
 	glDeleteShader(skybox_shader);
 	glDeleteShader(texture_shader);
 	glDeleteShader(combine_shader);
 	glDeleteShader(blur_shader);
 	glDeleteShader(flare_shader);*/
+	flares_destroy(renderer);
+	entity_costs_destroy(&renderer->entity_costs);
+	glDeleteQueries(PREPASS_QUERY_FRAMES, renderer->prepass.queries);
+	glDeleteQueries(SCENE_QUERY_FRAMES, renderer->statistics.primitive_queries);
+	glDeleteQueries(SCENE_QUERY_FRAMES, renderer->statistics.fragment_queries);
+	light_clusters_destroy(&renderer->clusters);
+	gl_state_forget_vertex_array(quad_vao);
+	gl_state_forget_vertex_array(cube_vao);
 	glDeleteVertexArrays(1, &quad_vao);
-	glDeleteVertexArrays(1, &quad_vbo);
+	glDeleteBuffers(1, &quad_vbo);
+	glDeleteVertexArrays(1, &cube_vao);
+	glDeleteBuffers(1, &cube_vbo);
 
 	for (u32 i = 0; i < renderer->texture_count; i++) {
 		u32* texture_id = &renderer->textures[i];
@@ -909,11 +2120,18 @@ void renderer_destroy() {
 
 	for (u32 i = 0; i < renderer->model_count; i++) {
 		Model* model = &renderer->models[i];
-		unload_model(model);
+		unload_model(renderer, model);
 	}
 	renderer->model_count = 0;
+	static_batches_clear(&renderer->static_batches, &renderer->mesh_pool);
+	mesh_pool_destroy(&renderer->mesh_pool);
+	stream_buffer_print_stats(&renderer->stream);
+	stream_buffer_destroy(&renderer->stream);
 
 	resources_unload(&render_state.resources);
-	unload_model(&cube_model);
-	fbos_unload(renderer);
+	frame_graph_destroy(&renderer->graph);
+	resolution_destroy(&renderer->resolution);
+	gpu_timers_destroy(&renderer->gpu_timers);
+	capture_destroy(&renderer->capture);
+	hud_destroy(&renderer->hud);
 }
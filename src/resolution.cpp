@@ -0,0 +1,145 @@
+// resolution.cpp
+// dynamic resolution, scales the scene target to keep gpu frame times within a budget
+
+#include <GL/glew.h>
+#include <math.h>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "resolution.hpp"
+
+#define RESOLUTION_HEADROOM 0.9f	// Aim a little below the budget when scaling down, so it doesn't immediately go over again
+#define RESOLUTION_RAISE 0.7f	// Scale up one step when the gpu time is below this fraction of the budget
+
+static float average(float* samples, u32 count);
+static void collect_queries(Dynamic_resolution* resolution);
+
+float average(float* samples, u32 count) {
+	u32 n = count < RESOLUTION_HISTORY ? count : RESOLUTION_HISTORY;
+	if (n == 0) {
+		return 0;
+	}
+	float sum = 0;
+	for (u32 i = 0; i < n; ++i) {
+		sum += samples[i];
+	}
+	return sum / n;
+}
+
+void resolution_initialize(Dynamic_resolution* resolution, float target_ms) {
+	*resolution = (Dynamic_resolution) {};
+	resolution->enabled = 1;
+	resolution->scale = RESOLUTION_MAX_SCALE;
+	resolution->target_ms = target_ms;
+	resolution->use_timer = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+	if (resolution->use_timer) {
+		glGenQueries(RESOLUTION_QUERY_FRAMES * 2, &resolution->queries[0][0]);
+	}
+	else {
+		fprintf(stdout, "Dynamic resolution: timer queries unavailable, scaling on cpu frame times\n");
+	}
+}
+
+void resolution_begin_frame(Dynamic_resolution* resolution) {
+	if (!resolution->use_timer) {
+		return;
+	}
+	u32 slot = resolution->frame % RESOLUTION_QUERY_FRAMES;
+	// Still not available after a full ring of frames, the old result is dropped rather than waited on
+	resolution->query_pending[slot] = 0;
+	glQueryCounter(resolution->queries[slot][0], GL_TIMESTAMP);
+}
+
+void resolution_end_frame(Dynamic_resolution* resolution) {
+	if (resolution->use_timer) {
+		u32 slot = resolution->frame % RESOLUTION_QUERY_FRAMES;
+		glQueryCounter(resolution->queries[slot][1], GL_TIMESTAMP);
+		resolution->query_pending[slot] = 1;
+		resolution->query_scale[slot] = resolution->scale;
+	}
+	resolution->frame++;
+}
+
+void collect_queries(Dynamic_resolution* resolution) {
+	for (u32 slot = 0; slot < RESOLUTION_QUERY_FRAMES; ++slot) {
+		if (!resolution->query_pending[slot]) {
+			continue;
+		}
+		i32 available = 0;
+		glGetQueryObjectiv(resolution->queries[slot][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) {
+			continue;
+		}
+		GLuint64 start = 0, end = 0;
+		glGetQueryObjectui64v(resolution->queries[slot][0], GL_QUERY_RESULT, &start);
+		glGetQueryObjectui64v(resolution->queries[slot][1], GL_QUERY_RESULT, &end);
+		resolution->query_pending[slot] = 0;
+		if (resolution->query_scale[slot] == resolution->scale && end > start) {
+			resolution->gpu_ms[resolution->gpu_count++ % RESOLUTION_HISTORY] = (end - start) / 1e6f;
+		}
+	}
+}
+
+void resolution_update(Dynamic_resolution* resolution, float cpu_ms) {
+	if (resolution->use_timer) {
+		collect_queries(resolution);
+	}
+	resolution->cpu_ms[resolution->cpu_count++ % RESOLUTION_HISTORY] = cpu_ms;
+	resolution->gpu_average = average(resolution->gpu_ms, resolution->gpu_count);
+	resolution->cpu_average = average(resolution->cpu_ms, resolution->cpu_count);
+
+	if (!resolution->enabled) {
+		return;
+	}
+	if (resolution->cooldown > 0) {
+		resolution->cooldown--;
+		return;
+	}
+	// Without timestamps the frame time is all there is, even if the cpu is what holds the frame back
+	u32 samples = resolution->use_timer ? resolution->gpu_count : resolution->cpu_count;
+	float gpu_ms = resolution->use_timer ? resolution->gpu_average : resolution->cpu_average;
+	if (samples < RESOLUTION_HISTORY || gpu_ms <= 0) {
+		return;
+	}
+
+	float scale = resolution->scale;
+	if (gpu_ms > resolution->target_ms) {
+		// Pixel cost grows with the square of the scale
+		scale *= sqrtf(RESOLUTION_HEADROOM * resolution->target_ms / gpu_ms);
+	}
+	else if (gpu_ms < RESOLUTION_RAISE * resolution->target_ms) {
+		scale += RESOLUTION_STEP;
+	}
+	scale = floorf(scale / RESOLUTION_STEP + 0.5f) * RESOLUTION_STEP;
+	scale = clamp(scale, RESOLUTION_MIN_SCALE, RESOLUTION_MAX_SCALE);
+	if (fabsf(scale - resolution->scale) < RESOLUTION_STEP * 0.5f) {
+		return;
+	}
+
+	fprintf(stdout, "Resolution scale: %.0f%% (gpu %.2f ms, cpu %.2f ms, target %.2f ms)\n", scale * 100.0f, resolution->gpu_average, resolution->cpu_average, resolution->target_ms);
+	resolution->scale = scale;
+	resolution->cooldown = RESOLUTION_COOLDOWN;
+	resolution->gpu_count = 0;
+	resolution->cpu_count = 0;
+}
+
+void resolution_set_enabled(Dynamic_resolution* resolution, u8 enabled) {
+	resolution->enabled = enabled;
+	if (!enabled) {
+		resolution->scale = RESOLUTION_MAX_SCALE;
+	}
+	resolution->gpu_count = 0;
+	resolution->cpu_count = 0;
+	fprintf(stdout, "Dynamic resolution: %s\n", enabled ? "on" : "off");
+}
+
+void resolution_destroy(Dynamic_resolution* resolution) {
+	if (resolution->use_timer) {
+		glDeleteQueries(RESOLUTION_QUERY_FRAMES * 2, &resolution->queries[0][0]);
+	}
+}
@@ -2,6 +2,8 @@
 // manager for loading/unloading static resources
 
 #include "resource.hpp"
+#include "profiler.hpp"
+#include "startup_trace.hpp"
 
 // Ugh loading takes ages. We ideally want to have a threaded resource loader, but we ain't got time to implement that.
 // TODO(lucas): Implement threaded resource loader if time is on our side.
@@ -14,6 +16,11 @@ const char* shader_path[MAX_SHADER] = {
 	"resource/shader/flare",
 	"resource/shader/brightness_extract",
 	"resource/shader/ground",
+	"resource/shader/bloom_downsample",
+	"resource/shader/bloom_upsample",
+	"resource/shader/flare_probe",
+	"resource/shader/depth",
+	"resource/shader/ground_depth",
 };
 
 const char* texture_path[MAX_TEXTURE] = {
@@ -59,6 +66,8 @@ void resources_initialize(Resources* resources) {
 }
 
 void resources_load(Resources* resources) {
+	PROFILE_FUNCTION();
+	i32 event = startup_trace_begin("resources load", NULL);
 	for (u32 i = 0; i < MAX_TEXTURE; i++) {
 		Image* image = &resources->images[i];
 		const char* path = texture_path[i];
@@ -79,6 +88,7 @@ void resources_load(Resources* resources) {
 		load_mesh(path, mesh, 1 /* sort mesh */);
 		resources->mesh_count++;
 	}
+	startup_trace_end(event, 0);
 }
 
 void resources_unload(Resources* resources) {
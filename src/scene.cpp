@@ -12,6 +12,8 @@
 #include "memory.hpp"
 #include "common.hpp"
 #include "renderer.hpp"
+#include "profiler.hpp"
+#include "startup_trace.hpp"
 
 #define SCENE_BUFFER_SIZE 255
 
@@ -89,6 +91,28 @@ static u8 scene_get_shader_id(char* shader_name, u32 shader_name_size, u32* shad
     }
 }
 
+std::unordered_map<std::string, u8> cull_names = {
+    {"back",    CULL_BACK},
+    {"front",   CULL_FRONT},
+    {"none",    CULL_NONE},
+};
+
+std::unordered_map<std::string, u8> blend_names = {
+    {"none",        BLEND_NONE},
+    {"alpha",       BLEND_ALPHA},
+    {"additive",    BLEND_ADDITIVE},
+};
+
+static u8 scene_get_mode(std::unordered_map<std::string, u8>& names, char* mode_name, u32 mode_name_size, u8* mode){
+    auto it = names.find(std::string(mode_name, mode_name_size));
+    if (it == names.end()) {
+        fprintf(stderr, "Invalid mode.\n");
+        return 0;
+    }
+    *mode = it->second;
+    return 1;
+}
+
 static void scene_print_pos() {
     fprintf(stderr, "At col %d row %d\n", col, row);
 }
@@ -227,7 +251,9 @@ static u8 scene_parse_material(FILE* fp, Engine* engine) {
         .shininess  = 10.0f,
         .color_map  = {.id = TEXTURE_MISSING},
         .texture1   = {}, .texture_mix = 0,
-        .shader_index = DIFFUSE_SHADER
+        .shader_index = DIFFUSE_SHADER,
+        .variant = 0,
+        .cull = CULL_BACK, .blend = BLEND_NONE, .depth_write = 1
     };
 
     while (current != EOF) {
@@ -302,6 +328,20 @@ static u8 scene_parse_material(FILE* fp, Engine* engine) {
                     if (!scene_get_name(fp, shader_name, &shader_name_size)) return 0;
                     if (!scene_get_shader_id(shader_name, shader_name_size, &shader_id)) return 0;
                     material->shader_index = shader_id;
+                } else if (strncmp("cull", buffer, buffer_size) == 0) {
+                    char mode_name[SCENE_BUFFER_SIZE] = "";
+                    u32 mode_name_size = 0;
+                    if (!scene_get_name(fp, mode_name, &mode_name_size)) return 0;
+                    if (!scene_get_mode(cull_names, mode_name, mode_name_size, &material->cull)) return 0;
+                } else if (strncmp("blend", buffer, buffer_size) == 0) {
+                    char mode_name[SCENE_BUFFER_SIZE] = "";
+                    u32 mode_name_size = 0;
+                    if (!scene_get_name(fp, mode_name, &mode_name_size)) return 0;
+                    if (!scene_get_mode(blend_names, mode_name, mode_name_size, &material->blend)) return 0;
+                } else if (strncmp("depth_write", buffer, buffer_size) == 0) {
+                    float depth_write = 0;
+                    if (!scene_parse_float(fp, &depth_write)) return 0;
+                    material->depth_write = depth_write != 0;
                 }
                 buffer_size = 0;
                 break;
@@ -337,6 +377,7 @@ std::unordered_map<std::string, Entity_update> entity_updates = {
     }}
 };
 std::unordered_map<std::string, Entity*> entity_ids = {};
+std::unordered_map<Entity*, std::string> entity_materials = {};	// Name of the material each entity was given
 static u8 scene_parse_entity(FILE* fp, Engine* engine) {
     char current = fgetc(fp);
     char buffer[SCENE_BUFFER_SIZE] = "";
@@ -352,7 +393,9 @@ static u8 scene_parse_entity(FILE* fp, Engine* engine) {
         .shininess  = 10.0f,
         .color_map  = {.id = TEXTURE_HOUSE},
         .texture1   = {}, .texture_mix = 0,
-        .shader_index = DIFFUSE_SHADER
+        .shader_index = DIFFUSE_SHADER,
+        .variant = 0,
+        .cull = CULL_BACK, .blend = BLEND_NONE, .depth_write = 1
     };
 
     while (current != EOF) {
@@ -396,6 +439,7 @@ static u8 scene_parse_entity(FILE* fp, Engine* engine) {
                     if (!scene_get_name(fp, material_name, &material_name_size)) return 0;
                     try {
                         entity->material = *scene_materials.at(std::string(material_name, material_name_size));
+                        entity_materials[entity] = std::string(material_name, material_name_size);
                     } catch (std::exception* e) {
                         fprintf(stderr, "Invalid material id.\n");
                         return 0;
@@ -415,6 +459,10 @@ static u8 scene_parse_entity(FILE* fp, Engine* engine) {
                         fprintf(stderr, "Invalid entity id.\n");
                         return 0;
                     }
+                } else if (strncmp("occluder", buffer, buffer_size) == 0) {
+                    float occluder = 0;
+                    if (!scene_parse_float(fp, &occluder)) return 0;
+                    entity->occluder = occluder != 0;
                 } else if (strncmp("following", buffer, buffer_size) == 0) {
                     char entity_name[SCENE_BUFFER_SIZE] = "";
                     u32 entity_name_size = 0;
@@ -498,17 +546,74 @@ static u8 scene_parse_light_sun(FILE* fp, Engine* engine) {
 }
 
 static u8 scene_parse_light_point(FILE* fp, Engine* engine) {
-    //TODO
+    char current = fgetc(fp);
+    char buffer[SCENE_BUFFER_SIZE] = "";
+    u32 buffer_size = 0;
+
+    Point_light light = {
+        .position = V3(0, 0, 0),
+        .color = V3(1, 1, 1),
+        .ambient = 0.0f,
+        .falloff_linear = 0.14f,
+        .falloff_quadratic = 0.07f
+    };
+
+    while (current != EOF) {
+        switch (current) {
+            case '\n':
+                row++;
+                col = 0;
+                break;
+            case ' ' :
+            case '\t':
+            case '\r':
+                col++;
+                break;
+            case ':':
+                if (strncmp("pos", buffer, buffer_size) == 0) {
+                    if (!scene_parse_v3(fp, engine, &light.position)) return 0;
+                } else if (strncmp("color", buffer, buffer_size) == 0) {
+                    if (!scene_parse_v3(fp, engine, &light.color)) return 0;
+                } else if (strncmp("ambient", buffer, buffer_size) == 0) {
+                    if (!scene_parse_float(fp, &light.ambient)) return 0;
+                } else if (strncmp("falloff_linear", buffer, buffer_size) == 0) {
+                    if (!scene_parse_float(fp, &light.falloff_linear)) return 0;
+                } else if (strncmp("falloff_quadratic", buffer, buffer_size) == 0) {
+                    if (!scene_parse_float(fp, &light.falloff_quadratic)) return 0;
+                }
+                buffer_size = 0;
+                break;
+            case '}':
+                if (buffer_size != 0) {
+                    fprintf(stderr, "Unexpected }.\n");
+                    return 0;
+                }
+                if (num_point_lights >= MAX_POINT_LIGHTS) {
+                    fprintf(stderr, "Warning: too many point lights (max: %d), ignoring the rest.\n", MAX_POINT_LIGHTS);
+                    return 1;
+                }
+                list_push(point_lights, num_point_lights, light);
+                return 1;
+            default:
+                buffer[buffer_size] = current;
+                buffer_size++;
+                break;
+        }
+        current = fgetc(fp);
+    }
+    fprintf(stderr, "Unexpected EOF while parsing point light.\n");
     return 0;
 }
 
 //TODO: we leak memory when returning error status
 u8 initialize_scene(Engine* engine, char* scene_path) {
+    PROFILE_FUNCTION();
     FILE* fp = fopen(scene_path, "r");
     if (fp == NULL) {
         fprintf(stderr, "Error, couldn't load scene file %s\n", scene_path);
         return 0;
     }
+    i32 event = startup_trace_begin("scene parse", scene_path);
 
     char current = fgetc(fp);
     char buffer[SCENE_BUFFER_SIZE] = "";
@@ -518,6 +623,9 @@ u8 initialize_scene(Engine* engine, char* scene_path) {
     num_sun_lights = 0;
     point_lights = NULL;
     num_point_lights = 0;
+    // Entities are reused between scenes, names from the previous one would point at whatever took their place
+    entity_ids.clear();
+    entity_materials.clear();
 
     while (current != EOF) {
         switch (current) {
@@ -576,6 +684,7 @@ u8 initialize_scene(Engine* engine, char* scene_path) {
         return 0;
     }
 
+    startup_trace_end(event, ftell(fp));	// Everything was read, so this is the file size
     fclose(fp);
 
     engine->scene = (Scene) {
@@ -585,9 +694,38 @@ u8 initialize_scene(Engine* engine, char* scene_path) {
         .num_sun_lights = num_sun_lights
     };
 
+    // Every material is known now, so the shader variants they need are compiled in one batch
+    event = startup_trace_begin("shader variants", NULL);
+    for (u32 i = 0; i < engine->entity_count; i++) {
+        renderer_select_variant(&engine->entities[i].material);
+    }
+    renderer_compile_variants();
+    startup_trace_end(event, 0);
+
     // Since we copy material contents over to the entities we can free them now.
     for (const std::pair<std::string, Material*> item : scene_materials) {
         m_free(item.second, sizeof(Material));
     }
     return 1;
 }
+
+Entity_names scene_get_entity_names(Entity* entity) {
+    Entity_names names = {};
+    for (const std::pair<const std::string, Entity*>& item : entity_ids) {
+        if (item.second == entity) {
+            names.id = item.first.c_str();
+            break;
+        }
+    }
+    for (const std::pair<const std::string, i32>& item : mesh_names) {
+        if (item.second == entity->mesh_id) {
+            names.mesh = item.first.c_str();
+            break;
+        }
+    }
+    std::unordered_map<Entity*, std::string>::iterator material = entity_materials.find(entity);
+    if (material != entity_materials.end()) {
+        names.material = material->second.c_str();
+    }
+    return names;
+}
@@ -0,0 +1,169 @@
+// shader_cache.cpp
+// keeps linked program binaries on disk, so later runs can skip compiling from source
+
+#include <GL/glew.h>
+#include <sys/stat.h>	// mkdir
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "memory.hpp"
+#include "shader_cache.hpp"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ull
+#define FNV_PRIME 0x100000001b3ull
+
+typedef struct Shader_cache_header {
+	u32 magic;
+	u32 version;
+	u64 key;
+	u32 format;
+	u32 length;	// Bytes of program binary following the header
+} Shader_cache_header;
+
+static void cache_path(const char* name, char* path);
+
+// One file per program, named after the shader path, so a changed source overwrites its stale entry
+void cache_path(const char* name, char* path) {
+	i32 length = snprintf(path, MAX_PATH_SIZE, "%s/", SHADER_CACHE_DIR);
+	for (const char* c = name; *c && length < MAX_PATH_SIZE - 5; ++c) {
+		path[length++] = (*c == '/' || *c == '\\' || *c == '.') ? '_' : *c;
+	}
+	snprintf(path + length, MAX_PATH_SIZE - length, ".bin");
+}
+
+u64 shader_cache_hash(u64 hash, const char* text) {
+	if (!text) {
+		return hash;
+	}
+	for (const u8* c = (const u8*)text; *c; ++c) {
+		hash ^= *c;
+		hash *= FNV_PRIME;
+	}
+	hash ^= 0xff;	// Separator, so "ab" + "c" and "a" + "bc" differ
+	hash *= FNV_PRIME;
+	return hash;
+}
+
+void shader_cache_initialize(Shader_cache* cache) {
+	*cache = (Shader_cache) {};
+	i32 format_count = 0;
+	if (GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	}
+	if (format_count <= 0) {
+		fprintf(stdout, "Shader cache: program binaries unsupported, compiling from source\n");
+		return;
+	}
+	cache->enabled = 1;
+	cache->driver_hash = FNV_OFFSET_BASIS;
+	cache->driver_hash = shader_cache_hash(cache->driver_hash, (const char*)glGetString(GL_VENDOR));
+	cache->driver_hash = shader_cache_hash(cache->driver_hash, (const char*)glGetString(GL_RENDERER));
+	cache->driver_hash = shader_cache_hash(cache->driver_hash, (const char*)glGetString(GL_VERSION));
+	mkdir(SHADER_CACHE_DIR, 0755);	// Fails harmlessly when it already exists
+}
+
+u64 shader_cache_key(Shader_cache* cache, const char* vert_source, const char* frag_source) {
+	u64 key = shader_cache_hash(cache->driver_hash, vert_source);
+	return shader_cache_hash(key, frag_source);
+}
+
+u32 shader_cache_load(Shader_cache* cache, const char* name, u64 key) {
+	if (!cache->enabled) {
+		return 0;
+	}
+	char path[MAX_PATH_SIZE] = {0};
+	cache_path(name, path);
+
+	// A missing file is the common case on a first run, so unlike read_file this stays quiet
+	FILE* fp = fopen(path, "rb");
+	if (!fp) {
+		cache->misses++;
+		return 0;
+	}
+	u32 program = 0;
+	void* binary = NULL;
+	i32 linked = 0;
+	Shader_cache_header header = {};
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+		header.magic != SHADER_CACHE_MAGIC || header.version != SHADER_CACHE_VERSION || header.key != key) {
+		cache->misses++;
+		goto done;
+	}
+	binary = m_malloc(header.length);
+	if (!binary || fread(binary, 1, header.length, fp) != header.length) {
+		cache->misses++;
+		goto done;
+	}
+
+	program = glCreateProgram();
+	glProgramBinary(program, header.format, binary, header.length);
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (!linked) {
+		// The driver may refuse binaries of its own, e.g. after an update that kept the version string
+		glDeleteProgram(program);
+		program = 0;
+		cache->rejected++;
+		goto done;
+	}
+	cache->hits++;
+
+done:
+	if (binary) {
+		m_free(binary, header.length);
+	}
+	fclose(fp);
+	return program;
+}
+
+void shader_cache_store(Shader_cache* cache, const char* name, u64 key, u32 program) {
+	if (!cache->enabled || program == 0) {
+		return;
+	}
+	i32 linked = 0;
+	i32 length = 0;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+	if (!linked || length <= 0) {
+		return;
+	}
+
+	char path[MAX_PATH_SIZE] = {0};
+	cache_path(name, path);
+	Shader_cache_header header = {
+		.magic = SHADER_CACHE_MAGIC,
+		.version = SHADER_CACHE_VERSION,
+		.key = key,
+	};
+	void* binary = m_malloc(length);
+	if (!binary) {
+		return;
+	}
+	GLenum format = 0;
+	glGetProgramBinary(program, length, NULL, &format, binary);
+	header.format = format;
+	header.length = length;
+
+	FILE* fp = fopen(path, "wb");
+	if (fp) {
+		if (fwrite(&header, sizeof(header), 1, fp) == 1 && fwrite(binary, 1, length, fp) == (size_t)length) {
+			cache->stored++;
+		}
+		fclose(fp);
+	}
+	else {
+		fprintf(stderr, "Shader cache: failed to write '%s'\n", path);
+	}
+	m_free(binary, length);
+}
+
+void shader_cache_print_stats(Shader_cache* cache) {
+	if (!cache->enabled) {
+		return;
+	}
+	fprintf(stdout, "Shader cache: %u loaded, %u missed, %u rejected, %u stored\n", cache->hits, cache->misses, cache->rejected, cache->stored);
+}
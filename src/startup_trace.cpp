@@ -0,0 +1,198 @@
+// startup_trace.cpp
+// time and size of every asset load and upload before the first frame, reported as a table and a json file to diff between builds
+
+#include <algorithm>
+
+#include "common.hpp"
+#include "startup_trace.hpp"
+
+#define MAX_STARTUP_PHASES 32
+
+typedef struct Startup_phase {
+	const char* phase;
+	u32 count;
+	u64 self_ns;
+	u64 bytes;
+} Startup_phase;
+
+typedef struct Startup_asset {
+	u32 event;
+	u64 self_ns;
+} Startup_asset;
+
+static Startup_trace startup_trace = {};
+
+static void compute_self_times(Startup_trace* trace, u64* self_ns);
+static bool phase_slower(const Startup_phase& a, const Startup_phase& b);
+static bool asset_slower(const Startup_asset& a, const Startup_asset& b);
+
+// Whatever an event spent in the events nested in it is not its own
+void compute_self_times(Startup_trace* trace, u64* self_ns) {
+	for (u32 i = 0; i < trace->event_count; ++i) {
+		Startup_event* event = &trace->events[i];
+		self_ns[i] = event->end - event->start;
+	}
+	for (u32 i = 0; i < trace->event_count; ++i) {
+		Startup_event* event = &trace->events[i];
+		if (event->parent >= 0) {
+			u64 duration = event->end - event->start;
+			u64* parent = &self_ns[event->parent];
+			*parent = *parent > duration ? *parent - duration : 0;
+		}
+	}
+}
+
+bool phase_slower(const Startup_phase& a, const Startup_phase& b) {
+	return a.self_ns > b.self_ns;
+}
+
+bool asset_slower(const Startup_asset& a, const Startup_asset& b) {
+	return a.self_ns > b.self_ns;
+}
+
+void startup_trace_start() {
+	Startup_trace* trace = &startup_trace;
+	trace->event_count = 0;
+	trace->dropped = 0;
+	trace->open = -1;
+	trace->start = time_now_ns();
+	trace->active = 1;
+}
+
+i32 startup_trace_begin(const char* phase, const char* asset) {
+	Startup_trace* trace = &startup_trace;
+	if (!trace->active) {
+		return -1;
+	}
+	if (trace->event_count >= MAX_STARTUP_EVENTS) {
+		trace->dropped++;
+		return -1;
+	}
+	i32 index = trace->event_count++;
+	Startup_event* event = &trace->events[index];
+	*event = (Startup_event) {
+		.phase = phase,
+		.parent = trace->open,
+	};
+	snprintf(event->asset, STARTUP_ASSET_SIZE, "%s", asset ? asset : "");
+	trace->open = index;
+	event->start = time_now_ns() - trace->start;
+	return index;
+}
+
+void startup_trace_end(i32 event, u64 bytes) {
+	Startup_trace* trace = &startup_trace;
+	if (event < 0 || !trace->active) {
+		return;
+	}
+	Startup_event* ended = &trace->events[event];
+	ended->end = time_now_ns() - trace->start;
+	ended->bytes = bytes;
+	ended->ended = 1;
+	trace->open = ended->parent;
+}
+
+i32 startup_trace_report(const char* path) {
+	Startup_trace* trace = &startup_trace;
+	if (!trace->active) {
+		return NoError;
+	}
+	trace->active = 0;
+	u64 total_ns = time_now_ns() - trace->start;
+	// Events left open, by a load that failed half way, end here
+	for (u32 i = 0; i < trace->event_count; ++i) {
+		if (!trace->events[i].ended) {
+			trace->events[i].end = total_ns;
+		}
+	}
+
+	static u64 self_ns[MAX_STARTUP_EVENTS];
+	compute_self_times(trace, self_ns);
+
+	// Phases in the order they first ran, which is what the json keeps so runs line up
+	Startup_phase phases[MAX_STARTUP_PHASES];
+	u32 phase_count = 0;
+	u64 traced_ns = 0;
+	for (u32 i = 0; i < trace->event_count; ++i) {
+		Startup_event* event = &trace->events[i];
+		u32 p = 0;
+		while (p < phase_count && strcmp(phases[p].phase, event->phase) != 0) {
+			p++;
+		}
+		if (p == phase_count) {
+			if (phase_count >= MAX_STARTUP_PHASES) {
+				continue;
+			}
+			phases[phase_count++] = (Startup_phase) {
+				.phase = event->phase,
+			};
+		}
+		phases[p].count++;
+		phases[p].self_ns += self_ns[i];
+		phases[p].bytes += event->bytes;
+		if (event->parent < 0) {
+			traced_ns += event->end - event->start;
+		}
+	}
+
+	Startup_phase sorted_phases[MAX_STARTUP_PHASES];
+	std::copy(phases, phases + phase_count, sorted_phases);
+	std::stable_sort(sorted_phases, sorted_phases + phase_count, phase_slower);
+	fprintf(stdout, "Startup took %.2f ms, %u events (%u dropped):\n", total_ns / 1e6, trace->event_count, trace->dropped);
+	fprintf(stdout, "  %-20s %6s %10s %6s %12s\n", "phase", "count", "ms", "share", "bytes");
+	for (u32 i = 0; i < phase_count; ++i) {
+		Startup_phase* phase = &sorted_phases[i];
+		fprintf(stdout, "  %-20s %6u %10.2f %5.1f%% %12llu\n", phase->phase, phase->count, phase->self_ns / 1e6,
+			100.0 * phase->self_ns / std::max(total_ns, (u64)1), (unsigned long long)phase->bytes);
+	}
+	u64 untraced_ns = total_ns > traced_ns ? total_ns - traced_ns : 0;
+	fprintf(stdout, "  %-20s %6s %10.2f %5.1f%%\n", "untraced", "", untraced_ns / 1e6, 100.0 * untraced_ns / std::max(total_ns, (u64)1));
+
+	static Startup_asset assets[MAX_STARTUP_EVENTS];
+	u32 asset_count = 0;
+	for (u32 i = 0; i < trace->event_count; ++i) {
+		if (trace->events[i].asset[0]) {
+			assets[asset_count++] = (Startup_asset) {
+				.event = i,
+				.self_ns = self_ns[i],
+			};
+		}
+	}
+	std::stable_sort(assets, assets + asset_count, asset_slower);
+	fprintf(stdout, "  %-20s %-40s %10s %12s %10s\n", "slowest assets", "", "ms", "bytes", "MiB/s");
+	for (u32 i = 0; i < asset_count && i < STARTUP_REPORT_ASSETS; ++i) {
+		Startup_event* event = &trace->events[assets[i].event];
+		double seconds = assets[i].self_ns / 1e9;
+		fprintf(stdout, "  %-20s %-40s %10.2f %12llu %10.1f\n", event->phase, event->asset, assets[i].self_ns / 1e6,
+			(unsigned long long)event->bytes, seconds > 0 ? event->bytes / (1024.0 * 1024.0) / seconds : 0.0);
+	}
+
+	if (!path) {
+		return NoError;
+	}
+	FILE* fp = fopen(path, "w");
+	if (!fp) {
+		fprintf(stderr, "Failed to write startup report '%s'\n", path);
+		return Error;
+	}
+	fprintf(fp, "{\n  \"total_ms\": %.3f,\n  \"dropped\": %u,\n  \"phases\": [", total_ns / 1e6, trace->dropped);
+	for (u32 i = 0; i < phase_count; ++i) {
+		fprintf(fp, "%s\n    {\"phase\": ", i == 0 ? "" : ",");
+		write_json_string(fp, phases[i].phase);
+		fprintf(fp, ", \"count\": %u, \"ms\": %.3f, \"bytes\": %llu}", phases[i].count, phases[i].self_ns / 1e6, (unsigned long long)phases[i].bytes);
+	}
+	fprintf(fp, "\n  ],\n  \"events\": [");
+	for (u32 i = 0; i < trace->event_count; ++i) {
+		Startup_event* event = &trace->events[i];
+		fprintf(fp, "%s\n    {\"phase\": ", i == 0 ? "" : ",");
+		write_json_string(fp, event->phase);
+		fprintf(fp, ", \"asset\": ");
+		write_json_string(fp, event->asset);
+		fprintf(fp, ", \"parent\": %d, \"start_ms\": %.3f, \"ms\": %.3f, \"self_ms\": %.3f, \"bytes\": %llu}", event->parent,
+			event->start / 1e6, (event->end - event->start) / 1e6, self_ns[i] / 1e6, (unsigned long long)event->bytes);
+	}
+	fprintf(fp, "\n  ]\n}\n");
+	fclose(fp);
+	fprintf(stdout, "Startup report written to '%s'\n", path);
+	return NoError;
+}
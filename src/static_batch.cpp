@@ -0,0 +1,183 @@
+// static_batch.cpp
+// merges meshes that never move into world space batches at scene load, drawn with one command per visible run
+
+#include <math.h>
+
+#include "common.hpp"
+#include "memory.hpp"
+#include "frustum.hpp"
+#include "static_batch.hpp"
+
+static v3 transform_direction(mat4 m, v3 d);
+static i32 static_batch_build(Static_batches* batches, Static_batch* batch, Mesh_pool* pool);
+
+v3 transform_direction(mat4 m, v3 d) {
+	return V3(
+		d.x * m.elements[0][0] + d.y * m.elements[1][0] + d.z * m.elements[2][0],
+		d.x * m.elements[0][1] + d.y * m.elements[1][1] + d.z * m.elements[2][1],
+		d.x * m.elements[0][2] + d.y * m.elements[1][2] + d.z * m.elements[2][2]
+	);
+}
+
+void static_batches_clear(Static_batches* batches, Mesh_pool* pool) {
+	for (u32 i = 0; i < batches->batch_count; ++i) {
+		Static_batch* batch = &batches->batches[i];
+		if (batch->vertices.count > 0) {
+			mesh_pool_free(pool, batch->vertices, batch->indices);
+		}
+	}
+	batches->batch_count = 0;
+	batches->member_count = 0;
+	batches->built = 0;
+}
+
+i32 static_batches_create(Static_batches* batches, u32* batch) {
+	if (batches->batch_count >= MAX_STATIC_BATCHES) {
+		return Error;
+	}
+	*batch = batches->batch_count++;
+	batches->batches[*batch] = (Static_batch) {};
+	return NoError;
+}
+
+i32 static_batches_add(Static_batches* batches, u32 batch, Pool_range vertices, Pool_range indices, Bounding_sphere sphere, mat4 transform, u32* member) {
+	if (batches->member_count >= MAX_BATCH_MEMBERS || batch >= batches->batch_count) {
+		return Error;
+	}
+	*member = batches->member_count++;
+	batches->members[*member] = (Batch_member) {
+		.batch = batch,
+		.transform = transform,
+		.source_vertices = vertices,
+		.source_indices = indices,
+	};
+	batches->visible[*member] = 0;
+
+	// Grow the batch sphere around the member, starting from the first member's
+	Static_batch* target = &batches->batches[batch];
+	Bounding_sphere world = bounding_sphere_transform(sphere, transform);
+	if (target->member_count == 0) {
+		target->sphere = world;
+	}
+	else {
+		v3 offset = world.center - target->sphere.center;
+		float distance = sqrtf(offset.x * offset.x + offset.y * offset.y + offset.z * offset.z);
+		if (distance + world.radius > target->sphere.radius) {
+			float radius = (target->sphere.radius + distance + world.radius) * 0.5f;
+			if (distance > 0.0f) {
+				target->sphere.center = target->sphere.center + offset * ((radius - target->sphere.radius) / distance);
+			}
+			target->sphere.radius = radius;
+		}
+	}
+	target->member_count++;
+	return NoError;
+}
+
+// Reads each member back out of the pool and writes it into the batch in world space
+i32 static_batch_build(Static_batches* batches, Static_batch* batch, Mesh_pool* pool) {
+	u32 vertex_count = 0;
+	u32 index_count = 0;
+	for (u32 i = 0; i < batch->member_count; ++i) {
+		Batch_member* member = &batches->members[batches->member_order[batch->first_member + i]];
+		vertex_count += member->source_vertices.count;
+		index_count += member->source_indices.count;
+	}
+	Pool_vertex* vertices = (Pool_vertex*)m_malloc(sizeof(Pool_vertex) * vertex_count);
+	u32* indices = (u32*)m_malloc(sizeof(u32) * index_count);
+	if (!vertices || !indices) {
+		if (vertices) m_free(vertices, sizeof(Pool_vertex) * vertex_count);
+		if (indices) m_free(indices, sizeof(u32) * index_count);
+		return Error;
+	}
+
+	u32 vertex_offset = 0;
+	u32 index_offset = 0;
+	for (u32 i = 0; i < batch->member_count; ++i) {
+		Batch_member* member = &batches->members[batches->member_order[batch->first_member + i]];
+		Pool_vertex* member_vertices = vertices + vertex_offset;
+		u32* member_indices = indices + index_offset;
+		mesh_pool_read_vertices(pool, member->source_vertices, member->source_indices, member_vertices, member_indices);
+
+		// The same normal matrix the instance data would have carried, the shaders normalize after it
+		mat4 normal_matrix = transpose(inverse(member->transform));
+		for (u32 v = 0; v < member->source_vertices.count; ++v) {
+			Pool_vertex* vertex = &member_vertices[v];
+			vertex->position = transform_point(member->transform, vertex->position);
+			vertex->normal = transform_direction(normal_matrix, vertex->normal);
+			vertex->tangent = transform_direction(normal_matrix, vertex->tangent);
+			vertex->bitangent = transform_direction(normal_matrix, vertex->bitangent);
+		}
+		for (u32 n = 0; n < member->source_indices.count; ++n) {
+			member_indices[n] += vertex_offset;
+		}
+		member->indices = (Pool_range) { .offset = index_offset, .count = member->source_indices.count };
+		vertex_offset += member->source_vertices.count;
+		index_offset += member->source_indices.count;
+	}
+
+	i32 result = mesh_pool_upload_vertices(pool, vertices, vertex_count, indices, index_count, &batch->vertices, &batch->indices);
+	m_free(vertices, sizeof(Pool_vertex) * vertex_count);
+	m_free(indices, sizeof(u32) * index_count);
+	if (result != NoError) {
+		return result;
+	}
+	for (u32 i = 0; i < batch->member_count; ++i) {
+		batches->members[batches->member_order[batch->first_member + i]].indices.offset += batch->indices.offset;
+	}
+	return NoError;
+}
+
+i32 static_batches_build(Static_batches* batches, Mesh_pool* pool) {
+	// Counting sort of the members by batch, keeping the order they were added in
+	u32 first = 0;
+	for (u32 i = 0; i < batches->batch_count; ++i) {
+		batches->batches[i].first_member = first;
+		first += batches->batches[i].member_count;
+	}
+	u32 filled[MAX_STATIC_BATCHES] = {};
+	for (u32 i = 0; i < batches->member_count; ++i) {
+		Static_batch* batch = &batches->batches[batches->members[i].batch];
+		batches->member_order[batch->first_member + filled[batches->members[i].batch]++] = i;
+	}
+
+	i32 result = NoError;
+	for (u32 i = 0; i < batches->batch_count; ++i) {
+		if (static_batch_build(batches, &batches->batches[i], pool) != NoError) {
+			fprintf(stderr, "Failed to build static batch %u\n", i);
+			result = Error;
+		}
+	}
+	batches->built = 1;
+	return result;
+}
+
+void static_batches_mark_visible(Static_batches* batches, u32 member) {
+	if (member < batches->member_count) {
+		batches->visible[member] = 1;
+	}
+}
+
+u32 static_batches_visible_ranges(Static_batches* batches, u32 batch_index, Pool_range* ranges) {
+	Static_batch* batch = &batches->batches[batch_index];
+	u32 range_count = 0;
+	if (batch->indices.count == 0) {
+		return 0;
+	}
+	for (u32 i = 0; i < batch->member_count; ++i) {
+		u32 member_index = batches->member_order[batch->first_member + i];
+		if (!batches->visible[member_index]) {
+			continue;
+		}
+		batches->visible[member_index] = 0;
+		Batch_member* member = &batches->members[member_index];
+		Pool_range* last = range_count > 0 ? &ranges[range_count - 1] : NULL;
+		if (last && last->offset + last->count == member->indices.offset) {
+			last->count += member->indices.count;
+		}
+		else {
+			ranges[range_count++] = member->indices;
+		}
+	}
+	return range_count;
+}
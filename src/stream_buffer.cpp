@@ -0,0 +1,154 @@
+// stream_buffer.cpp
+// ring buffer for data written by the cpu every frame, mapped once and split into one region per frame in flight
+
+#include <GL/glew.h>
+#include <algorithm>
+
+#if defined(__APPLE__)
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+#include "common.hpp"
+#include "memory.hpp"
+#include "render_stats.hpp"
+#include "stream_buffer.hpp"
+#include "window.hpp"
+
+i32 stream_buffer_initialize(Stream_buffer* stream, u32 region_size) {
+	*stream = (Stream_buffer) {};
+	stream->region_size = region_size;
+	stream->persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &stream->uniform_alignment);
+	stream->uniform_alignment = std::max(stream->uniform_alignment, 1);
+
+	u32 size = region_size * STREAM_FRAMES;
+	glGenBuffers(1, &stream->buffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stream->buffer);
+	if (stream->persistent) {
+		// Coherent, so writes are seen by draws issued afterwards without flushing or unmapping
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_COPY_WRITE_BUFFER, size, NULL, flags);
+		stream->mapped = (u8*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, size, flags);
+		if (!stream->mapped) {
+			fprintf(stderr, "Stream buffer: persistent mapping failed, uploading through a copy\n");
+			glDeleteBuffers(1, &stream->buffer);
+			glGenBuffers(1, &stream->buffer);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, stream->buffer);
+			stream->persistent = 0;
+		}
+	}
+	if (!stream->persistent) {
+		glBufferData(GL_COPY_WRITE_BUFFER, size, NULL, GL_STREAM_DRAW);
+		stream->mapped = (u8*)m_malloc(size);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	if (!stream->mapped) {
+		return Error;
+	}
+	fprintf(stdout, "Stream buffer: %u frames of %u KiB, %s\n", STREAM_FRAMES, region_size / 1024, stream->persistent ? "persistently mapped" : "uploaded on flush");
+	return NoError;
+}
+
+void stream_buffer_begin_frame(Stream_buffer* stream) {
+	GLsync fence = (GLsync)stream->fences[stream->region];
+	if (fence) {
+		// Checked without waiting first, only frames that actually block count as waits
+		GLenum status = glClientWaitSync(fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) {
+			u64 start = time_now_ns();
+			status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_FENCE_TIMEOUT_NS);
+			float wait = time_since_ms(start);
+			stream->stats.fence_waits++;
+			stream->stats.wait_ms += wait;
+			stream->stats.max_wait_ms = std::max(stream->stats.max_wait_ms, wait);
+			if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED) {
+				fprintf(stderr, "Stream buffer: region %u still busy after %.1f ms\n", stream->region, wait);
+			}
+		}
+		glDeleteSync(fence);
+		stream->fences[stream->region] = NULL;
+	}
+	stream->head = 0;
+	stream->flushed = 0;
+	stream->stats.frame_bytes = 0;
+}
+
+i32 stream_buffer_allocate(Stream_buffer* stream, u32 size, u32 alignment, Stream_allocation* allocation) {
+	*allocation = (Stream_allocation) {};
+	u32 region_start = stream->region * stream->region_size;
+	// Aligned relative to the whole buffer, attribute offsets are divided by the element size
+	u32 offset = region_start + stream->head;
+	if (alignment > 1) {
+		offset = (offset + alignment - 1) / alignment * alignment;
+	}
+	if (offset + size > region_start + stream->region_size) {
+		stream->stats.overflows++;
+		return Error;
+	}
+	stream->head = offset + size - region_start;
+	render_stats_count_upload(size);	// Written straight into memory the gpu reads, or uploaded on flush
+	stream->stats.frame_bytes = stream->head;
+	stream->stats.peak_bytes = std::max(stream->stats.peak_bytes, stream->head);
+	*allocation = (Stream_allocation) {
+		.data = stream->mapped + offset,
+		.buffer = stream->buffer,
+		.offset = offset,
+		.size = size,
+	};
+	return NoError;
+}
+
+i32 stream_buffer_allocate_uniform(Stream_buffer* stream, u32 size, Stream_allocation* allocation) {
+	return stream_buffer_allocate(stream, size, stream->uniform_alignment, allocation);
+}
+
+void stream_buffer_flush(Stream_buffer* stream) {
+	if (stream->persistent || stream->head <= stream->flushed) {
+		return;
+	}
+	// The region is not in use by the gpu, so this does not have to wait for anything
+	u32 start = stream->region * stream->region_size + stream->flushed;
+	glBindBuffer(GL_COPY_WRITE_BUFFER, stream->buffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, start, stream->head - stream->flushed, stream->mapped + start);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	stream->flushed = stream->head;
+}
+
+void stream_buffer_end_frame(Stream_buffer* stream) {
+	stream_buffer_flush(stream);
+	stream->fences[stream->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	stream->region = (stream->region + 1) % STREAM_FRAMES;
+	stream->stats.frames++;
+}
+
+Stream_stats stream_buffer_get_stats(Stream_buffer* stream) {
+	return stream->stats;
+}
+
+void stream_buffer_print_stats(Stream_buffer* stream) {
+	Stream_stats* stats = &stream->stats;
+	fprintf(stdout, "Stream buffer: %u frames, %u fence waits (%.2f ms total, %.2f ms max), peak %u of %u bytes per frame, %u overflows\n",
+		stats->frames, stats->fence_waits, stats->wait_ms, stats->max_wait_ms, stats->peak_bytes, stream->region_size, stats->overflows);
+}
+
+void stream_buffer_destroy(Stream_buffer* stream) {
+	// A persistent mapping can only be unmapped through the context that made it
+	assert("stream buffer destroyed without a context" && window_has_context());
+	for (u32 i = 0; i < STREAM_FRAMES; ++i) {
+		if (stream->fences[i]) {
+			glDeleteSync((GLsync)stream->fences[i]);
+		}
+	}
+	if (stream->persistent) {
+		glBindBuffer(GL_COPY_WRITE_BUFFER, stream->buffer);
+		glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+	else if (stream->mapped) {
+		m_free(stream->mapped, stream->region_size * STREAM_FRAMES);
+	}
+	glDeleteBuffers(1, &stream->buffer);
+	*stream = (Stream_buffer) {};
+}
@@ -1,6 +1,10 @@
 // window.cpp
 
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
 #include "renderer.hpp"
+#include "gl_state.hpp"
 #include "window.hpp"
 
 i8 mouse_state = 0;
@@ -17,15 +21,25 @@ typedef struct Window  {
 	u8 cursor_hidden;
 	framebuffer_change_cb framebuffer_cb;
 	void* window;
+
+	// Headless, an EGL pbuffer stands in for the window and there is no input
+	u8 headless;
+	EGLDisplay display;
+	EGLSurface surface;
+	EGLContext context;
 } Window;
 
 static Window win;
+static __thread u8 context_current = 0;	// The thread calling in has the context, only it may touch gl state
 
 static void framebuffer_callback(GLFWwindow* window, i32 width, i32 height);
 static void scroll_callback(GLFWwindow* window, double x, double y);
+static EGLDisplay headless_display();
 
 void framebuffer_callback(GLFWwindow* window, i32 width, i32 height) {
-	glViewport(0, 0, width, height);
+	if (context_current) {
+		gl_state_set_viewport(0, 0, width, height);
+	}
 	win.width = width;
 	win.height = height;
 	projection = perspective(
@@ -67,6 +81,7 @@ i32 window_open(const char* title, i32 width, i32 height, u8 fullscreen, u8 vsyn
 		return Error;
 	}
 	glfwMakeContextCurrent((GLFWwindow*)win.window);
+	context_current = 1;
 	glfwSetFramebufferSizeCallback((GLFWwindow*)win.window, framebuffer_callback);
 	glfwSetScrollCallback((GLFWwindow*)win.window, scroll_callback);
 	glfwSwapInterval(vsync);
@@ -75,6 +90,95 @@ i32 window_open(const char* title, i32 width, i32 height, u8 fullscreen, u8 vsyn
 	return NoError;
 }
 
+// Prefers Mesa's surfaceless platform, which needs neither X nor a gpu device node
+EGLDisplay headless_display() {
+	const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+	if (extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+		PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (get_platform_display) {
+			EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+			if (display != EGL_NO_DISPLAY) {
+				return display;
+			}
+		}
+	}
+	return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+i32 window_open_headless(i32 width, i32 height, framebuffer_change_cb framebuffer_cb) {
+	win.width = width;
+	win.height = height;
+	win.fullscreen = 0;
+	win.cursor_hidden = 0;
+	win.framebuffer_cb = framebuffer_cb;
+	win.headless = 1;
+
+	win.display = headless_display();
+	EGLint major = 0, minor = 0;
+	if (win.display == EGL_NO_DISPLAY || !eglInitialize(win.display, &major, &minor)) {
+		fprintf(stderr, "Failed to initialize an EGL display\n");
+		return Error;
+	}
+	EGLint config_attributes[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_RED_SIZE, 8,
+		EGL_GREEN_SIZE, 8,
+		EGL_BLUE_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_NONE
+	};
+	EGLConfig config;
+	EGLint config_count = 0;
+	if (!eglChooseConfig(win.display, config_attributes, &config, 1, &config_count) || config_count == 0) {
+		fprintf(stderr, "No EGL config with a pbuffer and desktop OpenGL\n");
+		eglTerminate(win.display);
+		return Error;
+	}
+	EGLint surface_attributes[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+	win.surface = eglCreatePbufferSurface(win.display, config, surface_attributes);
+	eglBindAPI(EGL_OPENGL_API);
+	EGLint context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 3,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE
+	};
+	win.context = eglCreateContext(win.display, config, EGL_NO_CONTEXT, context_attributes);
+	if (win.surface == EGL_NO_SURFACE || win.context == EGL_NO_CONTEXT || !eglMakeCurrent(win.display, win.surface, win.surface, win.context)) {
+		fprintf(stderr, "Failed to create a headless OpenGL 3.3 context (EGL %d.%d)\n", major, minor);
+		window_close();
+		return Error;
+	}
+	context_current = 1;
+	eglSwapInterval(win.display, 0);
+	framebuffer_callback(NULL, win.width, win.height);
+	return NoError;
+}
+
+void window_make_context_current(u8 current) {
+	if (win.headless) {
+		if (current) {
+			eglMakeCurrent(win.display, win.surface, win.surface, win.context);
+		}
+		else {
+			eglMakeCurrent(win.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		}
+	}
+	else {
+		glfwMakeContextCurrent(current ? (GLFWwindow*)win.window : NULL);
+	}
+	context_current = current;
+}
+
+u8 window_has_context() {
+	return context_current;
+}
+
+u8 window_is_headless() {
+	return win.headless;
+}
+
 i32 window_width() {
 	return win.width;
 }
@@ -84,10 +188,16 @@ i32 window_height() {
 }
 
 void window_set_title(const char* title) {
+	if (win.headless) {
+		return;
+	}
 	glfwSetWindowTitle((GLFWwindow*)win.window, title);
 }
 
 i32 window_poll_events() {
+	if (win.headless) {
+		return 0;
+	}
 	glfwPollEvents();
 
 	for (u16 i = 0; i < GLFW_KEY_LAST; i++) {
@@ -122,16 +232,37 @@ i32 window_poll_events() {
 	return 0;
 }
 
+i32 window_poll_cursor() {
+	if (win.headless) {
+		return 0;
+	}
+	glfwPollEvents();
+	if (glfwWindowShouldClose((GLFWwindow*)win.window)) {
+		return -1;
+	}
+	return 0;
+}
+
 void window_clear_buffers(float r, float g, float b) {
 	glClearColor(r, g, b, 1.0f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 }
 
 void window_swap_buffers() {
+	if (win.headless) {
+		// Nothing presents a pbuffer, waiting here keeps the frame times honest instead of measuring submission alone
+		eglSwapBuffers(win.display, win.surface);
+		glFinish();
+		return;
+	}
 	glfwSwapBuffers((GLFWwindow*)win.window);
 }
 
 void window_get_cursor(double* x, double* y) {
+	if (win.headless) {
+		*x = *y = 0;
+		return;
+	}
 	glfwGetCursorPos((GLFWwindow*)win.window, x, y);
 }
 
@@ -147,6 +278,9 @@ void window_get_scroll(double* x, double* y) {
 }
 
 void window_toggle_cursor_visibility() {
+	if (win.headless) {
+		return;
+	}
 	win.cursor_hidden = !win.cursor_hidden;
 	if (win.cursor_hidden) {
 		glfwSetInputMode((GLFWwindow*)win.window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
@@ -157,6 +291,9 @@ void window_toggle_cursor_visibility() {
 }
 
 void window_toggle_fullscreen() {
+  if (win.headless) {
+    return;
+  }
   win.fullscreen = !win.fullscreen;
   if (win.fullscreen) {
     const GLFWvidmode* mode = glfwGetVideoMode(glfwGetPrimaryMonitor());
@@ -171,6 +308,14 @@ void window_toggle_fullscreen() {
 }
 
 void window_close() {
+	if (win.headless) {
+		eglMakeCurrent(win.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (win.context != EGL_NO_CONTEXT) eglDestroyContext(win.display, win.context);
+		if (win.surface != EGL_NO_SURFACE) eglDestroySurface(win.display, win.surface);
+		eglTerminate(win.display);
+		win = (Window) {};
+		return;
+	}
 	if (win.window) {
 		glfwDestroyWindow((GLFWwindow*)win.window);
 		glfwTerminate();
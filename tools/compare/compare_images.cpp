@@ -0,0 +1,214 @@
+// compare_images.cpp
+// compares captured frames against reference images with a perceptual tolerance
+//
+// compile:
+//   g++ compare_images.cpp -o compare_images -lpng -lm
+//
+// usage:
+//   ./compare_images [--threshold DELTA_E] [--tolerance PERCENT] [--diff DIR] REFERENCE_DIR CAPTURE_DIR
+//
+// Every N.png in the reference directory is compared with N.png in the capture directory, e.g. frames written with
+//   solar-system --headless --size 1920x1080 --capture CAPTURE_DIR --capture-every 6
+// Colors are compared in CIELAB, a difference (delta E, CIE76) around 2.3 is the smallest most people notice.
+// An image passes when no more than the tolerated share of its pixels differ by more than the threshold.
+// Exits with 0 when every image passes.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <png.h>
+
+#define PATH_SIZE 512
+
+typedef struct Lab {
+	float l, a, b;
+} Lab;
+
+typedef struct Comparison {
+	float mean;
+	float max;
+	int over;	// Pixels over the threshold
+	int pixels;
+} Comparison;
+
+static unsigned char* load_png(const char* path, int* width, int* height);
+static int write_png(const char* path, unsigned char* pixels, int width, int height);
+static float linear(unsigned char value);
+static float lab_f(float t);
+static Lab to_lab(const unsigned char* rgb);
+static Comparison compare(const unsigned char* reference, const unsigned char* capture, int width, int height, float threshold, unsigned char* diff);
+static void print_usage(const char* program);
+
+// Always 8 bit rgb, whatever is stored in the file
+unsigned char* load_png(const char* path, int* width, int* height) {
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	if (!png_image_begin_read_from_file(&image, path)) {
+		return NULL;
+	}
+	image.format = PNG_FORMAT_RGB;
+	unsigned char* pixels = (unsigned char*)malloc(PNG_IMAGE_SIZE(image));
+	if (!pixels || !png_image_finish_read(&image, NULL, pixels, 0, NULL)) {
+		free(pixels);
+		png_image_free(&image);
+		return NULL;
+	}
+	*width = image.width;
+	*height = image.height;
+	return pixels;
+}
+
+int write_png(const char* path, unsigned char* pixels, int width, int height) {
+	png_image image;
+	memset(&image, 0, sizeof(image));
+	image.version = PNG_IMAGE_VERSION;
+	image.width = width;
+	image.height = height;
+	image.format = PNG_FORMAT_GRAY;
+	return png_image_write_to_file(&image, path, 0, pixels, 0, NULL);
+}
+
+// sRGB to linear
+float linear(unsigned char value) {
+	float c = value / 255.0f;
+	return c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+}
+
+float lab_f(float t) {
+	return t > 0.008856f ? cbrtf(t) : 7.787f * t + 16.0f / 116.0f;
+}
+
+// D65 white point
+Lab to_lab(const unsigned char* rgb) {
+	float r = linear(rgb[0]);
+	float g = linear(rgb[1]);
+	float b = linear(rgb[2]);
+	float x = (0.4124f * r + 0.3576f * g + 0.1805f * b) / 0.95047f;
+	float y = (0.2126f * r + 0.7152f * g + 0.0722f * b);
+	float z = (0.0193f * r + 0.1192f * g + 0.9505f * b) / 1.08883f;
+	float fx = lab_f(x);
+	float fy = lab_f(y);
+	float fz = lab_f(z);
+	Lab lab = { 116.0f * fy - 16.0f, 500.0f * (fx - fy), 200.0f * (fy - fz) };
+	return lab;
+}
+
+// The diff image, when there is one, gets the difference of every pixel scaled so the threshold is mid gray
+Comparison compare(const unsigned char* reference, const unsigned char* capture, int width, int height, float threshold, unsigned char* diff) {
+	Comparison result = {};
+	result.pixels = width * height;
+	double total = 0;
+	for (int i = 0; i < result.pixels; ++i) {
+		const unsigned char* p = reference + i * 3;
+		const unsigned char* q = capture + i * 3;
+		float delta = 0;
+		if (p[0] != q[0] || p[1] != q[1] || p[2] != q[2]) {
+			Lab a = to_lab(p);
+			Lab b = to_lab(q);
+			delta = sqrtf((a.l - b.l) * (a.l - b.l) + (a.a - b.a) * (a.a - b.a) + (a.b - b.b) * (a.b - b.b));
+		}
+		total += delta;
+		if (delta > result.max) {
+			result.max = delta;
+		}
+		if (delta > threshold) {
+			result.over++;
+		}
+		if (diff) {
+			float scaled = delta / threshold * 128.0f;
+			diff[i] = scaled > 255.0f ? 255 : (unsigned char)scaled;
+		}
+	}
+	result.mean = result.pixels > 0 ? (float)(total / result.pixels) : 0;
+	return result;
+}
+
+void print_usage(const char* program) {
+	fprintf(stderr,
+		"Usage: %s [options] REFERENCE_DIR CAPTURE_DIR\n"
+		"  --threshold DELTA_E   color difference a pixel may have (default: 2.3)\n"
+		"  --tolerance PERCENT   share of pixels allowed over the threshold (default: 0.1)\n"
+		"  --diff DIR            write a difference image per comparison to DIR\n",
+		program);
+}
+
+int main(int argc, char** argv) {
+	float threshold = 2.3f;
+	float tolerance = 0.1f;
+	const char* diff_dir = NULL;
+	const char* dirs[2] = { NULL, NULL };
+	int dir_count = 0;
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+			threshold = strtof(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--tolerance") == 0 && i + 1 < argc) {
+			tolerance = strtof(argv[++i], NULL);
+		}
+		else if (strcmp(argv[i], "--diff") == 0 && i + 1 < argc) {
+			diff_dir = argv[++i];
+		}
+		else if (argv[i][0] != '-' && dir_count < 2) {
+			dirs[dir_count++] = argv[i];
+		}
+		else {
+			print_usage(argv[0]);
+			return 2;
+		}
+	}
+	if (dir_count != 2 || threshold <= 0) {
+		print_usage(argv[0]);
+		return 2;
+	}
+
+	char path[PATH_SIZE];
+	int compared = 0;
+	int failed = 0;
+	for (int index = 0; ; ++index) {
+		int width = 0, height = 0, capture_width = 0, capture_height = 0;
+		snprintf(path, PATH_SIZE, "%s/%d.png", dirs[0], index);
+		unsigned char* reference = load_png(path, &width, &height);
+		if (!reference) {
+			break;
+		}
+		snprintf(path, PATH_SIZE, "%s/%d.png", dirs[1], index);
+		unsigned char* capture = load_png(path, &capture_width, &capture_height);
+		compared++;
+		if (!capture || capture_width != width || capture_height != height) {
+			if (capture) {
+				fprintf(stdout, "%d.png: FAIL, %dx%d captured, %dx%d reference\n", index, capture_width, capture_height, width, height);
+			}
+			else {
+				fprintf(stdout, "%d.png: FAIL, no capture\n", index);
+			}
+			failed++;
+			free(reference);
+			free(capture);
+			continue;
+		}
+		unsigned char* diff = diff_dir ? (unsigned char*)malloc(width * height) : NULL;
+		Comparison result = compare(reference, capture, width, height, threshold, diff);
+		float percent = 100.0f * result.over / result.pixels;
+		int pass = percent <= tolerance;
+		fprintf(stdout, "%d.png: %s, mean delta E %.3f, max %.2f, %.3f%% of pixels over %.2f\n",
+			index, pass ? "pass" : "FAIL", result.mean, result.max, percent, threshold);
+		if (diff) {
+			snprintf(path, PATH_SIZE, "%s/%d.png", diff_dir, index);
+			if (!write_png(path, diff, width, height)) {
+				fprintf(stderr, "Failed to write '%s'\n", path);
+			}
+			free(diff);
+		}
+		failed += !pass;
+		free(reference);
+		free(capture);
+	}
+	if (compared == 0) {
+		fprintf(stderr, "No reference images in '%s'\n", dirs[0]);
+		return 2;
+	}
+	fprintf(stdout, "%d of %d images within tolerance (%.2f%% of pixels over delta E %.2f)\n", compared - failed, compared, tolerance, threshold);
+	return failed > 0;
+}
@@ -0,0 +1,193 @@
+// occlusion_test.cpp
+// checks the software occlusion culler against scenes with a known answer, then times it
+//
+// compile:
+//   g++ occlusion_test.cpp ../../src/occlusion.cpp ../../src/memory.cpp ../../src/common.cpp -I../../include -DNO_PROFILER -O2 -o occlusion_test -lpthread -lm
+//
+// usage:
+//   ./occlusion_test [ITERATIONS]
+//
+// Exits with 0 when every check passes. The benchmark rasterizes a ring simplified to MAX_OCCLUDER_MESH_TRIANGLES triangles
+// and tests a grid of boxes behind it, ITERATIONS times (100 by default).
+
+#include "common.hpp"
+#include "memory.hpp"
+#include "matrix_math.hpp"
+#include "occlusion.hpp"
+
+#define WALL_MESH 0
+#define RING_MESH 1
+#define RING_SEGMENTS 3000	// Two triangles each, more than an occluder keeps so the ring is simplified
+#define RING_INNER_RADIUS 2.0f
+#define RING_OUTER_RADIUS 4.0f
+#define RING_DISTANCE 10.0f
+#define BENCH_BOXES 1024
+
+typedef struct Test_mesh {
+	v3 vertices[RING_SEGMENTS * 2];
+	u32 indices[RING_SEGMENTS * 6];
+} Test_mesh;
+
+static Test_mesh ring_data;
+static mat4 projection;
+static mat4 view;
+static u32 failures = 0;
+
+static void check(u8 passed, const char* what);
+static Aabb box(v3 min, v3 max);
+static void add_wall(i32 mesh_id);
+static void add_ring(i32 mesh_id);
+static void test_wall_hides_box();
+static void test_simplified_ring_stays_inside();
+static void test_bent_wall_hides_less();
+static void bench(u32 iterations);
+
+void check(u8 passed, const char* what) {
+	fprintf(stdout, "%s: %s\n", passed ? "pass" : "FAIL", what);
+	if (!passed) {
+		failures++;
+	}
+}
+
+Aabb box(v3 min, v3 max) {
+	return (Aabb) {min, max};
+}
+
+// Unit square in x and y facing the camera, scaled and moved into place by the occluder transform
+void add_wall(i32 mesh_id) {
+	static v3 vertices[4] = {V3(-1, -1, 0), V3(1, -1, 0), V3(1, 1, 0), V3(-1, 1, 0)};
+	static u32 indices[6] = {0, 1, 2, 0, 2, 3};
+	Mesh mesh = {};
+	mesh.vertices = vertices;
+	mesh.vertex_count = 4;
+	mesh.vertex_indices = indices;
+	mesh.vertex_index_count = 6;
+	mesh.bounds = box(V3(-1, -1, 0), V3(1, 1, 0));
+	occlusion_add_mesh(mesh_id, &mesh);
+}
+
+// Flat ring around the origin in the x y plane, merging vertices of its inner edge would cover part of the hole
+void add_ring(i32 mesh_id) {
+	for (u32 i = 0; i < RING_SEGMENTS; ++i) {
+		float angle = 2.0f * M_PI * i / RING_SEGMENTS;
+		ring_data.vertices[i * 2] = V3(cosf(angle) * RING_INNER_RADIUS, sinf(angle) * RING_INNER_RADIUS, 0);
+		ring_data.vertices[i * 2 + 1] = V3(cosf(angle) * RING_OUTER_RADIUS, sinf(angle) * RING_OUTER_RADIUS, 0);
+		u32 inner = i * 2, outer = i * 2 + 1;
+		u32 next_inner = (i + 1) % RING_SEGMENTS * 2, next_outer = next_inner + 1;
+		u32* indices = &ring_data.indices[i * 6];
+		indices[0] = inner; indices[1] = outer; indices[2] = next_outer;
+		indices[3] = inner; indices[4] = next_outer; indices[5] = next_inner;
+	}
+	Mesh mesh = {};
+	mesh.vertices = ring_data.vertices;
+	mesh.vertex_count = RING_SEGMENTS * 2;
+	mesh.vertex_indices = ring_data.indices;
+	mesh.vertex_index_count = RING_SEGMENTS * 6;
+	mesh.bounds = box(V3(-RING_OUTER_RADIUS, -RING_OUTER_RADIUS, 0), V3(RING_OUTER_RADIUS, RING_OUTER_RADIUS, 0));
+	occlusion_add_mesh(mesh_id, &mesh);
+}
+
+void test_wall_hides_box() {
+	occlusion_begin(view, projection);
+	occlusion_add_occluder(WALL_MESH, multiply_mat4(translate(V3(0, 0, -10)), scale_mat4(V3(5, 5, 1))), 0);
+	occlusion_rasterize();
+	check(!occlusion_test_aabb(box(V3(-1, -1, -22), V3(1, 1, -20))), "box right behind the wall is hidden");
+	check(occlusion_test_aabb(box(V3(-1, -1, -8), V3(1, 1, -6))), "box in front of the wall is visible");
+	check(occlusion_test_aabb(box(V3(-1, -1, -12), V3(1, 1, -8))), "box cutting through the wall is visible");
+	check(occlusion_test_aabb(box(V3(8, -1, -22), V3(12, 1, -20))), "box sticking out past the edge is visible");
+	check(occlusion_get_stats().occluder_triangles == 2, "both wall triangles are rasterized");
+}
+
+// Every pixel the simplified occluder covers has its center on the real ring
+void test_simplified_ring_stays_inside() {
+	occlusion_begin(view, projection);
+	occlusion_add_occluder(RING_MESH, translate(V3(0, 0, -RING_DISTANCE)), 0);
+	occlusion_rasterize();
+	const float* depth = occlusion_get_depth_buffer();
+	u32 covered = 0, outside = 0;
+	for (u32 y = 0; y < OCCLUSION_HEIGHT; ++y) {
+		for (u32 x = 0; x < OCCLUSION_WIDTH; ++x) {
+			if (depth[y * OCCLUSION_WIDTH + x] == 0) {
+				continue;
+			}
+			covered++;
+			float view_x = ((x + 0.5f) / OCCLUSION_WIDTH * 2.0f - 1.0f) * RING_DISTANCE / projection.elements[0][0];
+			float view_y = ((y + 0.5f) / OCCLUSION_HEIGHT * 2.0f - 1.0f) * RING_DISTANCE / projection.elements[1][1];
+			float radius_square = view_x * view_x + view_y * view_y;
+			// The segments are chords, the inner edge lies a hair inside its circle
+			if (radius_square > RING_OUTER_RADIUS * RING_OUTER_RADIUS * 1.0001f || radius_square < RING_INNER_RADIUS * RING_INNER_RADIUS * 0.9999f) {
+				outside++;
+			}
+		}
+	}
+	check(covered > 0, "simplified ring covers pixels");
+	check(outside == 0, "simplified ring covers nothing off the ring");
+	check(occlusion_get_stats().occluder_triangles <= MAX_OCCLUDER_MESH_TRIANGLES, "ring is simplified to the triangle budget");
+}
+
+// A wall drawn with the ground shader sinks with distance, what shows over its bent edge must not be culled
+void test_bent_wall_hides_less() {
+	mat4 wall = multiply_mat4(translate(V3(0, 1.5f, -40)), scale_mat4(V3(5, 1.5f, 1)));
+	Aabb over_bent_edge = box(V3(-0.5f, 1.5f, -52), V3(0.5f, 2.5f, -50));
+
+	occlusion_begin(view, projection);
+	occlusion_add_occluder(WALL_MESH, wall, 0);
+	occlusion_rasterize();
+	check(!occlusion_test_aabb(over_bent_edge), "straight wall hides the box");
+
+	occlusion_begin(view, projection);
+	occlusion_add_occluder(WALL_MESH, wall, 1.0f / 800.0f);
+	occlusion_rasterize();
+	check(occlusion_test_aabb(over_bent_edge), "bent wall leaves the box visible");
+}
+
+void bench(u32 iterations) {
+	Aabb boxes[BENCH_BOXES];
+	for (u32 i = 0; i < BENCH_BOXES; ++i) {
+		float x = (i % 32) * 0.5f - 8.0f;
+		float y = (i / 32) * 0.5f - 8.0f;
+		boxes[i] = box(V3(x, y, -20), V3(x + 0.3f, y + 0.3f, -19.7f));
+	}
+	double rasterize_ms = 0, test_ms = 0;
+	u32 hidden = 0;
+	for (u32 i = 0; i < iterations; ++i) {
+		occlusion_begin(view, projection);
+		occlusion_add_occluder(RING_MESH, translate(V3(0, 0, -RING_DISTANCE)), 0);
+		occlusion_rasterize();
+		rasterize_ms += occlusion_get_stats().rasterize_ms;
+		u64 start = time_now_ns();
+		hidden = 0;
+		for (u32 b = 0; b < BENCH_BOXES; ++b) {
+			hidden += !occlusion_test_aabb(boxes[b]);
+		}
+		test_ms += time_since_ms(start);
+	}
+	Occlusion_stats stats = occlusion_get_stats();
+	fprintf(stdout, "bench: %u triangles on %u threads, rasterize %.3f ms, %u box tests %.3f ms (%u hidden), averaged over %u runs\n",
+		stats.occluder_triangles, stats.thread_count, rasterize_ms / iterations, BENCH_BOXES, test_ms / iterations, hidden, iterations);
+}
+
+int main(int argc, char** argv) {
+	u32 iterations = argc > 1 ? (u32)atoi(argv[1]) : 100;
+	if (iterations == 0) {
+		iterations = 1;
+	}
+	projection = perspective(65, (float)OCCLUSION_WIDTH / OCCLUSION_HEIGHT, 0.02f, 2000.0f);
+	view = look_at(V3(0, 0, 0), V3(0, 0, -1), V3(0, 1, 0));
+
+	occlusion_initialize(0);
+	add_wall(WALL_MESH);
+	add_ring(RING_MESH);
+
+	test_wall_hides_box();
+	test_simplified_ring_stays_inside();
+	test_bent_wall_hides_less();
+	bench(iterations);
+
+	occlusion_destroy();
+	if (memory_total_allocated() != 0) {
+		check(0, "occluder meshes are freed");
+	}
+	fprintf(stdout, "%u failed\n", failures);
+	return failures == 0 ? 0 : 1;
+}